@@ -2,6 +2,10 @@
 #include <vector>
 #include <cstring>
 #include <cstdint>
+#include <cmath>
+#include <random>
+
+#include "../serialize/BitStream.hpp" // Bit packing and quantization
 
 // Compact struct optimized for network transport (28 bytes total)
 #pragma pack(push, 1) // Prevents compiler from adding padding bytes
@@ -16,6 +20,13 @@ struct NetworkPhysicsState {
 };
 #pragma pack(pop)
 
+// Wire ranges for the quantized encoding; resolution is range / (2^bits - 1)
+const Quantization POSITION_QUANT = {-512.0f, 512.0f, 18};        // ~0.004 units
+const Quantization VELOCITY_QUANT = {-64.0f, 64.0f, 16};          // ~0.002 units/s
+const Quantization ANGULAR_VELOCITY_QUANT = {-32.0f, 32.0f, 14};  // ~0.004 rad/s
+const int ANGLE_BITS = 12;                                        // ~0.0015 rad
+const size_t MAX_ENCODED_STATE_BYTES = 19;                        // 5-byte varint + 110 bits
+
 // Serializes the state into a raw byte vector
 std::vector<uint8_t> serializeState(const NetworkPhysicsState& state) {
     std::vector<uint8_t> buffer(sizeof(NetworkPhysicsState));
@@ -32,6 +43,90 @@ NetworkPhysicsState deserializeState(const std::vector<uint8_t>& buffer) {
     return state;
 }
 
+// Bit-packed, quantized encoding (14 bytes for a typical state instead of 28).
+// The frame is sent as a varint delta from baselineFrame, a frame both sides know
+// (e.g. the last acknowledged one), so it usually costs a single byte.
+std::vector<uint8_t> encodeState(const NetworkPhysicsState& state, uint32_t baselineFrame = 0) {
+    uint8_t scratch[MAX_ENCODED_STATE_BYTES];
+    BitWriter writer(scratch, sizeof(scratch));
+    writer.writeVarint(state.frameNumber - baselineFrame);
+    writer.writeQuantized(state.posX, POSITION_QUANT);
+    writer.writeQuantized(state.posY, POSITION_QUANT);
+    writer.writeQuantized(state.velX, VELOCITY_QUANT);
+    writer.writeQuantized(state.velY, VELOCITY_QUANT);
+    writer.writeAngle(state.angle, ANGLE_BITS);
+    writer.writeQuantized(state.angularVel, ANGULAR_VELOCITY_QUANT);
+    writer.flush();
+    return std::vector<uint8_t>(scratch, scratch + writer.bytesWritten());
+}
+
+// Returns false if the buffer is too short to hold a state
+bool decodeState(const std::vector<uint8_t>& buffer, NetworkPhysicsState& state, uint32_t baselineFrame = 0) {
+    BitReader reader(buffer.data(), buffer.size());
+    state.frameNumber = baselineFrame + reader.readVarint();
+    state.posX = reader.readQuantized(POSITION_QUANT);
+    state.posY = reader.readQuantized(POSITION_QUANT);
+    state.velX = reader.readQuantized(VELOCITY_QUANT);
+    state.velY = reader.readQuantized(VELOCITY_QUANT);
+    state.angle = reader.readAngle(ANGLE_BITS);
+    state.angularVel = reader.readQuantized(ANGULAR_VELOCITY_QUANT);
+    return !reader.overflowed();
+}
+
+// Smallest difference between two angles, in radians
+float angleError(float a, float b) {
+    float d = std::fmod(std::fabs(a - b), BITSTREAM_TWO_PI);
+    return d > BITSTREAM_TWO_PI * 0.5f ? BITSTREAM_TWO_PI - d : d;
+}
+
+// Encodes random in-range states and checks every decoded field is within half a
+// quantization step of the original; returns the number of failing states
+int runRoundTripTest(int iterations) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> pos(POSITION_QUANT.min, POSITION_QUANT.max);
+    std::uniform_real_distribution<float> vel(VELOCITY_QUANT.min, VELOCITY_QUANT.max);
+    std::uniform_real_distribution<float> angle(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> spin(ANGULAR_VELOCITY_QUANT.min, ANGULAR_VELOCITY_QUANT.max);
+    std::uniform_int_distribution<uint32_t> frame(0, 0xFFFFFFFFu);
+
+    // A float ulp of slack on top of half a step
+    const float posTolerance = POSITION_QUANT.resolution() * 0.5f + 1e-4f;
+    const float velTolerance = VELOCITY_QUANT.resolution() * 0.5f + 1e-5f;
+    const float angleTolerance = BITSTREAM_TWO_PI / float(1 << ANGLE_BITS) * 0.5f + 1e-5f;
+    const float spinTolerance = ANGULAR_VELOCITY_QUANT.resolution() * 0.5f + 1e-5f;
+
+    float maxPos = 0, maxVel = 0, maxAngle = 0, maxSpin = 0;
+    size_t totalBytes = 0;
+    int failures = 0;
+    for (int i = 0; i < iterations; ++i) {
+        NetworkPhysicsState in{ frame(rng), pos(rng), pos(rng), vel(rng), vel(rng), angle(rng), spin(rng) };
+        uint32_t baseline = in.frameNumber - (i % 300);
+        std::vector<uint8_t> wire = encodeState(in, baseline);
+        totalBytes += wire.size();
+
+        NetworkPhysicsState out;
+        bool ok = decodeState(wire, out, baseline) && out.frameNumber == in.frameNumber;
+        float ePos = std::fmax(std::fabs(out.posX - in.posX), std::fabs(out.posY - in.posY));
+        float eVel = std::fmax(std::fabs(out.velX - in.velX), std::fabs(out.velY - in.velY));
+        float eAngle = angleError(out.angle, in.angle);
+        float eSpin = std::fabs(out.angularVel - in.angularVel);
+        maxPos = std::fmax(maxPos, ePos);
+        maxVel = std::fmax(maxVel, eVel);
+        maxAngle = std::fmax(maxAngle, eAngle);
+        maxSpin = std::fmax(maxSpin, eSpin);
+        if (!ok || ePos > posTolerance || eVel > velTolerance || eAngle > angleTolerance || eSpin > spinTolerance) {
+            failures++;
+        }
+    }
+
+    std::cout << "Round trip: " << iterations << " states, " << failures << " failures, "
+              << double(totalBytes) / iterations << " bytes/state on average\n"
+              << "  max error: position " << maxPos << " (limit " << posTolerance << "), velocity " << maxVel
+              << " (limit " << velTolerance << "), angle " << maxAngle << " (limit " << angleTolerance
+              << "), angular velocity " << maxSpin << " (limit " << spinTolerance << ")\n";
+    return failures;
+}
+
 int main() {
     // 1. Create state
     NetworkPhysicsState originalState{ 4200, 0.15f, -0.6f, 2.4f, -4.5f, 0.35f, -0.1f };
@@ -42,8 +137,18 @@ int main() {
 
     // 3. Simulated received packet deserialization
     NetworkPhysicsState receivedState = deserializeState(wireData);
-    std::cout << "Deserialized Frame: " << receivedState.frameNumber 
+    std::cout << "Deserialized Frame: " << receivedState.frameNumber
               << " | Position: (" << receivedState.posX << ", " << receivedState.posY << ")\n";
 
-    return 0;
+    // 4. The same state bit-packed and quantized, frame sent relative to frame 0
+    std::vector<uint8_t> packedData = encodeState(originalState);
+    NetworkPhysicsState unpackedState;
+    decodeState(packedData, unpackedState);
+    std::cout << "Quantized Packet Size: " << packedData.size() << " bytes.\n";
+    std::cout << "Decoded Frame: " << unpackedState.frameNumber
+              << " | Position: (" << unpackedState.posX << ", " << unpackedState.posY << ")"
+              << " | Angle: " << unpackedState.angle << "\n";
+
+    // 5. Quantization error must stay within half a step for every field
+    return runRoundTripTest(100000) == 0 ? 0 : 1;
 }
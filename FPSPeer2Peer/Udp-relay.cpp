@@ -1,10 +1,226 @@
 // Inside your Quic/WebTransport Loop
-void handleIncomingDatagram(const uint8_t* buffer, size_t size, Session* sender) {
-    // We don't even need to parse the JSON. 
-    // Just blast the raw binary to everyone else.
-    for(auto& client : all_connected_sessions) {
-        if(client != sender) {
-            client->sendDatagram(buffer, size);
+#include "../include/interest_grid.h"    // Who is close enough to care about a player
+#include "../include/low_latency.h"      // Opt-in spinning, pinned, SCHED_FIFO relay threads
+#include "../include/packet_pool.h"      // Receive buffers handed from the receive thread to a worker
+#include "../include/room_router.h"      // Rooms (matches) owned by one worker thread each
+#include "../include/session_registry.h" // Lock-free session lookups while players join and leave
+#include "../include/transport.h"        // UDP (sendmmsg / GSO batches) or in-process loopback
+
+// Bit-packer.js move packet: type byte 0, then big-endian float x, y, z, rotation
+const uint8_t PACKET_MOVE = 0;
+const size_t MOVE_PACKET_SIZE = 17;
+const float AOI_RADIUS = 60.0f;       // World units; tune to the view distance
+const float AOI_HYSTERESIS = 6.0f;
+const int MAX_OBSERVERS = 64;
+const uint32_t RELAY_WORKERS = 4;     // One per core, next to the receive thread
+const uint32_t MAX_ROOMS = 1024;      // Room ids are match slots, reused by the next match
+const int REBALANCE_MS = 1000;
+
+// Competitive matches: set lowLatency.enabled (and cpus, fifo_priority) before startRelay().
+// Workers then spin on their inbox instead of sleeping on its futex, relay_fd busy-polls the
+// NIC, and the threads are pinned: the receive thread to the first listed core, worker i to
+// the (i + 1)-th.
+low_latency_config lowLatency = [] { low_latency_config ll; low_latency_init(&ll); return ll; }();
+
+// Sessions are grouped into rooms. Each room is owned by exactly one worker, which alone
+// touches its members, their grid entries and the fan-out of its datagrams: no locks and
+// no shared writes on the hot path. The receive thread only posts to the owner's inbox.
+room_router* router = room_router_create(RELAY_WORKERS, MAX_ROOMS, 4096);
+packet_pool* pool = packet_pool_create(16384, MAX_DATAGRAM);
+// Shared by all relay threads; each thread claims its reader slot once at startup
+session_registry* registry = session_registry_create(MAX_SESSIONS);
+thread_local int registryReader = session_registry_reader(registry);
+
+struct Member {
+    uint32_t session;                 // session->index
+    float x = 0, z = 0;               // Last position, so the grid can be rebuilt after a move
+    bool placed = false;
+};
+
+struct Room {
+    uint32_t id;
+    std::vector<Member> members;      // A match is small: lookups are a linear scan
+};
+
+// Everything a worker owns. The grid is layered by room id, so matches never see each other.
+struct RelayWorker {
+    interest_grid* interest = interest_grid_create(MAX_SESSIONS, AOI_RADIUS + AOI_HYSTERESIS, AOI_HYSTERESIS, MAX_OBSERVERS);
+    // Up to a full inbox batch of forwards; opened by startRelay() once relay_fd is a
+    // socket. Benchmarks and tests set transport_loopback_open(net, i) here before
+    // startRelay() to run the same relay without sockets.
+    transport* out = nullptr;
+    std::vector<Room*> rooms = std::vector<Room*>(MAX_ROOMS, nullptr);
+    std::vector<packet_buf*> pending; // Queued in the fan-out, released after the flush
+};
+RelayWorker workers[RELAY_WORKERS];
+
+float readFloatBE(const uint8_t* p) {
+    uint32_t bits = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+Member* findMember(Room* room, uint32_t session) {
+    for (Member& m : room->members) {
+        if (m.session == session) return &m;
+    }
+    return nullptr;
+}
+
+// --- worker side: only ever sees messages for rooms it owns ---
+
+void relayPacket(uint32_t self, Room* room, uint32_t senderIndex, packet_buf* packet) {
+    RelayWorker& w = workers[self];
+    Member* sender = findMember(room, senderIndex);
+    if (sender == nullptr) { // Left before this datagram was handled
+        packet_release(pool, packet);
+        return;
+    }
+    // We still don't parse the payload beyond a move's position (x and z; y is height).
+    if (packet->length >= MOVE_PACKET_SIZE && packet->data[0] == PACKET_MOVE) {
+        sender->x = readFloatBE(packet->data + 1);
+        sender->z = readFloatBE(packet->data + 9);
+        sender->placed = true;
+        interest_grid_update(w.interest, senderIndex, room->id, sender->x, sender->z, AOI_RADIUS);
+    }
+
+    // Only blast the raw binary to the players near the sender, instead of everyone else.
+    // Nothing is sent yet: the buffer stays valid until the batch is flushed.
+    uint32_t observers[MAX_OBSERVERS];
+    int count = interest_grid_observers(w.interest, senderIndex, observers, MAX_OBSERVERS);
+    const session_snapshot* snap = session_registry_enter(registry, registryReader);
+    for (int i = 0; i < count; ++i) {
+        Session* session = observers[i] < snap->slots ? (Session*)snap->items[observers[i]] : nullptr;
+        if (session != nullptr) transport_queue(w.out, observers[i], &session->addr, packet->data, packet->length);
+    }
+    session_registry_exit(registry, registryReader);
+    w.pending.push_back(packet);
+    room_router_account(router, self, room->id, uint32_t(count) + 1);
+}
+
+void handleRoomMessage(uint32_t self, const room_msg& m) {
+    RelayWorker& w = workers[self];
+    Room*& room = w.rooms[m.room];
+    switch (m.kind) {
+    case ROOM_MSG_PACKET:
+        if (room) relayPacket(self, room, m.session, (packet_buf*)m.data);
+        else packet_release(pool, (packet_buf*)m.data);
+        break;
+    case ROOM_MSG_JOIN:
+        if (room == nullptr) room = new Room{m.room, {}};
+        if (findMember(room, m.session) == nullptr) room->members.push_back(Member{m.session});
+        break;
+    case ROOM_MSG_LEAVE:
+        if (room == nullptr) break;
+        interest_grid_remove(w.interest, m.session);
+        for (size_t i = 0; i < room->members.size(); ++i) {
+            if (room->members[i].session == m.session) {
+                room->members[i] = room->members.back();
+                room->members.pop_back();
+                break;
+            }
+        }
+        break;
+    case ROOM_MSG_MIGRATE:
+        // Hand the room over; the new owner rebuilds its grid entries from the last positions
+        if (room == nullptr) room = new Room{m.room, {}};
+        for (const Member& member : room->members) interest_grid_remove(w.interest, member.session);
+        room_router_handoff(router, self, &m, room);
+        room = nullptr;
+        break;
+    case ROOM_MSG_ADOPT:
+        room = (Room*)m.data;
+        for (const Member& member : room->members) {
+            if (member.placed) interest_grid_update(w.interest, member.session, room->id, member.x, member.z, AOI_RADIUS);
+        }
+        break;
+    }
+}
+
+void relayWorker(uint32_t self) {
+    RelayWorker& w = workers[self];
+    if (low_latency_thread(&lowLatency, int(self) + 1) != 0) perror("relay worker: low-latency pinning");
+    room_msg m;
+    for (;;) {
+        int handled = 0;
+        while (handled < RECV_BATCH && room_router_next(router, self, &m)) {
+            handleRoomMessage(self, m);
+            handled++;
+        }
+        // One sendmmsg for all recipients of the batch, one GSO message per recipient
+        transport_flush(w.out);
+        for (packet_buf* packet : w.pending) packet_release(pool, packet);
+        w.pending.clear();
+        if (handled == 0) {
+            if (lowLatency.enabled) low_latency_relax(); // Posts to a spinning owner never need a wake-up
+            else room_router_wait(router, self, 10);
         }
     }
 }
+
+// --- receive thread ---
+
+// GSO batches where the kernel and NIC support UDP_SEGMENT, plain sendmmsg batches elsewhere
+transport* openRelayTransport() {
+    transport* t = transport_udp_create(relay_fd, UDP_FANOUT_GSO, MAX_SESSIONS, RECV_BATCH * MAX_OBSERVERS,
+                                        RECV_BATCH, MAX_DATAGRAM);
+    if (t == nullptr && errno == EOPNOTSUPP) {
+        t = transport_udp_create(relay_fd, UDP_FANOUT_MMSG, MAX_SESSIONS, RECV_BATCH * MAX_OBSERVERS,
+                                 RECV_BATCH, MAX_DATAGRAM);
+    }
+    return t;
+}
+
+// Call once relay_fd is opened and bound. False if a worker's transport could not be
+// opened; no worker has been started then.
+bool startRelay() {
+    for (RelayWorker& w : workers) {
+        if (w.out == nullptr) w.out = openRelayTransport();
+        if (w.out == nullptr) {
+            perror("relay: worker transport");
+            return false;
+        }
+    }
+    // The receive thread (the caller) reads relay_fd without blocking in low-latency mode
+    if (low_latency_socket(relay_fd, &lowLatency) != 0) perror("relay: SO_BUSY_POLL");
+    if (low_latency_thread(&lowLatency, 0) != 0) perror("relay receive thread: low-latency pinning");
+    // A forward that finds the new owner's inbox full gives its buffer back
+    room_router_set_drop(router, [](void*, const room_msg* m) { packet_release(pool, (packet_buf*)m->data); }, nullptr);
+    for (uint32_t w = 0; w < RELAY_WORKERS; ++w) std::thread(relayWorker, w).detach();
+    return true;
+}
+
+// The datagram was received straight into a pool buffer; the room's owner relays it
+void handleIncomingDatagram(packet_buf* packet, Session* sender) {
+    if (room_router_post(router, sender->room, ROOM_MSG_PACKET, sender->index, packet) != 0) {
+        packet_release(pool, packet); // Owner's inbox nearly full: drop rather than queue without bound
+    }
+}
+
+// After every receive batch: now and then, move a room off the busiest worker
+void onReceiveBatchDone() {
+    static auto lastRebalance = std::chrono::steady_clock::now();
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastRebalance >= std::chrono::milliseconds(REBALANCE_MS)) {
+        room_router_rebalance(router);
+        lastRebalance = now;
+    }
+}
+
+void handleConnect(Session* session, uint32_t room) {
+    session->room = room;
+    session_registry_set(registry, session->index, session, nullptr);
+    room_router_open(router, room);
+    room_router_post(router, room, ROOM_MSG_JOIN, session->index, nullptr);
+}
+
+void destroySession(void* session) {
+    delete (Session*)session;
+}
+
+void handleDisconnect(Session* session) {
+    room_router_post(router, session->room, ROOM_MSG_LEAVE, session->index, nullptr);
+    // Deleted only once no relay thread can still be reading it
+    session_registry_set(registry, session->index, nullptr, destroySession);
+}
@@ -1,10 +1,122 @@
 // Example using a generic WebTransport/UDP handler
-void onDatagramReceived(Session* sender, const uint8_t* data, size_t length) {
+#include "../include/packet_pool.h"      // Refcounted receive buffers, per-session send queues
+#include "../include/session_registry.h" // Lock-free session list while players join and leave
+#include "../include/udp_fanout.h"       // Batches the forwards into sendmmsg / GSO sends
+
+// Every datagram lives in a pool buffer from recv() until the last recipient's send
+// completed: no malloc/free and no copy per recipient. Each Session has
+// `packet_queue sendq` and `uint32_t index` (0 .. MAX_SESSIONS).
+packet_pool* pool = packet_pool_create(8192, MAX_DATAGRAM);
+
+// Created by startRelay() once relay_fd is open: the GSO probe needs the real socket
+udp_fanout* fanout = nullptr;
+
+// Joins and leaves publish a new session list; the fan-out reads whichever list was
+// current when it started, without a lock. One reader slot per relay thread.
+session_registry* registry = session_registry_create(MAX_SESSIONS);
+thread_local int registryReader = session_registry_reader(registry);
+
+// Call after relay_fd is opened and bound, before the first receive batch. The fan-out
+// holds every session's full send queue; where UDP_SEGMENT is not supported (older
+// kernels, some virtual NICs) the same batches go out as plain sendmmsg. False if
+// neither works: the relay must not start.
+bool startRelay() {
+    fanout = udp_fanout_create(UDP_FANOUT_GSO, relay_fd, MAX_SESSIONS, MAX_SESSIONS * PACKET_QUEUE_CAPACITY);
+    if (fanout == nullptr && errno == EOPNOTSUPP) {
+        fanout = udp_fanout_create(UDP_FANOUT_MMSG, relay_fd, MAX_SESSIONS, MAX_SESSIONS * PACKET_QUEUE_CAPACITY);
+    }
+    if (fanout == nullptr) {
+        perror("relay: fan-out");
+        return false;
+    }
+    return true;
+}
+
+// Bit-packer.js: a move (type byte 0) carries the sender's full current position, so a
+// newer one makes any still-queued older one from the same sender worthless.
+const uint8_t PACKET_MOVE = 0;
+
+// The receive loop: recv straight into pool buffers (refcount 1 each)
+packet_buf* receiveDatagram(int fd, sockaddr_in* from) {
+    packet_buf* packet = packet_pool_alloc(pool);
+    if (packet == nullptr) return nullptr; // Pool exhausted: counted in its stats, datagram stays in the socket
+    socklen_t len = sizeof(*from);
+    ssize_t n = recvfrom(fd, packet->data, pool->capacity, MSG_DONTWAIT, (sockaddr*)from, &len);
+    if (n < 0) {
+        packet_release(pool, packet);
+        return nullptr;
+    }
+    packet->length = uint32_t(n);
+    return packet;
+}
+
+void onDatagramReceived(Session* sender, packet_buf* packet) {
     // The server is now a "Dumb Pipe"
     // It doesn't know what the floats mean; it just moves bits.
-    for (auto& session : sessions) {
-        if (session != sender) {
-            session->sendDatagram(data, length); 
+    // Every recipient's queue holds a reference to the same buffer. Moves are latest-wins
+    // per sender: a laggy recipient's queue holds one position per player, not a backlog.
+    uint32_t key = packet->length > 0 && packet->data[0] == PACKET_MOVE ? sender->index + 1 : 0;
+    const session_snapshot* snap = session_registry_enter(registry, registryReader);
+    for (uint32_t i = 0; i < snap->slots; ++i) {
+        Session* session = (Session*)snap->items[i];
+        if (session != nullptr && session != sender && packet_queue_push_latest(&session->sendq, pool, packet, key)) {
+            packet_ref(packet);
+        }
+    }
+    session_registry_exit(registry, registryReader);
+    packet_release(pool, packet); // The receive loop's reference
+}
+
+// Once per receive batch, and again when the socket is writable after a would-block:
+// one sendmmsg for every recipient, each recipient's datagrams merged by GSO. What the
+// kernel did not take stays queued; a session whose queue is full drops new packets
+// (packet_queue.drops) instead of growing without bound, and replaced moves are
+// counted in packet_queue.coalesced.
+void onReceiveBatchDone() {
+    if (fanout == nullptr) return; // startRelay() has not run, or failed
+    // One snapshot for queue, flush and release, so every session seen is still alive
+    const session_snapshot* snap = session_registry_enter(registry, registryReader);
+    for (uint32_t s = 0; s < snap->slots; ++s) {
+        Session* session = (Session*)snap->items[s];
+        for (uint32_t i = 0; session && i < packet_queue_size(&session->sendq) && udp_fanout_room(fanout) > 0; ++i) {
+            packet_buf* packet = packet_queue_peek(&session->sendq, i);
+            udp_fanout_queue(fanout, session->index, &session->addr, packet->data, packet->length);
         }
     }
+    udp_fanout_flush(fanout);
+    for (uint32_t s = 0; s < snap->slots; ++s) {
+        Session* session = (Session*)snap->items[s];
+        if (session) packet_queue_release(&session->sendq, pool, udp_fanout_done(fanout, session->index));
+    }
+    session_registry_exit(registry, registryReader);
+    // fanout->stats.would_block > 0: wait for EPOLLOUT on relay_fd, then call this again
+}
+
+void handleConnect(Session* session) {
+    session_registry_set(registry, session->index, session, nullptr);
+}
+
+// Runs once no relay thread can still see the session: its queued references go back to the pool
+void destroySession(void* item) {
+    Session* session = (Session*)item;
+    packet_queue_release(&session->sendq, pool, packet_queue_size(&session->sendq));
+    delete session;
+}
+
+void handleDisconnect(Session* session) {
+    session_registry_set(registry, session->index, nullptr, destroySession);
+}
+
+// For the stats line: how much the send queues shed for slow links
+void sendQueueTotals(uint64_t* drops, uint64_t* coalesced) {
+    *drops = 0;
+    *coalesced = 0;
+    const session_snapshot* snap = session_registry_enter(registry, registryReader);
+    for (uint32_t i = 0; i < snap->slots; ++i) {
+        const Session* session = (const Session*)snap->items[i];
+        if (session == nullptr) continue;
+        *drops += session->sendq.drops;
+        *coalesced += session->sendq.coalesced;
+    }
+    session_registry_exit(registry, registryReader);
 }
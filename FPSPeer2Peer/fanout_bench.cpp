@@ -0,0 +1,286 @@
+// fanout_bench.cpp - relay fan-out cost per mode of include/udp_fanout.h
+//
+// Simulates the FPSPeer2Peer relay in one lobby: every tick each player sends one
+// datagram (a 17-byte move, or now and then a 25-byte shot, as in Bit-packer.js)
+// and the relay forwards it to every other player. The relay side queues the
+// forwards and flushes every --batch inbound datagrams, like a relay flushing
+// once per receive batch. Every player is a real socket on 127.0.0.1 and is
+// drained after each flush, so delivery is checked too.
+//
+// Reported per mode: syscalls, relayed bytes per syscall, sender CPU time per
+// tick and datagrams delivered.
+//
+// With --pool the relay works like FPSPeer2Peer/Zero-copy-relay.cpp: inbound
+// datagrams sit in include/packet_pool.h buffers, are queued to every recipient
+// by reference and go back to the pool after the last send. The pool counters are
+// printed to show it runs without allocating and without leaking buffers.
+//
+// --laggy N makes the first N players slow links: their queues are only sent every
+// LAGGY_FLUSH_TICKS ticks, so they back up. --coalesce queues moves latest-wins per
+// sender (packet_queue_push_latest). Reported for the laggy players: datagrams
+// delivered, their age in ticks when sent, and what the bounded queues dropped or
+// coalesced.
+//
+// Build: make benches (bin/fanout_bench), or g++ -std=c++17 -O2 fanout_bench.cpp -o fanout_bench
+// Usage: fanout_bench [--players N] [--ticks N] [--batch N] [--mode sendto|mmsg|gso] [--pool [BUFFERS]]
+//                     [--laggy N] [--coalesce]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "../include/bench.h"
+#include "../include/packet_pool.h"
+#include "../include/udp_fanout.h"
+
+const uint32_t MOVE_PACKET_SIZE = 17;
+const uint32_t SHOOT_PACKET_SIZE = 25;
+const int SHOTS_PER_HUNDRED = 5;
+const int LAGGY_FLUSH_TICKS = 4;
+
+struct BenchConfig {
+    int players = 64;
+    int ticks = 2000;
+    int batch = 64;     // Inbound datagrams per flush
+    uint32_t poolBuffers = 0; // 0 = forward straight from the inbound array
+    int laggy = 0;            // Players whose queues are sent every LAGGY_FLUSH_TICKS ticks only
+    bool coalesce = false;    // Moves are latest-wins per sender in the send queues
+};
+
+struct ModeResult {
+    udp_fanout_stats stats{};
+    uint64_t delivered = 0;
+    uint64_t deliveredBytes = 0;
+    double senderSeconds = 0;
+    packet_pool_stats pool{};
+    uint64_t queueDrops = 0;
+    uint64_t coalesced = 0;
+    uint64_t laggySent = 0;     // Datagrams sent to laggy players ...
+    uint64_t laggyAgeTicks = 0; // ... and the ticks they had waited in total
+};
+
+int openLoopbackSocket() {
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) return -1;
+    int bufferBytes = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferBytes, sizeof(bufferBytes));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferBytes, sizeof(bufferBytes));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void drain(int fd, ModeResult& result) {
+    const int batch = 64;
+    unsigned char buffers[batch][64];
+    iovec iov[batch];
+    mmsghdr msgs[batch];
+    while (true) {
+        for (int i = 0; i < batch; ++i) {
+            iov[i] = {buffers[i], sizeof(buffers[i])};
+            msgs[i].msg_hdr = {};
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(fd, msgs, batch, MSG_DONTWAIT, nullptr);
+        if (n <= 0) return;
+        result.delivered += uint64_t(n);
+        for (int i = 0; i < n; ++i) result.deliveredBytes += msgs[i].msg_len;
+    }
+}
+
+// Moves every queued packet the fan-out has room for, flushes, and drops the queue
+// references of what the kernel took. Laggy players are only sent to at the end of
+// every LAGGY_FLUSH_TICKS-th tick. packet->user is the tick the packet arrived in.
+void flushQueues(const BenchConfig& config, std::vector<packet_queue>& queues, packet_pool* pool, udp_fanout* fanout,
+                 const std::vector<sockaddr_in>& addrs, int tick, bool endOfTick, ModeResult& result) {
+    bool laggyTurn = endOfTick && tick % LAGGY_FLUSH_TICKS == LAGGY_FLUSH_TICKS - 1;
+    for (size_t p = 0; p < queues.size(); ++p) {
+        if (int(p) < config.laggy && !laggyTurn) continue;
+        for (uint32_t i = 0; i < packet_queue_size(&queues[p]) && udp_fanout_room(fanout) > 0; ++i) {
+            packet_buf* packet = packet_queue_peek(&queues[p], i);
+            udp_fanout_queue(fanout, uint32_t(p), &addrs[p], packet->data, packet->length);
+        }
+    }
+    udp_fanout_flush(fanout);
+    for (size_t p = 0; p < queues.size(); ++p) {
+        uint32_t done = udp_fanout_done(fanout, uint32_t(p));
+        if (int(p) < config.laggy) {
+            for (uint32_t i = 0; i < done; ++i) result.laggyAgeTicks += uint64_t(tick) - packet_queue_peek(&queues[p], i)->user;
+            result.laggySent += done;
+        }
+        packet_queue_release(&queues[p], pool, done);
+    }
+}
+
+// One tick through the pool: "receive" into a pool buffer, queue it by reference
+void relayFromPool(const BenchConfig& config, packet_pool* pool, std::vector<packet_queue>& queues,
+                   udp_fanout* fanout, const std::vector<sockaddr_in>& addrs,
+                   const std::vector<unsigned char>& inbound, const std::vector<uint32_t>& lengths,
+                   int tick, ModeResult& result) {
+    for (int sender = 0; sender < config.players; ++sender) {
+        packet_buf* packet = packet_pool_alloc(pool);
+        if (packet != nullptr) {
+            packet->length = lengths[sender];
+            packet->user = uint64_t(tick);
+            memcpy(packet->data, &inbound[size_t(sender) * SHOOT_PACKET_SIZE], packet->length); // Stands in for recv()
+            uint32_t key = config.coalesce && packet->length == MOVE_PACKET_SIZE ? uint32_t(sender) + 1 : 0;
+            for (int p = 0; p < config.players; ++p) {
+                if (p != sender && packet_queue_push_latest(&queues[p], pool, packet, key)) packet_ref(packet);
+            }
+            packet_release(pool, packet);
+        }
+        if ((sender + 1) % config.batch == 0) flushQueues(config, queues, pool, fanout, addrs, tick, false, result);
+    }
+    flushQueues(config, queues, pool, fanout, addrs, tick, true, result);
+}
+
+bool runMode(udp_fanout_mode mode, const BenchConfig& config, ModeResult& result) {
+    int relay = openLoopbackSocket();
+    std::vector<int> players(config.players);
+    std::vector<sockaddr_in> addrs(config.players);
+    for (int p = 0; p < config.players; ++p) {
+        players[p] = openLoopbackSocket();
+        socklen_t len = sizeof(addrs[p]);
+        getsockname(players[p], (sockaddr*)&addrs[p], &len);
+    }
+    udp_fanout* fanout = udp_fanout_create(mode, relay, uint32_t(config.players),
+                                           uint32_t(config.batch * (config.players - 1)));
+    packet_pool* pool = config.poolBuffers ? packet_pool_create(config.poolBuffers, SHOOT_PACKET_SIZE) : nullptr;
+    std::vector<packet_queue> queues(config.poolBuffers ? config.players : 0);
+    for (packet_queue& q : queues) memset(&q, 0, sizeof(q));
+    if (fanout == nullptr || (config.poolBuffers && pool == nullptr)) {
+        udp_fanout_destroy(fanout);
+        for (int fd : players) close(fd);
+        close(relay);
+        return false;
+    }
+
+    // The inbound payloads of one tick; the relay forwards them without copying
+    std::mt19937 rng(42);
+    std::vector<unsigned char> inbound(size_t(config.players) * SHOOT_PACKET_SIZE);
+    std::vector<uint32_t> lengths(config.players);
+    for (unsigned char& b : inbound) b = uint8_t(rng());
+
+    for (int tick = 0; tick < config.ticks; ++tick) {
+        for (int p = 0; p < config.players; ++p) {
+            lengths[p] = int(rng() % 100) < SHOTS_PER_HUNDRED ? SHOOT_PACKET_SIZE : MOVE_PACKET_SIZE;
+            inbound[size_t(p) * SHOOT_PACKET_SIZE] = lengths[p] == MOVE_PACKET_SIZE ? 0 : 1;
+        }
+        uint64_t start = bench_now_ns();
+        if (pool) {
+            relayFromPool(config, pool, queues, fanout, addrs, inbound, lengths, tick, result);
+            result.senderSeconds += bench_seconds_since(start);
+            for (int fd : players) drain(fd, result);
+            continue;
+        }
+        for (int sender = 0; sender < config.players; ++sender) {
+            const unsigned char* data = &inbound[size_t(sender) * SHOOT_PACKET_SIZE];
+            for (int p = 0; p < config.players; ++p) {
+                if (p != sender) udp_fanout_queue(fanout, uint32_t(p), &addrs[p], data, lengths[sender]);
+            }
+            if ((sender + 1) % config.batch == 0) udp_fanout_flush(fanout);
+        }
+        udp_fanout_flush(fanout);
+        result.senderSeconds += bench_seconds_since(start);
+        for (int fd : players) drain(fd, result);
+    }
+
+    result.stats = fanout->stats;
+    if (pool) {
+        for (packet_queue& q : queues) {
+            result.queueDrops += q.drops;
+            result.coalesced += q.coalesced;
+            packet_queue_release(&q, pool, packet_queue_size(&q));
+        }
+        result.pool = packet_pool_get_stats(pool);
+        packet_pool_destroy(pool);
+    }
+    udp_fanout_destroy(fanout);
+    for (int fd : players) close(fd);
+    close(relay);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    std::vector<udp_fanout_mode> modes = {UDP_FANOUT_SENDTO, UDP_FANOUT_MMSG, UDP_FANOUT_GSO};
+    const char* mode = nullptr;
+    bench_option options[] = {
+        {"--players", BENCH_INT, &config.players},
+        {"--ticks", BENCH_INT, &config.ticks},
+        {"--batch", BENCH_INT, &config.batch},
+        {"--laggy", BENCH_INT, &config.laggy},
+        {"--coalesce", BENCH_FLAG, &config.coalesce},
+        {"--mode", BENCH_STRING, &mode},
+    };
+    const char* usage = "[--players N] [--ticks N] [--batch N] [--mode sendto|mmsg|gso] [--pool [BUFFERS]]\n"
+                        "          [--laggy N] [--coalesce]";
+    for (int i = 1; i < argc; ++i) {
+        if (bench_match(argc, argv, &i, options, BENCH_COUNT(options))) continue;
+        if (strcmp(argv[i], "--pool") == 0) { // The buffer count is optional
+            config.poolBuffers = i + 1 < argc && argv[i + 1][0] != '-' ? uint32_t(atoi(argv[++i])) : 1024;
+        } else {
+            bench_usage(argv[0], usage);
+            return 1;
+        }
+    }
+    if (mode != nullptr) {
+        if (udp_fanout_parse_mode(mode) < 0) {
+            bench_usage(argv[0], usage);
+            return 1;
+        }
+        modes = {udp_fanout_mode(udp_fanout_parse_mode(mode))};
+    }
+    if (config.players < 2 || config.ticks < 1 || config.batch < 1 || config.laggy < 0 || config.laggy > config.players) {
+        fprintf(stderr, "Need at least 2 players, 1 tick, a batch of 1 and at most every player laggy.\n");
+        return 1;
+    }
+    if ((config.laggy || config.coalesce) && !config.poolBuffers) config.poolBuffers = 1024; // Needs the send queues
+
+    printf("Relay fan-out: %d players, %d ticks, flush every %d inbound datagrams", config.players, config.ticks, config.batch);
+    if (config.poolBuffers) printf(", through a %u-buffer packet pool", config.poolBuffers);
+    if (config.laggy) printf(", %d laggy players sent to every %d ticks", config.laggy, LAGGY_FLUSH_TICKS);
+    if (config.coalesce) printf(", moves coalesced");
+    printf("\n\n");
+    printf("%-9s %12s %12s %12s %14s %12s %12s\n",
+           "mode", "syscalls", "dgrams/call", "bytes/call", "syscalls/MB", "us/tick", "delivered");
+    for (udp_fanout_mode mode : modes) {
+        ModeResult r;
+        if (!runMode(mode, config, r)) {
+            printf("%-9s unavailable: %s\n", udp_fanout_mode_name(mode), strerror(errno));
+            continue;
+        }
+        const udp_fanout_stats& s = r.stats;
+        printf("%-9s %12llu %12.1f %12.0f %14.1f %12.1f %11.2f%%\n", udp_fanout_mode_name(mode),
+               (unsigned long long)s.send_calls, double(s.datagrams) / double(s.send_calls),
+               double(s.bytes) / double(s.send_calls), double(s.send_calls) / (double(s.bytes) / 1048576.0),
+               r.senderSeconds * 1e6 / config.ticks,
+               s.datagrams ? 100.0 * double(r.delivered) / double(s.datagrams) : 0.0);
+        if (s.errors) printf("          %llu datagrams refused by the kernel\n", (unsigned long long)s.errors);
+        if (config.poolBuffers) {
+            printf("          pool: %llu allocs, %llu frees, %llu exhausted, high water %u, %u in use at exit; "
+                   "%llu queue drops, %llu coalesced, %llu would-block flushes\n",
+                   (unsigned long long)r.pool.allocs, (unsigned long long)r.pool.frees,
+                   (unsigned long long)r.pool.exhausted, r.pool.high_water, r.pool.in_use,
+                   (unsigned long long)r.queueDrops, (unsigned long long)r.coalesced, (unsigned long long)s.would_block);
+        }
+        if (config.laggy) {
+            printf("          laggy players: %.1f datagrams sent per tick each, %.2f ticks old on average\n",
+                   double(r.laggySent) / config.laggy / config.ticks,
+                   r.laggySent ? double(r.laggyAgeTicks) / double(r.laggySent) : 0.0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,253 @@
+// registry_bench.cpp - relay fan-out throughput while sessions join and leave
+//
+// Reader threads play the relay: for every "datagram" they walk the session list
+// and read every session (its slot, standing in for the address a forward needs).
+// One writer thread churns the lobby: a session leaves and a new one joins in its
+// slot, at --churn operations per second (0 = none, -1 = as fast as it can).
+//
+//   rcu    include/session_registry.h: readers pin an epoch, writers copy and publish
+//   mutex  a std::mutex around a std::vector<Session*>, as the relay had before
+//
+// Reported per list and churn rate: fan-outs per second summed over the readers,
+// fan-outs per second of reader CPU time (what one fan-out costs, independent of
+// how the cores are shared with the writer) and the churn the writer achieved. Every freed session is poisoned first, so a
+// reader that ever touches one after release is counted as a use-after-free.
+//
+// Build: make benches (bin/registry_bench), or g++ -std=c++17 -O2 -pthread registry_bench.cpp -o registry_bench
+// Usage: registry_bench [--sessions N] [--readers N] [--seconds S] [--churn OPS ...]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "../include/bench.h"
+#include "../include/session_registry.h"
+
+const uint32_t SESSION_ALIVE = 0x5E55104Eu;
+const uint32_t SESSION_FREED = 0xDEADBEEFu;
+
+struct Session {
+    uint32_t magic = SESSION_ALIVE;
+    uint32_t index = 0;
+};
+
+struct BenchConfig {
+    uint32_t sessions = 256;
+    int readers = 2;
+    double seconds = 2.0;
+    std::vector<int> churnRates = {0, 1000, 10000, -1};
+};
+
+struct RunResult {
+    uint64_t fanouts = 0;
+    uint64_t churnOps = 0;
+    double readerCpuSeconds = 0;
+};
+
+std::atomic<uint64_t> g_useAfterFree{0};
+std::atomic<uint64_t> g_checksum{0}; // Keeps the reads from being optimized away
+
+void destroySession(void* item) {
+    Session* session = (Session*)item;
+    session->magic = SESSION_FREED;
+    delete session;
+}
+
+// Counts a session whose magic says it was already released
+inline void touch(const Session* session, uint64_t& sum, uint64_t& bad) {
+    if (session->magic != SESSION_ALIVE) bad++;
+    sum += session->index;
+}
+
+double threadCpuSeconds() {
+    rusage usage{};
+    getrusage(RUSAGE_THREAD, &usage);
+    return double(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + double(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+// Paces the writer: returns once op number `ops` is due
+void pace(int rate, uint64_t ops, std::chrono::steady_clock::time_point start) {
+    if (rate <= 0) return;
+    auto due = start + std::chrono::duration<double>(double(ops) / rate);
+    std::this_thread::sleep_until(due);
+}
+
+RunResult runRcu(const BenchConfig& config, int churnRate) {
+    session_registry* registry = session_registry_create(config.sessions);
+    for (uint32_t i = 0; i < config.sessions; ++i) {
+        Session* s = new Session;
+        s->index = i;
+        session_registry_set(registry, i, s, nullptr);
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> fanouts{0};
+    std::atomic<uint64_t> cpuMicros{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < config.readers; ++r) {
+        readers.emplace_back([&] {
+            int reader = session_registry_reader(registry);
+            uint64_t done = 0, bad = 0, sum = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                const session_snapshot* snap = session_registry_enter(registry, reader);
+                for (uint32_t i = 0; i < snap->slots; ++i) {
+                    if (snap->items[i]) touch((const Session*)snap->items[i], sum, bad);
+                }
+                session_registry_exit(registry, reader);
+                done++;
+            }
+            session_registry_release_reader(registry, reader);
+            fanouts += done;
+            cpuMicros += uint64_t(threadCpuSeconds() * 1e6);
+            g_useAfterFree += bad;
+            g_checksum += sum;
+        });
+    }
+
+    uint64_t ops = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration<double>(config.seconds);
+    std::mt19937 rng(7);
+    while (std::chrono::steady_clock::now() < end) {
+        if (churnRate == 0) {
+            std::this_thread::sleep_until(end);
+            break;
+        }
+        pace(churnRate, ops, start);
+        uint32_t slot = rng() % config.sessions;
+        session_registry_set(registry, slot, nullptr, destroySession); // Leave
+        Session* s = new Session;
+        s->index = slot;
+        session_registry_set(registry, slot, s, nullptr);              // Join
+        ops++;
+    }
+    stop = true;
+    for (std::thread& t : readers) t.join();
+
+    session_registry_reclaim(registry);
+    const session_snapshot* last = registry->current;
+    for (uint32_t i = 0; i < last->slots; ++i) {
+        if (last->items[i]) destroySession(last->items[i]);
+    }
+    session_registry_destroy(registry);
+    return {fanouts.load(), ops, double(cpuMicros.load()) * 1e-6};
+}
+
+RunResult runMutex(const BenchConfig& config, int churnRate) {
+    std::mutex lock;
+    std::vector<Session*> sessions(config.sessions);
+    for (uint32_t i = 0; i < config.sessions; ++i) {
+        sessions[i] = new Session;
+        sessions[i]->index = i;
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> fanouts{0};
+    std::atomic<uint64_t> cpuMicros{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < config.readers; ++r) {
+        readers.emplace_back([&] {
+            uint64_t done = 0, bad = 0, sum = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> guard(lock);
+                for (Session* session : sessions) {
+                    if (session) touch(session, sum, bad);
+                }
+                done++;
+            }
+            fanouts += done;
+            cpuMicros += uint64_t(threadCpuSeconds() * 1e6);
+            g_useAfterFree += bad;
+            g_checksum += sum;
+        });
+    }
+
+    uint64_t ops = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration<double>(config.seconds);
+    std::mt19937 rng(7);
+    while (std::chrono::steady_clock::now() < end) {
+        if (churnRate == 0) {
+            std::this_thread::sleep_until(end);
+            break;
+        }
+        pace(churnRate, ops, start);
+        uint32_t slot = rng() % config.sessions;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            destroySession(sessions[slot]);
+            sessions[slot] = nullptr;
+        }
+        Session* s = new Session;
+        s->index = slot;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            sessions[slot] = s;
+        }
+        ops++;
+    }
+    stop = true;
+    for (std::thread& t : readers) t.join();
+    for (Session* s : sessions) delete s;
+    return {fanouts.load(), ops, double(cpuMicros.load()) * 1e-6};
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    bench_option options[] = {
+        {"--sessions", BENCH_U32, &config.sessions},
+        {"--readers", BENCH_INT, &config.readers},
+        {"--seconds", BENCH_DOUBLE, &config.seconds},
+    };
+    for (int i = 1; i < argc; ++i) {
+        if (bench_match(argc, argv, &i, options, BENCH_COUNT(options))) continue;
+        if (strcmp(argv[i], "--churn") == 0 && i + 1 < argc) { // One or more rates
+            config.churnRates.clear();
+            while (i + 1 < argc && (argv[i + 1][0] != '-' || strcmp(argv[i + 1], "-1") == 0)) {
+                config.churnRates.push_back(atoi(argv[++i]));
+            }
+        } else {
+            bench_usage(argv[0], "[--sessions N] [--readers N] [--seconds S] [--churn OPS ...]");
+            return 1;
+        }
+    }
+    if (config.sessions < 1 || config.readers < 1 || config.readers > SESSION_REGISTRY_MAX_READERS - 1
+        || config.seconds <= 0 || config.churnRates.empty()) {
+        fprintf(stderr, "Need at least 1 session, 1 to %d readers, a positive duration and a churn rate.\n",
+                SESSION_REGISTRY_MAX_READERS - 1);
+        return 1;
+    }
+
+    printf("Fan-out over %u sessions, %d reader threads, %.1f s per run (%u hardware threads)\n\n",
+           config.sessions, config.readers, config.seconds, std::thread::hardware_concurrency());
+    printf("%-6s %10s %12s %14s %12s %16s %12s\n",
+           "list", "churn/s", "achieved/s", "fan-outs/s", "vs no churn", "per reader-CPU s", "vs no churn");
+    for (int pass = 0; pass < 2; ++pass) {
+        const char* name = pass == 0 ? "rcu" : "mutex";
+        double baseline = 0, cpuBaseline = 0;
+        for (int rate : config.churnRates) {
+            RunResult r = pass == 0 ? runRcu(config, rate) : runMutex(config, rate);
+            double perSecond = double(r.fanouts) / config.seconds;
+            double perCpuSecond = r.readerCpuSeconds > 0 ? double(r.fanouts) / r.readerCpuSeconds : 0;
+            if (rate == 0 || baseline == 0) {
+                baseline = perSecond;
+                cpuBaseline = perCpuSecond;
+            }
+            char churn[32];
+            if (rate < 0) snprintf(churn, sizeof(churn), "max");
+            else snprintf(churn, sizeof(churn), "%d", rate);
+            printf("%-6s %10s %12.0f %14.0f %11.1f%% %16.0f %11.1f%%\n", name, churn, double(r.churnOps) / config.seconds,
+                   perSecond, 100.0 * perSecond / baseline, perCpuSecond, cpuBaseline > 0 ? 100.0 * perCpuSecond / cpuBaseline : 0.0);
+        }
+    }
+    uint64_t bad = g_useAfterFree.load();
+    printf("\n%llu reads of a released session\n", (unsigned long long)bad);
+    return bad == 0 ? 0 : 2;
+}
@@ -0,0 +1,260 @@
+// room_bench.cpp - room ownership and rebalancing of include/room_router.h
+//
+// Simulates FPSPeer2Peer/Udp-relay.cpp without sockets: one receive thread posts
+// datagrams for --rooms matches of --players each to the room owners, and every
+// worker "fans out" each datagram to the other members of its room (a fixed amount
+// of work per recipient, --cost-ns, standing in for queueing the sends).
+//
+// Rooms are opened in order, so they start spread evenly by count. With --skew K
+// every room the first worker gets is K times as busy as the others, so worker 0
+// starts overloaded; the rebalancer (every --rebalance-ms, 0 = off) has to move
+// rooms away. Reconnects (--churn per second: a seat leaves and joins again) keep
+// coming during the moves.
+//
+// Printed every --sample-ms: each worker's share of the fan-out work, the busiest
+// worker against the mean, and the moves so far. At the end the run is checked:
+// every datagram posted was handled exactly once, and never by a worker that did
+// not own its room.
+//
+// Build: make benches (bin/room_bench), or g++ -std=c++17 -O2 -pthread room_bench.cpp -o room_bench
+// Usage: room_bench [--workers N] [--rooms N] [--players N] [--rate PKTS] [--seconds S]
+//                   [--skew K] [--cost-ns NS] [--churn OPS] [--rebalance-ms MS] [--sample-ms MS]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../include/bench.h"
+#include "../include/room_router.h"
+
+struct BenchConfig {
+    uint32_t workers = 4;
+    uint32_t rooms = 200;
+    uint32_t players = 8;
+    double rate = 100000;      // Datagrams per second over all rooms
+    double seconds = 6;
+    double skew = 4;
+    int costNs = 100;
+    double churn = 1000;       // Leave+join pairs per second
+    int rebalanceMs = 500;
+    int sampleMs = 500;
+};
+
+struct Room {
+    uint32_t id;
+    uint32_t owner;            // Worker that holds it, checked on every message
+    std::vector<uint32_t> members;
+    uint64_t relayed = 0;
+};
+
+struct Worker {
+    std::vector<Room*> rooms;
+    uint64_t handled = 0;      // Datagrams, written by the worker only
+    uint64_t stale = 0;        // From a sender that had left
+    uint64_t wrongOwner = 0;
+    std::atomic<uint64_t> done{0};
+};
+
+std::atomic<bool> g_stop{false};
+volatile uint64_t g_sink = 0;
+
+void burn(int ns) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+    while (std::chrono::steady_clock::now() < until) g_sink = g_sink + 1;
+}
+
+void workerLoop(room_router* router, const BenchConfig& config, std::vector<Worker>& workers, uint32_t self) {
+    Worker& w = workers[self];
+    room_msg m;
+    for (;;) {
+        int handled = 0;
+        while (room_router_next(router, self, &m)) {
+            handled++;
+            Room*& room = w.rooms[m.room];
+            if (m.kind == ROOM_MSG_ADOPT) {
+                room = (Room*)m.data;
+                room->owner = self;
+                continue;
+            }
+            if (room == nullptr) room = new Room{m.room, self, {}, 0};
+            if (room->owner != self) w.wrongOwner++;
+            switch (m.kind) {
+            case ROOM_MSG_PACKET: {
+                w.handled++;
+                if (std::find(room->members.begin(), room->members.end(), m.session) == room->members.end()) {
+                    w.stale++;
+                    break;
+                }
+                uint32_t recipients = uint32_t(room->members.size()) - 1;
+                burn(config.costNs * int(recipients));
+                room->relayed++;
+                room_router_account(router, self, m.room, recipients);
+                break;
+            }
+            case ROOM_MSG_JOIN:
+                room->members.push_back(m.session);
+                break;
+            case ROOM_MSG_LEAVE:
+                room->members.erase(std::remove(room->members.begin(), room->members.end(), m.session), room->members.end());
+                break;
+            case ROOM_MSG_MIGRATE:
+                room_router_handoff(router, self, &m, room);
+                room = nullptr;
+                break;
+            }
+        }
+        w.done.store(w.handled, std::memory_order_release);
+        if (handled == 0) {
+            if (g_stop.load()) return;
+            room_router_wait(router, self, 5);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    bench_option options[] = {
+        {"--workers", BENCH_U32, &config.workers},
+        {"--rooms", BENCH_U32, &config.rooms},
+        {"--players", BENCH_U32, &config.players},
+        {"--rate", BENCH_DOUBLE, &config.rate},
+        {"--seconds", BENCH_DOUBLE, &config.seconds},
+        {"--skew", BENCH_DOUBLE, &config.skew},
+        {"--cost-ns", BENCH_INT, &config.costNs},
+        {"--churn", BENCH_DOUBLE, &config.churn},
+        {"--rebalance-ms", BENCH_INT, &config.rebalanceMs},
+        {"--sample-ms", BENCH_INT, &config.sampleMs},
+    };
+    if (bench_parse(argc, argv, options, BENCH_COUNT(options),
+                    "[--workers N] [--rooms N] [--players N] [--rate PKTS] [--seconds S]\n"
+                    "          [--skew K] [--cost-ns NS] [--churn OPS] [--rebalance-ms MS] [--sample-ms MS]") != 0) {
+        return 1;
+    }
+    if (config.workers < 1 || config.rooms < 1 || config.players < 2 || config.rate <= 0 || config.seconds <= 0
+        || config.skew < 1 || config.sampleMs < 1) {
+        fprintf(stderr, "Need 1+ workers and rooms, 2+ players, a positive rate and duration, and a skew of 1 or more.\n");
+        return 1;
+    }
+
+    room_router* router = room_router_create(config.workers, config.rooms, 8192);
+    if (router == nullptr) {
+        fprintf(stderr, "Could not create the router.\n");
+        return 1;
+    }
+    std::vector<Worker> workers(config.workers);
+    for (Worker& w : workers) w.rooms.assign(config.rooms, nullptr);
+
+    std::vector<std::thread> threads;
+    for (uint32_t w = 0; w < config.workers; ++w) {
+        threads.emplace_back(workerLoop, router, std::cref(config), std::ref(workers), w);
+    }
+
+    // Session ids: room * players + seat
+    std::vector<double> cumulative(config.rooms);
+    double total = 0;
+    for (uint32_t r = 0; r < config.rooms; ++r) {
+        uint32_t owner = room_router_open(router, r);
+        total += owner == 0 ? config.skew : 1.0;
+        cumulative[r] = total;
+        for (uint32_t p = 0; p < config.players; ++p) room_router_post(router, r, ROOM_MSG_JOIN, r * config.players + p, nullptr);
+    }
+
+    printf("%u workers, %u rooms x %u players, %.0f datagrams/s, skew %.1f on worker 0's rooms, %.0f churn/s, "
+           "rebalance %s (%u hardware threads)\n\n", config.workers, config.rooms, config.players, config.rate,
+           config.skew, config.churn, config.rebalanceMs > 0 ? "on" : "off", std::thread::hardware_concurrency());
+    printf("%8s", "time s");
+    for (uint32_t w = 0; w < config.workers; ++w) printf("   w%-3u", w);
+    printf(" %10s %8s\n", "max/mean", "moves");
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> pick(0, total);
+    std::vector<uint64_t> lastLoad(config.workers, 0);
+    uint64_t posted = 0, refused = 0, churnOps = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration<double>(config.seconds);
+    auto nextSample = start + std::chrono::milliseconds(config.sampleMs);
+    auto nextRebalance = start + std::chrono::milliseconds(std::max(config.rebalanceMs, 1));
+    const int batch = 64;
+
+    for (uint64_t sent = 0;; sent += batch) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= end) break;
+        for (int i = 0; i < batch; ++i) {
+            uint32_t room = uint32_t(std::lower_bound(cumulative.begin(), cumulative.end(), pick(rng)) - cumulative.begin());
+            room = std::min(room, config.rooms - 1);
+            uint32_t seat = rng() % config.players;
+            if (room_router_post(router, room, ROOM_MSG_PACKET, room * config.players + seat, nullptr) == 0) posted++;
+            else refused++;
+        }
+        // A seat reconnects, churn times a second
+        while (config.churn > 0 && double(churnOps) < config.churn * std::chrono::duration<double>(now - start).count()) {
+            uint32_t room = rng() % config.rooms, seat = rng() % config.players;
+            room_router_post(router, room, ROOM_MSG_LEAVE, room * config.players + seat, nullptr);
+            room_router_post(router, room, ROOM_MSG_JOIN, room * config.players + seat, nullptr);
+            churnOps++;
+        }
+        if (config.rebalanceMs > 0 && now >= nextRebalance) {
+            room_router_rebalance(router);
+            nextRebalance = now + std::chrono::milliseconds(config.rebalanceMs);
+        }
+        if (now >= nextSample) {
+            uint64_t sum = 0, most = 0;
+            std::vector<uint64_t> delta(config.workers);
+            for (uint32_t w = 0; w < config.workers; ++w) {
+                uint64_t load = __atomic_load_n(&router->workers[w].load, __ATOMIC_RELAXED);
+                delta[w] = load - lastLoad[w];
+                lastLoad[w] = load;
+                sum += delta[w];
+                most = std::max(most, delta[w]);
+            }
+            printf("%8.1f", std::chrono::duration<double>(now - start).count());
+            for (uint32_t w = 0; w < config.workers; ++w) printf(" %5.1f%%", sum ? 100.0 * double(delta[w]) / double(sum) : 0.0);
+            printf(" %10.2f %8llu\n", sum ? double(most) * config.workers / double(sum) : 0.0,
+                   (unsigned long long)room_router_get_stats(router).migrations);
+            nextSample = now + std::chrono::milliseconds(config.sampleMs);
+        }
+        std::this_thread::sleep_until(start + std::chrono::duration<double>(double(sent + batch) / config.rate));
+    }
+
+    // Let the workers drain, then check that nothing was lost or handled twice
+    for (;;) {
+        uint64_t handled = 0;
+        for (Worker& w : workers) handled += w.done.load(std::memory_order_acquire);
+        room_router_stats s = room_router_get_stats(router);
+        if (handled + s.dropped >= posted) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    g_stop = true;
+    for (uint32_t w = 0; w < config.workers; ++w) {
+        __atomic_fetch_add(&router->workers[w].wake, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &router->workers[w].wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+    for (std::thread& t : threads) t.join();
+
+    uint64_t handled = 0, stale = 0, wrongOwner = 0, relayed = 0;
+    for (Worker& w : workers) {
+        handled += w.handled;
+        stale += w.stale;
+        wrongOwner += w.wrongOwner;
+        for (Room* room : w.rooms) {
+            if (room) relayed += room->relayed;
+            delete room;
+        }
+    }
+    room_router_stats s = room_router_get_stats(router);
+    printf("\n%llu datagrams posted, %llu refused (inbox nearly full), %llu handled (%llu from seats that had left), "
+           "%llu dropped in forwarding\n", (unsigned long long)posted, (unsigned long long)refused,
+           (unsigned long long)handled, (unsigned long long)stale, (unsigned long long)s.dropped);
+    printf("%llu moves, %llu messages forwarded after a move, %llu churn ops, %llu handled by a non-owner\n",
+           (unsigned long long)s.migrations, (unsigned long long)s.forwarded, (unsigned long long)churnOps,
+           (unsigned long long)wrongOwner);
+    room_router_destroy(router);
+    bool ok = handled + s.dropped == posted && handled == relayed + stale && wrongOwner == 0;
+    printf("%s\n", ok ? "OK" : "MISMATCH");
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,212 @@
+// transport_bench.cpp - the relay loop over include/transport.h, kernel vs memory
+//
+// One relay and --players clients. Every tick each client sends one 17-byte move
+// (Bit-packer.js) to the relay; the relay receives in batches, forwards every
+// datagram to every other client and flushes once per batch, like
+// FPSPeer2Peer/Udp-relay.cpp; then the clients drain what they got.
+//
+//   loopback  every endpoint is a transport_loopback_open() endpoint in one process
+//   udp       every endpoint is a real socket on 127.0.0.1 (relay sends with --mode)
+//
+// The relay code is the same for both, so the difference is the cost of the kernel
+// path. Reported per transport: datagrams delivered per second, nanoseconds per
+// delivered datagram (relay and clients together, one thread), syscalls and drops.
+//
+// Build: make benches (bin/transport_bench), or g++ -std=c++17 -O2 transport_bench.cpp -o transport_bench
+// Usage: transport_bench [--players N] [--ticks N] [--transport loopback|udp] [--mode sendto|mmsg|gso]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../include/bench.h"
+#include "../include/transport.h"
+
+const uint32_t MOVE_PACKET_SIZE = 17;
+const uint32_t MAX_DATAGRAM = 64;
+const int RECV_BATCH = 64;
+
+struct BenchConfig {
+    int players = 64;
+    int ticks = 2000;
+    std::vector<std::string> transports = {"loopback", "udp"};
+    udp_fanout_mode mode = UDP_FANOUT_GSO;
+};
+
+struct Endpoints {
+    transport* relay = nullptr;
+    std::vector<transport*> clients;
+    std::vector<sockaddr_in> clientAddrs;
+    sockaddr_in relayAddr{};
+    transport_loopback_net* net = nullptr;
+    std::vector<int> fds;
+};
+
+struct RunResult {
+    uint64_t delivered = 0;
+    double seconds = 0;
+    transport_stats relay{};
+    uint64_t clientSyscalls = 0;
+    uint64_t clientDrops = 0;
+};
+
+uint64_t addrKey(const sockaddr_in& a) {
+    return uint64_t(a.sin_addr.s_addr) << 16 | a.sin_port;
+}
+
+int openLoopbackSocket() {
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) return -1;
+    int bufferBytes = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferBytes, sizeof(bufferBytes));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferBytes, sizeof(bufferBytes));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void closeEndpoints(Endpoints& e) {
+    transport_destroy(e.relay);
+    for (transport* t : e.clients) transport_destroy(t);
+    transport_loopback_net_destroy(e.net);
+    for (int fd : e.fds) close(fd);
+}
+
+bool openEndpoints(const std::string& kind, const BenchConfig& config, Endpoints& e) {
+    uint32_t players = uint32_t(config.players);
+    if (kind == "loopback") {
+        e.net = transport_loopback_net_create(players + 1, 4096, MAX_DATAGRAM);
+        if (e.net == nullptr) return false;
+        e.relay = transport_loopback_open(e.net, 0);
+        e.relayAddr = transport_loopback_addr(0);
+        for (uint32_t p = 0; p < players; ++p) {
+            e.clients.push_back(transport_loopback_open(e.net, p + 1));
+            e.clientAddrs.push_back(transport_loopback_addr(p + 1));
+        }
+    } else {
+        for (uint32_t i = 0; i <= players; ++i) {
+            int fd = openLoopbackSocket();
+            if (fd < 0) return false;
+            e.fds.push_back(fd);
+            sockaddr_in addr{};
+            socklen_t len = sizeof(addr);
+            getsockname(fd, (sockaddr*)&addr, &len);
+            if (i == 0) {
+                e.relayAddr = addr;
+                e.relay = transport_udp_create(fd, config.mode, players, RECV_BATCH * players, RECV_BATCH, MAX_DATAGRAM);
+            } else {
+                e.clientAddrs.push_back(addr);
+                e.clients.push_back(transport_udp_create(fd, UDP_FANOUT_MMSG, 1, 16, RECV_BATCH, MAX_DATAGRAM));
+            }
+        }
+    }
+    if (e.relay == nullptr) return false;
+    for (transport* t : e.clients) {
+        if (t == nullptr) return false;
+    }
+    return true;
+}
+
+// The relay: forward every received datagram to every other session, flush per batch
+void relayStep(transport* relay, const std::unordered_map<uint64_t, uint32_t>& sessions,
+               const std::vector<sockaddr_in>& addrs) {
+    transport_datagram in[RECV_BATCH];
+    for (;;) {
+        int n = transport_recv(relay, in, RECV_BATCH);
+        if (n == 0) return;
+        for (int i = 0; i < n; ++i) {
+            auto sender = sessions.find(addrKey(in[i].addr));
+            if (sender == sessions.end()) continue;
+            for (uint32_t p = 0; p < addrs.size(); ++p) {
+                if (p != sender->second) transport_queue(relay, p, &addrs[p], in[i].data, in[i].length);
+            }
+        }
+        transport_flush(relay); // Before the next recv recycles in[]
+    }
+}
+
+bool run(const std::string& kind, const BenchConfig& config, RunResult& result) {
+    Endpoints e;
+    if (!openEndpoints(kind, config, e)) {
+        closeEndpoints(e);
+        return false;
+    }
+    std::unordered_map<uint64_t, uint32_t> sessions;
+    for (uint32_t p = 0; p < e.clientAddrs.size(); ++p) sessions[addrKey(e.clientAddrs[p])] = p;
+
+    unsigned char move[MOVE_PACKET_SIZE] = {0};
+    transport_datagram in[RECV_BATCH];
+    uint64_t start = bench_now_ns();
+    for (int tick = 0; tick < config.ticks; ++tick) {
+        memcpy(move + 1, &tick, sizeof(tick));
+        for (transport* client : e.clients) {
+            transport_queue(client, 0, &e.relayAddr, move, MOVE_PACKET_SIZE);
+            transport_flush(client);
+        }
+        relayStep(e.relay, sessions, e.clientAddrs);
+        for (transport* client : e.clients) {
+            int n;
+            while ((n = transport_recv(client, in, RECV_BATCH)) > 0) result.delivered += uint64_t(n);
+        }
+    }
+    result.seconds = bench_seconds_since(start);
+    result.relay = e.relay->stats;
+    for (transport* client : e.clients) {
+        result.clientSyscalls += client->stats.syscalls;
+        result.clientDrops += client->stats.dropped;
+    }
+    closeEndpoints(e);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    const char* kind = nullptr;
+    const char* mode = nullptr;
+    bench_option options[] = {
+        {"--players", BENCH_INT, &config.players},
+        {"--ticks", BENCH_INT, &config.ticks},
+        {"--transport", BENCH_STRING, &kind},
+        {"--mode", BENCH_STRING, &mode},
+    };
+    const char* usage = "[--players N] [--ticks N] [--transport loopback|udp] [--mode sendto|mmsg|gso]";
+    if (bench_parse(argc, argv, options, BENCH_COUNT(options), usage) != 0) return 1;
+    if ((kind != nullptr && strcmp(kind, "loopback") != 0 && strcmp(kind, "udp") != 0)
+        || (mode != nullptr && udp_fanout_parse_mode(mode) < 0)) {
+        bench_usage(argv[0], usage);
+        return 1;
+    }
+    if (kind != nullptr) config.transports = {kind};
+    if (mode != nullptr) config.mode = udp_fanout_mode(udp_fanout_parse_mode(mode));
+    if (config.players < 2 || config.ticks < 1) {
+        fprintf(stderr, "Need at least 2 players and 1 tick.\n");
+        return 1;
+    }
+
+    printf("Relay over a transport: %d players, %d ticks, %u-byte moves, relay sends with %s on udp\n\n",
+           config.players, config.ticks, MOVE_PACKET_SIZE, udp_fanout_mode_name(config.mode));
+    printf("%-9s %14s %14s %10s %12s %12s %10s\n", "transport", "delivered", "dgrams/s", "ns/dgram",
+           "relay calls", "client calls", "dropped");
+    uint64_t expected = uint64_t(config.ticks) * uint64_t(config.players) * uint64_t(config.players - 1);
+    for (const std::string& kind : config.transports) {
+        RunResult r;
+        if (!run(kind, config, r)) {
+            printf("%-9s unavailable: %s\n", kind.c_str(), strerror(errno));
+            continue;
+        }
+        printf("%-9s %13.2f%% %14.0f %10.1f %12llu %12llu %10llu\n", kind.c_str(),
+               100.0 * double(r.delivered) / double(expected), double(r.delivered) / r.seconds,
+               r.seconds * 1e9 / double(r.delivered ? r.delivered : 1), (unsigned long long)r.relay.syscalls,
+               (unsigned long long)r.clientSyscalls, (unsigned long long)(r.relay.dropped + r.clientDrops));
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+// LatencyHistogram.hpp - HDR-style latency histogram for the UDP server tools
+//
+// Log-linear buckets: values below 128 ns are exact, above that every power of
+// two is split into 64 linear sub-buckets, so any recorded value is reported
+// within ~1.6% of its true value. Recording is one bit scan and one increment;
+// the bucket array is fixed (about 22 KB), so nothing allocates after construction.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 6;                   // 64 sub-buckets per power of two
+    static const int MAX_EXPONENT = 47;                     // ~39 hours in nanoseconds
+    static const int BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) << SUB_BUCKET_BITS;
+
+    LatencyHistogram() { reset(); }
+
+    void reset() {
+        memset(buckets, 0, sizeof(buckets));
+        total = 0;
+        sum = 0;
+        minValue = UINT64_MAX;
+        maxValue = 0;
+    }
+
+    void record(uint64_t valueNs) {
+        buckets[indexOf(valueNs)]++;
+        total++;
+        sum += valueNs;
+        if (valueNs < minValue) minValue = valueNs;
+        if (valueNs > maxValue) maxValue = valueNs;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < BUCKET_COUNT; ++i) buckets[i] += other.buckets[i];
+        total += other.total;
+        sum += other.sum;
+        if (other.minValue < minValue) minValue = other.minValue;
+        if (other.maxValue > maxValue) maxValue = other.maxValue;
+    }
+
+    // Smallest recorded bucket value at or above the given percentile (0-100)
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t rank = uint64_t(p / 100.0 * double(total) + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > total) rank = total;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                uint64_t v = upperBound(i);
+                return v > maxValue ? maxValue : v;
+            }
+        }
+        return maxValue;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total ? minValue : 0; }
+    uint64_t max() const { return maxValue; }
+    double mean() const { return total ? double(sum) / double(total) : 0.0; }
+
+    // "p50 12.3us p99 45.6us p99.9 78.9us max 0.1ms (n=1000)"
+    std::string summary() const {
+        char line[256];
+        snprintf(line, sizeof(line), "p50 %s  p99 %s  p99.9 %s  max %s  (n=%llu)",
+                 formatNs(percentile(50.0)).c_str(), formatNs(percentile(99.0)).c_str(),
+                 formatNs(percentile(99.9)).c_str(), formatNs(maxValue).c_str(), (unsigned long long)total);
+        return line;
+    }
+
+    // {"count":N,"min_ns":..,"mean_ns":..,"p50_ns":..,"p99_ns":..,"p999_ns":..,"max_ns":..}
+    std::string json() const {
+        char line[320];
+        snprintf(line, sizeof(line),
+                 "{\"count\":%llu,\"min_ns\":%llu,\"mean_ns\":%.0f,\"p50_ns\":%llu,\"p90_ns\":%llu,"
+                 "\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}",
+                 (unsigned long long)total, (unsigned long long)min(), mean(),
+                 (unsigned long long)percentile(50.0), (unsigned long long)percentile(90.0),
+                 (unsigned long long)percentile(99.0), (unsigned long long)percentile(99.9),
+                 (unsigned long long)maxValue);
+        return line;
+    }
+
+    static std::string formatNs(uint64_t ns) {
+        char text[32];
+        if (ns < 1000) snprintf(text, sizeof(text), "%lluns", (unsigned long long)ns);
+        else if (ns < 1000000) snprintf(text, sizeof(text), "%.1fus", double(ns) / 1e3);
+        else if (ns < 1000000000) snprintf(text, sizeof(text), "%.2fms", double(ns) / 1e6);
+        else snprintf(text, sizeof(text), "%.2fs", double(ns) / 1e9);
+        return text;
+    }
+
+private:
+    static int indexOf(uint64_t v) {
+        if (v < (uint64_t(2) << SUB_BUCKET_BITS)) return int(v);
+        int exponent = 63 - __builtin_clzll(v);
+        if (exponent > MAX_EXPONENT) return BUCKET_COUNT - 1;
+        int shift = exponent - SUB_BUCKET_BITS;
+        return (shift << SUB_BUCKET_BITS) + int(v >> shift);
+    }
+
+    static uint64_t upperBound(int index) {
+        if (index < (2 << SUB_BUCKET_BITS)) return uint64_t(index);
+        int shift = (index >> SUB_BUCKET_BITS) - 1;
+        uint64_t mantissa = uint64_t(index - (shift << SUB_BUCKET_BITS));
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    uint64_t buckets[BUCKET_COUNT];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t minValue;
+    uint64_t maxValue;
+};
@@ -0,0 +1,883 @@
+// ServerWorker.hpp - one Udpserver worker: sessions, matches, snapshots and the receive/tick loop
+//
+// Everything between a worker's udp_io (include/udp_io.h) and its snapshots lives
+// here. Udpserver.cpp parses the options, opens one socket per worker and calls
+// runWorker for each; the soak harness (soak.cpp) calls the same runWorker over a
+// simulated link (include/udp_io_transport.h), so what it soaks is this code and
+// not a copy of it. A Worker created without an io gets one on its socket.
+//
+// Worker::stop ends the loop (Udpserver runs until killed), and Worker::onTick is
+// called on the worker's thread after every tick, the one place where another thread
+// may copy its counters out. Functions are inline, the header is not: include it from
+// one translation unit per program, as netlog.h and udp_io.h require.
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring> // For memset
+#include <cstdlib> // For atoi
+#include <cstdint>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#include "../include/netlog.h" // Async binary logging; keeps stdout off the hot path
+#include "../include/udp_io.h" // Blocking / recvmmsg / io_uring datagram backends
+#include "../include/interest_grid.h" // Area-of-interest filtering of snapshots
+#include "../include/rate_limit.h" // Per-endpoint token buckets, checked before any parsing
+#include "../include/low_latency.h" // Busy polling, pinned and SCHED_FIFO workers for --low-latency
+#include "../include/ack_channel.h" // Sequence / ack bitfield reliability for --reliable commands
+#ifdef WITH_SODIUM
+#include "../include/secure_link.h" // Connect tokens and AEAD for --secure (link with -lsodium)
+#endif
+#include "Snapshot.hpp" // PlayerPosition, SnapshotHeader and the bit-packed entity encoding
+#include "SessionTable.hpp"
+#include "LatencyHistogram.hpp"
+
+#ifdef _WIN32
+    // Windows-specific headers and setup
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "ws2_32.lib") // Link with the Winsock library
+#else
+    // POSIX (Linux, macOS) specific headers
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <unistd.h> // For close()
+    #include <errno.h>
+    #include <pthread.h> // For pthread_setaffinity_np
+    // Define SOCKET and other Windows types for cross-compatibility
+    using SOCKET = int;
+    const int INVALID_SOCKET = -1;
+    const int SOCKET_ERROR = -1;
+    #define closesocket close
+#endif
+
+const int BUFFER_SIZE = 12; // 12 bytes for our player struct (PlayerPosition, Snapshot.hpp)
+
+// --- SNAPSHOTS ---
+// Positions are not echoed as they arrive. The latest one per player is kept in a flat
+// array and, once per tick, every active match member gets one datagram holding a
+// SnapshotHeader followed by the bit-packed position of every active member of its
+// match (its own included), so outbound pps depends on the tick rate only. The wire
+// format and the entity encoding are in Snapshot.hpp.
+const int DEFAULT_TICK_RATE = 30;       // Hz
+const int MAX_TICK_RATE = 1000;
+
+// A tick's datagrams are staged and flushed whenever the staging area fills up, so
+// memory does not grow with the number of sessions
+const size_t SNAPSHOT_STAGING_BYTES = 1 << 20;
+const size_t SNAPSHOT_STAGING_SENDS = 16384;    // At least one part for MAX_MATCH_SIZE recipients
+
+// --- LOGGING ---
+// Per-packet lines go through netlog: the hot path only copies a few integers into a
+// per-thread ring and the drainer thread does the formatting and the stdout writes.
+enum LogCategory : uint16_t {
+    LOG_PACKETS = 0, // One line per datagram (sampled / rate limited)
+    LOG_WARNINGS = 1,
+    LOG_SESSIONS = 2 // Joins and idle evictions
+};
+const uint32_t DEFAULT_LOG_RATE = 1000; // Packet lines per second per thread
+
+// Packs the client endpoint into one payload slot: IPv4 (network order) << 16 | port
+inline uint64_t packEndpoint(const sockaddr_in& addr) {
+    return (uint64_t(addr.sin_addr.s_addr) << 16) | ntohs(addr.sin_port);
+}
+
+inline uint64_t packPosition(const PlayerPosition& pos) {
+    uint32_t x, y;
+    memcpy(&x, &pos.x, sizeof(x));
+    memcpy(&y, &pos.y, sizeof(y));
+    return (uint64_t(x) << 32) | y;
+}
+
+inline void formatRecv(FILE* out, const netlog_record* record) {
+    uint64_t endpoint = record->payload.u[2];
+    in_addr ip;
+    ip.s_addr = uint32_t(endpoint >> 16);
+    char clientIp[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &ip, clientIp, INET_ADDRSTRLEN);
+
+    uint32_t xBits = uint32_t(record->payload.u[1] >> 32), yBits = uint32_t(record->payload.u[1]);
+    float x, y;
+    memcpy(&x, &xBits, sizeof(x));
+    memcpy(&y, &yBits, sizeof(y));
+    fprintf(out, "RECV ◀️: Player %d at (%g, %g) from %s:%u",
+            int32_t(record->payload.u[0]), x, y, clientIp, unsigned(endpoint & 0xFFFF));
+}
+
+inline void formatSnapshot(FILE* out, const netlog_record* record) {
+    fprintf(out, "SENT ▶️: Tick %llu snapshots to %llu players in %llu matches (%llu datagrams).",
+            (unsigned long long)record->payload.u[0], (unsigned long long)record->payload.u[1],
+            (unsigned long long)record->payload.u[2], (unsigned long long)record->payload.u[3]);
+}
+
+inline void formatJoin(FILE* out, const netlog_record* record) {
+    in_addr ip;
+    ip.s_addr = uint32_t(record->payload.u[0] >> 16);
+    char clientIp[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &ip, clientIp, INET_ADDRSTRLEN);
+    fprintf(out, "JOIN: %s:%u joined match %llu (%llu sessions)", clientIp, unsigned(record->payload.u[0] & 0xFFFF),
+            (unsigned long long)record->payload.u[1], (unsigned long long)record->payload.u[2]);
+}
+
+inline void formatEvicted(FILE* out, const netlog_record* record) {
+    fprintf(out, "EVICT: %llu idle sessions removed (%llu sessions)",
+            (unsigned long long)record->payload.u[0], (unsigned long long)record->payload.u[1]);
+}
+
+inline void formatBadSize(FILE* out, const netlog_record* record) {
+    fprintf(out, "Warning: Received packet of incorrect size: %lld bytes.", (long long)int64_t(record->payload.u[0]));
+}
+
+// --- I/O BACKENDS (include/udp_io.h) ---
+// blocking: recvfrom/sendto. mmsg: up to `batchSize` datagrams per recvmmsg/sendmmsg.
+// uring: io_uring multishot receive into a kernel-registered buffer ring.
+const int DEFAULT_BATCH_SIZE = 64;
+const int MAX_BATCH_SIZE = 1024;
+const int MAX_SEND_SLOTS = 1024;    // sendmmsg accepts at most UIO_MAXIOV messages per call
+const int RECV_BUFFER_SIZE = 64;    // Larger than BUFFER_SIZE so oversized packets are seen as such
+const int STATS_INTERVAL_SECONDS = 5;
+
+// --- SESSIONS / MATCHES ---
+// Every endpoint that sends a valid position gets a session and a seat in a match;
+// its latest position is included in that match's snapshots.
+const uint32_t DEFAULT_MAX_SESSIONS = 65536; // Per worker
+const uint32_t DEFAULT_MATCH_SIZE = 16;
+const uint32_t MAX_MATCH_SIZE = 4096;           // Large worlds want --aoi-radius
+const int64_t DEFAULT_IDLE_TIMEOUT_MS = 10000;
+const uint32_t EVICT_BUDGET_PER_TICK = 4096; // Session records checked for idleness per tick
+
+// --- AREA OF INTEREST (include/interest_grid.h) ---
+// With --aoi-radius each player's snapshot only holds the players of its match within
+// that radius (plus hysteresis once seen), so per-client bandwidth depends on the local
+// player density instead of the match size.
+const uint32_t DEFAULT_AOI_MAX_VISIBLE = 64;  // Grid memory: max-sessions x this x 8 bytes
+const float DEFAULT_AOI_HYSTERESIS_RATIO = 0.1f;
+
+// --- FLOOD PROTECTION (include/rate_limit.h) ---
+// Every datagram is checked against its endpoint's token bucket before it is logged,
+// parsed or admitted, so one flooding client only spends its own budget. With
+// --global-rate the worker also sheds datagrams once its total budget runs low:
+// wrongly sized ones first, positions only when the budget is gone.
+const uint32_t DEFAULT_RATE_LIMIT = 120;        // Datagrams per second per endpoint; clients send at 30-60 Hz
+const uint32_t DEFAULT_RATE_BURST = 240;
+const uint32_t RATE_LIMIT_IDLE_MS = 2000;       // Endpoints silent this long leave the limiter table
+
+// --- LOW-LATENCY MODE (include/low_latency.h) ---
+// With --low-latency every worker spins on its non-blocking socket instead of sleeping
+// in poll until a datagram or the next tick, its socket busy-polls the NIC, and it is
+// pinned to one of --cpus (the tick runs on the same thread) and, with --fifo, runs
+// SCHED_FIFO. Each worker then keeps one core at 100% even when idle.
+
+// --- RELIABLE COMMANDS (include/ack_channel.h, --reliable) ---
+// Every datagram in both directions starts with the session's ack_channel header, so
+// positions and snapshots carry each other's acks. A client datagram is the header
+// followed by a PlayerPosition or by nothing (commands and acks only). Commands (up to
+// COMMAND_MAX_BYTES, e.g. build and train orders) are relayed reliably and in order to
+// the other active members of the sender's match, prefixed with the sender's player id.
+// Snapshots keep RELIABLE_SNAPSHOT_RESERVE bytes free for the header and commands, and
+// members no snapshot reached get a bare header at the end of the tick. Costs
+// sizeof(ack_channel) (3.5 KB) per --max-sessions slot.
+const int RELIABLE_RECV_BUFFER_SIZE = 512;      // Header, ACK_CHANNEL_PACKET_MESSAGES commands and a position
+const uint32_t RELIABLE_SNAPSHOT_RESERVE = ACK_CHANNEL_HEADER_BYTES + 2 * (ACK_CHANNEL_MESSAGE_OVERHEAD + ACK_CHANNEL_MAX_MESSAGE);
+const uint32_t COMMAND_MAX_BYTES = ACK_CHANNEL_MAX_MESSAGE - sizeof(int32_t);
+
+// --- SECURE MODE (include/secure_link.h, --secure) ---
+// Endpoints get a session only after echoing a MAC'd connect token from a challenge,
+// so spoofed sources cost one HMAC and no memory. Every datagram after that is
+// ChaCha20-Poly1305 sealed with that session's keys: received ones are opened in place
+// before anything else reads them, and a tick's staged datagrams are sealed in one
+// pass per MAX_SEND_SLOTS right before they are sent, SECURE_LINK_DATA_OVERHEAD (25)
+// bytes each, so a full snapshot is 1225 bytes on the wire. Handshake replies go out
+// after each receive batch instead of waiting for the tick. Only built with
+// -DWITH_SODIUM (make WITH_SODIUM=1); without it --secure is refused at startup.
+
+// --- RECEIVE LATENCY (--rx-timestamps) ---
+// Every datagram carries its kernel arrival time (SO_TIMESTAMPNS, udp_io_enable_timestamps).
+// Each worker records, per STATS interval:
+//   socket queue   kernel arrival -> the receive call returned it (time in the socket buffer)
+//   processing     the receive call returned it -> it was handled
+//   turnaround     kernel arrival -> the snapshot carrying it was handed to the kernel
+// Turnaround includes the wait for the next tick, so it is bounded below by the tick interval.
+
+struct ServerConfig {
+    udp_io_kind ioKind = UDP_IO_BLOCKING;
+    int batchSize = DEFAULT_BATCH_SIZE;
+    int workerCount = 1;
+    uint32_t logSample = 1;
+    uint32_t logRate = DEFAULT_LOG_RATE;
+    uint32_t maxSessions = DEFAULT_MAX_SESSIONS;
+    uint32_t matchSize = DEFAULT_MATCH_SIZE;
+    int64_t idleTimeoutMs = DEFAULT_IDLE_TIMEOUT_MS;
+    int tickRate = DEFAULT_TICK_RATE;
+    float aoiRadius = 0.0f;                     // 0 = everyone in the match
+    float aoiHysteresis = -1.0f;                // < 0 = DEFAULT_AOI_HYSTERESIS_RATIO x radius
+    uint32_t aoiMaxVisible = DEFAULT_AOI_MAX_VISIBLE;
+    uint32_t rateLimit = DEFAULT_RATE_LIMIT;    // 0 = no per-endpoint limit
+    uint32_t rateBurst = DEFAULT_RATE_BURST;
+    uint32_t globalRate = 0;                    // Per worker; 0 = no overload shedding
+    low_latency_config lowLatency;              // Off unless --low-latency
+    bool rxTimestamps = false;
+    bool reliable = false;
+#ifdef WITH_SODIUM
+    const secure_link_keys* secureKeys = nullptr; // --secure
+#endif
+    int statsIntervalSeconds = STATS_INTERVAL_SECONDS; // 0 = no STATS / LATENCY lines
+
+    ServerConfig() { low_latency_init(&lowLatency); }
+};
+
+inline int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Counters used to confirm the syscall amortization under load; the I/O counters
+// (syscalls and packets in each direction) are kept by the backend itself
+struct WorkerStats {
+    uint64_t badPackets = 0;
+    uint64_t sessionsJoined = 0;
+    uint64_t sessionsEvicted = 0;
+    uint64_t tableFull = 0;
+    uint64_t ticks = 0;
+    uint64_t lateTicks = 0;         // Ticks that overran their interval; the schedule was reset
+    uint64_t idleSpins = 0;         // --low-latency: receive attempts that found nothing
+    uint64_t snapshotsSent = 0;
+    uint64_t bareHeaders = 0;       // --reliable: datagrams carrying only acks and commands
+    uint64_t commandsReceived = 0;
+    uint64_t commandsRelayed = 0;   // One per recipient
+    uint64_t commandsRefused = 0;   // Too long, or the recipient had ACK_CHANNEL_MESSAGES unacked
+    uint64_t challengesSent = 0;    // --secure: answered REQUESTs (no state kept)
+    uint64_t connectsAccepted = 0;  // Valid tokens that created or re-keyed a session
+    uint64_t badTokens = 0;         // Forged, expired or replayed from another endpoint
+    uint64_t unknownData = 0;       // Sealed datagrams from endpoints without a session
+    uint64_t rejectedData = 0;      // Sealed datagrams that failed to open or were replays
+
+    void print(int workerId, const udp_io* io, uint32_t sessions, const rate_limit* limiter) const {
+        const udp_io_stats& s = io->stats;
+        // Format into one string so lines from concurrent workers do not interleave
+        std::ostringstream line;
+        line << "STATS[worker " << workerId << ", " << io->name << "]: recv " << s.recv_calls << " calls, " << s.packets_in << " pkts ("
+                  << (s.recv_calls ? double(s.packets_in) / s.recv_calls : 0.0) << " pkts/call) | "
+                  << "send " << s.send_calls << " calls, " << s.packets_out << " pkts ("
+                  << (s.send_calls ? double(s.packets_out) / s.send_calls : 0.0) << " pkts/call) | "
+                  << "bad " << badPackets << ", send errors " << s.send_errors << " | "
+                  << "sessions " << sessions << ", joined " << sessionsJoined << ", evicted " << sessionsEvicted << ", table full " << tableFull << " | "
+                  << "ticks " << ticks << " (" << lateTicks << " late), snapshots " << snapshotsSent;
+        if (idleSpins > 0) line << ", idle spins " << idleSpins;
+        if (commandsReceived > 0 || bareHeaders > 0) {
+            line << " | commands " << commandsReceived << ", relayed " << commandsRelayed << ", refused " << commandsRefused
+                 << ", bare headers " << bareHeaders;
+        }
+        if (challengesSent > 0 || badTokens > 0 || unknownData > 0) {
+            line << " | challenges " << challengesSent << ", accepted " << connectsAccepted << ", bad tokens " << badTokens
+                 << ", unknown senders " << unknownData << ", rejected " << rejectedData;
+        }
+        if (limiter) {
+            const rate_limit_stats& r = limiter->stats;
+            line << " | limited " << r.limited << ", shed " << r.shed[RATE_LIMIT_NORMAL] << "+" << r.shed[RATE_LIMIT_LOW]
+                 << (r.overloaded ? " (overloaded)" : "") << ", limiter sources " << r.sources << " (" << r.untracked << " untracked)";
+        }
+        line << "\n";
+        std::cout << line.str() << std::flush;
+    }
+};
+
+// --- SHARDED WORKERS (SO_REUSEPORT) ---
+// Every worker owns its socket and all of its state, so the hot path shares nothing.
+// The kernel hashes each client's 4-tuple to one of the sockets bound to PORT.
+const int MAX_WORKERS = 64;
+
+struct alignas(64) Worker { // Cache-line aligned so per-worker counters never false-share
+    int id = 0;
+    SOCKET socket = INVALID_SOCKET;
+    udp_io* io = nullptr;                       // Created on socket by runWorker unless set before
+    const std::atomic<bool>* stop = nullptr;    // Set to end runServerLoop; null = run forever
+    void (*onTick)(Worker& worker, void* context) = nullptr; // After every tick, on the worker's thread
+    void* onTickContext = nullptr;
+    WorkerStats stats;
+    SessionTable sessions; // Matches are worker-local: every member hashes to this socket
+    uint32_t tick = 0;
+    std::vector<PlayerPosition> latest;         // Latest position per session index
+    std::vector<uint8_t> hasPosition;           // Set by the first valid position; until then not a match member
+    std::vector<unsigned char> snapshotBytes;   // Staged snapshot datagrams
+    std::vector<udp_packet> snapshotSends;      // One entry per recipient and snapshot part
+    size_t stagedBytes = 0;
+    size_t stagedSends = 0;
+    std::vector<uint32_t> active;               // Scratch: active members of one match
+    std::vector<uint32_t> players;              // Scratch: players in one observer's snapshot
+    std::vector<uint32_t> evicted;              // Scratch: sessions removed by the idle sweep
+    interest_grid* interest = nullptr;          // Only with --aoi-radius
+    // --rx-timestamps: kernel arrival of each session's latest position (0 = sent already)
+    std::vector<uint64_t> latestRxNs;
+    std::vector<uint32_t> sentPlayers;          // Scratch: players whose position went out this tick
+    LatencyHistogram socketQueue, processing, turnaround;
+    rate_limit* limiter = nullptr;              // Unless --rate-limit 0 and no --global-rate
+    uint32_t playersPerSnapshot = PLAYERS_PER_SNAPSHOT;
+    std::vector<ack_channel> channels;          // --reliable: one per session index
+    std::vector<unsigned char> snapshotBody;    // --reliable: one part, copied behind each recipient's header
+    std::vector<uint32_t> snapshotRecipients;   // --secure: session of each staged send
+#ifdef WITH_SODIUM
+    std::vector<secure_link_session> links;     // --secure: one per session index
+    std::vector<unsigned char> sealedBytes;     // --secure: one batch of sealed datagrams
+    std::vector<udp_packet> sealedSends;
+    std::vector<unsigned char> handshakeBytes;  // --secure: replies to one receive batch
+    std::vector<udp_packet> handshakeSends;
+    size_t handshakeCount = 0;
+#endif
+};
+
+// Forgets what the slot's previous occupant left behind: its position, player id and
+// arrival time, and its command stream. The session stays out of snapshots and command
+// relays until its own first position arrives.
+inline void resetSession(Worker& worker, uint32_t self) {
+    worker.latest[self] = PlayerPosition();
+    worker.hasPosition[self] = 0;
+    if (!worker.latestRxNs.empty()) worker.latestRxNs[self] = 0;
+    if (!worker.channels.empty()) ack_channel_reset(&worker.channels[self]);
+    if (worker.interest) interest_grid_remove(worker.interest, self);
+}
+
+// Finds or creates the sender's session; INVALID if the table is full
+inline uint32_t admitSender(Worker& worker, const sockaddr_in& addr, int64_t now) {
+    bool created = false;
+    uint32_t self = worker.sessions.touch(addr, now, &created);
+    if (self == SessionTable::INVALID) {
+        worker.stats.tableFull++;
+    } else if (created) {
+        worker.stats.sessionsJoined++;
+        resetSession(worker, self);
+        netlog_write(LOG_SESSIONS, formatJoin, packEndpoint(addr), worker.sessions.session(self).matchId, worker.sessions.size(), 0);
+    }
+    return self;
+}
+
+inline void evictIdleSessions(Worker& worker, int64_t now) {
+    worker.evicted.clear();
+    uint32_t evicted = worker.sessions.evictIdle(now, EVICT_BUDGET_PER_TICK, &worker.evicted);
+    if (worker.interest) {
+        for (uint32_t index : worker.evicted) interest_grid_remove(worker.interest, index);
+    }
+    if (evicted > 0) {
+        worker.stats.sessionsEvicted += evicted;
+        netlog_write(LOG_SESSIONS, formatEvicted, evicted, worker.sessions.size(), 0, 0);
+    }
+}
+
+// Allocates every per-tick buffer up front, so ticks never allocate
+inline bool allocateSnapshots(Worker& worker, const ServerConfig& config) {
+    worker.latest.assign(config.maxSessions, PlayerPosition());
+    worker.hasPosition.assign(config.maxSessions, 0);
+    worker.snapshotBytes.resize(SNAPSHOT_STAGING_BYTES);
+    worker.snapshotSends.resize(SNAPSHOT_STAGING_SENDS);
+    worker.active.resize(config.matchSize);
+    worker.players.resize(config.aoiMaxVisible + 1);
+    worker.evicted.reserve(EVICT_BUDGET_PER_TICK);
+    if (config.reliable) {
+        worker.channels.resize(config.maxSessions);
+        worker.snapshotBody.resize(MAX_SNAPSHOT_BYTES);
+        worker.playersPerSnapshot = (MAX_SNAPSHOT_BYTES - RELIABLE_SNAPSHOT_RESERVE - sizeof(SnapshotHeader)) * 8 / MAX_ENCODED_POSITION_BITS;
+    }
+#ifdef WITH_SODIUM
+    if (config.secureKeys) {
+        worker.links.resize(config.maxSessions);
+        worker.snapshotRecipients.resize(SNAPSHOT_STAGING_SENDS);
+        worker.sealedBytes.resize(size_t(MAX_SEND_SLOTS) * (MAX_SNAPSHOT_BYTES + SECURE_LINK_DATA_OVERHEAD));
+        worker.sealedSends.resize(MAX_SEND_SLOTS);
+        worker.handshakeBytes.resize(size_t(config.batchSize) * SECURE_LINK_HANDSHAKE_BYTES);
+        worker.handshakeSends.resize(config.batchSize);
+    }
+#endif
+    if (config.rxTimestamps) {
+        worker.latestRxNs.assign(config.maxSessions, 0);
+        worker.sentPlayers.reserve(config.maxSessions);
+    }
+    if (config.aoiRadius > 0.0f) {
+        float hysteresis = config.aoiHysteresis >= 0.0f ? config.aoiHysteresis : config.aoiRadius * DEFAULT_AOI_HYSTERESIS_RATIO;
+        worker.interest = interest_grid_create(config.maxSessions, config.aoiRadius + hysteresis, hysteresis, config.aoiMaxVisible);
+        if (worker.interest == nullptr) return false;
+    }
+    return true;
+}
+
+#ifdef WITH_SODIUM
+// --secure: seals the staged datagrams MAX_SEND_SLOTS at a time, each batch in one pass
+// right before its send, so the cipher runs back to back over a tick's packets
+inline void sealAndSend(Worker& worker) {
+    const size_t slotBytes = MAX_SNAPSHOT_BYTES + SECURE_LINK_DATA_OVERHEAD;
+    for (size_t first = 0; first < worker.stagedSends; first += worker.sealedSends.size()) {
+        size_t count = worker.stagedSends - first < worker.sealedSends.size() ? worker.stagedSends - first : worker.sealedSends.size();
+        udp_io_wait_sends(worker.io); // The previous batch may still be reading sealedBytes (io_uring)
+        for (size_t i = 0; i < count; ++i) {
+            const udp_packet& plain = worker.snapshotSends[first + i];
+            udp_packet& out = worker.sealedSends[i];
+            out.addr = plain.addr;
+            out.data = worker.sealedBytes.data() + i * slotBytes;
+            out.length = secure_link_seal(&worker.links[worker.snapshotRecipients[first + i]], plain.data, plain.length, out.data);
+            out.truncated = 0;
+        }
+        udp_io_send(worker.io, worker.sealedSends.data(), int(count));
+    }
+}
+#endif
+
+inline void flushSnapshots(Worker& worker) {
+    if (worker.stagedSends > 0) {
+        if (worker.snapshotRecipients.empty()) udp_io_send(worker.io, worker.snapshotSends.data(), int(worker.stagedSends));
+#ifdef WITH_SODIUM
+        else sealAndSend(worker);
+#endif
+        worker.stats.snapshotsSent += worker.stagedSends;
+    }
+    worker.stagedBytes = 0;
+    worker.stagedSends = 0;
+}
+
+// --reliable: stages one datagram for one session, its ack_channel header (acks and due
+// commands) followed by payload; a bare header if length is 0
+inline void stageReliable(Worker& worker, uint32_t recipient, const unsigned char* payload, uint32_t length, int64_t now) {
+    if (worker.stagedBytes + MAX_SNAPSHOT_BYTES > worker.snapshotBytes.size() || worker.stagedSends == worker.snapshotSends.size()) {
+        flushSnapshots(worker);
+        udp_io_wait_sends(worker.io);
+    }
+    unsigned char* datagram = worker.snapshotBytes.data() + worker.stagedBytes;
+    int headerBytes = ack_channel_write(&worker.channels[recipient], datagram, MAX_SNAPSHOT_BYTES - length, uint64_t(now));
+    if (length > 0) memcpy(datagram + headerBytes, payload, length);
+    if (!worker.snapshotRecipients.empty()) worker.snapshotRecipients[worker.stagedSends] = recipient;
+    udp_packet& out = worker.snapshotSends[worker.stagedSends++];
+    out.addr = worker.sessions.session(recipient).addr;
+    out.data = datagram;
+    out.length = uint32_t(headerBytes) + length;
+    out.truncated = 0;
+    worker.stagedBytes += out.length;
+}
+
+// Encodes the players into as few datagrams as they fit in and queues every datagram
+// for every recipient
+inline void queueSnapshot(Worker& worker, const uint32_t* players, uint32_t playerCount,
+                   const uint32_t* recipients, uint32_t recipientCount, int64_t now) {
+    const uint32_t perPart = worker.playersPerSnapshot;
+    const bool shared = worker.channels.empty(); // Without --reliable every recipient gets the same bytes
+    uint32_t partCount = (playerCount + perPart - 1) / perPart;
+    for (uint32_t part = 0; part < partCount; ++part) {
+        if (shared && (worker.stagedBytes + MAX_SNAPSHOT_BYTES > worker.snapshotBytes.size()
+                       || worker.stagedSends + recipientCount > worker.snapshotSends.size())) {
+            flushSnapshots(worker);
+            udp_io_wait_sends(worker.io); // The staging area is reused right away
+        }
+        uint32_t first = part * perPart;
+        uint32_t count = playerCount - first < perPart ? playerCount - first : perPart;
+        unsigned char* datagram = shared ? worker.snapshotBytes.data() + worker.stagedBytes : worker.snapshotBody.data();
+        uint32_t length = writeSnapshotPart(datagram, worker.tick, part, partCount, worker.latest, players + first, count);
+        if (!shared) {
+            for (uint32_t r = 0; r < recipientCount; ++r) stageReliable(worker, recipients[r], datagram, length, now);
+            continue;
+        }
+        worker.stagedBytes += length;
+
+        for (uint32_t r = 0; r < recipientCount; ++r) {
+            if (!worker.snapshotRecipients.empty()) worker.snapshotRecipients[worker.stagedSends] = recipients[r];
+            udp_packet& out = worker.snapshotSends[worker.stagedSends++];
+            out.addr = worker.sessions.session(recipients[r]).addr;
+            out.data = datagram;
+            out.length = length;
+            out.truncated = 0;
+        }
+    }
+}
+
+// --reliable: acks and commands for the active members no snapshot carried them to this
+// tick (alone in their match, nobody in AOI range, or more due commands than fit)
+inline void queueBareHeaders(Worker& worker, int64_t now) {
+    for (uint32_t matchId = 0; matchId < worker.sessions.matchCapacity(); ++matchId) {
+        uint32_t memberCount = 0;
+        const uint32_t* members = worker.sessions.matchMembers(matchId, memberCount);
+        for (uint32_t k = 0; k < memberCount; ++k) {
+            if (worker.sessions.isIdle(members[k], now) || !ack_channel_wants_packet(&worker.channels[members[k]], uint64_t(now))) continue;
+            stageReliable(worker, members[k], nullptr, 0, now);
+            worker.stats.bareHeaders++;
+        }
+    }
+}
+
+// Sends one client's command to every other active member of its match. A sender that
+// has not sent a position yet has no player id to stamp it with, so it is refused.
+inline void relayCommand(Worker& worker, uint32_t sender, const unsigned char* command, uint32_t length, int64_t now) {
+    worker.stats.commandsReceived++;
+    if (length > COMMAND_MAX_BYTES || !worker.hasPosition[sender]) {
+        worker.stats.commandsRefused++;
+        return;
+    }
+    unsigned char message[ACK_CHANNEL_MAX_MESSAGE];
+    memcpy(message, &worker.latest[sender].id, sizeof(int32_t));
+    memcpy(message + sizeof(int32_t), command, length);
+    uint32_t memberCount = 0;
+    const uint32_t* members = worker.sessions.matchMembers(worker.sessions.session(sender).matchId, memberCount);
+    for (uint32_t k = 0; k < memberCount; ++k) {
+        if (members[k] == sender || !worker.hasPosition[members[k]] || worker.sessions.isIdle(members[k], now)) continue;
+        if (ack_channel_send(&worker.channels[members[k]], message, uint32_t(sizeof(int32_t)) + length, uint64_t(now)) == 0) {
+            worker.stats.commandsRelayed++;
+        } else {
+            worker.stats.commandsRefused++;
+        }
+    }
+}
+
+// --reliable: admits the sender and reads its ack_channel header. Returns the session,
+// or INVALID if the table is full or the header is malformed; payload and length are
+// narrowed to what follows the header. Its commands wait in the channel for relayCommands.
+inline uint32_t readReliable(Worker& worker, const udp_packet& in, int64_t now, const unsigned char*& payload, uint32_t& length) {
+    if (in.length < ACK_CHANNEL_HEADER_BYTES || in.truncated) {
+        worker.stats.badPackets++;
+        netlog_write(LOG_WARNINGS, formatBadSize, in.length, 0, 0, 0);
+        return SessionTable::INVALID;
+    }
+    uint32_t self = admitSender(worker, in.addr, now);
+    if (self == SessionTable::INVALID) return self;
+    ack_channel& channel = worker.channels[self];
+    int offset = ack_channel_read(&channel, in.data, in.length, uint64_t(now));
+    if (offset < 0) {
+        worker.stats.badPackets++;
+        netlog_write(LOG_WARNINGS, formatBadSize, in.length, 0, 0, 0);
+        return SessionTable::INVALID;
+    }
+    payload = in.data + offset;
+    length = in.length - uint32_t(offset);
+    return self;
+}
+
+// --reliable: relays the commands the sender's last datagram delivered, after the
+// position that came with it (if any) was stored, so they carry its player id
+inline void relayCommands(Worker& worker, uint32_t self, int64_t now) {
+    const unsigned char* command;
+    uint32_t commandLength;
+    while (ack_channel_receive(&worker.channels[self], &command, &commandLength)) relayCommand(worker, self, command, commandLength, now);
+}
+
+#ifdef WITH_SODIUM
+// --secure: replies to handshakes go out once per receive batch, not with the tick
+inline void flushHandshakes(Worker& worker) {
+    if (worker.handshakeCount > 0) udp_io_send(worker.io, worker.handshakeSends.data(), int(worker.handshakeCount));
+    worker.handshakeCount = 0;
+}
+
+// Reserves one handshake reply to addr; the caller writes it and sets its length
+inline udp_packet& stageHandshake(Worker& worker, const sockaddr_in& addr) {
+    if (worker.handshakeCount == worker.handshakeSends.size()) flushHandshakes(worker);
+    if (worker.handshakeCount == 0) udp_io_wait_sends(worker.io); // The last batch's replies may still be in flight (io_uring)
+    udp_packet& out = worker.handshakeSends[worker.handshakeCount];
+    out.addr = addr;
+    out.data = worker.handshakeBytes.data() + worker.handshakeCount * SECURE_LINK_HANDSHAKE_BYTES;
+    out.truncated = 0;
+    worker.handshakeCount++;
+    return out;
+}
+
+// --secure: answers handshakes, which only reach the session table with a valid token,
+// and opens sealed datagrams in place. True if `in` now holds a plaintext payload for
+// the unsecured path; everything else ends here.
+inline bool openSecure(Worker& worker, const ServerConfig& config, udp_packet& in, int64_t now) {
+    int type = in.truncated ? 0 : secure_link_type(in.data, in.length);
+    if (type == SECURE_LINK_DATA) {
+        uint32_t self = worker.sessions.find(in.addr);
+        if (self == SessionTable::INVALID) {
+            worker.stats.unknownData++;
+            return false;
+        }
+        int length = secure_link_open(&worker.links[self], in.data, in.length, in.data + SECURE_LINK_DATA_HEADER_BYTES);
+        if (length < 0) {
+            worker.stats.rejectedData++;
+            return false;
+        }
+        in.data += SECURE_LINK_DATA_HEADER_BYTES;
+        in.length = uint32_t(length);
+        return true;
+    }
+    if (type == SECURE_LINK_REQUEST) {
+        udp_packet& out = stageHandshake(worker, in.addr);
+        out.length = secure_link_challenge(config.secureKeys, packEndpoint(in.addr), in.data, in.length, uint64_t(now), out.data);
+        worker.stats.challengesSent++;
+        return false;
+    }
+    if (type == SECURE_LINK_RESPONSE) {
+        secure_link_session link;
+        if (secure_link_accept(config.secureKeys, packEndpoint(in.addr), in.data, in.length, uint64_t(now), &link) != 0) {
+            worker.stats.badTokens++;
+            return false;
+        }
+        // The same salt again is a retransmitted response: keep the session and its counters.
+        // A new handshake on a known endpoint is a new client there (new keys, since every
+        // challenge has its own salt): it starts over like a new session, outside snapshots
+        // and relays until its first position (admitSender resets new ones)
+        uint32_t existing = worker.sessions.find(in.addr);
+        bool duplicate = existing != SessionTable::INVALID && secure_link_same_handshake(&worker.links[existing], &link);
+        uint32_t self = admitSender(worker, in.addr, now);
+        if (self == SessionTable::INVALID) return false;
+        if (!duplicate) {
+            if (existing != SessionTable::INVALID) resetSession(worker, self);
+            worker.links[self] = link;
+            worker.stats.connectsAccepted++;
+        }
+        // An empty sealed datagram tells the client it is in
+        udp_packet& out = stageHandshake(worker, in.addr);
+        out.length = secure_link_seal(&worker.links[self], out.data, 0, out.data);
+        return false;
+    }
+    worker.stats.badPackets++;
+    netlog_write(LOG_WARNINGS, formatBadSize, in.length, 0, 0, 0);
+    return false;
+}
+#endif
+
+// One tick: without AOI each match's snapshot is built once and sent to every active
+// member; with AOI every member gets its own snapshot of the players near it
+inline void runTick(Worker& worker) {
+    SessionTable& sessions = worker.sessions;
+    int64_t now = nowMs();
+    worker.tick++;
+    worker.stats.ticks++;
+    evictIdleSessions(worker, now);
+    if (worker.limiter) rate_limit_age(worker.limiter, uint64_t(now), RATE_LIMIT_IDLE_MS, EVICT_BUDGET_PER_TICK);
+    udp_io_wait_sends(worker.io); // Last tick's snapshots may still be in flight (io_uring)
+
+    uint64_t recipients = 0, matches = 0, queuedBefore = worker.stats.snapshotsSent;
+    uint32_t* active = worker.active.data();
+    for (uint32_t matchId = 0; matchId < sessions.matchCapacity(); ++matchId) {
+        uint32_t memberCount = 0;
+        const uint32_t* members = sessions.matchMembers(matchId, memberCount);
+        if (memberCount < 2) continue;
+        uint32_t activeCount = 0;
+        for (uint32_t k = 0; k < memberCount; ++k) {
+            if (worker.hasPosition[members[k]] && !sessions.isIdle(members[k], now)) active[activeCount++] = members[k];
+        }
+        if (activeCount < 2) continue; // Nobody else to replicate to
+        matches++;
+        if (!worker.latestRxNs.empty()) {
+            for (uint32_t k = 0; k < activeCount; ++k) {
+                if (worker.latestRxNs[active[k]] != 0) worker.sentPlayers.push_back(active[k]);
+            }
+        }
+
+        if (worker.interest == nullptr) {
+            queueSnapshot(worker, active, activeCount, active, activeCount, now);
+            recipients += activeCount;
+            continue;
+        }
+        uint32_t* players = worker.players.data();
+        for (uint32_t k = 0; k < activeCount; ++k) {
+            uint32_t observer = active[k];
+            int visible = interest_grid_visible(worker.interest, observer, players + 1, int(worker.players.size()) - 1);
+            uint32_t count = 1;
+            players[0] = observer; // Own position first, as without AOI it is included too
+            for (int i = 0; i < visible; ++i) {
+                if (!sessions.isIdle(players[1 + i], now)) players[count++] = players[1 + i];
+            }
+            if (count < 2) continue;
+            queueSnapshot(worker, players, count, &observer, 1, now);
+            recipients++;
+        }
+    }
+    if (!worker.channels.empty()) queueBareHeaders(worker, now);
+    flushSnapshots(worker);
+    if (!worker.sentPlayers.empty()) {
+        uint64_t sentNs = udp_io_realtime_ns();
+        for (uint32_t index : worker.sentPlayers) {
+            uint64_t& rxNs = worker.latestRxNs[index];
+            worker.turnaround.record(sentNs > rxNs ? sentNs - rxNs : 0);
+            rxNs = 0;
+        }
+        worker.sentPlayers.clear();
+    }
+
+    uint64_t datagrams = worker.stats.snapshotsSent - queuedBefore;
+    if (datagrams > 0) netlog_write(LOG_PACKETS, formatSnapshot, worker.tick, recipients, matches, datagrams);
+}
+
+// One line per STATS interval, then the histograms start over
+inline void printLatency(Worker& worker) {
+    std::ostringstream line;
+    line << "LATENCY[worker " << worker.id << "]: socket queue " << worker.socketQueue.summary()
+         << " | processing " << worker.processing.summary() << " | turnaround " << worker.turnaround.summary() << "\n";
+    std::cout << line.str() << std::flush;
+    worker.socketQueue.reset();
+    worker.processing.reset();
+    worker.turnaround.reset();
+}
+
+// Stores one received position as the sender's latest, admitting the sender if self is
+// INVALID; the first one makes the session a match member. Returns the session.
+inline uint32_t storePosition(Worker& worker, const ServerConfig& config, const udp_packet& in, const unsigned char* payload,
+                       uint32_t length, uint32_t self, int64_t now, uint64_t pickedUpNs) {
+    if (length != (uint32_t)BUFFER_SIZE || in.truncated) {
+        worker.stats.badPackets++;
+        netlog_write(LOG_WARNINGS, formatBadSize, length, 0, 0, 0);
+        return self;
+    }
+    PlayerPosition pos;
+    memcpy(&pos, payload, sizeof(pos));
+    netlog_write(LOG_PACKETS, formatRecv, uint64_t(pos.id), packPosition(pos), packEndpoint(in.addr), 0);
+
+    if (self == SessionTable::INVALID) self = admitSender(worker, in.addr, now);
+    if (self == SessionTable::INVALID) return self;
+    worker.latest[self] = pos;
+    worker.hasPosition[self] = 1;
+    if (worker.interest) {
+        interest_grid_update(worker.interest, self, worker.sessions.session(self).matchId, pos.x, pos.y, config.aoiRadius);
+    }
+    if (pickedUpNs != 0 && in.rx_ns != 0) {
+        worker.latestRxNs[self] = in.rx_ns;
+        uint64_t handledNs = udp_io_realtime_ns();
+        worker.processing.record(handledNs > pickedUpNs ? handledNs - pickedUpNs : 0);
+    }
+    return self;
+}
+
+// One receive/tick loop for every backend: between ticks, datagrams are received (one
+// per call for the blocking backend, up to config.batchSize for mmsg and io_uring)
+// and only update the latest position table; all replication happens in runTick
+inline void runServerLoop(Worker& worker, const ServerConfig& config) {
+    udp_io* io = worker.io;
+    const int batchSize = io->batch;
+    std::vector<udp_packet> packets(batchSize);
+
+    WorkerStats& stats = worker.stats;
+    const auto tickInterval = std::chrono::nanoseconds(1000000000LL / config.tickRate);
+    auto nextTick = std::chrono::steady_clock::now() + tickInterval;
+    const auto reportInterval = std::chrono::seconds(config.statsIntervalSeconds);
+    auto nextReport = std::chrono::steady_clock::now() + reportInterval;
+
+    while (worker.stop == nullptr || !worker.stop->load(std::memory_order_relaxed)) {
+        auto clock = std::chrono::steady_clock::now();
+        if (clock >= nextTick) {
+            runTick(worker);
+            nextTick += tickInterval;
+            clock = std::chrono::steady_clock::now();
+            if (clock >= nextTick) {
+                // Overran: start a fresh schedule rather than firing a burst of catch-up ticks
+                stats.lateTicks++;
+                nextTick = clock + tickInterval;
+            }
+            if (worker.onTick) worker.onTick(worker, worker.onTickContext);
+            if (config.statsIntervalSeconds > 0 && clock >= nextReport) {
+                stats.print(worker.id, io, worker.sessions.size(), worker.limiter);
+                if (config.rxTimestamps) printLatency(worker);
+                nextReport = clock + reportInterval;
+            }
+        }
+
+        // 1. Receive until the next tick is due; in low-latency mode check once and spin
+        int received;
+        if (config.lowLatency.enabled) {
+            received = udp_io_try_recv(io, packets.data(), batchSize);
+            if (received == 0) {
+                stats.idleSpins++;
+                low_latency_relax();
+                continue;
+            }
+        } else {
+            int64_t waitNs = std::chrono::duration_cast<std::chrono::nanoseconds>(nextTick - clock).count();
+            received = udp_io_recv_timeout(io, packets.data(), batchSize, int((waitNs + 999999) / 1000000));
+        }
+        if (received < 0) {
+            if (errno != EINTR) std::cerr << io->name << " receive failed: " << strerror(errno) << std::endl;
+            continue;
+        }
+
+        // 2. Latest position wins; nothing is sent from here. Datagrams over their
+        // endpoint's budget are dropped before they are even logged.
+        int64_t now = nowMs();
+        uint64_t pickedUpNs = config.rxTimestamps ? udp_io_realtime_ns() : 0;
+        for (int i = 0; i < received; ++i) {
+            udp_packet& in = packets[i];
+            if (pickedUpNs != 0 && in.rx_ns != 0) {
+                worker.socketQueue.record(pickedUpNs > in.rx_ns ? pickedUpNs - in.rx_ns : 0);
+            }
+            if (worker.limiter) {
+                bool wellFormed = (config.reliable ? in.length >= ACK_CHANNEL_HEADER_BYTES : in.length == (uint32_t)BUFFER_SIZE)
+                                  && !in.truncated;
+#ifdef WITH_SODIUM
+                if (config.secureKeys) wellFormed = secure_link_type(in.data, in.length) != 0 && !in.truncated;
+#endif
+                if (!rate_limit_check(worker.limiter, packEndpoint(in.addr), wellFormed ? RATE_LIMIT_NORMAL : RATE_LIMIT_LOW,
+                                      uint64_t(now))) continue;
+            }
+#ifdef WITH_SODIUM
+            if (config.secureKeys && !openSecure(worker, config, in, now)) continue; // Handshake, or not from a session
+#endif
+            const unsigned char* payload = in.data;
+            uint32_t length = in.length;
+            uint32_t self = SessionTable::INVALID;
+            if (config.reliable) {
+                self = readReliable(worker, in, now, payload, length);
+                if (self == SessionTable::INVALID) continue;
+            }
+            if (length > 0 || !config.reliable) { // Reliable datagrams may carry only acks and commands
+                self = storePosition(worker, config, in, payload, length, self, now, pickedUpNs);
+            }
+            if (config.reliable) relayCommands(worker, self, now);
+        }
+#ifdef WITH_SODIUM
+        if (worker.handshakeCount > 0) flushHandshakes(worker);
+#endif
+    }
+}
+
+// Receive buffer per datagram for the configured mode, larger than anything it accepts
+// (so oversized datagrams are seen as such); also what a caller-made io must hold
+inline int workerRecvBufferSize(const ServerConfig& config) {
+    int size = config.reliable ? RELIABLE_RECV_BUFFER_SIZE : RECV_BUFFER_SIZE;
+#ifdef WITH_SODIUM
+    if (config.secureKeys) { // Sealed datagrams, and handshakes, which may be longer than a plain datagram
+        size += SECURE_LINK_DATA_OVERHEAD;
+        if (size < SECURE_LINK_HANDSHAKE_BYTES) size = SECURE_LINK_HANDSHAKE_BYTES;
+    }
+#endif
+    return size;
+}
+
+inline void runWorker(Worker& worker, const ServerConfig& config) {
+    if (low_latency_thread(&config.lowLatency, worker.id) != 0) {
+        std::cerr << "Warning: worker " << worker.id << " could not be pinned to core " << low_latency_cpu(&config.lowLatency, worker.id)
+                  << (config.lowLatency.fifo_priority > 0 ? " with SCHED_FIFO" : "") << ": " << strerror(errno) << std::endl;
+    }
+    // Allocated on the worker's own thread (and so on its NUMA node), never again after this
+    worker.sessions.init(config.maxSessions, config.matchSize, config.idleTimeoutMs);
+    if (!allocateSnapshots(worker, config)) {
+        std::cerr << "Failed to allocate the interest grid for worker " << worker.id << "." << std::endl;
+        return;
+    }
+    if (config.rateLimit > 0 || config.globalRate > 0) {
+        // Without a per-endpoint limit the buckets never run dry and only the global budget applies
+        uint32_t rate = config.rateLimit > 0 ? config.rateLimit : UINT32_MAX, burst = config.rateLimit > 0 ? config.rateBurst : UINT32_MAX;
+        worker.limiter = rate_limit_create(config.maxSessions, rate, burst, config.globalRate, config.globalRate / 4);
+        if (worker.limiter == nullptr) {
+            std::cerr << "Failed to allocate the rate limiter for worker " << worker.id << "." << std::endl;
+            return;
+        }
+    }
+
+    // Snapshots go out in one burst per tick, so use the largest send batches available
+    int sendSlots = MAX_SEND_SLOTS;
+    int recvBufferSize = workerRecvBufferSize(config);
+    if (worker.io == nullptr) worker.io = udp_io_create(config.ioKind, worker.socket, config.batchSize, recvBufferSize, sendSlots);
+    if (worker.io == nullptr && config.ioKind == UDP_IO_URING) {
+        std::cerr << "Warning: io_uring unavailable (" << strerror(errno) << "); worker " << worker.id << " falls back to mmsg." << std::endl;
+        worker.io = udp_io_create(UDP_IO_MMSG, worker.socket, config.batchSize, recvBufferSize, sendSlots);
+    }
+    if (worker.io == nullptr) {
+        std::cerr << "Failed to create the I/O backend for worker " << worker.id << "." << std::endl;
+        return;
+    }
+    if (config.rxTimestamps && udp_io_enable_timestamps(worker.io) != 0) {
+        std::cerr << "Warning: no kernel receive timestamps for worker " << worker.id << ": " << strerror(errno) << std::endl;
+    }
+    runServerLoop(worker, config);
+    interest_grid_destroy(worker.interest);
+    rate_limit_destroy(worker.limiter);
+    worker.interest = nullptr;
+    worker.limiter = nullptr;
+}
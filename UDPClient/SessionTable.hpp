@@ -0,0 +1,217 @@
+// SessionTable.hpp - client sessions for the UDP replication server (Udpserver.cpp)
+//
+// Sessions are keyed by the client's IPv4 endpoint and found through an
+// open-addressing (linear probing) hash table of 16-byte slots. Session records
+// live in a dense, preallocated array, and every session belongs to one match
+// whose member list is what a received position gets fanned out to.
+//
+// All memory is allocated by init(); touch/find/remove/evictIdle never allocate.
+// A table is owned by exactly one worker thread, so nothing here is synchronized.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+#else
+    #include <netinet/in.h>
+#endif
+
+struct Session {
+    sockaddr_in addr;
+    int64_t lastSeenMs = 0;
+    uint32_t matchId = 0;
+    uint16_t matchSlot = 0;     // Position in the match's member list
+    uint8_t active = 0;
+    uint8_t reserved = 0;
+};
+
+class SessionTable {
+public:
+    static constexpr uint32_t INVALID = 0xFFFFFFFFu;
+
+    // maxSessions endpoints, matchSize players per match, sessions idle for longer
+    // than idleTimeoutMs are evicted by evictIdle()
+    void init(uint32_t maxSessions, uint32_t matchSize, int64_t idleTimeoutMs) {
+        capacity = maxSessions;
+        playersPerMatch = matchSize;
+        idleTimeout = idleTimeoutMs;
+        count = 0;
+        sweepCursor = 0;
+
+        // Keep the load factor at or below 50% so probe sequences stay short
+        uint32_t slotCount = 16;
+        while (slotCount < maxSessions * 2) slotCount <<= 1;
+        slots.assign(slotCount, Slot());
+        slotMask = slotCount - 1;
+
+        sessions.assign(maxSessions, Session());
+        freeList.resize(maxSessions);
+        for (uint32_t i = 0; i < maxSessions; ++i) freeList[i] = maxSessions - 1 - i;
+
+        // Enough seats for every session; matches with a free seat wait on a stack
+        matchCount = (maxSessions + matchSize - 1) / matchSize;
+        members.assign(size_t(matchCount) * matchSize, INVALID);
+        memberCounts.assign(matchCount, 0);
+        openMatches.resize(matchCount);
+        for (uint32_t m = 0; m < matchCount; ++m) openMatches[m] = matchCount - 1 - m;
+    }
+
+    // Returns the session for addr, creating it and seating it in a match on first
+    // contact. Refreshes the idle timer. Returns INVALID when the table is full.
+    uint32_t touch(const sockaddr_in& addr, int64_t nowMs, bool* created = nullptr) {
+        uint64_t key = makeKey(addr);
+        uint32_t pos = home(key);
+        while (slots[pos].key != 0) {
+            if (slots[pos].key == key) {
+                Session& s = sessions[slots[pos].index];
+                s.lastSeenMs = nowMs;
+                if (created) *created = false;
+                return slots[pos].index;
+            }
+            pos = (pos + 1) & slotMask;
+        }
+        if (freeList.empty() || openMatches.empty()) return INVALID;
+
+        uint32_t index = freeList.back();
+        freeList.pop_back();
+        slots[pos].key = key;
+        slots[pos].index = index;
+
+        Session& s = sessions[index];
+        s.addr = addr;
+        s.lastSeenMs = nowMs;
+        s.active = 1;
+        joinMatch(index);
+        count++;
+        if (created) *created = true;
+        return index;
+    }
+
+    uint32_t find(const sockaddr_in& addr) const {
+        uint64_t key = makeKey(addr);
+        for (uint32_t pos = home(key); slots[pos].key != 0; pos = (pos + 1) & slotMask) {
+            if (slots[pos].key == key) return slots[pos].index;
+        }
+        return INVALID;
+    }
+
+    void remove(uint32_t index) {
+        Session& s = sessions[index];
+        if (!s.active) return;
+
+        uint64_t key = makeKey(s.addr);
+        uint32_t hole = home(key);
+        while (slots[hole].key != key) hole = (hole + 1) & slotMask;
+
+        // Backward-shift deletion: pull later entries of the probe chain into the hole
+        // so lookups never need tombstones
+        uint32_t next = hole;
+        while (true) {
+            next = (next + 1) & slotMask;
+            if (slots[next].key == 0) break;
+            uint32_t desired = home(slots[next].key);
+            bool between = (hole <= next) ? (hole < desired && desired <= next)
+                                          : (hole < desired || desired <= next);
+            if (!between) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+        }
+        slots[hole] = Slot();
+
+        leaveMatch(index);
+        s.active = 0;
+        freeList.push_back(index);
+        count--;
+    }
+
+    // Checks up to `budget` session records for idle timeout, resuming where the
+    // previous call stopped, so eviction cost is spread evenly over the packets.
+    // Evicted indices are appended to evictedOut if given.
+    uint32_t evictIdle(int64_t nowMs, uint32_t budget, std::vector<uint32_t>* evictedOut = nullptr) {
+        uint32_t evicted = 0;
+        for (uint32_t n = 0; n < budget && n < capacity; ++n) {
+            uint32_t index = sweepCursor;
+            sweepCursor = (sweepCursor + 1 == capacity) ? 0 : sweepCursor + 1;
+            if (sessions[index].active && isIdle(index, nowMs)) {
+                remove(index);
+                if (evictedOut) evictedOut->push_back(index);
+                evicted++;
+            }
+        }
+        return evicted;
+    }
+
+    bool isIdle(uint32_t index, int64_t nowMs) const {
+        return nowMs - sessions[index].lastSeenMs > idleTimeout;
+    }
+
+    Session& session(uint32_t index) { return sessions[index]; }
+    const Session& session(uint32_t index) const { return sessions[index]; }
+
+    // Members of the session's match, including the session itself
+    const uint32_t* matchMembers(uint32_t matchId, uint32_t& memberCount) const {
+        memberCount = memberCounts[matchId];
+        return &members[size_t(matchId) * playersPerMatch];
+    }
+
+    uint32_t size() const { return count; }
+    uint32_t matchSize() const { return playersPerMatch; }
+    uint32_t matchCapacity() const { return matchCount; } // Match ids are 0 .. matchCapacity() - 1
+
+private:
+    struct Slot {
+        uint64_t key = 0;       // 0 marks an empty slot
+        uint32_t index = 0;
+        uint32_t reserved = 0;
+    };
+
+    // IPv4 address and port in the low 48 bits, bit 63 set so no key is ever 0
+    static uint64_t makeKey(const sockaddr_in& addr) {
+        return (uint64_t(1) << 63) | (uint64_t(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+    }
+
+    uint32_t home(uint64_t key) const {
+        return uint32_t((key * 0x9E3779B97F4A7C15ull) >> 32) & slotMask;
+    }
+
+    void joinMatch(uint32_t index) {
+        uint32_t matchId = openMatches.back();
+        uint32_t seat = memberCounts[matchId]++;
+        members[size_t(matchId) * playersPerMatch + seat] = index;
+        sessions[index].matchId = matchId;
+        sessions[index].matchSlot = uint16_t(seat);
+        if (memberCounts[matchId] == playersPerMatch) openMatches.pop_back();
+    }
+
+    void leaveMatch(uint32_t index) {
+        Session& s = sessions[index];
+        uint32_t* seats = &members[size_t(s.matchId) * playersPerMatch];
+        uint32_t last = --memberCounts[s.matchId];
+        if (last + 1 == playersPerMatch) openMatches.push_back(s.matchId); // Was full, has a seat again
+
+        // Swap-remove keeps the member list dense for fan-out
+        seats[s.matchSlot] = seats[last];
+        sessions[seats[last]].matchSlot = s.matchSlot;
+        seats[last] = INVALID;
+    }
+
+    std::vector<Slot> slots;
+    uint32_t slotMask = 0;
+
+    std::vector<Session> sessions;
+    std::vector<uint32_t> freeList;
+    uint32_t capacity = 0;
+    uint32_t count = 0;
+    uint32_t sweepCursor = 0;
+    int64_t idleTimeout = 0;
+
+    std::vector<uint32_t> members;      // matchCount x playersPerMatch session indices
+    std::vector<uint32_t> memberCounts;
+    std::vector<uint32_t> openMatches;  // Matches with at least one free seat
+    uint32_t matchCount = 0;
+    uint32_t playersPerMatch = 0;
+};
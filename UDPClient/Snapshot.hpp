@@ -0,0 +1,65 @@
+// Snapshot.hpp - wire format of the UDP replication server's positions and snapshots
+//
+// Clients send a PlayerPosition (12 bytes, the JavaScript client's layout) per
+// update. Once per tick the server sends every active match member a SnapshotHeader
+// followed by the bit-packed positions of the players it replicates; matches too
+// large for one datagram are split into parts. Shared by Udpserver.cpp and the
+// soak harness, so both put the same bytes on the wire.
+//
+// Entity encoding: zigzag varint id, then x and y as 16-bit fixed point over +-2048
+// units (1/16 unit steps). Ids below 8192 take 6 bytes per player instead of 12.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "../serialize/BitStream.hpp"
+
+// This struct MUST match the byte layout of the JavaScript client
+#pragma pack(push, 1) // Ensures compiler doesn't add padding bytes
+struct PlayerPosition {
+    int32_t id;
+    float x;
+    float y;
+};
+
+struct SnapshotHeader {
+    uint32_t tick;
+    uint16_t playerCount;   // PlayerPosition records after the header
+    uint8_t part;           // Matches too large for one datagram are split into parts
+    uint8_t partCount;
+};
+#pragma pack(pop)
+
+const int MAX_SNAPSHOT_BYTES = 1200;    // Below common path MTUs, so snapshots never fragment
+
+const Quantization POSITION_QUANT = {-2048.0f, 2048.0f, 16};
+const uint32_t MAX_ENCODED_POSITION_BITS = 40 + 2 * 16; // Ids up to 2^31 need a 5-byte varint
+const uint32_t PLAYERS_PER_SNAPSHOT = (MAX_SNAPSHOT_BYTES - sizeof(SnapshotHeader)) * 8 / MAX_ENCODED_POSITION_BITS;
+
+inline void encodePosition(BitWriter& writer, const PlayerPosition& pos) {
+    writer.writeVarint(zigzagEncode(pos.id));
+    writer.writeQuantized(pos.x, POSITION_QUANT);
+    writer.writeQuantized(pos.y, POSITION_QUANT);
+}
+
+// Mirrors fromSnapshot() in main.js; false if the datagram ends early
+inline bool decodePosition(BitReader& reader, PlayerPosition& pos) {
+    pos.id = zigzagDecode(reader.readVarint());
+    pos.x = reader.readQuantized(POSITION_QUANT);
+    pos.y = reader.readQuantized(POSITION_QUANT);
+    return !reader.overflowed();
+}
+
+// Writes one snapshot part into datagram (MAX_SNAPSHOT_BYTES): the header, then the
+// latest positions of players[0..count). Returns its length.
+inline uint32_t writeSnapshotPart(unsigned char* datagram, uint32_t tick, uint32_t part, uint32_t partCount,
+                                  const std::vector<PlayerPosition>& latest, const uint32_t* players, uint32_t count) {
+    SnapshotHeader header = {tick, uint16_t(count), uint8_t(part), uint8_t(partCount)};
+    memcpy(datagram, &header, sizeof(header));
+    BitWriter writer(datagram + sizeof(header), MAX_SNAPSHOT_BYTES - sizeof(header));
+    for (uint32_t i = 0; i < count; ++i) encodePosition(writer, latest[players[i]]);
+    writer.flush();
+    return uint32_t(sizeof(header) + writer.bytesWritten());
+}
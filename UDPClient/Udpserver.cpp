@@ -1,65 +1,51 @@
 #include <iostream>
 #include <vector>
-#include <string>
 #include <cstring> // For memset
+#include <cstdlib> // For atoi
+#include <thread>
 
-#ifdef _WIN32
-    // Windows-specific headers and setup
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-    #pragma comment(lib, "ws2_32.lib") // Link with the Winsock library
-#else
-    // POSIX (Linux, macOS) specific headers
-    #include <sys/socket.h>
-    #include <netinet/in.h>
-    #include <arpa/inet.h>
-    #include <unistd.h> // For close()
-    // Define SOCKET and other Windows types for cross-compatibility
-    using SOCKET = int;
-    const int INVALID_SOCKET = -1;
-    const int SOCKET_ERROR = -1;
-    #define closesocket close
-#endif
+#include "ServerWorker.hpp" // One worker's sessions, matches and receive/tick loop, over include/udp_io.h
 
 const int PORT = 12345;
-const int BUFFER_SIZE = 12; // 12 bytes for our player struct
-
-// This struct MUST match the byte layout of the JavaScript client
-#pragma pack(push, 1) // Ensures compiler doesn't add padding bytes
-struct PlayerPosition {
-    int32_t id;
-    float x;
-    float y;
-};
-#pragma pack(pop)
-
-
-int main() {
-    #ifdef _WIN32
-        // Initialize Winsock
-        WSADATA wsaData;
-        int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
-        if (result != 0) {
-            std::cerr << "WSAStartup failed: " << result << std::endl;
-            return 1;
-        }
-    #endif
 
-    SOCKET serverSocket;
-    sockaddr_in serverAddr, clientAddr;
-    char buffer[BUFFER_SIZE];
+#ifdef __linux__
+// Pins the calling thread to one core so a worker keeps its socket, caches and IRQ locality
+void pinThreadToCore(int core) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (rc != 0) {
+        std::cerr << "Warning: could not pin worker to core " << core << ": " << strerror(rc) << std::endl;
+    }
+}
+#endif
 
+// Creates and binds a UDP socket on PORT; with reusePort several sockets can share the port
+SOCKET openServerSocket(bool reusePort) {
     // 1. Create a UDP socket
-    serverSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    SOCKET serverSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (serverSocket == INVALID_SOCKET) {
         std::cerr << "Failed to create socket." << std::endl;
-        #ifdef _WIN32
-            WSACleanup();
-        #endif
-        return 1;
+        return INVALID_SOCKET;
     }
 
+    #ifdef SO_REUSEPORT
+        if (reusePort) {
+            int enable = 1;
+            if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, (const char*)&enable, sizeof(enable)) == SOCKET_ERROR) {
+                std::cerr << "setsockopt(SO_REUSEPORT) failed." << std::endl;
+                closesocket(serverSocket);
+                return INVALID_SOCKET;
+            }
+        }
+    #else
+        (void)reusePort;
+    #endif
+
     // 2. Prepare the server address structure
+    sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_port = htons(PORT);
     serverAddr.sin_addr.s_addr = INADDR_ANY; // Listen on all available interfaces
@@ -68,50 +54,269 @@ int main() {
     if (bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
         std::cerr << "Bind failed." << std::endl;
         closesocket(serverSocket);
-        #ifdef _WIN32
-            WSACleanup();
-        #endif
-        return 1;
+        return INVALID_SOCKET;
     }
+    return serverSocket;
+}
 
-    std::cout << "UDP server listening on port " << PORT << "..." << std::endl;
 
-    // 4. Main server loop to receive and replicate data
-    while (true) {
-        socklen_t clientAddrSize = sizeof(clientAddr);
-        memset(buffer, 0, BUFFER_SIZE);
 
-        // Receive data from a client
-        int bytesReceived = recvfrom(serverSocket, buffer, BUFFER_SIZE, 0, (struct sockaddr*)&clientAddr, &clientAddrSize);
+int main(int argc, char* argv[]) {
+    // Usage: Udpserver [--io blocking|mmsg|uring] [--batch N] [--workers N] [--log-sample N]
+    //                  [--log-rate N] [--max-sessions N] [--match-size N] [--idle-timeout MS]
+    //                  [--tick-rate HZ] [--aoi-radius R] [--aoi-hysteresis H] [--aoi-max N]
+    //                  [--rate-limit PKTS] [--rate-burst N] [--global-rate PKTS]
+    //                  [--low-latency] [--cpus LIST] [--busy-poll US] [--fifo PRIO] [--rx-timestamps] [--reliable]
+    //                  [--secure]
+    //   --io KIND         I/O backend (default blocking; mmsg and uring are Linux only)
+    //   --batch N         N datagrams per receive call; implies --io mmsg unless --io is given
+    //   --workers N       N pinned threads, each with its own SO_REUSEPORT socket (Linux only)
+    //   --log-sample N    log 1 of every N packets
+    //   --log-rate N      at most N packet log lines per second per thread (0 = unlimited)
+    //   --max-sessions N  client endpoints per worker
+    //   --match-size N    players per match (positions are fanned out within a match)
+    //   --idle-timeout MS sessions silent for this long are evicted
+    //   --tick-rate HZ    snapshots sent per second to every player (default 30)
+    //   --aoi-radius R    only replicate players within R units of each other (default: whole match)
+    //   --aoi-hysteresis H  keep replicating until R + H apart (default R / 10)
+    //   --aoi-max N       players per snapshot and interest memory per player with AOI (default 64)
+    //   --rate-limit PKTS datagrams per second per client endpoint, excess dropped unread (default 120, 0 = off)
+    //   --rate-burst N    datagrams an endpoint may send at once after being quiet (default 240)
+    //   --global-rate PKTS datagrams per second per worker before overload shedding starts (default off)
+    //   --low-latency     spin on non-blocking sockets with SO_BUSY_POLL instead of sleeping (Linux only)
+    //   --cpus LIST       with --low-latency, pin worker i to the i-th core of LIST, e.g. 2-5 (isolated cores)
+    //   --busy-poll US    SO_BUSY_POLL budget per read with --low-latency (default 50, 0 = off)
+    //   --fifo PRIO       with --low-latency and --cpus, run the workers SCHED_FIFO at PRIO (1-99)
+    //   --rx-timestamps   kernel receive timestamps; socket queue / processing / turnaround latency per STATS line
+    //   --reliable        ack_channel header on every datagram; client commands are relayed reliably to their match
+    //   --secure          sessions only after a connect-token handshake; all datagrams ChaCha20-Poly1305 sealed
+    //                     (builds with -DWITH_SODIUM only; --idle-timeout must exceed the 5 s token lifetime)
+    ServerConfig config;
+#ifdef WITH_SODIUM
+    secure_link_keys secureKeys; // Generated at startup; sessions do not survive a restart
+#endif
+    bool ioGiven = false, batchGiven = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--io") == 0 && i + 1 < argc) {
+            int kind = udp_io_parse_kind(argv[++i]);
+            if (kind < 0) {
+                std::cerr << "Unknown I/O backend '" << argv[i] << "' (blocking, mmsg or uring)." << std::endl;
+                return 1;
+            }
+            config.ioKind = udp_io_kind(kind);
+            ioGiven = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batchGiven = true;
+            config.batchSize = (i + 1 < argc) ? atoi(argv[++i]) : DEFAULT_BATCH_SIZE;
+            if (config.batchSize < 1 || config.batchSize > MAX_BATCH_SIZE) {
+                std::cerr << "Batch size must be between 1 and " << MAX_BATCH_SIZE << "." << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            config.workerCount = atoi(argv[++i]);
+            if (config.workerCount < 1 || config.workerCount > MAX_WORKERS) {
+                std::cerr << "Worker count must be between 1 and " << MAX_WORKERS << "." << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--log-sample") == 0 && i + 1 < argc) {
+            config.logSample = uint32_t(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--log-rate") == 0 && i + 1 < argc) {
+            config.logRate = uint32_t(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--max-sessions") == 0 && i + 1 < argc) {
+            config.maxSessions = uint32_t(atoi(argv[++i]));
+            if (config.maxSessions < 1) {
+                std::cerr << "Max sessions must be at least 1." << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--match-size") == 0 && i + 1 < argc) {
+            config.matchSize = uint32_t(atoi(argv[++i]));
+            if (config.matchSize < 2 || config.matchSize > MAX_MATCH_SIZE) {
+                std::cerr << "Match size must be between 2 and " << MAX_MATCH_SIZE << "." << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            config.idleTimeoutMs = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            config.tickRate = atoi(argv[++i]);
+            if (config.tickRate < 1 || config.tickRate > MAX_TICK_RATE) {
+                std::cerr << "Tick rate must be between 1 and " << MAX_TICK_RATE << " Hz." << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--aoi-radius") == 0 && i + 1 < argc) {
+            config.aoiRadius = float(atof(argv[++i]));
+            if (config.aoiRadius < 0.0f) {
+                std::cerr << "AOI radius must not be negative." << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--aoi-hysteresis") == 0 && i + 1 < argc) {
+            config.aoiHysteresis = float(atof(argv[++i]));
+        } else if (strcmp(argv[i], "--aoi-max") == 0 && i + 1 < argc) {
+            config.aoiMaxVisible = uint32_t(atoi(argv[++i]));
+            if (config.aoiMaxVisible < 1 || config.aoiMaxVisible > MAX_MATCH_SIZE) {
+                std::cerr << "AOI max must be between 1 and " << MAX_MATCH_SIZE << "." << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--rate-limit") == 0 && i + 1 < argc) {
+            config.rateLimit = uint32_t(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--rate-burst") == 0 && i + 1 < argc) {
+            config.rateBurst = uint32_t(atoi(argv[++i]));
+            if (config.rateBurst < 1) {
+                std::cerr << "Rate burst must be at least 1." << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--global-rate") == 0 && i + 1 < argc) {
+            config.globalRate = uint32_t(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--rx-timestamps") == 0) {
+            config.rxTimestamps = true;
+        } else if (strcmp(argv[i], "--reliable") == 0) {
+            config.reliable = true;
+        } else if (strcmp(argv[i], "--secure") == 0) {
+#ifdef WITH_SODIUM
+            if (secure_link_keys_generate(&secureKeys) != 0) {
+                std::cerr << "Failed to initialize libsodium." << std::endl;
+                return 1;
+            }
+            config.secureKeys = &secureKeys;
+#else
+            std::cerr << "--secure needs a build with libsodium (make WITH_SODIUM=1)." << std::endl;
+            return 1;
+#endif
+        } else if (strcmp(argv[i], "--low-latency") == 0) {
+            config.lowLatency.enabled = 1;
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            if (low_latency_parse_cpus(&config.lowLatency, argv[++i]) != 0) {
+                std::cerr << "CPU list must look like 2,3 or 2-5." << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            config.lowLatency.busy_poll_us = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fifo") == 0 && i + 1 < argc) {
+            config.lowLatency.fifo_priority = atoi(argv[++i]);
+            if (config.lowLatency.fifo_priority < 1 || config.lowLatency.fifo_priority > 99) {
+                std::cerr << "SCHED_FIFO priority must be between 1 and 99." << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--io blocking|mmsg|uring] [--batch N] [--workers N] [--log-sample N] [--log-rate N]"
+                      << " [--max-sessions N] [--match-size N] [--idle-timeout MS] [--tick-rate HZ]"
+                      << " [--aoi-radius R] [--aoi-hysteresis H] [--aoi-max N]"
+                      << " [--rate-limit PKTS] [--rate-burst N] [--global-rate PKTS]"
+                      << " [--low-latency] [--cpus LIST] [--busy-poll US] [--fifo PRIO] [--rx-timestamps] [--reliable] [--secure]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (batchGiven && !ioGiven) config.ioKind = UDP_IO_MMSG;
+#ifdef WITH_SODIUM
+    // An evicted session's RESPONSE must have expired, or a replay of it would restart its keys at counter 0
+    if (config.secureKeys && config.idleTimeoutMs <= SECURE_LINK_TOKEN_LIFETIME_MS) {
+        std::cerr << "--secure needs an idle timeout above " << SECURE_LINK_TOKEN_LIFETIME_MS << " ms." << std::endl;
+        return 1;
+    }
+#endif
+
+    #ifndef __linux__
+        if (config.ioKind != UDP_IO_BLOCKING || config.workerCount > 1) {
+            std::cerr << "Warning: --io mmsg/uring and --workers require Linux; using one blocking loop." << std::endl;
+            config.ioKind = UDP_IO_BLOCKING;
+            config.workerCount = 1;
+        }
+        if (config.lowLatency.enabled) {
+            std::cerr << "Warning: --low-latency requires Linux; ignored." << std::endl;
+            config.lowLatency.enabled = 0;
+        }
+    #endif
 
-        if (bytesReceived == SOCKET_ERROR) {
-            std::cerr << "recvfrom failed." << std::endl;
-            continue;
+    #ifdef _WIN32
+        // Initialize Winsock
+        WSADATA wsaData;
+        int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+        if (result != 0) {
+            std::cerr << "WSAStartup failed: " << result << std::endl;
+            return 1;
         }
+    #endif
 
-        if (bytesReceived == BUFFER_SIZE) {
-            // Cast the buffer to our struct to interpret the data
-            PlayerPosition* pos = reinterpret_cast<PlayerPosition*>(buffer);
+    // Open every socket up front so a bind failure is reported before any worker starts
+    std::vector<Worker> workers(config.workerCount);
+    for (int i = 0; i < config.workerCount; ++i) {
+        workers[i].id = i;
+        workers[i].socket = openServerSocket(config.workerCount > 1);
+        if (workers[i].socket != INVALID_SOCKET && low_latency_socket(workers[i].socket, &config.lowLatency) != 0) {
+            std::cerr << "Warning: SO_BUSY_POLL " << config.lowLatency.busy_poll_us << " us refused (" << strerror(errno)
+                      << "; needs CAP_NET_ADMIN above net.core.busy_read); spinning without it." << std::endl;
+        }
+        if (workers[i].socket == INVALID_SOCKET) {
+            for (int j = 0; j < i; ++j) closesocket(workers[j].socket);
+            #ifdef _WIN32
+                WSACleanup();
+            #endif
+            return 1;
+        }
+    }
 
-            char clientIp[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &clientAddr.sin_addr, clientIp, INET_ADDRSTRLEN);
+    std::cout << "UDP server listening on port " << PORT << "..." << std::endl;
+    std::cout << "Up to " << config.maxSessions << " sessions per worker, " << config.matchSize
+              << " players per match, " << config.idleTimeoutMs << " ms idle timeout." << std::endl;
+    std::cout << "Snapshot tick: " << config.tickRate << " Hz";
+    if (config.aoiRadius > 0.0f) std::cout << ", area of interest " << config.aoiRadius << " units";
+    std::cout << "." << std::endl;
+    if (config.rateLimit > 0) std::cout << "Rate limit: " << config.rateLimit << " datagrams/s per endpoint (burst " << config.rateBurst << ")";
+    else std::cout << "Rate limit: off";
+    if (config.globalRate > 0) std::cout << ", shedding above " << config.globalRate << " datagrams/s per worker";
+    std::cout << "." << std::endl;
+    if (config.reliable) {
+        std::cout << "Reliable commands: ack_channel header on every datagram, "
+                  << (sizeof(ack_channel) * config.maxSessions) / (1024 * 1024) << " MB of channel state per worker." << std::endl;
+    }
+#ifdef WITH_SODIUM
+    if (config.secureKeys) {
+        char publicKey[2 * SECURE_LINK_KEY_BYTES + 1];
+        sodium_bin2hex(publicKey, sizeof(publicKey), secureKeys.public_key, SECURE_LINK_KEY_BYTES);
+        std::cout << "Secure mode: connect-token handshake, ChaCha20-Poly1305 datagrams. Server key " << publicKey << std::endl;
+    }
+#endif
+    if (config.lowLatency.enabled) {
+        std::cout << "Low-latency mode: spinning receive loop, busy poll " << config.lowLatency.busy_poll_us << " us";
+        if (config.lowLatency.cpu_count > 0) std::cout << ", workers pinned to " << config.lowLatency.cpu_count << " listed cores";
+        if (config.lowLatency.fifo_priority > 0) std::cout << ", SCHED_FIFO " << config.lowLatency.fifo_priority;
+        std::cout << "." << std::endl;
+    }
 
-            std::cout << "RECV ◀️: Player " << pos->id
-                      << " at (" << pos->x << ", " << pos->y << ") "
-                      << "from " << clientIp << ":" << ntohs(clientAddr.sin_port)
-                      << std::endl;
+    netlog_set_category(LOG_PACKETS, "packets", config.logSample, config.logRate);
+    netlog_set_category(LOG_WARNINGS, "warning", 1, 100);
+    netlog_set_category(LOG_SESSIONS, "session", 1, 100);
+    if (netlog_start(stdout) != 0) {
+        std::cerr << "Failed to start the log drainer thread." << std::endl;
+        return 1;
+    }
 
-            // Replicate: Send the exact same data back to the client
-            sendto(serverSocket, buffer, bytesReceived, 0, (struct sockaddr*)&clientAddr, clientAddrSize);
-            std::cout << "SENT ▶️: Replicated position back to client." << std::endl;
+    std::cout << "I/O backend: " << udp_io_kind_name(config.ioKind);
+    if (config.ioKind != UDP_IO_BLOCKING) std::cout << ", up to " << config.batchSize << " datagrams per receive";
+    std::cout << "." << std::endl;
 
-        } else {
-             std::cerr << "Warning: Received packet of incorrect size: " << bytesReceived << " bytes." << std::endl;
-        }
+    // 4. Main server loop(s) to receive and replicate data
+    if (config.workerCount == 1) {
+        runWorker(workers[0], config);
+    } else {
+        #ifdef __linux__
+            std::cout << "Sharding across " << config.workerCount << " SO_REUSEPORT workers." << std::endl;
+            unsigned int cores = std::thread::hardware_concurrency();
+            std::vector<std::thread> threads;
+            for (int i = 0; i < config.workerCount; ++i) {
+                threads.emplace_back([&workers, &config, i, cores]() {
+                    // --cpus overrides the default spread (runWorker pins to the listed core)
+                    if (cores > 0 && !(config.lowLatency.enabled && config.lowLatency.cpu_count > 0)) pinThreadToCore(i % cores);
+                    runWorker(workers[i], config);
+                });
+            }
+            for (auto& t : threads) t.join();
+        #endif
     }
 
     // Cleanup
-    closesocket(serverSocket);
+    netlog_shutdown();
+    for (auto& worker : workers) closesocket(worker.socket);
     #ifdef _WIN32
         WSACleanup();
     #endif
@@ -0,0 +1,126 @@
+// interest_bench.cpp - per-client snapshot bandwidth with and without area of interest
+//
+// Simulates one match of N players random-walking in a square world that grows
+// with N, so the player density (and the expected number of neighbours) stays the
+// same. Every tick each player moves, the grid is updated, and each player's
+// visible set is queried exactly like Udpserver's runTick does with --aoi-radius.
+// Reported per N: average and maximum visible players, grid CPU time per tick,
+// and the snapshot bytes per client per second compared with sending everyone.
+//
+// Build: make benches (bin/interest_bench), or g++ -std=c++17 -O2 interest_bench.cpp -o interest_bench
+// Usage: interest_bench [--ticks N] [--tick-rate HZ] [--radius R] [--neighbours N] [--players N]
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "../include/bench.h"
+#include "../include/interest_grid.h"
+
+// Snapshot layout from Udpserver.cpp: 8-byte header, then per player a varint id
+// and two 16-bit coordinates, at most PLAYERS_PER_SNAPSHOT players per datagram
+const double SNAPSHOT_HEADER_BYTES = 8.0;
+const double POSITION_BITS = 32.0;
+const uint32_t PLAYERS_PER_SNAPSHOT = 132;
+const uint32_t MAX_VISIBLE = 256;
+
+struct BenchConfig {
+    int ticks = 300;
+    int tickRate = 30;
+    float radius = 50.0f;
+    float neighbours = 20.0f;   // Expected players inside one radius
+    float speed = 3.0f;         // Units per tick
+    std::vector<uint32_t> players = {500, 1000, 2000, 4000};
+};
+
+struct Player {
+    float x, y, heading;
+};
+
+double varintBits(uint32_t id) {
+    double bytes = 1;
+    while (id >= 0x80) {
+        id >>= 7;
+        bytes++;
+    }
+    return bytes * 8.0;
+}
+
+// Bytes on the wire for one snapshot holding `count` players with ids below idLimit
+double snapshotBytes(uint32_t count, uint32_t idLimit) {
+    double parts = std::ceil(double(count) / PLAYERS_PER_SNAPSHOT);
+    return parts * SNAPSHOT_HEADER_BYTES + std::ceil(count * (varintBits(idLimit - 1) + POSITION_BITS) / 8.0);
+}
+
+void runPlayers(uint32_t n, const BenchConfig& config) {
+    float side = std::sqrt(float(n) * 3.14159265f * config.radius * config.radius / config.neighbours);
+    std::mt19937 rng(n);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Player> players(n);
+    for (Player& p : players) p = {unit(rng) * side, unit(rng) * side, unit(rng) * 6.2831853f};
+
+    interest_grid* grid = interest_grid_create(n, config.radius * 1.1f, config.radius * 0.1f, MAX_VISIBLE);
+    if (grid == nullptr) {
+        fprintf(stderr, "Failed to allocate the grid for %u players.\n", n);
+        return;
+    }
+    std::vector<uint32_t> visible(MAX_VISIBLE);
+    uint64_t visibleTotal = 0, visibleMax = 0;
+    double aoiBytes = 0;
+    uint64_t start = bench_now_ns();
+    for (int tick = 0; tick < config.ticks; ++tick) {
+        for (uint32_t i = 0; i < n; ++i) {
+            Player& p = players[i];
+            p.heading += (unit(rng) - 0.5f) * 0.5f;
+            p.x = std::fmin(std::fmax(p.x + std::cos(p.heading) * config.speed, 0.0f), side);
+            p.y = std::fmin(std::fmax(p.y + std::sin(p.heading) * config.speed, 0.0f), side);
+            interest_grid_update(grid, i, 0, p.x, p.y, config.radius);
+        }
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t count = uint32_t(interest_grid_visible(grid, i, visible.data(), int(MAX_VISIBLE)));
+            visibleTotal += count;
+            if (count > visibleMax) visibleMax = count;
+            if (count > 0) aoiBytes += snapshotBytes(count + 1, n); // Plus the observer itself
+        }
+    }
+    double seconds = bench_seconds_since(start);
+    interest_grid_destroy(grid);
+
+    double samples = double(n) * config.ticks;
+    double aoiPerClient = aoiBytes / samples * config.tickRate;
+    double fullPerClient = snapshotBytes(n, n) * config.tickRate;
+    printf("%8u %10.1f %8llu %12.1f %14.0f %14.0f %8.1fx\n", n, double(visibleTotal) / samples,
+           (unsigned long long)visibleMax, seconds * 1e6 / config.ticks, aoiPerClient, fullPerClient,
+           fullPerClient / aoiPerClient);
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    uint32_t players = UINT32_MAX; // One player count instead of the default list
+    bench_option options[] = {
+        {"--ticks", BENCH_INT, &config.ticks},
+        {"--tick-rate", BENCH_INT, &config.tickRate},
+        {"--radius", BENCH_FLOAT, &config.radius},
+        {"--neighbours", BENCH_FLOAT, &config.neighbours},
+        {"--players", BENCH_U32, &players},
+    };
+    if (bench_parse(argc, argv, options, BENCH_COUNT(options),
+                    "[--ticks N] [--tick-rate HZ] [--radius R] [--neighbours N] [--players N]") != 0) {
+        return 1;
+    }
+    if (players != UINT32_MAX) config.players = {players};
+    if (config.ticks < 1 || config.tickRate < 1 || config.radius <= 0.0f || config.neighbours <= 0.0f
+        || config.players[0] < 2) {
+        fprintf(stderr, "All options must be positive (and at least 2 players).\n");
+        return 1;
+    }
+
+    printf("Area of interest: radius %.0f, ~%.0f players per radius, %d ticks at %d Hz\n\n",
+           config.radius, config.neighbours, config.ticks, config.tickRate);
+    printf("%8s %10s %8s %12s %14s %14s %9s\n",
+           "players", "visible", "max", "us/tick", "AOI B/s/client", "all B/s/client", "saving");
+    for (uint32_t n : config.players) runPlayers(n, config);
+    return 0;
+}
@@ -0,0 +1,270 @@
+// io_bench.cpp - compares the include/udp_io.h backends on loopback
+//
+// For every backend an echo server thread is started on 127.0.0.1, and client
+// threads keep a fixed window of timestamped datagrams in flight against it.
+// Each echo is timed into a LatencyHistogram. Reported per backend: echoed
+// packets per second, server syscalls per packet, and round-trip p50/p99/p99.9.
+//
+// Build: make benches (bin/io_bench), or g++ -std=c++17 -O2 -pthread io_bench.cpp -o io_bench
+// Usage: io_bench [--seconds S] [--clients N] [--window N] [--batch N] [--io blocking|mmsg|uring]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "../include/bench.h"
+#include "../include/udp_io.h"
+#include "LatencyHistogram.hpp"
+
+const int PAYLOAD_SIZE = 16;     // 8-byte sequence + 8-byte send timestamp
+const int STOP_PAYLOAD_SIZE = 1; // A 1-byte datagram tells the echo server to exit
+
+struct BenchConfig {
+    int seconds = 3;
+    int clients = 2;
+    int window = 32;   // Datagrams in flight per client
+    int batch = 64;
+};
+
+struct BackendResult {
+    const char* name = "";
+    bool available = false;
+    int createError = 0;
+    uint64_t echoed = 0;
+    uint64_t lost = 0;
+    udp_io_stats serverStats{};
+    LatencyHistogram rtt;
+};
+
+inline uint64_t monotonicNs() {
+    return bench_now_ns();
+}
+
+int openLoopbackSocket(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) return -1;
+    int bufferBytes = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferBytes, sizeof(bufferBytes));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferBytes, sizeof(bufferBytes));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+uint16_t localPort(int fd) {
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    return ntohs(addr.sin_port);
+}
+
+// Echoes every datagram back to its sender until the stop datagram arrives
+void runEchoServer(udp_io* io, std::atomic<bool>& ready) {
+    std::vector<udp_packet> packets(io->batch);
+    ready = true;
+    while (true) {
+        int n = udp_io_recv(io, packets.data(), io->batch);
+        if (n < 0) continue;
+        for (int i = 0; i < n; ++i) {
+            if (packets[i].length == (uint32_t)STOP_PAYLOAD_SIZE) return;
+        }
+        udp_io_send(io, packets.data(), n);
+    }
+}
+
+// Keeps `window` datagrams in flight; every echo is timed and immediately replaced
+void runClient(const BenchConfig& config, uint16_t serverPort, std::atomic<bool>& stop,
+               LatencyHistogram& rtt, uint64_t& echoed, uint64_t& lost) {
+    int fd = openLoopbackSocket(0);
+    timeval timeout{0, 100000}; // 100 ms: anything older is counted as lost
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port = htons(serverPort);
+
+    const int w = config.window;
+    std::vector<unsigned char> txBuf(size_t(w) * PAYLOAD_SIZE), rxBuf(size_t(w) * PAYLOAD_SIZE);
+    std::vector<iovec> txIov(w), rxIov(w);
+    std::vector<mmsghdr> txMsg(w), rxMsg(w);
+    for (int i = 0; i < w; ++i) {
+        txIov[i] = {&txBuf[size_t(i) * PAYLOAD_SIZE], size_t(PAYLOAD_SIZE)};
+        rxIov[i] = {&rxBuf[size_t(i) * PAYLOAD_SIZE], size_t(PAYLOAD_SIZE)};
+        txMsg[i].msg_hdr = {};
+        txMsg[i].msg_hdr.msg_name = &server;
+        txMsg[i].msg_hdr.msg_namelen = sizeof(server);
+        txMsg[i].msg_hdr.msg_iov = &txIov[i];
+        txMsg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    uint64_t sequence = 0;
+    auto sendBurst = [&](int count) {
+        uint64_t now = monotonicNs();
+        for (int i = 0; i < count; ++i) {
+            memcpy(&txBuf[size_t(i) * PAYLOAD_SIZE], &sequence, 8);
+            memcpy(&txBuf[size_t(i) * PAYLOAD_SIZE + 8], &now, 8);
+            sequence++;
+        }
+        int sent = 0;
+        while (sent < count) {
+            int n = sendmmsg(fd, txMsg.data() + sent, unsigned(count - sent), 0);
+            if (n <= 0) break;
+            sent += n;
+        }
+    };
+
+    int inFlight = w;
+    sendBurst(w);
+    while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < w; ++i) {
+            rxMsg[i].msg_hdr = {};
+            rxMsg[i].msg_hdr.msg_iov = &rxIov[i];
+            rxMsg[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(fd, rxMsg.data(), unsigned(w), MSG_WAITFORONE, nullptr);
+        if (n <= 0) {
+            // Nothing came back in time: write off the window and start a fresh one
+            lost += uint64_t(inFlight);
+            inFlight = w;
+            sendBurst(w);
+            continue;
+        }
+        uint64_t now = monotonicNs();
+        for (int i = 0; i < n; ++i) {
+            uint64_t sentAt;
+            memcpy(&sentAt, &rxBuf[size_t(i) * PAYLOAD_SIZE + 8], 8);
+            rtt.record(now - sentAt);
+        }
+        echoed += uint64_t(n);
+        sendBurst(n);
+    }
+    close(fd);
+}
+
+BackendResult runBackend(udp_io_kind kind, const BenchConfig& config) {
+    BackendResult result;
+    result.name = udp_io_kind_name(kind);
+
+    int serverFd = openLoopbackSocket(0);
+    udp_io* io = nullptr;
+    std::atomic<bool> ready{false}, serverDone{false};
+    // io_uring rings are single-issuer, so the backend is created on the server thread
+    std::thread server([&]() {
+        io = udp_io_create(kind, serverFd, config.batch, PAYLOAD_SIZE, config.batch);
+        if (io == nullptr) {
+            result.createError = errno;
+            ready = true;
+        } else {
+            runEchoServer(io, ready);
+        }
+        serverDone = true;
+    });
+    while (!ready) std::this_thread::yield();
+    if (io == nullptr) {
+        server.join();
+        close(serverFd);
+        return result;
+    }
+    result.available = true;
+
+    uint16_t port = localPort(serverFd);
+    std::atomic<bool> stop{false};
+    std::vector<LatencyHistogram> histograms(config.clients);
+    std::vector<uint64_t> echoed(config.clients, 0), lost(config.clients, 0);
+    std::vector<std::thread> clients;
+    for (int c = 0; c < config.clients; ++c) {
+        clients.emplace_back(runClient, std::cref(config), port, std::ref(stop),
+                             std::ref(histograms[c]), std::ref(echoed[c]), std::ref(lost[c]));
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(config.seconds));
+    stop = true;
+    for (auto& t : clients) t.join();
+
+    // Stop the server; keep asking in case a full receive queue dropped the request
+    int fd = openLoopbackSocket(0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    char stopByte = 0;
+    while (!serverDone) {
+        sendto(fd, &stopByte, STOP_PAYLOAD_SIZE, 0, (sockaddr*)&addr, sizeof(addr));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    server.join();
+    close(fd);
+
+    for (int c = 0; c < config.clients; ++c) {
+        result.rtt.merge(histograms[c]);
+        result.echoed += echoed[c];
+        result.lost += lost[c];
+    }
+    result.serverStats = io->stats;
+    udp_io_destroy(io);
+    close(serverFd);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    std::vector<udp_io_kind> kinds = {UDP_IO_BLOCKING, UDP_IO_MMSG, UDP_IO_URING};
+    const char* usage = "[--seconds S] [--clients N] [--window N] [--batch N] [--io blocking|mmsg|uring]";
+    const char* io = nullptr;
+    bench_option options[] = {
+        {"--seconds", BENCH_INT, &config.seconds},
+        {"--clients", BENCH_INT, &config.clients},
+        {"--window", BENCH_INT, &config.window},
+        {"--batch", BENCH_INT, &config.batch},
+        {"--io", BENCH_STRING, &io},
+    };
+    if (bench_parse(argc, argv, options, BENCH_COUNT(options), usage) != 0) return 1;
+    if (io != nullptr) {
+        if (udp_io_parse_kind(io) < 0) {
+            bench_usage(argv[0], usage);
+            return 1;
+        }
+        kinds = {udp_io_kind(udp_io_parse_kind(io))};
+    }
+    if (config.seconds < 1 || config.clients < 1 || config.window < 1 || config.batch < 1) {
+        fprintf(stderr, "All options must be positive.\n");
+        return 1;
+    }
+
+    printf("Loopback echo: %d s per backend, %d clients x %d in flight, batch %d\n\n",
+           config.seconds, config.clients, config.window, config.batch);
+    printf("%-10s %12s %10s %10s %10s %10s %10s %8s\n",
+           "backend", "echo pps", "rx pkt/sc", "tx pkt/sc", "p50", "p99", "p99.9", "lost");
+    for (udp_io_kind kind : kinds) {
+        BackendResult r = runBackend(kind, config);
+        if (!r.available) {
+            printf("%-10s unavailable: %s\n", r.name, strerror(r.createError));
+            continue;
+        }
+        const udp_io_stats& s = r.serverStats;
+        printf("%-10s %12.0f %10.2f %10.2f %10s %10s %10s %8llu\n", r.name,
+               double(r.echoed) / config.seconds,
+               s.recv_calls ? double(s.packets_in) / double(s.recv_calls) : 0.0,
+               s.send_calls ? double(s.packets_out) / double(s.send_calls) : 0.0,
+               LatencyHistogram::formatNs(r.rtt.percentile(50.0)).c_str(),
+               LatencyHistogram::formatNs(r.rtt.percentile(99.0)).c_str(),
+               LatencyHistogram::formatNs(r.rtt.percentile(99.9)).c_str(),
+               (unsigned long long)r.lost);
+    }
+    return 0;
+}
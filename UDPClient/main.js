@@ -42,6 +42,79 @@ function fromArrayBuffer(buffer) {
 }
 
 
+// Snapshot positions are quantized to 16 bits over this range (see POSITION_QUANT in Snapshot.hpp)
+const POSITION_MIN = -2048.0;
+const POSITION_MAX = 2048.0;
+const POSITION_BITS = 16;
+
+/**
+ * Reads LSB-first bit-packed fields, matching BitReader in serialize/BitStream.hpp.
+ * @param {ArrayBuffer} buffer - The packed bytes.
+ * @param {number} offset - Byte offset of the first field.
+ */
+function BitReader(buffer, offset) {
+  const bytes = new Uint8Array(buffer);
+  let pos = offset;
+  let scratch = 0;     // Kept below 2^40, so plain arithmetic is exact
+  let scratchBits = 0;
+
+  this.readBits = function (bits) {
+    while (scratchBits < bits) {
+      scratch += (pos < bytes.length ? bytes[pos++] : 0) * Math.pow(2, scratchBits);
+      scratchBits += 8;
+    }
+    const scale = Math.pow(2, bits);
+    const value = scratch % scale;
+    scratch = Math.floor(scratch / scale);
+    scratchBits -= bits;
+    return value;
+  };
+
+  this.readVarint = function () {
+    let value = 0;
+    for (let shift = 0; shift < 35; shift += 7) {
+      const group = this.readBits(8);
+      value += (group & 0x7f) * Math.pow(2, shift);
+      if (!(group & 0x80)) break;
+    }
+    return value;
+  };
+
+  this.readQuantized = function (min, max, bits) {
+    return min + this.readBits(bits) * (max - min) / (Math.pow(2, bits) - 1);
+  };
+}
+
+/**
+ * Parses a snapshot datagram from the server's fixed-rate tick.
+ * Layout: 4-byte Uint (tick) | 2-byte Uint (player count) | 1-byte part | 1-byte part count,
+ * followed by one bit-packed record per player: zigzag varint ID, quantized X, quantized Y.
+ * Mirrors decodePosition() and writeSnapshotPart() in Snapshot.hpp.
+ * @param {ArrayBuffer} buffer - The incoming data buffer.
+ * @returns {object} {tick, part, partCount, players}
+ */
+function fromSnapshot(buffer) {
+  const view = new DataView(buffer);
+  const snapshot = {
+    tick: view.getUint32(0, true),
+    part: view.getUint8(6),
+    partCount: view.getUint8(7),
+    players: []
+  };
+  const count = view.getUint16(4, true);
+  const reader = new BitReader(buffer, 8);
+  for (let i = 0; i < count; i++) {
+    const zigzag = reader.readVarint();
+    snapshot.players.push({
+      id: zigzag % 2 ? -(zigzag + 1) / 2 : zigzag / 2,
+      x: reader.readQuantized(POSITION_MIN, POSITION_MAX, POSITION_BITS),
+      y: reader.readQuantized(POSITION_MIN, POSITION_MAX, POSITION_BITS)
+    });
+  }
+  return snapshot;
+}
+
+
 // --- Main Logic ---
 
 // Create a UDP socket
@@ -65,8 +138,11 @@ chrome.sockets.udp.create({}, (createInfo) => {
 // Add a listener for incoming data
 chrome.sockets.udp.onReceive.addListener((info) => {
   if (info.socketId === socketId) {
-    const receivedPlayer = fromArrayBuffer(info.data);
-    console.log('RECV ◀️:', `Received replicated position for player ${receivedPlayer.id}:`, `x=${receivedPlayer.x.toFixed(2)}, y=${receivedPlayer.y.toFixed(2)}`);
+    const snapshot = fromSnapshot(info.data);
+    for (const receivedPlayer of snapshot.players) {
+      if (receivedPlayer.id === player.id) continue; // Our own position comes back too
+      console.log('RECV ◀️:', `Tick ${snapshot.tick}: replicated position for player ${receivedPlayer.id}:`, `x=${receivedPlayer.x.toFixed(2)}, y=${receivedPlayer.y.toFixed(2)}`);
+    }
   }
 });
 
@@ -0,0 +1,162 @@
+// ratelimit_bench.cpp - cost and behaviour of include/rate_limit.h under floods
+//
+// Runs the limiter on synthetic traffic with a simulated millisecond clock, so the
+// numbers do not depend on the machine's load. Every scenario has --players honest
+// sources sending --player-rate datagrams per second on top of a flood that starts
+// after one second of normal play:
+//
+//   one       one endpoint sends --flood datagrams per second
+//   spoofed   --flood datagrams per second, each from a new random source
+//   overload  no flood, but the server-wide budget is --overload-factor times
+//             smaller, below what the players send in a mix of priorities
+//
+// Reported per scenario: nanoseconds per check (all checks, and timed separately
+// for the rejected ones), the share of the honest players' datagrams that got
+// through, what the flood got through, and the drops per priority.
+//
+// Build: make benches (bin/ratelimit_bench), or g++ -std=c++17 -O2 ratelimit_bench.cpp -o ratelimit_bench
+// Usage: ratelimit_bench [--players N] [--player-rate PKTS] [--flood PKTS] [--seconds S]
+//                        [--overload-factor K] [--scenario one|spoofed|overload]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/bench.h"
+#include "../include/rate_limit.h"
+
+struct BenchConfig {
+    uint32_t players = 4096;
+    uint32_t playerRate = 30;      // Datagrams per second per player
+    uint32_t flood = 2000000;      // Datagrams per second
+    int seconds = 5;
+    uint32_t overloadFactor = 4;
+    std::vector<std::string> scenarios = {"one", "spoofed", "overload"};
+};
+
+struct Result {
+    uint64_t checks = 0, rejected = 0;
+    double ns = 0, rejectedNs = 0;
+    uint64_t honestSent = 0, honestPassed = 0;
+    uint64_t floodSent = 0, floodPassed = 0;
+    rate_limit_stats stats{};
+};
+
+const uint64_t WARMUP_MS = 1000;   // The players' buckets exist before the flood starts
+const uint32_t IDLE_MS = 1000;     // Sources silent this long are aged out
+
+const char* PRIORITY_NAMES[RATE_LIMIT_PRIORITIES] = {"critical", "high", "normal", "low"};
+
+uint64_t playerKey(uint32_t player) {
+    return uint64_t(0x0A000000u + player) << 16 | 40000; // 10.x.y.z:40000
+}
+
+Result run(const std::string& scenario, const BenchConfig& config) {
+    // Per source: the player rate with 2x headroom. Server-wide: 2x what all players send.
+    uint32_t perSource = config.playerRate * 2;
+    uint32_t global = config.players * config.playerRate * 2;
+    if (scenario == "overload") global /= config.overloadFactor;
+    rate_limit* rl = rate_limit_create(config.players * 2, perSource, perSource, global, global / 4);
+    Result r;
+    std::mt19937_64 rng(7);
+    uint32_t flood = scenario == "overload" ? 0 : config.flood;
+
+    // One millisecond at a time: the players' datagrams spread evenly, the flood interleaved
+    std::vector<uint64_t> keys;
+    std::vector<rate_limit_priority> priorities;
+    std::vector<uint8_t> honest;
+    double playerCarry = 0, floodCarry = 0;
+    for (uint64_t ms = 1; ms <= uint64_t(config.seconds) * 1000; ++ms) {
+        keys.clear();
+        priorities.clear();
+        honest.clear();
+        playerCarry += double(config.players) * config.playerRate / 1000.0;
+        if (ms > WARMUP_MS) floodCarry += double(flood) / 1000.0;
+        uint32_t fromPlayers = uint32_t(playerCarry), fromFlood = uint32_t(floodCarry);
+        playerCarry -= fromPlayers;
+        floodCarry -= fromFlood;
+        for (uint32_t i = 0, count = fromPlayers + fromFlood; i < count; ++i) {
+            // Interleave: flood datagrams between player datagrams
+            bool player = fromFlood == 0 || (fromPlayers > 0 && rng() % (fromPlayers + fromFlood) < fromPlayers);
+            if (player) {
+                fromPlayers--;
+                keys.push_back(playerKey(uint32_t(rng() % config.players)));
+                priorities.push_back(rate_limit_priority(rng() % RATE_LIMIT_PRIORITIES));
+            } else {
+                fromFlood--;
+                keys.push_back(scenario == "one" ? playerKey(config.players + 1) : (rng() >> 2));
+                priorities.push_back(RATE_LIMIT_LOW);
+            }
+            honest.push_back(player);
+        }
+
+        uint64_t start = bench_now_ns();
+        for (size_t i = 0; i < keys.size(); ++i) {
+            int ok = rate_limit_check(rl, keys[i], priorities[i], ms);
+            if (honest[i]) r.honestPassed += uint64_t(ok);
+            else r.floodPassed += uint64_t(ok);
+        }
+        r.ns += bench_ns_since(start);
+        if (ms % 33 == 0) rate_limit_age(rl, ms, IDLE_MS, 4096); // Once per 30 Hz tick
+        for (uint8_t h : honest) (h ? r.honestSent : r.floodSent)++;
+        r.checks += keys.size();
+    }
+
+    // The rejection path alone: a source whose bucket is empty, at one instant
+    uint64_t flooder = playerKey(config.players + 2);
+    uint64_t now = uint64_t(config.seconds) * 1000 + 1;
+    while (rate_limit_check(rl, flooder, RATE_LIMIT_LOW, now)) {
+    }
+    const uint64_t rejections = 10000000;
+    uint64_t start = bench_now_ns();
+    for (uint64_t i = 0; i < rejections; ++i) r.rejected += uint64_t(!rate_limit_check(rl, flooder, RATE_LIMIT_LOW, now));
+    r.rejectedNs = bench_ns_since(start) / double(rejections);
+    r.stats = rl->stats;
+    rate_limit_destroy(rl);
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    const char* scenario = nullptr;
+    bench_option options[] = {
+        {"--players", BENCH_U32, &config.players},
+        {"--player-rate", BENCH_U32, &config.playerRate},
+        {"--flood", BENCH_U32, &config.flood},
+        {"--seconds", BENCH_INT, &config.seconds},
+        {"--overload-factor", BENCH_U32, &config.overloadFactor},
+        {"--scenario", BENCH_STRING, &scenario},
+    };
+    if (bench_parse(argc, argv, options, BENCH_COUNT(options),
+                    "[--players N] [--player-rate PKTS] [--flood PKTS] [--seconds S]\n"
+                    "          [--overload-factor K] [--scenario one|spoofed|overload]") != 0) {
+        return 1;
+    }
+    if (scenario != nullptr) config.scenarios = {scenario};
+    if (config.players < 1 || config.playerRate < 1 || config.seconds < 1 || config.overloadFactor < 1) {
+        fprintf(stderr, "Players, player rate, seconds and overload factor must be positive.\n");
+        return 1;
+    }
+
+    printf("%u players at %u datagrams/s, flood %u datagrams/s, %d simulated seconds\n\n", config.players,
+           config.playerRate, config.flood, config.seconds);
+    printf("%-9s %12s %10s %12s %10s %10s %10s  %s\n", "scenario", "checks", "ns/check", "ns/rejected", "players",
+           "flood", "sources", "shed critical/high/normal/low");
+    for (const std::string& scenario : config.scenarios) {
+        Result r = run(scenario, config);
+        printf("%-9s %12llu %10.1f %12.1f %9.2f%% %9.2f%% %10u  ", scenario.c_str(), (unsigned long long)r.checks,
+               r.ns / double(r.checks ? r.checks : 1), r.rejectedNs,
+               100.0 * double(r.honestPassed) / double(r.honestSent ? r.honestSent : 1),
+               100.0 * double(r.floodPassed) / double(r.floodSent ? r.floodSent : 1), r.stats.sources);
+        for (int p = 0; p < RATE_LIMIT_PRIORITIES; ++p) {
+            printf("%s%llu", p ? "/" : "", (unsigned long long)r.stats.shed[p]);
+        }
+        printf("\n");
+    }
+    printf("\nplayers/flood: share of their datagrams that passed. In the overload scenario the server-wide\n"
+           "budget is %.0f%% of what the players send; %s priority is shed first.\n",
+           200.0 / config.overloadFactor, PRIORITY_NAMES[RATE_LIMIT_LOW]);
+    return 0;
+}
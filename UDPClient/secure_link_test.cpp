@@ -0,0 +1,183 @@
+// secure_link_test.cpp - checks of the include/secure_link.h handshake and sessions
+//
+// Runs client and server side against each other in memory, no sockets:
+//   - a handshake, then sealed datagrams both ways; a replay and a forgery are refused
+//   - tokens for another address, expired or tampered with are refused
+//   - a retransmitted RESPONSE is recognised as one (same salt), and a duplicated
+//     CHALLENGE leaves the client's session and its counter alone
+//   - reconnecting after an eviction, with a new keypair or with the same one, and
+//     the same keypair from a new address (NAT rebinding) all get keys no earlier
+//     session had, so no key ever sees counter 0 twice
+//
+// Prints one line per failed check and PASS or FAIL; the exit code is 1 on failure.
+//
+// Build: make check (bin/secure_link_test), or
+//        g++ -std=c++17 -O2 secure_link_test.cpp -o secure_link_test -lsodium
+// Usage: secure_link_test
+#include <cstdio>
+#include <cstring>
+
+#include "../include/secure_link.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+const uint64_t ENDPOINT = 0x0A000001C350ull;   // 10.0.0.1:50000, as packEndpoint would
+const uint64_t REBOUND = 0x0A000001C351ull;    // The same host after a NAT rebinding
+const uint64_t NOW_MS = 1000000;
+
+// One full handshake from endpoint; true if the server accepted it
+bool handshake(const secure_link_keys& keys, secure_link_client& client, uint64_t endpoint, uint64_t now,
+               secure_link_session& server) {
+    unsigned char request[SECURE_LINK_HANDSHAKE_BYTES], challenge[SECURE_LINK_HANDSHAKE_BYTES];
+    unsigned char response[SECURE_LINK_HANDSHAKE_BYTES];
+    secure_link_client_request(&client, request);
+    if (secure_link_challenge(&keys, endpoint, request, sizeof(request), now, challenge) == 0) return false;
+    if (secure_link_client_respond(&client, challenge, sizeof(challenge), response) == 0) return false;
+    return secure_link_accept(&keys, endpoint, response, sizeof(response), now, &server) == 0;
+}
+
+bool sameKeys(const secure_link_session& a, const secure_link_session& b) {
+    return memcmp(a.rx_key, b.rx_key, SECURE_LINK_KEY_BYTES) == 0 || memcmp(a.tx_key, b.tx_key, SECURE_LINK_KEY_BYTES) == 0;
+}
+
+// Seals in one direction and opens in the other; true if the payload came through intact
+bool roundTrip(secure_link_session& from, secure_link_session& to, const char* text) {
+    unsigned char sealed[64 + SECURE_LINK_DATA_OVERHEAD], plain[64];
+    uint32_t length = secure_link_seal(&from, (const unsigned char*)text, uint32_t(strlen(text)), sealed);
+    int opened = secure_link_open(&to, sealed, length, plain);
+    return opened == int(strlen(text)) && memcmp(plain, text, strlen(text)) == 0;
+}
+
+void testSession(const secure_link_keys& keys) {
+    secure_link_client client;
+    secure_link_session server;
+    CHECK(secure_link_client_init(&client, keys.public_key) == 0);
+    CHECK(handshake(keys, client, ENDPOINT, NOW_MS, server));
+    CHECK(memcmp(client.session.tx_key, server.rx_key, SECURE_LINK_KEY_BYTES) == 0);
+    CHECK(memcmp(client.session.rx_key, server.tx_key, SECURE_LINK_KEY_BYTES) == 0);
+    CHECK(roundTrip(client.session, server, "position"));
+    CHECK(roundTrip(server, client.session, "snapshot"));
+
+    unsigned char sealed[16 + SECURE_LINK_DATA_OVERHEAD], plain[16];
+    uint32_t length = secure_link_seal(&client.session, (const unsigned char*)"again", 5, sealed);
+    CHECK(secure_link_open(&server, sealed, length, plain) == 5);
+    CHECK(secure_link_open(&server, sealed, length, plain) == -1);   // Replay
+    sealed[length - 1] ^= 1;
+    CHECK(secure_link_open(&server, sealed, length, plain) == -1);   // Forgery
+}
+
+void testTokens(const secure_link_keys& keys) {
+    secure_link_client client;
+    secure_link_session server;
+    unsigned char request[SECURE_LINK_HANDSHAKE_BYTES], challenge[SECURE_LINK_HANDSHAKE_BYTES];
+    unsigned char response[SECURE_LINK_HANDSHAKE_BYTES];
+    CHECK(secure_link_client_init(&client, nullptr) == 0);
+    secure_link_client_request(&client, request);
+    CHECK(secure_link_challenge(&keys, ENDPOINT, request, sizeof(request), NOW_MS, challenge) == SECURE_LINK_HANDSHAKE_BYTES);
+    CHECK(secure_link_client_respond(&client, challenge, sizeof(challenge), response) == SECURE_LINK_HANDSHAKE_BYTES);
+
+    CHECK(secure_link_accept(&keys, REBOUND, response, sizeof(response), NOW_MS, &server) == -1);
+    CHECK(secure_link_accept(&keys, ENDPOINT, response, sizeof(response), NOW_MS + SECURE_LINK_TOKEN_LIFETIME_MS + 1,
+                             &server) == -1);
+    response[SECURE_LINK_SALT_OFFSET] ^= 1;   // The salt is covered by the MAC
+    CHECK(secure_link_accept(&keys, ENDPOINT, response, sizeof(response), NOW_MS, &server) == -1);
+    response[SECURE_LINK_SALT_OFFSET] ^= 1;
+    CHECK(secure_link_accept(&keys, ENDPOINT, response, sizeof(response), NOW_MS, &server) == 0);
+
+    // Another server's challenge is refused by a client pinned to this one
+    secure_link_keys other;
+    secure_link_client pinned;
+    CHECK(secure_link_keys_generate(&other) == 0);
+    CHECK(secure_link_client_init(&pinned, keys.public_key) == 0);
+    secure_link_client_request(&pinned, request);
+    CHECK(secure_link_challenge(&other, ENDPOINT, request, sizeof(request), NOW_MS, challenge) == SECURE_LINK_HANDSHAKE_BYTES);
+    CHECK(secure_link_client_respond(&pinned, challenge, sizeof(challenge), response) == 0);
+}
+
+void testDuplicates(const secure_link_keys& keys) {
+    secure_link_client client;
+    secure_link_session first, again;
+    unsigned char request[SECURE_LINK_HANDSHAKE_BYTES], challenge[SECURE_LINK_HANDSHAKE_BYTES];
+    unsigned char response[SECURE_LINK_HANDSHAKE_BYTES], repeated[SECURE_LINK_HANDSHAKE_BYTES];
+    CHECK(secure_link_client_init(&client, keys.public_key) == 0);
+
+    // Retransmitted requests keep the keypair, so a challenge to any copy still matches
+    secure_link_client_request(&client, request);
+    secure_link_client_request(&client, repeated);
+    CHECK(memcmp(request, repeated, sizeof(request)) == 0);
+
+    CHECK(secure_link_challenge(&keys, ENDPOINT, request, sizeof(request), NOW_MS, challenge) == SECURE_LINK_HANDSHAKE_BYTES);
+    CHECK(secure_link_client_respond(&client, challenge, sizeof(challenge), response) == SECURE_LINK_HANDSHAKE_BYTES);
+    CHECK(secure_link_accept(&keys, ENDPOINT, response, sizeof(response), NOW_MS, &first) == 0);
+    CHECK(roundTrip(client.session, first, "position"));
+
+    // The same RESPONSE again: the server sees the same handshake and keeps its session
+    CHECK(secure_link_accept(&keys, ENDPOINT, response, sizeof(response), NOW_MS + 10, &again) == 0);
+    CHECK(secure_link_same_handshake(&first, &again));
+
+    // A duplicated CHALLENGE: same response, the client's counter is not reset
+    uint64_t counter = client.session.tx_counter;
+    CHECK(secure_link_client_respond(&client, challenge, sizeof(challenge), repeated) == SECURE_LINK_HANDSHAKE_BYTES);
+    CHECK(memcmp(response, repeated, sizeof(response)) == 0);
+    CHECK(client.session.tx_counter == counter);
+
+    // A second challenge to the same request has its own salt: a new handshake
+    CHECK(secure_link_challenge(&keys, ENDPOINT, request, sizeof(request), NOW_MS, challenge) == SECURE_LINK_HANDSHAKE_BYTES);
+    CHECK(memcmp(challenge + SECURE_LINK_SALT_OFFSET, response + SECURE_LINK_SALT_OFFSET, SECURE_LINK_SALT_BYTES) != 0);
+}
+
+void testReconnect(const secure_link_keys& keys) {
+    secure_link_client client;
+    secure_link_session evicted, server;
+    CHECK(secure_link_client_init(&client, keys.public_key) == 0);
+    CHECK(handshake(keys, client, ENDPOINT, NOW_MS, evicted));
+    CHECK(roundTrip(evicted, client.session, "snapshot"));
+
+    // The session is evicted and the client handshakes again: a new keypair, new keys
+    unsigned char oldPublic[SECURE_LINK_KEY_BYTES];
+    memcpy(oldPublic, client.public_key, sizeof(oldPublic));
+    CHECK(handshake(keys, client, ENDPOINT, NOW_MS + 20000, server));
+    CHECK(memcmp(oldPublic, client.public_key, sizeof(oldPublic)) != 0);
+    CHECK(!sameKeys(evicted, server));
+    CHECK(!secure_link_same_handshake(&evicted, &server));
+    CHECK(server.tx_counter == 0 && roundTrip(server, client.session, "snapshot"));
+
+    // Even a client that keeps its keypair gets new keys, from the challenge's salt
+    secure_link_client sameKeypair = client;
+    sameKeypair.fresh = 1;
+    secure_link_session previous = server;
+    CHECK(handshake(keys, sameKeypair, ENDPOINT, NOW_MS + 40000, server));
+    CHECK(memcmp(sameKeypair.public_key, client.public_key, SECURE_LINK_KEY_BYTES) == 0);
+    CHECK(!sameKeys(previous, server));
+
+    // The same keypair from a new address while the old session still exists
+    secure_link_client rebound = client;
+    rebound.fresh = 1;
+    secure_link_session moved;
+    CHECK(handshake(keys, rebound, REBOUND, NOW_MS + 40000, moved));
+    CHECK(!sameKeys(previous, moved));
+    CHECK(!sameKeys(server, moved));
+    CHECK(roundTrip(rebound.session, moved, "position"));
+}
+
+int main() {
+    secure_link_keys keys;
+    if (secure_link_keys_generate(&keys) != 0) {
+        printf("FAIL: libsodium could not be initialized\n");
+        return 1;
+    }
+    testSession(keys);
+    testTokens(keys);
+    testDuplicates(keys);
+    testReconnect(keys);
+    printf(failures == 0 ? "PASS\n" : "FAIL\n");
+    return failures == 0 ? 0 : 1;
+}
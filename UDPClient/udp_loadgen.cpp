@@ -0,0 +1,626 @@
+// udp_loadgen.cpp - synthetic load and latency measurement for the UDP servers
+//
+// Simulates N virtual clients spread over a few threads. Every client has its own
+// socket (so the server sees N endpoints) and sends PlayerPosition packets at a
+// fixed rate. Latency goes into one LatencyHistogram per thread, merged at the end.
+//
+//   --mode snapshot (default, Udpserver on 12345): the server only accepts
+//     12-byte PlayerPosition packets, so the send timestamp stays on the client.
+//     x carries a 12-bit sequence number (an integer survives the 16-bit
+//     quantization), and latency is from sending a position to the first snapshot
+//     that shows it, i.e. it includes the wait for the next tick. Lost = snapshot
+//     ticks a client never received.
+//   --mode echo (meta_server on 8090): a ping message carrying the PlayerPosition,
+//     a sequence number and the send timestamp; the echo is timed directly.
+//     Lost = packets not echoed within --drain-ms of the last send.
+//   --mode query (meta_server on 8090): server-list queries for page 0. Replies
+//     carry no timestamp, so each is matched to the client's oldest unanswered
+//     query (loopback keeps order). --servers N registers N fake game servers first.
+//
+// --secure (snapshot mode, Udpserver --secure): every client first runs the
+// include/secure_link.h connect-token handshake, repeated on its send schedule until
+// the server's first sealed datagram arrives, and then seals its positions.
+// --server-key HEX pins the key Udpserver prints at startup. Both need a build with
+// -DWITH_SODIUM, like the server's --secure.
+//
+// Everything defaults to 127.0.0.1, so it runs in CI next to a server started
+// in the background. Results are printed as text, and with --json as JSON too.
+// --baseline PATH compares the latency percentiles with an earlier --json run, e.g.
+// Udpserver in its default mode against --low-latency:
+//
+//   Udpserver --io mmsg --tick-rate 1000 &            udp_loadgen --json default.json
+//   Udpserver --io mmsg --tick-rate 1000 --low-latency --cpus 2 &
+//                                                     udp_loadgen --baseline default.json
+//
+// Build: g++ -std=c++17 -O2 -pthread udp_loadgen.cpp -o udp_loadgen
+//        (with --secure: add -DWITH_SODIUM ... -lsodium)
+// Usage: udp_loadgen [--mode snapshot|echo|query] [--host IP] [--port N] [--clients N] [--threads N]
+//                    [--rate HZ] [--seconds S] [--drain-ms MS] [--id-base N] [--servers N] [--json PATH|-]
+//                    [--baseline PATH] [--secure] [--server-key HEX]
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#ifdef WITH_SODIUM
+#include "../include/secure_link.h"
+#endif
+#include "../serialize/BitStream.hpp"
+#include "LatencyHistogram.hpp"
+
+#pragma pack(push, 1)
+struct PlayerPosition {
+    int32_t id;
+    float x;
+    float y;
+};
+
+// meta_server.c messages
+const uint8_t MSG_HEARTBEAT = 1;
+const uint8_t MSG_QUERY = 2;
+const uint8_t MSG_LIST = 3;
+const uint8_t MSG_PING = 4;
+
+struct HeartbeatMessage {
+    uint8_t type;
+    uint8_t mode;
+    uint8_t flags;
+    uint8_t nameLength;
+    uint16_t gamePort;
+    uint16_t players;
+    uint16_t maxPlayers;
+    char name[16];
+};
+
+struct QueryMessage {
+    uint8_t type;
+    uint8_t mode;
+    uint8_t filter;
+    uint8_t reserved;
+    uint16_t page;
+};
+
+struct EchoPacket {
+    uint8_t type;           // MSG_PING
+    uint8_t reserved[3];
+    PlayerPosition position;
+    uint32_t sequence;
+    uint64_t sentNs;
+};
+
+// Snapshot wire format, see SNAPSHOTS in ServerWorker.hpp
+struct SnapshotHeader {
+    uint32_t tick;
+    uint16_t playerCount;
+    uint8_t part;
+    uint8_t partCount;
+};
+#pragma pack(pop)
+
+const Quantization POSITION_QUANT = {-2048.0f, 2048.0f, 16}; // Must match Udpserver.cpp
+const uint32_t SEQUENCE_WINDOW = 4096;                       // Sequences carried in x
+const int RECV_BATCH = 32;
+const int MAX_DATAGRAM = 1500;
+
+enum LoadMode { MODE_SNAPSHOT, MODE_ECHO, MODE_QUERY };
+
+const char* modeName(LoadMode mode) {
+    return mode == MODE_ECHO ? "echo" : mode == MODE_QUERY ? "query" : "snapshot";
+}
+
+struct LoadConfig {
+    LoadMode mode = MODE_SNAPSHOT;
+    const char* host = "127.0.0.1";
+    int port = 0;               // 0 = the mode's default
+    int clients = 64;
+    int threads = 2;
+    double rate = 30.0;         // Packets per second per client
+    int seconds = 5;
+    int drainMs = 250;
+    int idBase = 0;
+    int gameServers = 0;        // Query mode: fake game servers registered before the run
+    const char* jsonPath = nullptr;
+    const char* baselinePath = nullptr;
+    bool secure = false;
+#ifdef WITH_SODIUM
+    bool serverKeyGiven = false;
+    unsigned char serverKey[SECURE_LINK_KEY_BYTES];
+#endif
+};
+
+struct VirtualClient {
+    int fd = -1;
+    int32_t id = 0;
+    uint64_t nextSendNs = 0;
+    uint32_t sequence = 0;
+    uint32_t answered = 0;             // Query mode: replies received
+    uint64_t sentAt[SEQUENCE_WINDOW];  // Snapshot and query mode: send time per sequence slot
+    int64_t lastSeen = -1;             // Snapshot mode: newest sequence seen in a snapshot
+    int64_t lastTick = -1;
+#ifdef WITH_SODIUM
+    secure_link_client link;           // --secure
+    bool responding = false;           // Got a challenge; response holds the answer
+    bool connected = false;            // The server sealed something to us
+    unsigned char response[SECURE_LINK_HANDSHAKE_BYTES];
+#endif
+};
+
+struct ThreadResult {
+    uint64_t sent = 0;
+    uint64_t sendErrors = 0;
+    uint64_t received = 0;       // Echoes, or snapshot datagrams
+    uint64_t bytesReceived = 0;
+    uint64_t ticks = 0;          // Snapshot mode: distinct ticks per client
+    uint64_t missedTicks = 0;
+    uint64_t handshakes = 0;     // --secure: requests and responses sent
+    uint64_t connected = 0;
+    uint64_t rejected = 0;       // Sealed datagrams that did not open
+    LatencyHistogram latency;
+};
+
+inline uint64_t monotonicNs() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+int openClientSocket(const sockaddr_in& server) {
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) return -1;
+    // Connected: the kernel filters out anything not from the server and send() needs no address
+    if (connect(fd, (const sockaddr*)&server, sizeof(server)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void sendPosition(const LoadConfig& config, VirtualClient& client, uint64_t now, ThreadResult& result) {
+#ifdef WITH_SODIUM
+    if (config.secure && !client.connected) {
+        unsigned char request[SECURE_LINK_HANDSHAKE_BYTES];
+        if (!client.responding) secure_link_client_request(&client.link, request);
+        send(client.fd, client.responding ? client.response : request, SECURE_LINK_HANDSHAKE_BYTES, 0);
+        result.handshakes++;
+        return;
+    }
+#endif
+    uint32_t slot = client.sequence % SEQUENCE_WINDOW;
+    EchoPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.type = MSG_PING;
+    packet.position.id = client.id;
+    packet.position.x = float(slot) + POSITION_QUANT.min;
+    packet.position.y = float(client.id % 1024);
+    packet.sequence = client.sequence;
+    packet.sentNs = now;
+    QueryMessage query = {MSG_QUERY, 0, 0, 0, 0};
+    const void* data = &packet.position;
+    size_t size = sizeof(PlayerPosition);
+    if (config.mode == MODE_ECHO) {
+        data = &packet;
+        size = sizeof(packet);
+    } else if (config.mode == MODE_QUERY) {
+        data = &query;
+        size = sizeof(query);
+    }
+#ifdef WITH_SODIUM
+    unsigned char sealed[sizeof(PlayerPosition) + SECURE_LINK_DATA_OVERHEAD];
+    if (config.secure) {
+        size = secure_link_seal(&client.link.session, (const unsigned char*)data, uint32_t(size), sealed);
+        data = sealed;
+    }
+#endif
+    client.sentAt[slot] = now;
+    client.sequence++;
+    if (send(client.fd, data, size, 0) == ssize_t(size)) result.sent++;
+    else result.sendErrors++;
+}
+
+// Finds this client's own entry in a snapshot part and times the newest position it shows
+void handleSnapshot(VirtualClient& client, const unsigned char* data, size_t length, uint64_t now, ThreadResult& result) {
+    SnapshotHeader header;
+    if (length < sizeof(header)) return;
+    memcpy(&header, data, sizeof(header));
+    if (int64_t(header.tick) > client.lastTick) {
+        if (client.lastTick >= 0) result.missedTicks += uint64_t(header.tick - client.lastTick - 1);
+        client.lastTick = header.tick;
+        result.ticks++;
+    }
+
+    BitReader reader(data + sizeof(header), length - sizeof(header));
+    for (uint32_t i = 0; i < header.playerCount; ++i) {
+        int32_t id = zigzagDecode(reader.readVarint());
+        float x = reader.readQuantized(POSITION_QUANT);
+        reader.readQuantized(POSITION_QUANT);
+        if (reader.overflowed()) return;
+        if (id != client.id) continue;
+
+        // Unwrap the 12-bit slot to the newest sequence sent with it
+        uint32_t slot = uint32_t(std::lround(x - POSITION_QUANT.min)) % SEQUENCE_WINDOW;
+        uint32_t back = (client.sequence - 1 - slot) % SEQUENCE_WINDOW;
+        int64_t sequence = int64_t(client.sequence) - 1 - int64_t(back);
+        if (sequence > client.lastSeen) {
+            client.lastSeen = sequence;
+            result.latency.record(now - client.sentAt[slot]);
+        }
+        return;
+    }
+}
+
+void handleEcho(const unsigned char* data, size_t length, uint64_t now, ThreadResult& result) {
+    EchoPacket packet;
+    if (length != sizeof(packet)) return;
+    memcpy(&packet, data, sizeof(packet));
+    result.latency.record(now - packet.sentNs);
+}
+
+void handleList(VirtualClient& client, const unsigned char* data, size_t length, uint64_t now, ThreadResult& result) {
+    if (length < 1 || data[0] != MSG_LIST || client.answered == client.sequence) return;
+    result.latency.record(now - client.sentAt[client.answered % SEQUENCE_WINDOW]);
+    client.answered++;
+}
+
+#ifdef WITH_SODIUM
+// --secure: answers the challenge, or opens a sealed snapshot in place; false if
+// there is nothing (more) to hand to handleSnapshot
+bool openSecure(VirtualClient& client, unsigned char*& data, uint32_t& length, ThreadResult& result) {
+    int type = secure_link_type(data, length);
+    if (type == SECURE_LINK_CHALLENGE && !client.connected) {
+        if (secure_link_client_respond(&client.link, data, length, client.response) == 0) return false;
+        client.responding = true;
+        send(client.fd, client.response, SECURE_LINK_HANDSHAKE_BYTES, 0);
+        result.handshakes++;
+        return false;
+    }
+    if (type != SECURE_LINK_DATA || !client.responding) return false;
+    int opened = secure_link_open(&client.link.session, data, length, data + SECURE_LINK_DATA_HEADER_BYTES);
+    if (opened < 0) {
+        result.rejected++;
+        return false;
+    }
+    if (!client.connected) {
+        client.connected = true;
+        result.connected++;
+    }
+    data += SECURE_LINK_DATA_HEADER_BYTES;
+    length = uint32_t(opened);
+    return opened > 0;
+}
+#endif
+
+// Registers `count` game servers on the meta server from one socket (all share its ip)
+bool registerGameServers(const sockaddr_in& server, int count) {
+    int fd = openClientSocket(server);
+    if (fd < 0) return false;
+    for (int i = 0; i < count; ++i) {
+        HeartbeatMessage hb;
+        memset(&hb, 0, sizeof(hb));
+        hb.type = MSG_HEARTBEAT;
+        hb.mode = uint8_t(1 + i % 4);
+        hb.nameLength = uint8_t(snprintf(hb.name, sizeof(hb.name), "loadgen-%d", i));
+        hb.gamePort = uint16_t(20000 + i);
+        hb.players = uint16_t(i % 17);
+        hb.maxPlayers = 16;
+        size_t size = sizeof(hb) - sizeof(hb.name) + hb.nameLength;
+        if (send(fd, &hb, size, 0) != ssize_t(size)) {
+            close(fd);
+            return false;
+        }
+        if (i % 256 == 255) usleep(1000); // Stay under the receive buffer
+    }
+    close(fd);
+    usleep(200000); // The list generation advances on the next registry tick
+    return true;
+}
+
+void drainSocket(const LoadConfig& config, VirtualClient& client, std::vector<unsigned char>& buffer, ThreadResult& result) {
+    mmsghdr msgs[RECV_BATCH];
+    iovec iov[RECV_BATCH];
+    while (true) {
+        for (int i = 0; i < RECV_BATCH; ++i) {
+            iov[i] = {&buffer[size_t(i) * MAX_DATAGRAM], size_t(MAX_DATAGRAM)};
+            msgs[i].msg_hdr = {};
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(client.fd, msgs, RECV_BATCH, MSG_DONTWAIT, nullptr);
+        if (n <= 0) return;
+        uint64_t now = monotonicNs();
+        for (int i = 0; i < n; ++i) {
+            unsigned char* data = &buffer[size_t(i) * MAX_DATAGRAM];
+            uint32_t length = msgs[i].msg_len;
+            result.received++;
+            result.bytesReceived += msgs[i].msg_len;
+#ifdef WITH_SODIUM
+            if (config.secure && !openSecure(client, data, length, result)) continue;
+#endif
+            if (config.mode == MODE_SNAPSHOT) handleSnapshot(client, data, length, now, result);
+            else if (config.mode == MODE_QUERY) handleList(client, data, msgs[i].msg_len, now, result);
+            else handleEcho(data, msgs[i].msg_len, now, result);
+        }
+        if (n < RECV_BATCH) return;
+    }
+}
+
+// Sends on schedule for `seconds`, then keeps receiving for drainMs
+void runThread(const LoadConfig& config, const sockaddr_in& server, int firstClient, int clientCount,
+               std::atomic<int>& failures, ThreadResult& result) {
+    std::vector<VirtualClient> clients(clientCount);
+    int epfd = epoll_create1(0);
+    uint64_t intervalNs = uint64_t(1e9 / config.rate);
+    uint64_t start = monotonicNs();
+    for (int i = 0; i < clientCount; ++i) {
+        VirtualClient& c = clients[i];
+        c.fd = openClientSocket(server);
+        if (c.fd < 0 || epfd < 0) {
+            failures++;
+            break;
+        }
+        c.id = config.idBase + firstClient + i;
+#ifdef WITH_SODIUM
+        if (config.secure && secure_link_client_init(&c.link, config.serverKeyGiven ? config.serverKey : nullptr) != 0) {
+            failures++;
+            break;
+        }
+#endif
+        c.nextSendNs = start + intervalNs * uint64_t(i) / uint64_t(clientCount); // Spread the sends out
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = uint32_t(i);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    std::vector<unsigned char> buffer(size_t(RECV_BATCH) * MAX_DATAGRAM);
+    epoll_event events[64];
+    uint64_t sendUntil = start + uint64_t(config.seconds) * 1000000000ull;
+    uint64_t stopAt = sendUntil + uint64_t(config.drainMs) * 1000000ull;
+    while (failures.load(std::memory_order_relaxed) == 0) {
+        uint64_t now = monotonicNs();
+        if (now >= stopAt) break;
+        uint64_t nextSend = stopAt;
+        if (now < sendUntil) {
+            for (VirtualClient& c : clients) {
+                while (c.nextSendNs <= now) {
+                    sendPosition(config, c, now, result);
+                    c.nextSendNs += intervalNs;
+                }
+                if (c.nextSendNs < nextSend) nextSend = c.nextSendNs;
+            }
+        }
+        int timeoutMs = int((nextSend - now) / 1000000); // Rounded down: early wake-ups just loop
+        int n = epoll_wait(epfd, events, 64, timeoutMs);
+        for (int i = 0; i < n; ++i) drainSocket(config, clients[events[i].data.u32], buffer, result);
+    }
+
+    for (VirtualClient& c : clients) {
+        if (c.fd >= 0) close(c.fd);
+    }
+    if (epfd >= 0) close(epfd);
+}
+
+std::string toJson(const LoadConfig& config, const ThreadResult& total, double lossPercent) {
+    uint64_t lost = config.mode != MODE_SNAPSHOT ? (total.sent > total.received ? total.sent - total.received : 0)
+                                                 : total.missedTicks;
+    char line[640];
+    snprintf(line, sizeof(line),
+             "{\"mode\":\"%s\",\"target\":\"%s:%d\",\"clients\":%d,\"threads\":%d,\"rate_hz\":%.2f,"
+             "\"seconds\":%d,\"sent\":%llu,\"send_errors\":%llu,\"send_pps\":%.1f,\"received\":%llu,"
+             "\"recv_pps\":%.1f,\"bytes_received\":%llu,\"lost\":%llu,\"loss_pct\":%.4f,\"latency\":",
+             modeName(config.mode), config.host, config.port, config.clients,
+             config.threads, config.rate, config.seconds, (unsigned long long)total.sent,
+             (unsigned long long)total.sendErrors, double(total.sent) / config.seconds,
+             (unsigned long long)total.received, double(total.received) / config.seconds,
+             (unsigned long long)total.bytesReceived, (unsigned long long)lost, lossPercent);
+    return std::string(line) + total.latency.json() + "}";
+}
+
+// Reads a latency field ("p99_ns" etc.) from an earlier --json report; false if absent
+bool readBaselineField(const std::string& json, const char* field, uint64_t& value) {
+    std::string key = std::string("\"") + field + "\":";
+    size_t latency = json.find("\"latency\":");
+    size_t at = latency == std::string::npos ? std::string::npos : json.find(key, latency);
+    if (at == std::string::npos) return false;
+    value = strtoull(json.c_str() + at + key.size(), nullptr, 10);
+    return true;
+}
+
+// One line per percentile: baseline -> this run, and the change
+bool printBaselineComparison(FILE* text, const char* path, const LatencyHistogram& latency) {
+    FILE* in = fopen(path, "r");
+    if (in == nullptr) {
+        fprintf(stderr, "Cannot read %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    std::string json;
+    char chunk[512];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) json.append(chunk, n);
+    fclose(in);
+
+    const struct { const char* field; const char* name; double p; } rows[] = {
+        {"p50_ns", "p50", 50.0}, {"p99_ns", "p99", 99.0}, {"p999_ns", "p99.9", 99.9}};
+    fprintf(text, "vs baseline %s:\n", path);
+    for (const auto& row : rows) {
+        uint64_t before = 0;
+        if (!readBaselineField(json, row.field, before)) {
+            fprintf(stderr, "%s has no latency.%s; was it written by --json?\n", path, row.field);
+            return false;
+        }
+        uint64_t after = latency.percentile(row.p);
+        fprintf(text, "  %-6s %10s -> %-10s (%+.1f%%)\n", row.name, LatencyHistogram::formatNs(before).c_str(),
+                LatencyHistogram::formatNs(after).c_str(), before ? 100.0 * (double(after) - double(before)) / double(before) : 0.0);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    LoadConfig config;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "snapshot") == 0) config.mode = MODE_SNAPSHOT;
+            else if (strcmp(mode, "echo") == 0) config.mode = MODE_ECHO;
+            else if (strcmp(mode, "query") == 0) config.mode = MODE_QUERY;
+            else {
+                fprintf(stderr, "Unknown mode '%s' (snapshot, echo or query).\n", mode);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) config.host = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) config.port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) config.clients = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) config.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) config.rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) config.seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--drain-ms") == 0 && i + 1 < argc) config.drainMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--id-base") == 0 && i + 1 < argc) config.idBase = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--servers") == 0 && i + 1 < argc) config.gameServers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) config.jsonPath = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) config.baselinePath = argv[++i];
+        else if (strcmp(argv[i], "--secure") == 0) config.secure = true;
+        else if (strcmp(argv[i], "--server-key") == 0 && i + 1 < argc) {
+            const char* hex = argv[++i];
+#ifdef WITH_SODIUM
+            size_t keyLength = 0;
+            if (sodium_hex2bin(config.serverKey, sizeof(config.serverKey), hex, strlen(hex), nullptr, &keyLength, nullptr) != 0
+                || keyLength != SECURE_LINK_KEY_BYTES) {
+                fprintf(stderr, "Server key must be %d hex digits.\n", 2 * SECURE_LINK_KEY_BYTES);
+                return 1;
+            }
+            config.serverKeyGiven = true;
+#else
+            (void)hex;
+#endif
+            config.secure = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--mode snapshot|echo|query] [--host IP] [--port N] [--clients N] [--threads N]\n"
+                            "          [--rate HZ] [--seconds S] [--drain-ms MS] [--id-base N] [--servers N] [--json PATH|-]\n"
+                            "          [--baseline PATH] [--secure] [--server-key HEX]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (config.port == 0) config.port = config.mode == MODE_SNAPSHOT ? 12345 : 8090;
+    if (config.clients < 1 || config.threads < 1 || config.rate <= 0.0 || config.seconds < 1 || config.drainMs < 0
+        || config.port > 65535) {
+        fprintf(stderr, "Clients, threads, rate and seconds must be positive.\n");
+        return 1;
+    }
+    if (config.threads > config.clients) config.threads = config.clients;
+#ifndef WITH_SODIUM
+    if (config.secure) {
+        fprintf(stderr, "--secure needs a build with libsodium (make WITH_SODIUM=1).\n");
+        return 1;
+    }
+#endif
+    if (config.secure && config.mode != MODE_SNAPSHOT) {
+        fprintf(stderr, "--secure only applies to snapshot mode.\n");
+        return 1;
+    }
+
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(uint16_t(config.port));
+    if (inet_pton(AF_INET, config.host, &server.sin_addr) != 1) {
+        fprintf(stderr, "Invalid host '%s'.\n", config.host);
+        return 1;
+    }
+
+    // With --json - the JSON owns stdout and the text report moves to stderr
+    FILE* text = config.jsonPath && strcmp(config.jsonPath, "-") == 0 ? stderr : stdout;
+    fprintf(text, "%s load: %d clients x %.1f Hz on %d threads against %s:%d for %d s\n",
+            modeName(config.mode), config.clients, config.rate, config.threads,
+            config.host, config.port, config.seconds);
+
+    if (config.mode == MODE_QUERY && config.gameServers > 0) {
+        if (!registerGameServers(server, config.gameServers)) {
+            fprintf(stderr, "Failed to register the game servers.\n");
+            return 1;
+        }
+        fprintf(text, "registered %d game servers\n", config.gameServers);
+    }
+
+    std::atomic<int> failures{0};
+    std::vector<ThreadResult> results(config.threads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < config.threads; ++t) {
+        int first = config.clients * t / config.threads;
+        int last = config.clients * (t + 1) / config.threads;
+        threads.emplace_back(runThread, std::cref(config), std::cref(server), first, last - first,
+                             std::ref(failures), std::ref(results[t]));
+    }
+    for (auto& t : threads) t.join();
+    if (failures > 0) {
+        fprintf(stderr, "Failed to open %d client sockets (raise ulimit -n?).\n", failures.load());
+        return 1;
+    }
+
+    ThreadResult total;
+    for (const ThreadResult& r : results) {
+        total.sent += r.sent;
+        total.sendErrors += r.sendErrors;
+        total.received += r.received;
+        total.bytesReceived += r.bytesReceived;
+        total.ticks += r.ticks;
+        total.missedTicks += r.missedTicks;
+        total.handshakes += r.handshakes;
+        total.connected += r.connected;
+        total.rejected += r.rejected;
+        total.latency.merge(r.latency);
+    }
+
+    double lossPercent;
+    if (config.mode != MODE_SNAPSHOT) {
+        uint64_t lost = total.sent > total.received ? total.sent - total.received : 0;
+        lossPercent = total.sent ? 100.0 * double(lost) / double(total.sent) : 0.0;
+        fprintf(text, "sent %llu (%.0f pps, %llu errors), answered %llu (%.0f pps, %.1f KB/s), lost %llu (%.3f%%)\n",
+                (unsigned long long)total.sent, double(total.sent) / config.seconds,
+                (unsigned long long)total.sendErrors, (unsigned long long)total.received,
+                double(total.received) / config.seconds, double(total.bytesReceived) / 1024.0 / config.seconds,
+                (unsigned long long)lost, lossPercent);
+        fprintf(text, "round trip: %s\n", total.latency.summary().c_str());
+    } else {
+        uint64_t expected = total.ticks + total.missedTicks;
+        lossPercent = expected ? 100.0 * double(total.missedTicks) / double(expected) : 0.0;
+        fprintf(text, "sent %llu (%.0f pps, %llu errors), received %llu snapshot datagrams (%.0f pps, %.1f KB/s)\n",
+                (unsigned long long)total.sent, double(total.sent) / config.seconds,
+                (unsigned long long)total.sendErrors, (unsigned long long)total.received,
+                double(total.received) / config.seconds, double(total.bytesReceived) / 1024.0 / config.seconds);
+        fprintf(text, "ticks seen %llu, missed %llu (%.3f%%)\n", (unsigned long long)total.ticks,
+                (unsigned long long)total.missedTicks, lossPercent);
+        if (config.secure) {
+            fprintf(text, "secure: %llu of %d clients connected, %llu handshake packets, %llu datagrams rejected\n",
+                    (unsigned long long)total.connected, config.clients, (unsigned long long)total.handshakes,
+                    (unsigned long long)total.rejected);
+        }
+        fprintf(text, "update to snapshot: %s\n", total.latency.summary().c_str());
+        if (total.received == 0) {
+            fprintf(text, "No snapshots: is Udpserver running, and are there at least 2 clients per match?\n");
+        }
+    }
+
+    if (config.baselinePath && !printBaselineComparison(text, config.baselinePath, total.latency)) return 1;
+
+    if (config.jsonPath) {
+        std::string json = toJson(config, total, lossPercent);
+        FILE* out = strcmp(config.jsonPath, "-") == 0 ? stdout : fopen(config.jsonPath, "w");
+        if (out == nullptr) {
+            fprintf(stderr, "Cannot write %s: %s\n", config.jsonPath, strerror(errno));
+            return 1;
+        }
+        fprintf(out, "%s\n", json.c_str());
+        if (out != stdout) fclose(out);
+    }
+    return 0;
+}
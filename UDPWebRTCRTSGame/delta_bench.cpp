@@ -0,0 +1,193 @@
+// delta_bench.cpp - bytes per RTS player update, full objects against PlayerUpdates.hpp deltas
+//
+// Plays server_multiuser.cpp's traffic for --players players over --ticks economy
+// ticks: each tick a player sends a build command with probability --commands
+// (processCommand's rules; the reply goes out either way), then every player with
+// a refinery earns gold and gets an update. The client side keeps the states it
+// applied, rebuilds deltas on their baseline state and acks every update on the
+// next tick; --loss drops that fraction of updates and of acks.
+//
+//   full    the old sendUpdate(): every field, every time
+//   delta   UpdateTracker: changed fields against the last acknowledged state,
+//           with full updates on a missing baseline and every FULL_RESYNC_UPDATES
+//
+// Reported per mode: updates sent, bytes per update and in total, the share of
+// full updates, and mismatches - client states differing from the server's
+// after applying an update, which must be 0.
+//
+// Build: make benches (bin/delta_bench), or g++ -std=c++17 -O2 delta_bench.cpp -o delta_bench
+// Usage: delta_bench [--players N] [--ticks N] [--commands P] [--loss P]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "../include/bench.h"
+#include "PlayerUpdates.hpp"
+
+struct BenchConfig {
+    uint32_t players = 1000;
+    uint32_t ticks = 600;
+    double commands = 0.1;      // Build commands per player per tick
+    double loss = 0.0;          // Updates and acks lost
+};
+
+struct ModeResult {
+    uint64_t updates = 0;
+    uint64_t bytes = 0;
+    uint64_t full = 0;
+    uint64_t lost = 0;
+    uint64_t mismatches = 0;
+};
+
+const size_t UPDATE_MAX_BYTES = 128; // server_multiuser.cpp
+
+struct ServerPlayer {
+    UpdateFields state;
+    UpdateTracker updates;
+};
+
+struct ClientPlayer {
+    std::map<uint32_t, UpdateFields> states; // By seq, from the newest base seen on
+    std::vector<uint32_t> acks;              // Sent on the next tick
+};
+
+// The value after "key": in text; false if the key is absent
+bool readField(const char* text, char key, long& value) {
+    const char pattern[] = {'"', key, '"', ':', '\0'};
+    const char* at = strstr(text, pattern);
+    if (at == nullptr) return false;
+    value = strtol(at + 4, nullptr, 10);
+    return true;
+}
+
+// The client's half of the protocol; false if it could not apply the update
+bool applyUpdate(ClientPlayer& c, const char* text, UpdateFields& applied) {
+    long seq = 0, distance = 0, value = 0;
+    if (!readField(text, 's', seq)) return false;
+    if (readField(text, 'd', distance)) {
+        auto it = c.states.find(uint32_t(seq - distance));
+        if (it == c.states.end()) return false;
+        applied = it->second;
+        c.states.erase(c.states.begin(), it); // The server has moved its baseline past them
+    } else {
+        applied = UpdateFields();
+    }
+    if (readField(text, 'b', value)) applied.barracks = int(value);
+    if (readField(text, 'g', value)) applied.gold = int(value);
+    if (readField(text, 'r', value)) applied.refineries = int(value);
+    c.states[uint32_t(seq)] = applied;
+    c.acks.push_back(uint32_t(seq));
+    return true;
+}
+
+// processCommand in server_multiuser.cpp
+void applyCommand(ServerPlayer& p, bool refinery) {
+    if (refinery && p.state.gold >= 100) {
+        p.state.gold -= 100;
+        p.state.refineries++;
+        p.updates.mark(FIELD_GOLD | FIELD_REFINERIES);
+    } else if (!refinery && p.state.gold >= 150) {
+        p.state.gold -= 150;
+        p.state.barracks++;
+        p.updates.mark(FIELD_GOLD | FIELD_BARRACKS);
+    }
+}
+
+template <bool DELTA>
+ModeResult runMode(const BenchConfig& config) {
+    std::mt19937 rng(11);
+    std::mt19937 lossRng(13);   // Its own stream, so both modes play the same game
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::vector<ServerPlayer> servers(config.players);
+    std::vector<ClientPlayer> clients(config.players);
+    for (ServerPlayer& p : servers) p.state.gold = 200;
+    ModeResult result;
+    char text[UPDATE_MAX_BYTES];
+
+    auto send = [&](ServerPlayer& p, ClientPlayer& c) {
+        size_t length;
+        bool full = true;
+        if (DELTA) {
+            length = p.updates.format(p.state, text, sizeof(text), full);
+        } else {
+            length = size_t(snprintf(text, sizeof(text), "{\"barracks\":%d,\"gold\":%d,\"refineries\":%d}",
+                                     p.state.barracks, p.state.gold, p.state.refineries));
+        }
+        result.updates++;
+        result.bytes += length;
+        result.full += full ? 1 : 0;
+        if (!DELTA) return; // Nothing to rebuild
+        if (chance(lossRng) < config.loss) {
+            result.lost++;
+            return;
+        }
+        UpdateFields applied;
+        if (!applyUpdate(c, text, applied)) return; // Waits for a delta it has the base of, or a full update
+        if (applied.barracks != p.state.barracks || applied.gold != p.state.gold
+            || applied.refineries != p.state.refineries) {
+            result.mismatches++;
+        }
+    };
+
+    for (uint32_t i = 0; i < config.players; ++i) send(servers[i], clients[i]); // Initial state
+    for (uint32_t tick = 0; tick < config.ticks; ++tick) {
+        for (uint32_t i = 0; i < config.players; ++i) {
+            ClientPlayer& c = clients[i];
+            for (uint32_t seq : c.acks) {
+                if (chance(lossRng) >= config.loss) servers[i].updates.acknowledge(seq);
+            }
+            c.acks.clear();
+            if (chance(rng) < config.commands) {
+                applyCommand(servers[i], rng() % 2 == 0);
+                send(servers[i], c);
+            }
+        }
+        for (uint32_t i = 0; i < config.players; ++i) {
+            ServerPlayer& p = servers[i];
+            if (p.state.refineries > 0) {
+                p.state.gold += p.state.refineries * 10;
+                p.updates.mark(FIELD_GOLD);
+                send(p, clients[i]);
+            }
+        }
+    }
+    return result;
+}
+
+void printRow(const char* name, const ModeResult& r) {
+    printf("%-8s %10llu %12.1f %12.1f %9.1f%% %10llu %11llu\n", name, (unsigned long long)r.updates,
+           r.updates ? double(r.bytes) / double(r.updates) : 0.0, double(r.bytes) / 1024.0,
+           r.updates ? 100.0 * double(r.full) / double(r.updates) : 0.0, (unsigned long long)r.lost,
+           (unsigned long long)r.mismatches);
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    bench_option options[] = {
+        {"--players", BENCH_U32, &config.players},
+        {"--ticks", BENCH_U32, &config.ticks},
+        {"--commands", BENCH_DOUBLE, &config.commands},
+        {"--loss", BENCH_DOUBLE, &config.loss},
+    };
+    if (bench_parse(argc, argv, options, BENCH_COUNT(options), "[--players N] [--ticks N] [--commands P] [--loss P]") != 0) {
+        return 1;
+    }
+    if (config.players < 1 || config.loss < 0.0 || config.loss >= 1.0) {
+        fprintf(stderr, "Players must be positive and loss in [0, 1).\n");
+        return 1;
+    }
+
+    printf("%u players, %u ticks, %.2f commands per player per tick, %.0f%% loss\n\n", config.players, config.ticks,
+           config.commands, config.loss * 100.0);
+    printf("%-8s %10s %12s %12s %10s %10s %11s\n", "mode", "updates", "bytes/update", "total KB", "full", "lost",
+           "mismatches");
+    ModeResult full = runMode<false>(config);
+    ModeResult delta = runMode<true>(config);
+    printRow("full", full);
+    printRow("delta", delta);
+    printf("\nfull / delta: %.2fx fewer bytes\n", double(full.bytes) / double(delta.bytes));
+    return delta.mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+// memory_bench.cpp - per-connection TLSF heaps and tick arenas against malloc/free
+//
+// Each thread plays one server worker with --connections connections. Every tick
+// each connection allocates a few messages of 32 B - 1 KB and frees its oldest
+// ones once it holds --live of them (queued commands, pending sends), the tick
+// allocates one serialization buffer per connection and drops them all at the end,
+// and --churn connections per tick disconnect (everything they hold is freed) and
+// are replaced by new ones.
+//
+//   malloc  every allocation goes through the global malloc/free
+//   pools   include/tlsf_heap.h heaps of --heap-kb per connection for the messages,
+//           include/tick_arena.h for the serialization buffers
+//
+// Reported per mode: nanoseconds per allocate+free pair over all threads (wall time),
+// resident memory growth at its peak and what is still resident after everything
+// was freed. The default --heap-kb holds --live messages of the largest size, so
+// both modes run the same workload (the checksums match; a warning says so when
+// they do not). A separate run then repeats the pools in --cap-kb heaps, the size
+// server_multiuser.cpp uses, and counts the allocations the cap refuses.
+//
+// Build: make benches (bin/memory_bench), or g++ -std=c++17 -O2 -pthread memory_bench.cpp -o memory_bench
+// Usage: memory_bench [--threads N] [--connections N] [--live N] [--ticks N] [--churn N] [--heap-kb KB]
+//                     [--cap-kb KB]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../include/bench.h"
+#include "../include/tick_arena.h"
+#include "../include/tlsf_heap.h"
+
+struct BenchConfig {
+    int threads = 4;
+    uint32_t connections = 2500;
+    uint32_t live = 8;              // Messages a connection holds
+    uint32_t ticks = 2000;
+    uint32_t churn = 25;            // Connections replaced per tick per thread
+    size_t heapKb = 16;             // Room for live 1 KB messages, so nothing is refused
+    size_t capKb = 8;               // CONNECTION_HEAP_BYTES in server_multiuser.cpp; 0 skips the cap run
+};
+
+const uint32_t MESSAGES_PER_TICK = 2;
+const size_t UPDATE_BYTES = 192;
+
+struct Connection {
+    tlsf_heap* heap = nullptr;
+    std::vector<void*> messages;    // Oldest first, at most live
+    uint32_t oldest = 0;            // Ring position
+};
+
+struct RunResult {
+    uint64_t pairs = 0;
+    uint64_t refused = 0;
+    uint64_t checksum = 0;
+};
+
+double residentMb() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == nullptr) return 0.0;
+    unsigned long long pages = 0, resident = 0;
+    int fields = fscanf(f, "%llu %llu", &pages, &resident);
+    fclose(f);
+    return fields == 2 ? double(resident) * double(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0) : 0.0;
+}
+
+// Message sizes skew small, as commands and queued snapshots do
+size_t messageSize(std::mt19937& rng) {
+    return size_t(32) << (rng() % 6); // 32 B - 1 KB
+}
+
+template <bool POOLS>
+RunResult runWorker(const BenchConfig& config, uint32_t seed) {
+    std::mt19937 rng(seed);
+    tlsf_heap_set* set = nullptr;
+    tick_arena* arena = nullptr;
+    if (POOLS) {
+        set = tlsf_heap_set_create(config.connections, config.heapKb * 1024);
+        arena = tick_arena_create(size_t(config.connections) * UPDATE_BYTES + 4096);
+        if (set == nullptr || arena == nullptr) {
+            fprintf(stderr, "Out of memory for the pools.\n");
+            exit(1);
+        }
+    }
+    std::vector<Connection> connections(config.connections);
+    std::vector<void*> updates(config.connections);
+    RunResult result;
+
+    auto release = [&](void* p, Connection& c) {
+        if (POOLS) tlsf_heap_free(c.heap, p);
+        else free(p);
+    };
+    auto connect = [&](Connection& c) {
+        if (POOLS) c.heap = tlsf_heap_set_acquire(set);
+        c.messages.assign(config.live, nullptr);
+        c.oldest = 0;
+    };
+    auto disconnect = [&](Connection& c) {
+        for (void* p : c.messages) {
+            if (p) release(p, c);
+        }
+        if (POOLS) tlsf_heap_set_release(set, c.heap);
+    };
+    for (Connection& c : connections) connect(c);
+
+    for (uint32_t tick = 0; tick < config.ticks; ++tick) {
+        if (POOLS) tick_arena_reset(arena);
+        for (uint32_t i = 0; i < config.connections; ++i) {
+            Connection& c = connections[i];
+            for (uint32_t m = 0; m < MESSAGES_PER_TICK; ++m) {
+                void*& slot = c.messages[c.oldest];
+                if (slot) release(slot, c);
+                size_t size = messageSize(rng);
+                slot = POOLS ? tlsf_heap_malloc(c.heap, size) : malloc(size);
+                if (slot) {
+                    memset(slot, int(i), size < 64 ? size : 64);
+                    result.checksum += *(unsigned char*)slot;
+                } else {
+                    result.refused++;
+                }
+                c.oldest = (c.oldest + 1) % config.live;
+                result.pairs++;
+            }
+            updates[i] = POOLS ? tick_arena_alloc(arena, UPDATE_BYTES, 16) : malloc(UPDATE_BYTES);
+            memset(updates[i], 0, 16);
+        }
+        if (!POOLS) {
+            for (void* p : updates) free(p);
+        }
+        result.pairs += config.connections;
+        for (uint32_t k = 0; k < config.churn; ++k) {
+            Connection& c = connections[rng() % config.connections];
+            disconnect(c);
+            connect(c);
+        }
+    }
+    for (Connection& c : connections) disconnect(c);
+    tlsf_heap_set_destroy(set);
+    tick_arena_destroy(arena);
+    return result;
+}
+
+template <bool POOLS>
+RunResult runMode(const BenchConfig& config, const char* name) {
+    double rssBefore = residentMb();
+    std::vector<RunResult> results(config.threads);
+    std::vector<std::thread> threads;
+    std::atomic<bool> done{false};
+    double peakRss = rssBefore;
+    std::thread sampler([&] {
+        while (!done.load()) {
+            double rss = residentMb();
+            if (rss > peakRss) peakRss = rss;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    });
+    uint64_t start = bench_now_ns();
+    for (int t = 0; t < config.threads; ++t) {
+        threads.emplace_back([&config, &results, t] { results[t] = runWorker<POOLS>(config, uint32_t(t) + 1); });
+    }
+    for (std::thread& t : threads) t.join();
+    double seconds = bench_seconds_since(start);
+    done = true;
+    sampler.join();
+
+    RunResult total;
+    for (const RunResult& r : results) {
+        total.pairs += r.pairs;
+        total.refused += r.refused;
+        total.checksum += r.checksum;
+    }
+    printf("%-8s %10.1f %12.1f %12.1f %10llu %10llu\n", name, seconds * 1e9 / double(total.pairs), peakRss - rssBefore,
+           residentMb() - rssBefore, (unsigned long long)total.refused, (unsigned long long)(total.checksum & 0xFFFF));
+    return total;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    bench_option options[] = {
+        {"--threads", BENCH_INT, &config.threads},
+        {"--connections", BENCH_U32, &config.connections},
+        {"--live", BENCH_U32, &config.live},
+        {"--ticks", BENCH_U32, &config.ticks},
+        {"--churn", BENCH_U32, &config.churn},
+        {"--heap-kb", BENCH_SIZE, &config.heapKb},
+        {"--cap-kb", BENCH_SIZE, &config.capKb},
+    };
+    if (bench_parse(argc, argv, options, BENCH_COUNT(options),
+                    "[--threads N] [--connections N] [--live N] [--ticks N] [--churn N] [--heap-kb KB]\n"
+                    "          [--cap-kb KB]") != 0) {
+        return 1;
+    }
+    if (config.threads < 1 || config.connections < 1 || config.live < 1 || config.churn > config.connections) {
+        fprintf(stderr, "Threads, connections and live must be positive; churn at most connections.\n");
+        return 1;
+    }
+
+    printf("%d threads x %u connections, %u live messages each, %u ticks, %u reconnects per tick, %zu KB heaps\n\n",
+           config.threads, config.connections, config.live, config.ticks, config.churn, config.heapKb);
+    printf("%-8s %10s %12s %12s %10s %10s\n", "mode", "ns/pair", "peak RSS MB", "kept MB", "refused", "checksum");
+    // The pools run first, so the malloc run cannot reuse memory they returned
+    RunResult pools = runMode<true>(config, "pools");
+    RunResult heap = runMode<false>(config, "malloc");
+    if (pools.refused > 0 || pools.checksum != heap.checksum) {
+        printf("\nThe pools refused %llu allocations, so the two rows ran different workloads; raise --heap-kb.\n",
+               (unsigned long long)pools.refused);
+    }
+
+    if (config.capKb > 0) {
+        BenchConfig capped = config;
+        capped.heapKb = config.capKb;
+        printf("\nThe same load in %zu KB heaps; what the cap refuses instead of growing the process:\n", capped.heapKb);
+        runMode<true>(capped, "capped");
+    }
+    return 0;
+}
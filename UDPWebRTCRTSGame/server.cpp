@@ -6,42 +6,28 @@
 #include <vector>
 #include <variant>
 
-// Libraries: libdatachannel and nlohmann/json
+// Libraries: libdatachannel
 #include <rtc/rtc.hpp> 
-#include <nlohmann/json.hpp>
 
-using json = nlohmann::json;
+#include "GameState.hpp" // GameState and its binary encoding
+
 using namespace std::chrono_literals;
 
 // --- GAME STATE ---
-// The server holds the only valid copy of the game state.
-struct GameState {
-    int gold = 200;      // Starting gold
-    int power = 0;       // Current power capacity
-    int soldiers = 0;
-    
-    int hq_count = 1;
-    int barracks_count = 0;
-    int power_plant_count = 0;
-    int refinery_count = 0;
-};
-
 GameState state;
 std::mutex state_mutex; // Prevents data races between game loop and network thread
+StateCache state_cache; // Guarded by state_mutex
 
 // --- SERIALIZATION ---
-// Convert C++ struct to JSON to send to the browser
-std::string serializeState() {
+// Encoded once per state version (GameState.hpp); every send until the next change
+// copies the cached bytes out under the lock and sends them after releasing it
+EncodedState serializeState() {
     std::lock_guard<std::mutex> lock(state_mutex);
-    json j;
-    j["resources"] = { {"gold", state.gold}, {"power", state.power}, {"soldiers", state.soldiers} };
-    j["buildings"] = { 
-        {"hq", state.hq_count}, 
-        {"barracks", state.barracks_count}, 
-        {"power_plant", state.power_plant_count}, 
-        {"refinery", state.refinery_count} 
-    };
-    return j.dump();
+    return state_cache.get(state);
+}
+
+void sendState(const std::shared_ptr<rtc::DataChannel>& dc, const EncodedState& encoded) {
+    dc->send(reinterpret_cast<const rtc::byte*>(encoded.bytes), encoded.size);
 }
 
 // --- GAME LOGIC ---
@@ -54,6 +40,7 @@ void handleCommand(const std::string& cmd) {
             state.gold -= 50;
             state.power_plant_count++;
             state.power += 50; // Power plant adds 50 power
+            state.version++;
             std::cout << "Built: Power Plant. Power is now: " << state.power << "\n";
         }
     }
@@ -63,6 +50,7 @@ void handleCommand(const std::string& cmd) {
             state.gold -= 100;
             state.power -= 10; // Consumes power capacity
             state.refinery_count++;
+            state.version++;
             std::cout << "Built: Refinery.\n";
         }
     }
@@ -72,6 +60,7 @@ void handleCommand(const std::string& cmd) {
             state.gold -= 150;
             state.power -= 20;
             state.barracks_count++;
+            state.version++;
             std::cout << "Built: Barracks.\n";
         }
     }
@@ -81,6 +70,7 @@ void handleCommand(const std::string& cmd) {
             state.gold -= 20;
             state.power -= 5;
             state.soldiers++;
+            state.version++;
             std::cout << "Trained: Soldier.\n";
         }
     }
@@ -95,14 +85,14 @@ int main() {
         std::cout << "[New Client Connected]\n";
 
         // Send initial state immediately
-        dc->send(serializeState());
+        sendState(dc, serializeState());
 
         // Handle messages (e.g., "build_barracks")
         dc->onMessage([dc](auto data) {
             if (std::holds_alternative<std::string>(data)) {
                 std::string msg = std::get<std::string>(data);
                 handleCommand(msg);
-                dc->send(serializeState()); // Send updated state back to client
+                sendState(dc, serializeState()); // Send updated state back to client (cached if unchanged)
             }
         });
 
@@ -111,17 +101,18 @@ int main() {
         std::thread([dc]() {
             while (true) {
                 std::this_thread::sleep_for(2s); // Every 2 seconds
+                EncodedState encoded;
                 {
                     std::lock_guard<std::mutex> lock(state_mutex);
-                    if (state.refinery_count > 0) {
-                        // Refineries generate 10 gold per tick
-                        state.gold += (state.refinery_count * 10);
-                        
-                        // Notify client of the passive gold increase
-                        // (Use try/catch in case client disconnects)
-                        try { dc->send(serializeState()); } catch(...) { break; }
-                    }
+                    if (state.refinery_count == 0) continue;
+                    // Refineries generate 10 gold per tick
+                    state.gold += (state.refinery_count * 10);
+                    state.version++;
+                    encoded = state_cache.get(state);
                 }
+                // Notify client of the passive gold increase, outside the lock
+                // (Use try/catch in case client disconnects)
+                try { sendState(dc, encoded); } catch(...) { break; }
             }
         }).detach();
     });
@@ -2,14 +2,77 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
 #include <rtc/rtc.hpp>
-#include <nlohmann/json.hpp>
 
-using json = nlohmann::json;
+#include "../include/tlsf_heap.h" // Capped per-connection heaps
+#include "../include/tick_arena.h" // Per-tick scratch memory for serialized updates
+#include "PlayerUpdates.hpp"             // Delta updates against the last acknowledged state
+
+// --- MEMORY ---
+// Every connection gets its own capped TLSF heap out of one preallocated set. Its
+// Player, the shared_ptr control block and the player id live there, so players
+// coming and going never fragment the global heap, and a connection is refused
+// once all heaps are taken instead of growing the process. Updates are formatted
+// into the tick arena, which is reset every economy tick, and handed to
+// libdatachannel straight from there, so the economy tick itself does not allocate;
+// only libdatachannel's own copy of each message does.
+const uint32_t MAX_PLAYERS = 10000;
+const size_t CONNECTION_HEAP_BYTES = 8 * 1024;   // Bookkeeping (~2.5 KB) included
+const size_t TICK_ARENA_BYTES = 2 * 1024 * 1024; // One update per player per tick, with room to spare
+const size_t UPDATE_MAX_BYTES = 128;
+const int MEMORY_REPORT_TICKS = 10;              // Economy ticks between MEMORY and UPDATES lines
+
+// The heap set is shared by all connections; a heap goes back to it once the last
+// allocation in it (the shared_ptr control block) is freed, on whichever thread that is.
+// mutex guards the set and every allocation and free, since printMemory reads the
+// stats of every heap in use
+struct ConnectionHeaps {
+    tlsf_heap_set* set = nullptr;
+    std::mutex mutex;
+};
+
+// Allocates from one connection's heap; past the cap it throws like operator new
+template <typename T>
+struct ConnectionAllocator {
+    using value_type = T;
+    ConnectionHeaps* heaps;
+    tlsf_heap* heap;
+
+    ConnectionAllocator(ConnectionHeaps* heaps, tlsf_heap* heap) : heaps(heaps), heap(heap) {}
+    template <typename U>
+    ConnectionAllocator(const ConnectionAllocator<U>& other) : heaps(other.heaps), heap(other.heap) {}
+
+    T* allocate(size_t n) {
+        void* p;
+        {
+            std::lock_guard<std::mutex> lock(heaps->mutex);
+            p = tlsf_heap_malloc(heap, n * sizeof(T));
+        }
+        if (p == nullptr) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) {
+        std::lock_guard<std::mutex> lock(heaps->mutex);
+        tlsf_heap_free(heap, p);
+        if (heap->stats.used == 0) tlsf_heap_set_release(heaps->set, heap);
+    }
+    template <typename U>
+    bool operator==(const ConnectionAllocator<U>& other) const { return heap == other.heap; }
+    template <typename U>
+    bool operator!=(const ConnectionAllocator<U>& other) const { return heap != other.heap; }
+};
+
+using ConnectionString = std::basic_string<char, std::char_traits<char>, ConnectionAllocator<char>>;
 
 // --- INDIVIDUAL PLAYER STATE ---
 struct Player {
-    std::string id;
+    ConnectionString id;
     int gold = 200;
     int power = 0;
     int soldiers = 0;
@@ -18,80 +81,200 @@ struct Player {
     int barracks_count = 0;
     int power_plant_count = 0;
     int refinery_count = 0;
-    
+
+    UpdateTracker updates; // Fields changed since the client's baseline (PlayerUpdates.hpp)
+
     // The connection to this specific user
     std::shared_ptr<rtc::PeerConnection> pc;
     std::shared_ptr<rtc::DataChannel> dc;
+
+    Player(const std::string& playerId, const ConnectionAllocator<char>& alloc)
+        : id(playerId.data(), playerId.size(), alloc) {}
 };
 
 // --- GLOBAL GAME SERVER ---
 class GameServer {
     std::map<std::string, std::shared_ptr<Player>> players;
+    std::vector<std::string> leaving;   // Disconnected; removed on the next economy tick
     std::mutex server_mutex;
+    ConnectionHeaps heaps;
+    tick_arena* arena = nullptr;        // Guarded by server_mutex
+    uint64_t refused = 0;               // Connections turned away: no heap left
+    uint64_t updatesDropped = 0;        // Tick arena full
+    uint64_t fullUpdates = 0, deltaUpdates = 0, updateBytes = 0, badAcks = 0;
+    int ticks = 0;
 
 public:
-    // Create a new player session
-    void addPlayer(std::string id, std::shared_ptr<rtc::PeerConnection> pc) {
-        auto player = std::make_shared<Player>();
-        player->id = id;
+    GameServer() {
+        heaps.set = tlsf_heap_set_create(MAX_PLAYERS, CONNECTION_HEAP_BYTES);
+        arena = tick_arena_create(TICK_ARENA_BYTES);
+        if (heaps.set == nullptr || arena == nullptr) throw std::bad_alloc();
+    }
+
+    ~GameServer() {
+        players.clear();
+        tick_arena_destroy(arena);
+        tlsf_heap_set_destroy(heaps.set);
+    }
+
+    // Create a new player session; false if the server is full
+    bool addPlayer(std::string id, std::shared_ptr<rtc::PeerConnection> pc) {
+        tlsf_heap* heap;
+        {
+            std::lock_guard<std::mutex> lock(heaps.mutex);
+            heap = tlsf_heap_set_acquire(heaps.set);
+        }
+        if (heap == nullptr) {
+            std::lock_guard<std::mutex> lock(server_mutex);
+            refused++;
+            std::cout << "Player " << id << " refused: server full.\n";
+            return false;
+        }
+        ConnectionAllocator<char> alloc(&heaps, heap);
+        auto player = std::allocate_shared<Player>(ConnectionAllocator<Player>(alloc), id, alloc);
         player->pc = pc;
-        
-        // Setup Data Channel Handler for this specific player
-        pc->onDataChannel([this, player](std::shared_ptr<rtc::DataChannel> dc) {
-            player->dc = dc;
-            
-            // Send initial state
-            sendUpdate(player);
-
-            dc->onMessage([this, player](auto data) {
-                if (std::holds_alternative<std::string>(data)) {
+
+        // Callbacks hold the player weakly: the player owns pc and dc, which own the callbacks
+        std::weak_ptr<Player> weak = player;
+        pc->onDataChannel([this, weak](std::shared_ptr<rtc::DataChannel> dc) {
+            auto player = weak.lock();
+            if (!player) return;
+            {
+                std::lock_guard<std::mutex> lock(server_mutex);
+                player->dc = dc;
+                // Send initial state
+                size_t mark = tick_arena_mark(arena);
+                sendUpdate(*player);
+                tick_arena_rewind(arena, mark);
+            }
+
+            dc->onMessage([this, weak](auto data) {
+                auto player = weak.lock();
+                if (player && std::holds_alternative<std::string>(data)) {
                     std::string cmd = std::get<std::string>(data);
-                    processCommand(player, cmd);
+                    if (cmd.compare(0, 4, "ack:") == 0) acknowledgeUpdate(*player, cmd);
+                    else processCommand(*player, cmd);
                 }
             });
         });
+        pc->onStateChange([this, id](rtc::PeerConnection::State state) {
+            if (state == rtc::PeerConnection::State::Disconnected || state == rtc::PeerConnection::State::Failed
+                || state == rtc::PeerConnection::State::Closed) {
+                std::lock_guard<std::mutex> lock(server_mutex);
+                leaving.push_back(id); // Not erased here: that would destroy pc inside its own callback
+            }
+        });
 
         std::lock_guard<std::mutex> lock(server_mutex);
         players[id] = player;
         std::cout << "Player " << id << " connected.\n";
+        return true;
     }
 
-    void processCommand(std::shared_ptr<Player> p, const std::string& cmd) {
+    void processCommand(Player& p, const std::string& cmd) {
         std::lock_guard<std::mutex> lock(server_mutex);
-        
-        if (cmd == "build_refinery" && p->gold >= 100) {
-            p->gold -= 100;
-            p->refinery_count++;
+
+        if (cmd == "build_refinery" && p.gold >= 100) {
+            p.gold -= 100;
+            p.refinery_count++;
+            p.updates.mark(FIELD_GOLD | FIELD_REFINERIES);
         }
-        else if (cmd == "build_barracks" && p->gold >= 150) {
-            p->gold -= 150;
-            p->barracks_count++;
+        else if (cmd == "build_barracks" && p.gold >= 150) {
+            p.gold -= 150;
+            p.barracks_count++;
+            p.updates.mark(FIELD_GOLD | FIELD_BARRACKS);
         }
-        
-        // Sync state back to THIS player immediately
+
+        // Sync state back to THIS player immediately; the arena is borrowed between ticks
+        size_t mark = tick_arena_mark(arena);
         sendUpdate(p);
+        tick_arena_rewind(arena, mark);
     }
 
-    void sendUpdate(std::shared_ptr<Player> p) {
-        if (!p->dc || p->dc->readyState() != rtc::DataChannel::State::Open) return;
+    // "ack:<seq>": the client holds that update, so later deltas can build on it
+    void acknowledgeUpdate(Player& p, const std::string& ack) {
+        char* end = nullptr;
+        unsigned long seq = strtoul(ack.c_str() + 4, &end, 10);
+        std::lock_guard<std::mutex> lock(server_mutex);
+        if (end == ack.c_str() + 4 || *end != '\0' || !p.updates.acknowledge(uint32_t(seq))) badAcks++;
+    }
 
-        json j;
-        j["gold"] = p->gold;
-        j["refineries"] = p->refinery_count;
-        j["barracks"] = p->barracks_count;
-        
-        p->dc->send(j.dump());
+    // Caller holds server_mutex; the text lives in the tick arena until the next reset and
+    // goes out as a binary message from there. Full or delta is up to the player's UpdateTracker
+    void sendUpdate(Player& p) {
+        if (!p.dc || p.dc->readyState() != rtc::DataChannel::State::Open) return;
+
+        char* text = static_cast<char*>(tick_arena_alloc(arena, UPDATE_MAX_BYTES, 1));
+        if (text == nullptr) {
+            updatesDropped++;
+            return;
+        }
+        UpdateFields fields;
+        fields.barracks = p.barracks_count;
+        fields.gold = p.gold;
+        fields.refineries = p.refinery_count;
+        bool full = false;
+        size_t length = p.updates.format(fields, text, UPDATE_MAX_BYTES, full);
+        if (length == 0) {
+            updatesDropped++;
+            return;
+        }
+        (full ? fullUpdates : deltaUpdates)++;
+        updateBytes += length;
+        p.dc->send(reinterpret_cast<const rtc::byte*>(text), length);
     }
 
     // Run this every 1 second
     void tickEconomy() {
+        // Destroyed after the lock is dropped: closing a PeerConnection may run callbacks that take it
+        std::vector<std::shared_ptr<Player>> gone;
         std::lock_guard<std::mutex> lock(server_mutex);
+        tick_arena_reset(arena);
+        for (const std::string& id : leaving) {
+            auto it = players.find(id);
+            if (it == players.end()) continue;
+            gone.push_back(std::move(it->second));
+            players.erase(it);
+            std::cout << "Player " << id << " disconnected.\n";
+        }
+        leaving.clear();
+
         for (auto& [id, player] : players) {
             if (player->refinery_count > 0) {
                 player->gold += (player->refinery_count * 10);
-                sendUpdate(player);
+                player->updates.mark(FIELD_GOLD);
+                sendUpdate(*player);
             }
         }
+        if (++ticks % MEMORY_REPORT_TICKS == 0) {
+            printMemory();
+            printUpdates();
+        }
+    }
+
+    // Caller holds server_mutex
+    void printUpdates() {
+        uint64_t sent = fullUpdates + deltaUpdates;
+        printf("UPDATES: %llu full, %llu delta, %.1f bytes average, %llu bad acks\n", (unsigned long long)fullUpdates,
+               (unsigned long long)deltaUpdates, sent ? double(updateBytes) / double(sent) : 0.0,
+               (unsigned long long)badAcks);
+        fflush(stdout);
+    }
+
+    // Caller holds server_mutex
+    void printMemory() {
+        tlsf_heap_set_stats h;
+        {
+            std::lock_guard<std::mutex> lock(heaps.mutex);
+            h = tlsf_heap_set_get_stats(heaps.set);
+        }
+        const tick_arena_stats& a = arena->stats;
+        printf("MEMORY: %u/%u connection heaps (peak %u, %llu refused), %zu KB used, largest %zu of %zu bytes, %llu failed allocs"
+               " | tick arena peak %zu of %zu bytes, %llu overflows, %llu updates dropped\n",
+               h.in_use, h.heaps, h.high_water, (unsigned long long)refused, h.used / 1024, h.peak, CONNECTION_HEAP_BYTES,
+               (unsigned long long)h.failures, a.peak, a.capacity, (unsigned long long)a.overflows,
+               (unsigned long long)updatesDropped);
+        fflush(stdout);
     }
 };
 
@@ -123,7 +306,7 @@ int main() {
         
         // Add to our game engine
         std::string newPlayerID = generateUUID();
-        game.addPlayer(newPlayerID, pc);
+        if (!game.addPlayer(newPlayerID, pc)) pc->close(); // Server full
         
         // ... Perform SDP Handshake via WebSocket ...
     });
@@ -0,0 +1,187 @@
+// state_bench.cpp - bytes and nanoseconds per RTS state update, JSON against GameState.hpp
+//
+// Replays server.cpp's traffic on UDPWebRTCRTSGame's GameState: every event is
+// either a command, applied with handleCommand's rules (refused ones change
+// nothing) and answered to the one client that sent it, or an economy heartbeat,
+// which pays the refineries and is sent by every one of --clients heartbeat
+// threads. The match starts over every --match-events events, so gold and the
+// building counts stay in the range a real match reaches.
+//
+//   json    the old serializeState(): an nlohmann::json tree, then dump(), per send
+//   binary  encodeState() per send
+//   cached  StateCache: encoded once per version, every other send copies the bytes
+//
+// Reported per mode: bytes per update sent, nanoseconds per event (all of its
+// sends included) and encodes performed, then the JSON / cached ratios. Every
+// state of the stream is decoded again and checked first.
+//
+// Build: make benches JSON_CFLAGS=-I<dir with nlohmann/json.hpp> (bin/state_bench),
+//        or g++ -std=c++17 -O2 state_bench.cpp -o state_bench   (nlohmann/json.hpp on the include path)
+// Usage: state_bench [--events N] [--clients N] [--match-events N]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "../include/bench.h"
+#include "GameState.hpp"
+
+using json = nlohmann::json;
+
+struct BenchConfig {
+    uint32_t events = 200000;
+    uint32_t clients = 4;       // Heartbeat threads, each sending the state
+    uint32_t matchEvents = 1800; // About half an hour of heartbeats and commands
+};
+
+struct ModeResult {
+    double nsPerEvent = 0.0;
+    double bytesPerUpdate = 0.0;
+    uint64_t encodes = 0;
+    uint64_t checksum = 0;      // Keeps the work from being optimized out
+};
+
+// The JSON path server.cpp used before GameState.hpp
+std::string serializeJson(const GameState& state) {
+    json j;
+    j["resources"] = { {"gold", state.gold}, {"power", state.power}, {"soldiers", state.soldiers} };
+    j["buildings"] = {
+        {"hq", state.hq_count},
+        {"barracks", state.barracks_count},
+        {"power_plant", state.power_plant_count},
+        {"refinery", state.refinery_count}
+    };
+    return j.dump();
+}
+
+// handleCommand in server.cpp
+void applyCommand(GameState& state, uint32_t command) {
+    if (command == 0 && state.gold >= 50) {
+        state.gold -= 50;
+        state.power_plant_count++;
+        state.power += 50;
+        state.version++;
+    } else if (command == 1 && state.gold >= 100 && state.power >= 10) {
+        state.gold -= 100;
+        state.power -= 10;
+        state.refinery_count++;
+        state.version++;
+    } else if (command == 2 && state.gold >= 150 && state.power >= 20) {
+        state.gold -= 150;
+        state.power -= 20;
+        state.barracks_count++;
+        state.version++;
+    } else if (command == 3 && state.barracks_count > 0 && state.gold >= 20 && state.power >= 5) {
+        state.gold -= 20;
+        state.power -= 5;
+        state.soldiers++;
+        state.version++;
+    }
+}
+
+// Advances the stream by one event; returns how many sends it causes
+uint32_t nextEvent(const BenchConfig& config, GameState& state, uint32_t index, std::mt19937& rng) {
+    if (index % config.matchEvents == 0) {
+        uint32_t version = state.version;
+        state = GameState();
+        state.version = version + 1;
+    }
+    if (rng() % 2 == 0) {
+        applyCommand(state, rng() % 4);
+        return 1; // The reply, changed or not
+    }
+    if (state.refinery_count == 0) return 0;
+    state.gold += state.refinery_count * 10;
+    state.version++;
+    return config.clients;
+}
+
+template <typename Send>
+ModeResult runMode(const BenchConfig& config, Send send) {
+    std::mt19937 rng(7);
+    GameState state;
+    ModeResult result;
+    uint64_t bytes = 0, sends = 0;
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < config.events; ++i) {
+        uint32_t count = nextEvent(config, state, i, rng);
+        for (uint32_t s = 0; s < count; ++s) bytes += send(state, result);
+        sends += count;
+    }
+    double ns = bench_ns_since(start);
+    result.nsPerEvent = ns / config.events;
+    result.bytesPerUpdate = sends ? double(bytes) / double(sends) : 0.0;
+    return result;
+}
+
+bool sameState(const GameState& a, const GameState& b) {
+    return (a.version & STATE_VERSION_MASK) == b.version && a.gold == b.gold && a.power == b.power && a.soldiers == b.soldiers
+        && a.hq_count == b.hq_count && a.barracks_count == b.barracks_count
+        && a.power_plant_count == b.power_plant_count && a.refinery_count == b.refinery_count;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    bench_option options[] = {
+        {"--events", BENCH_U32, &config.events},
+        {"--clients", BENCH_U32, &config.clients},
+        {"--match-events", BENCH_U32, &config.matchEvents},
+    };
+    if (bench_parse(argc, argv, options, BENCH_COUNT(options), "[--events N] [--clients N] [--match-events N]") != 0) return 1;
+    if (config.events < 1 || config.clients < 1 || config.matchEvents < 1) {
+        fprintf(stderr, "Events, clients and match events must be positive.\n");
+        return 1;
+    }
+
+    // Round trip first: every state of the stream must decode to itself
+    {
+        std::mt19937 rng(7);
+        GameState state, decoded;
+        uint8_t bytes[STATE_MAX_BYTES];
+        for (uint32_t i = 0; i < config.events; ++i) {
+            nextEvent(config, state, i, rng);
+            size_t size = encodeState(state, bytes);
+            if (!decodeState(bytes, size, decoded) || !sameState(state, decoded)) {
+                fprintf(stderr, "Event %u did not survive the round trip.\n", i);
+                return 1;
+            }
+        }
+    }
+
+    ModeResult jsonResult = runMode(config, [](const GameState& state, ModeResult& r) {
+        std::string text = serializeJson(state);
+        r.encodes++;
+        r.checksum += uint8_t(text[text.size() / 2]);
+        return text.size();
+    });
+    ModeResult binaryResult = runMode(config, [](const GameState& state, ModeResult& r) {
+        EncodedState encoded;
+        encoded.size = encodeState(state, encoded.bytes);
+        r.encodes++;
+        r.checksum += encoded.bytes[encoded.size / 2];
+        return encoded.size;
+    });
+    StateCache cache;
+    ModeResult cachedResult = runMode(config, [&cache](const GameState& state, ModeResult& r) {
+        EncodedState encoded = cache.get(state); // Copied out, as server.cpp does under state_mutex
+        r.checksum += encoded.bytes[encoded.size / 2];
+        return encoded.size;
+    });
+    cachedResult.encodes = cache.encodeCount();
+
+    printf("%u events, %u clients, match restarts every %u events\n\n", config.events, config.clients, config.matchEvents);
+    printf("%-8s %12s %14s %12s %10s\n", "mode", "bytes/update", "ns/event", "encodes", "checksum");
+    const struct { const char* name; const ModeResult& r; } rows[] = {
+        {"json", jsonResult}, {"binary", binaryResult}, {"cached", cachedResult}};
+    for (const auto& row : rows) {
+        printf("%-8s %12.1f %14.1f %12llu %10llu\n", row.name, row.r.bytesPerUpdate, row.r.nsPerEvent,
+               (unsigned long long)row.r.encodes, (unsigned long long)(row.r.checksum & 0xFFFF));
+    }
+    printf("\njson / cached: %.1fx fewer bytes, %.1fx less time per event\n",
+           jsonResult.bytesPerUpdate / cachedResult.bytesPerUpdate, jsonResult.nsPerEvent / cachedResult.nsPerEvent);
+    return 0;
+}
@@ -0,0 +1,313 @@
+/*
+ * ack_channel.h - per-connection sequence / ack / ack-bitfield reliability over UDP.
+ *
+ * Every datagram of a connection, in both directions, starts with a small
+ * header: its own 16-bit sequence number, the newest sequence received from
+ * the peer and a 32-bit field saying which of the 32 packets before that
+ * arrived too. Each datagram therefore acknowledges the last 33 packets, and
+ * acks ride on whatever traffic flows anyway (snapshots one way, inputs the
+ * other), with no extra packets and no head-of-line blocking: the unreliable
+ * payload after the header is handed over as soon as it arrives.
+ *
+ * Reliable messages (build orders, chat, ...) are queued with
+ * ack_channel_send() and written into the headers of the following packets.
+ * A message is only resent once the packet that carried it has gone
+ * unacknowledged for a retransmission timeout (smoothed RTT + 4 x deviation),
+ * and only messages are resent, never the unreliable payload. The receiver
+ * drops duplicates and hands messages out in order:
+ *
+ *   ack_channel ch;
+ *   ack_channel_reset(&ch);                                // once per connection
+ *   ack_channel_send(&ch, "build_barracks", 14, now_ms);   // 0, or -1 if the queue is full
+ *   int n = ack_channel_write(&ch, out, capacity, now_ms); // header + due messages
+ *   memcpy(out + n, snapshot, len);                        // unreliable payload after it
+ *   ...
+ *   int off = ack_channel_read(&ch, in, in_len, now_ms);   // payload at in + off; -1 malformed
+ *   const unsigned char* msg; uint32_t len;
+ *   while (ack_channel_receive(&ch, &msg, &len)) handle(msg, len);
+ *   if (ack_channel_wants_packet(&ch, now_ms)) ...;        // nothing else is going out: send a bare header
+ *
+ * Wire format (little endian): u16 sequence, u16 ack, u32 ack bits, u8 message
+ * count, then per message u16 id, u8 length and the bytes. A duplicate packet
+ * reads as valid with an empty payload.
+ *
+ * Memory is fixed: ACK_CHANNEL_WINDOW sent-packet records and
+ * ACK_CHANNEL_MESSAGES message slots each way, 3.5 KB per connection with
+ * the defaults (35 MB for 10k connections), so a server can allocate one per
+ * session slot up front. At most ACK_CHANNEL_MESSAGES messages may be
+ * unacknowledged; ack_channel_send() refuses more, and the caller decides
+ * whether to drop, wait or disconnect. A channel belongs to one thread.
+ * Header-only, usable from C and C++.
+ */
+#ifndef ACK_CHANNEL_H
+#define ACK_CHANNEL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef ACK_CHANNEL_WINDOW
+#define ACK_CHANNEL_WINDOW 64                /* sent packets remembered; power of two, >= 33 */
+#endif
+#ifndef ACK_CHANNEL_MESSAGES
+#define ACK_CHANNEL_MESSAGES 16              /* unacked messages out, out-of-order messages in; power of two */
+#endif
+#ifndef ACK_CHANNEL_MAX_MESSAGE
+#define ACK_CHANNEL_MAX_MESSAGE 64           /* bytes per message */
+#endif
+#define ACK_CHANNEL_PACKET_MESSAGES 4        /* messages carried per packet */
+#define ACK_CHANNEL_HEADER_BYTES 9
+#define ACK_CHANNEL_MESSAGE_OVERHEAD 3
+#define ACK_CHANNEL_MIN_RTO_MS 20
+#define ACK_CHANNEL_MAX_RTO_MS 1000
+#define ACK_CHANNEL_INITIAL_RTO_MS 100      /* until the first RTT sample */
+
+typedef struct ack_channel_stats {
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t packets_acked;
+    uint64_t packets_lost;                   /* left the window unacknowledged */
+    uint64_t duplicates;                     /* packets received twice */
+    uint64_t messages_sent;
+    uint64_t messages_resent;
+    uint64_t messages_acked;
+    uint64_t messages_received;              /* handed out by ack_channel_receive */
+    uint64_t messages_refused;               /* ack_channel_send with a full queue */
+} ack_channel_stats;
+
+typedef struct ack_channel_packet {
+    uint16_t sequence;
+    uint8_t acked;
+    uint8_t message_count;
+    uint32_t sent_ms;
+    uint16_t messages[ACK_CHANNEL_PACKET_MESSAGES];
+} ack_channel_packet;
+
+typedef struct ack_channel_message {
+    uint16_t id;
+    uint8_t length;
+    uint8_t used;
+    uint32_t sent_ms;                        /* last time it was written into a packet */
+    uint32_t sends;                          /* 0 = not sent yet */
+    unsigned char data[ACK_CHANNEL_MAX_MESSAGE];
+} ack_channel_message;
+
+typedef struct ack_channel {
+    uint16_t sequence;                       /* of the next packet written */
+    uint16_t remote_sequence;                /* newest packet read */
+    uint32_t remote_bits;                    /* bit i: remote_sequence - 1 - i was read too */
+    uint8_t has_remote;
+    uint8_t ack_owed;                        /* read something since the last write */
+    uint16_t send_id;                        /* id of the next message queued */
+    uint16_t oldest_id;                      /* oldest unacked message */
+    uint16_t receive_id;                     /* next message to hand out */
+    float srtt_ms;
+    float rttvar_ms;
+    uint32_t rto_ms;
+    ack_channel_stats stats;
+    ack_channel_packet sent[ACK_CHANNEL_WINDOW];
+    ack_channel_message outgoing[ACK_CHANNEL_MESSAGES];
+    ack_channel_message incoming[ACK_CHANNEL_MESSAGES];
+} ack_channel;
+
+static inline void ack_channel_reset(ack_channel* ch) {
+    memset(ch, 0, sizeof(*ch));
+    for (int i = 0; i < ACK_CHANNEL_WINDOW; ++i) ch->sent[i].acked = 1; /* Nothing to ack or lose yet */
+    ch->rto_ms = ACK_CHANNEL_INITIAL_RTO_MS;
+}
+
+static inline void ack_channel_put16(unsigned char* p, uint16_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static inline uint16_t ack_channel_get16(const unsigned char* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/* Queues a reliable message; 0, or -1 if it is too long or ACK_CHANNEL_MESSAGES are unacked */
+static inline int ack_channel_send(ack_channel* ch, const void* data, uint32_t length, uint64_t now_ms) {
+    (void)now_ms;
+    if (length > ACK_CHANNEL_MAX_MESSAGE || (uint16_t)(ch->send_id - ch->oldest_id) >= ACK_CHANNEL_MESSAGES) {
+        ch->stats.messages_refused++;
+        return -1;
+    }
+    ack_channel_message* m = &ch->outgoing[ch->send_id % ACK_CHANNEL_MESSAGES];
+    m->id = ch->send_id++;
+    m->length = (uint8_t)length;
+    m->used = 1;
+    m->sends = 0;
+    memcpy(m->data, data, length);
+    return 0;
+}
+
+static inline int ack_channel_message_due(const ack_channel* ch, const ack_channel_message* m, uint32_t now) {
+    return m->used && (m->sends == 0 || (uint32_t)(now - m->sent_ms) >= ch->rto_ms);
+}
+
+/* Something owes the peer a packet: an ack, or a message that is new or due for resending */
+static inline int ack_channel_wants_packet(const ack_channel* ch, uint64_t now_ms) {
+    if (ch->ack_owed) return 1;
+    for (uint16_t id = ch->oldest_id; id != ch->send_id; ++id) {
+        if (ack_channel_message_due(ch, &ch->outgoing[id % ACK_CHANNEL_MESSAGES], (uint32_t)now_ms)) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Writes the header of the next packet into out, with as many due messages as
+ * fit in capacity. Returns the bytes written (the payload goes right after),
+ * or -1 if capacity is below ACK_CHANNEL_HEADER_BYTES.
+ */
+static inline int ack_channel_write(ack_channel* ch, unsigned char* out, uint32_t capacity, uint64_t now_ms) {
+    if (capacity < ACK_CHANNEL_HEADER_BYTES) return -1;
+    uint32_t now = (uint32_t)now_ms;
+    ack_channel_packet* p = &ch->sent[ch->sequence % ACK_CHANNEL_WINDOW];
+    if (!p->acked) ch->stats.packets_lost++; /* Overwritten unacked: the peer never saw it */
+    p->sequence = ch->sequence;
+    p->acked = 0;
+    p->sent_ms = now;
+    p->message_count = 0;
+
+    uint32_t length = ACK_CHANNEL_HEADER_BYTES;
+    for (uint16_t id = ch->oldest_id; id != ch->send_id && p->message_count < ACK_CHANNEL_PACKET_MESSAGES; ++id) {
+        ack_channel_message* m = &ch->outgoing[id % ACK_CHANNEL_MESSAGES];
+        if (!ack_channel_message_due(ch, m, now)) continue;
+        if (length + ACK_CHANNEL_MESSAGE_OVERHEAD + m->length > capacity) break; /* Keep later ones behind it */
+        ack_channel_put16(out + length, m->id);
+        out[length + 2] = m->length;
+        memcpy(out + length + 3, m->data, m->length);
+        length += ACK_CHANNEL_MESSAGE_OVERHEAD + m->length;
+        if (m->sends++ == 0) ch->stats.messages_sent++;
+        else ch->stats.messages_resent++;
+        m->sent_ms = now;
+        p->messages[p->message_count++] = m->id;
+    }
+
+    ack_channel_put16(out, ch->sequence);
+    ack_channel_put16(out + 2, ch->remote_sequence);
+    uint32_t bits = ch->remote_bits;
+    for (int i = 0; i < 4; ++i) out[4 + i] = (unsigned char)(bits >> (8 * i));
+    out[8] = p->message_count;
+    ch->sequence++;
+    ch->ack_owed = 0;
+    ch->stats.packets_sent++;
+    return (int)length;
+}
+
+static inline void ack_channel_acked(ack_channel* ch, uint16_t sequence, uint32_t now) {
+    ack_channel_packet* p = &ch->sent[sequence % ACK_CHANNEL_WINDOW];
+    if (p->acked || p->sequence != sequence) return;
+    p->acked = 1;
+    ch->stats.packets_acked++;
+
+    /* RFC 6298 smoothing, in milliseconds */
+    float sample = (float)(uint32_t)(now - p->sent_ms);
+    if (ch->stats.packets_acked == 1) {
+        ch->srtt_ms = sample;
+        ch->rttvar_ms = sample / 2.0f;
+    } else {
+        float delta = sample > ch->srtt_ms ? sample - ch->srtt_ms : ch->srtt_ms - sample;
+        ch->rttvar_ms += (delta - ch->rttvar_ms) / 4.0f;
+        ch->srtt_ms += (sample - ch->srtt_ms) / 8.0f;
+    }
+    float rto = ch->srtt_ms + 4.0f * ch->rttvar_ms;
+    ch->rto_ms = rto < ACK_CHANNEL_MIN_RTO_MS ? ACK_CHANNEL_MIN_RTO_MS
+               : rto > ACK_CHANNEL_MAX_RTO_MS ? ACK_CHANNEL_MAX_RTO_MS : (uint32_t)rto;
+
+    for (int i = 0; i < p->message_count; ++i) {
+        ack_channel_message* m = &ch->outgoing[p->messages[i] % ACK_CHANNEL_MESSAGES];
+        if (m->used && m->id == p->messages[i]) {
+            m->used = 0;
+            ch->stats.messages_acked++;
+        }
+    }
+    while (ch->oldest_id != ch->send_id && !ch->outgoing[ch->oldest_id % ACK_CHANNEL_MESSAGES].used) ch->oldest_id++;
+}
+
+/*
+ * Reads a packet's header: processes its acks and stores its messages for
+ * ack_channel_receive(). Returns the offset of the unreliable payload (equal to
+ * length for a duplicate, whose payload was seen already), or -1 if malformed.
+ */
+static inline int ack_channel_read(ack_channel* ch, const unsigned char* data, uint32_t length, uint64_t now_ms) {
+    if (length < ACK_CHANNEL_HEADER_BYTES) return -1;
+    uint16_t sequence = ack_channel_get16(data);
+    uint16_t ack = ack_channel_get16(data + 2);
+    uint32_t ack_bits = (uint32_t)data[4] | (uint32_t)data[5] << 8 | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+    uint32_t count = data[8];
+    uint32_t offset = ACK_CHANNEL_HEADER_BYTES;
+    for (uint32_t i = 0; i < count; ++i) { /* Validate before touching any state */
+        if (offset + ACK_CHANNEL_MESSAGE_OVERHEAD > length) return -1;
+        uint32_t size = data[offset + 2];
+        if (size > ACK_CHANNEL_MAX_MESSAGE || offset + ACK_CHANNEL_MESSAGE_OVERHEAD + size > length) return -1;
+        offset += ACK_CHANNEL_MESSAGE_OVERHEAD + size;
+    }
+
+    if (!ch->has_remote) {
+        ch->has_remote = 1;
+        ch->remote_sequence = sequence;
+        ch->remote_bits = 0;
+    } else {
+        int16_t ahead = (int16_t)(sequence - ch->remote_sequence);
+        if (ahead > 0) {
+            ch->remote_bits = ahead > 32 ? 0 : ((ahead == 32 ? 0 : ch->remote_bits << ahead) | 1u << (ahead - 1));
+            ch->remote_sequence = sequence;
+        } else if (ahead == 0) {
+            ch->stats.duplicates++;
+            return (int)length;
+        } else if (ahead >= -32) {
+            uint32_t bit = 1u << (-ahead - 1);
+            if (ch->remote_bits & bit) {
+                ch->stats.duplicates++;
+                return (int)length;
+            }
+            ch->remote_bits |= bit;
+        } /* Older than the ack field: its messages are still taken, duplicates are dropped below */
+    }
+    ch->ack_owed = 1;
+    ch->stats.packets_received++;
+
+    uint32_t now = (uint32_t)now_ms;
+    ack_channel_acked(ch, ack, now);
+    for (int i = 0; i < 32; ++i) {
+        if (ack_bits & (1u << i)) ack_channel_acked(ch, (uint16_t)(ack - 1 - i), now);
+    }
+
+    offset = ACK_CHANNEL_HEADER_BYTES;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint16_t id = ack_channel_get16(data + offset);
+        uint32_t size = data[offset + 2];
+        uint16_t ahead = (uint16_t)(id - ch->receive_id);
+        /* Handed out already (ahead wrapped) or beyond what the sender may have unacked */
+        if (ahead < ACK_CHANNEL_MESSAGES) {
+            ack_channel_message* m = &ch->incoming[id % ACK_CHANNEL_MESSAGES];
+            if (!m->used) {
+                m->id = id;
+                m->length = (uint8_t)size;
+                m->used = 1;
+                memcpy(m->data, data + offset + 3, size);
+            }
+        }
+        offset += ACK_CHANNEL_MESSAGE_OVERHEAD + size;
+    }
+    return (int)offset;
+}
+
+/* Hands out the next message in order; the bytes stay valid until the next ack_channel_read */
+static inline int ack_channel_receive(ack_channel* ch, const unsigned char** data, uint32_t* length) {
+    ack_channel_message* m = &ch->incoming[ch->receive_id % ACK_CHANNEL_MESSAGES];
+    if (!m->used || m->id != ch->receive_id) return 0;
+    m->used = 0;
+    ch->receive_id++;
+    ch->stats.messages_received++;
+    *data = m->data;
+    *length = m->length;
+    return 1;
+}
+
+/* Smoothed round-trip time in ms; 0 before the first ack */
+static inline float ack_channel_rtt_ms(const ack_channel* ch) {
+    return ch->srtt_ms;
+}
+
+#endif /* ACK_CHANNEL_H */
@@ -0,0 +1,107 @@
+/*
+ * bench.h - option parsing and timing shared by the *_bench.cpp programs.
+ *
+ * Every bench takes "--name value" options with defaults in its own config
+ * struct and prints a usage line on anything it does not know. The options are
+ * a table of (name, kind, where to store it):
+ *
+ *   bench_option options[] = {
+ *       {"--players", BENCH_INT, &config.players},
+ *       {"--loss", BENCH_DOUBLE, &config.loss},
+ *       {"--coalesce", BENCH_FLAG, &config.coalesce},
+ *   };
+ *   if (bench_parse(argc, argv, options, BENCH_COUNT(options), "[--players N] [--loss P] [--coalesce]") != 0) return 1;
+ *
+ * Options that take several values or an optional one are handled by the bench
+ * itself around bench_match(), which parses one argument at a time.
+ *
+ * Timing is CLOCK_MONOTONIC in nanoseconds: bench_now_ns() at the start,
+ * bench_seconds_since() or bench_ns_since() at the end. Header-only, usable
+ * from C and C++ (POSIX).
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum bench_kind {
+    BENCH_INT,          /* int */
+    BENCH_U32,          /* uint32_t */
+    BENCH_SIZE,         /* size_t */
+    BENCH_DOUBLE,       /* double */
+    BENCH_FLOAT,        /* float */
+    BENCH_STRING,       /* const char*, pointing into argv */
+    BENCH_FLAG          /* bool, set without a value */
+} bench_kind;
+
+typedef struct bench_option {
+    const char* name;
+    bench_kind kind;
+    void* value;
+} bench_option;
+
+#define BENCH_COUNT(options) ((int)(sizeof(options) / sizeof((options)[0])))
+
+static inline uint64_t bench_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static inline double bench_ns_since(uint64_t start_ns) {
+    return (double)(bench_now_ns() - start_ns);
+}
+
+static inline double bench_seconds_since(uint64_t start_ns) {
+    return bench_ns_since(start_ns) / 1e9;
+}
+
+static inline void bench_usage(const char* program, const char* usage) {
+    fprintf(stderr, "Usage: %s %s\n", program, usage);
+}
+
+/* If argv[*i] is one of the options, stores its value, moves *i to the last argument
+ * it used and returns 1; 0 if it is none of them or its value is missing. */
+static inline int bench_match(int argc, char** argv, int* i, const bench_option* options, int count) {
+    for (int k = 0; k < count; ++k) {
+        const bench_option* o = &options[k];
+        if (strcmp(argv[*i], o->name) != 0) continue;
+        if (o->kind == BENCH_FLAG) {
+            *(bool*)o->value = true;
+            return 1;
+        }
+        if (*i + 1 >= argc) return 0;
+        const char* text = argv[++*i];
+        switch (o->kind) {
+        case BENCH_INT: *(int*)o->value = atoi(text); break;
+        case BENCH_U32: *(uint32_t*)o->value = (uint32_t)strtoul(text, NULL, 10); break;
+        case BENCH_SIZE: *(size_t*)o->value = (size_t)strtoull(text, NULL, 10); break;
+        case BENCH_DOUBLE: *(double*)o->value = atof(text); break;
+        case BENCH_FLOAT: *(float*)o->value = (float)atof(text); break;
+        case BENCH_STRING: *(const char**)o->value = text; break;
+        case BENCH_FLAG: break;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Parses every argument against the options; prints the usage and returns -1 on
+ * the first one that is not an option or lacks its value. */
+static inline int bench_parse(int argc, char** argv, const bench_option* options, int count, const char* usage) {
+    for (int i = 1; i < argc; ++i) {
+        if (!bench_match(argc, argv, &i, options, count)) {
+            bench_usage(argv[0], usage);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#endif /* BENCH_H */
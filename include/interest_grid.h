@@ -0,0 +1,352 @@
+/*
+ * interest_grid.h - spatial interest management for the relay servers.
+ *
+ * Entities (players) live in a uniform grid hashed by (layer, cell), so the
+ * world needs no bounds and moving an entity is O(1): it only changes bucket
+ * when it crosses a cell edge. Two queries sit on top of the grid:
+ *
+ *   interest_grid_visible(g, observer, out, max)    what this observer sees
+ *   interest_grid_observers(g, entity, out, max)    who should get this entity
+ *
+ * An observer becomes interested in an entity inside its radius and stays
+ * interested until the entity is more than radius + hysteresis away, so
+ * players near the edge do not flicker in and out on every update. That
+ * memory is a sorted list of up to `max_visible` entities per observer.
+ * Entities on different layers (e.g. different matches) never see each other.
+ *
+ *   interest_grid* g = interest_grid_create(2048, 50.0f, 5.0f, 64);
+ *   interest_grid_update(g, session, match, x, y, 50.0f);  // on every position
+ *   int n = interest_grid_observers(g, session, out, 64);   // forward to out[0..n)
+ *   interest_grid_remove(g, session);                       // on disconnect
+ *
+ * All memory is allocated by interest_grid_create(). A grid belongs to one
+ * thread. Header-only and usable from both C and C++.
+ */
+#ifndef INTEREST_GRID_H
+#define INTEREST_GRID_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define INTEREST_GRID_NONE 0xFFFFFFFFu
+#define INTEREST_GRID_CELL_LIMIT 1.0e9f     /* cell coordinates are clamped to +-this */
+
+typedef struct interest_entity {
+    float x, y;
+    float radius;                       /* area of interest when acting as an observer */
+    uint32_t layer;
+    int32_t cell_x, cell_y;
+    uint32_t bucket;
+    uint32_t next, prev;                /* bucket chain */
+    uint32_t generation;                /* bumped on remove, invalidates old interest */
+    uint32_t query_stamp;               /* visited marker, so colliding buckets are walked once */
+    uint32_t active;
+} interest_entity;
+
+typedef struct interest_grid {
+    float cell_size;
+    float inv_cell_size;
+    float hysteresis;
+    float max_radius;                   /* largest observer radius seen so far */
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t stamp;
+    interest_entity* entities;
+    uint32_t* buckets;                  /* head entity of each chain */
+    uint32_t bucket_mask;
+
+    /* Per observer: the entities it is currently interested in, sorted by index */
+    uint32_t max_visible;
+    uint32_t* visible;                  /* capacity x max_visible entity indices */
+    uint32_t* visible_gen;              /* generation of each listed entity when it was added */
+    uint32_t* visible_count;
+
+    /* Candidates of the current query (capacity entries each) */
+    uint32_t* near_index;
+    float* near_dist2;
+} interest_grid;
+
+static inline void interest_grid_destroy(interest_grid* g) {
+    if (g == NULL) return;
+    free(g->entities);
+    free(g->buckets);
+    free(g->visible);
+    free(g->visible_gen);
+    free(g->visible_count);
+    free(g->near_index);
+    free(g->near_dist2);
+    free(g);
+}
+
+/* Room for entity indices 0 .. capacity-1. cell_size should be about the
+ * typical radius + hysteresis, so a query touches the 3x3 cells around it. */
+static inline interest_grid* interest_grid_create(uint32_t capacity, float cell_size, float hysteresis, uint32_t max_visible) {
+    interest_grid* g = (interest_grid*)calloc(1, sizeof(interest_grid));
+    if (g == NULL) return NULL;
+    if (cell_size <= 0.0f) cell_size = 1.0f;
+    if (max_visible < 1) max_visible = 1;
+    g->cell_size = cell_size;
+    g->inv_cell_size = 1.0f / cell_size;
+    g->hysteresis = hysteresis > 0.0f ? hysteresis : 0.0f;
+    g->capacity = capacity;
+    g->max_visible = max_visible;
+
+    uint32_t bucket_count = 16;
+    while (bucket_count < capacity) bucket_count <<= 1;   /* ~1 entity per bucket at full load */
+    g->bucket_mask = bucket_count - 1;
+
+    g->entities = (interest_entity*)calloc(capacity, sizeof(interest_entity));
+    g->buckets = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+    g->visible = (uint32_t*)malloc((size_t)capacity * max_visible * sizeof(uint32_t));
+    g->visible_gen = (uint32_t*)malloc((size_t)capacity * max_visible * sizeof(uint32_t));
+    g->visible_count = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    g->near_index = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    g->near_dist2 = (float*)malloc(capacity * sizeof(float));
+    if (!g->entities || !g->buckets || !g->visible || !g->visible_gen || !g->visible_count || !g->near_index || !g->near_dist2) {
+        interest_grid_destroy(g);
+        return NULL;
+    }
+    for (uint32_t i = 0; i <= g->bucket_mask; ++i) g->buckets[i] = INTEREST_GRID_NONE;
+    return g;
+}
+
+static inline uint32_t interest_grid_hash(const interest_grid* g, uint32_t layer, int32_t cx, int32_t cy) {
+    uint64_t key = ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+    key ^= (uint64_t)layer * 0xC2B2AE3D27D4EB4Full;
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & g->bucket_mask;
+}
+
+static inline int32_t interest_grid_cell(const interest_grid* g, float v) {
+    float cell = floorf(v * g->inv_cell_size);
+    if (!(cell > -INTEREST_GRID_CELL_LIMIT)) return (int32_t)-INTEREST_GRID_CELL_LIMIT;
+    if (cell > INTEREST_GRID_CELL_LIMIT) return (int32_t)INTEREST_GRID_CELL_LIMIT;
+    return (int32_t)cell;
+}
+
+static inline void interest_grid_unlink(interest_grid* g, uint32_t index) {
+    interest_entity* e = &g->entities[index];
+    if (e->prev != INTEREST_GRID_NONE) g->entities[e->prev].next = e->next;
+    else g->buckets[e->bucket] = e->next;
+    if (e->next != INTEREST_GRID_NONE) g->entities[e->next].prev = e->prev;
+}
+
+static inline void interest_grid_link(interest_grid* g, uint32_t index) {
+    interest_entity* e = &g->entities[index];
+    e->prev = INTEREST_GRID_NONE;
+    e->next = g->buckets[e->bucket];
+    if (e->next != INTEREST_GRID_NONE) g->entities[e->next].prev = index;
+    g->buckets[e->bucket] = index;
+}
+
+/* Inserts the entity or moves it; cheap enough to call on every received position. */
+static inline void interest_grid_update(interest_grid* g, uint32_t index, uint32_t layer, float x, float y, float radius) {
+    interest_entity* e = &g->entities[index];
+    int32_t cx = interest_grid_cell(g, x);
+    int32_t cy = interest_grid_cell(g, y);
+    e->x = x;
+    e->y = y;
+    e->radius = radius;
+    if (radius > g->max_radius) g->max_radius = radius;
+
+    if (e->active && e->layer == layer && e->cell_x == cx && e->cell_y == cy) return;
+    if (e->active) {
+        interest_grid_unlink(g, index);
+    } else {
+        e->active = 1;
+        g->visible_count[index] = 0;
+        g->count++;
+    }
+    e->layer = layer;
+    e->cell_x = cx;
+    e->cell_y = cy;
+    e->bucket = interest_grid_hash(g, layer, cx, cy);
+    interest_grid_link(g, index);
+}
+
+static inline void interest_grid_remove(interest_grid* g, uint32_t index) {
+    interest_entity* e = &g->entities[index];
+    if (!e->active) return;
+    interest_grid_unlink(g, index);
+    e->active = 0;
+    e->generation++;
+    g->visible_count[index] = 0;
+    g->count--;
+}
+
+/* Position of `entity` in the observer's sorted interest list, or where it would go */
+static inline uint32_t interest_grid_find(const interest_grid* g, uint32_t observer, uint32_t entity, int* found) {
+    const uint32_t* list = &g->visible[(size_t)observer * g->max_visible];
+    uint32_t lo = 0, hi = g->visible_count[observer];
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (list[mid] < entity) lo = mid + 1;
+        else hi = mid;
+    }
+    *found = lo < g->visible_count[observer] && list[lo] == entity;
+    return lo;
+}
+
+/* Whether the observer was interested in the entity after its previous update */
+static inline int interest_grid_was_visible(const interest_grid* g, uint32_t observer, uint32_t entity) {
+    int found;
+    uint32_t pos = interest_grid_find(g, observer, entity, &found);
+    return found && g->visible_gen[(size_t)observer * g->max_visible + pos] == g->entities[entity].generation;
+}
+
+/* Applies the radius/hysteresis rule to one pair, given their squared distance */
+static inline int interest_grid_decide(const interest_grid* g, uint32_t observer, uint32_t entity, float dist2) {
+    float inner = g->entities[observer].radius;
+    float outer = inner + g->hysteresis;
+    if (dist2 <= inner * inner) return 1;
+    if (dist2 > outer * outer) return 0;
+    return interest_grid_was_visible(g, observer, entity);
+}
+
+static inline void interest_grid_consider(interest_grid* g, const interest_entity* c, uint32_t other,
+                                          float range2, uint32_t stamp, uint32_t* n) {
+    interest_entity* o = &g->entities[other];
+    if (o->query_stamp == stamp) return;
+    o->query_stamp = stamp;
+    if (!o->active || o->layer != c->layer) return;
+    float dx = o->x - c->x, dy = o->y - c->y;
+    float dist2 = dx * dx + dy * dy;
+    if (dist2 > range2) return;
+    g->near_index[*n] = other;
+    g->near_dist2[*n] = dist2;
+    (*n)++;
+}
+
+/* Collects the active entities on the centre's layer within `range` of it, itself
+ * excluded, into near_index / near_dist2 and returns how many there are. */
+static inline uint32_t interest_grid_gather(interest_grid* g, uint32_t center, float range) {
+    const interest_entity* c = &g->entities[center];
+    if (++g->stamp == 0) { /* Wrapped: forget every old marker */
+        for (uint32_t i = 0; i < g->capacity; ++i) g->entities[i].query_stamp = 0;
+        g->stamp = 1;
+    }
+    uint32_t stamp = g->stamp;
+    g->entities[center].query_stamp = stamp;
+    float range2 = range * range;
+    uint32_t n = 0;
+
+    float span_cells = ceilf(range * g->inv_cell_size);
+    if ((2.0f * span_cells + 1.0f) * (2.0f * span_cells + 1.0f) > (float)g->capacity) {
+        /* More cells than entities: a linear scan is cheaper */
+        for (uint32_t i = 0; i < g->capacity; ++i) interest_grid_consider(g, c, i, range2, stamp, &n);
+        return n;
+    }
+    int32_t span = (int32_t)span_cells;
+    for (int32_t dy = -span; dy <= span; ++dy) {
+        for (int32_t dx = -span; dx <= span; ++dx) {
+            uint32_t bucket = interest_grid_hash(g, c->layer, c->cell_x + dx, c->cell_y + dy);
+            for (uint32_t i = g->buckets[bucket]; i != INTEREST_GRID_NONE; i = g->entities[i].next) {
+                interest_grid_consider(g, c, i, range2, stamp, &n);
+            }
+        }
+    }
+    return n;
+}
+
+static inline int interest_grid_compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static inline void interest_grid_swap_near(interest_grid* g, uint32_t a, uint32_t b) {
+    uint32_t index = g->near_index[a];
+    float dist2 = g->near_dist2[a];
+    g->near_index[a] = g->near_index[b];
+    g->near_dist2[a] = g->near_dist2[b];
+    g->near_index[b] = index;
+    g->near_dist2[b] = dist2;
+}
+
+/* Partial selection (quickselect) over near_index / near_dist2[0..n): afterwards the
+ * first k entries are the k nearest, in no particular order. */
+static inline void interest_grid_select_nearest(interest_grid* g, uint32_t n, uint32_t k) {
+    uint32_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2; /* Median of three as the pivot, moved to hi */
+        if (g->near_dist2[mid] < g->near_dist2[lo]) interest_grid_swap_near(g, mid, lo);
+        if (g->near_dist2[hi] < g->near_dist2[lo]) interest_grid_swap_near(g, hi, lo);
+        if (g->near_dist2[mid] < g->near_dist2[hi]) interest_grid_swap_near(g, mid, hi);
+        float pivot = g->near_dist2[hi];
+        uint32_t store = lo;
+        for (uint32_t i = lo; i < hi; ++i) {
+            if (g->near_dist2[i] < pivot) interest_grid_swap_near(g, i, store++);
+        }
+        interest_grid_swap_near(g, store, hi);
+        if (store == k) return;
+        if (store < k) lo = store + 1;
+        else hi = store - 1;
+    }
+}
+
+/* Entities the observer is interested in, in index order: the nearest max (and at most
+ * max_visible) of them. Also records them as the observer's interest set for the next call. */
+static inline int interest_grid_visible(interest_grid* g, uint32_t observer, uint32_t* out, int max) {
+    if (!g->entities[observer].active) return 0;
+    int limit = max < (int)g->max_visible ? max : (int)g->max_visible;
+    if (limit <= 0) return 0;
+    uint32_t candidates = interest_grid_gather(g, observer, g->entities[observer].radius + g->hysteresis);
+    uint32_t accepted = 0; /* Compacted in place; decide() only reads the old interest set */
+    for (uint32_t i = 0; i < candidates; ++i) {
+        if (!interest_grid_decide(g, observer, g->near_index[i], g->near_dist2[i])) continue;
+        g->near_index[accepted] = g->near_index[i];
+        g->near_dist2[accepted] = g->near_dist2[i];
+        accepted++;
+    }
+    /* Over the limit the nearest win, not whichever bucket was walked first */
+    if (accepted > (uint32_t)limit) interest_grid_select_nearest(g, accepted, (uint32_t)limit);
+    int n = accepted < (uint32_t)limit ? (int)accepted : limit;
+    for (int i = 0; i < n; ++i) out[i] = g->near_index[i];
+
+    /* Everything not seen this time is out of range: the result is the new interest set */
+    qsort(out, (size_t)n, sizeof(uint32_t), interest_grid_compare_u32);
+    uint32_t* list = &g->visible[(size_t)observer * g->max_visible];
+    uint32_t* gens = &g->visible_gen[(size_t)observer * g->max_visible];
+    for (int i = 0; i < n; ++i) {
+        list[i] = out[i];
+        gens[i] = g->entities[out[i]].generation;
+    }
+    g->visible_count[observer] = (uint32_t)n;
+    return n;
+}
+
+/* Observers interested in the entity, i.e. who an update from it should go to.
+ * Updates each observer's interest set for this one entity. */
+static inline int interest_grid_observers(interest_grid* g, uint32_t entity, uint32_t* out, int max) {
+    if (!g->entities[entity].active) return 0;
+    int n = 0;
+    uint32_t generation = g->entities[entity].generation;
+    uint32_t candidates = interest_grid_gather(g, entity, g->max_radius + g->hysteresis);
+    for (uint32_t i = 0; i < candidates; ++i) {
+        uint32_t other = g->near_index[i];
+        int found;
+        uint32_t pos = interest_grid_find(g, other, entity, &found);
+        uint32_t* list = &g->visible[(size_t)other * g->max_visible];
+        uint32_t* gens = &g->visible_gen[(size_t)other * g->max_visible];
+        uint32_t* count = &g->visible_count[other];
+        if (interest_grid_decide(g, other, entity, g->near_dist2[i])) {
+            if (n < max) out[n++] = other;
+            if (found) {
+                gens[pos] = generation;
+            } else if (*count < g->max_visible) {
+                memmove(&list[pos + 1], &list[pos], (*count - pos) * sizeof(uint32_t));
+                memmove(&gens[pos + 1], &gens[pos], (*count - pos) * sizeof(uint32_t));
+                list[pos] = entity;
+                gens[pos] = generation;
+                (*count)++;
+            } /* else: list full, still forwarded but without hysteresis memory */
+        } else if (found) {
+            memmove(&list[pos], &list[pos + 1], (*count - pos - 1) * sizeof(uint32_t));
+            memmove(&gens[pos], &gens[pos + 1], (*count - pos - 1) * sizeof(uint32_t));
+            (*count)--;
+        }
+    }
+    return n;
+}
+
+#endif /* INTEREST_GRID_H */
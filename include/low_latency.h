@@ -0,0 +1,160 @@
+/*
+ * low_latency.h - opt-in low-latency mode for the UDP servers and the relay.
+ *
+ * Trades CPU for tail latency: a thread in this mode never sleeps in the
+ * kernel between datagrams, so a datagram is picked up without a wake-up and
+ * a context switch, and nothing else is scheduled on its core.
+ *
+ *   low_latency_config ll;
+ *   low_latency_init(&ll);                      // off
+ *   low_latency_parse_cpus(&ll, "2-5");         // --cpus, ideally isolcpus= / nohz_full= cores
+ *   ll.enabled = 1;
+ *   low_latency_socket(fd, &ll);                // SO_BUSY_POLL (+ prefer busy poll)
+ *   low_latency_thread(&ll, worker_index);      // pin to cpus[i % count], SCHED_FIFO if asked
+ *   for (;;) {
+ *       int n = udp_io_try_recv(io, packets, max); // never waits
+ *       if (n == 0) low_latency_relax();        // spin instead of sleeping
+ *   }
+ *
+ * SO_BUSY_POLL makes socket reads poll the NIC's receive queue for up to
+ * busy_poll_us instead of waiting for its interrupt (only on NICs with NAPI;
+ * loopback ignores it). Raising it above the system default needs
+ * CAP_NET_ADMIN. SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit; a FIFO
+ * thread that spins forever must be alone on its core, so it is only set on
+ * threads that are also pinned. Failures are reported as -1 with errno set and
+ * the caller decides whether to carry on without that setting.
+ *
+ * Header-only, usable from C and C++; the settings are Linux only and report
+ * ENOTSUP elsewhere. C programs must define _GNU_SOURCE before their first
+ * system include (CPU_SET, pthread_setaffinity_np).
+ */
+#ifndef LOW_LATENCY_H
+#define LOW_LATENCY_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#endif
+
+#define LOW_LATENCY_MAX_CPUS 256
+#define LOW_LATENCY_BUSY_POLL_US 50          /* per read; the kernel's own suggestion */
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69               /* Linux 5.11 */
+#endif
+
+typedef struct low_latency_config {
+    int enabled;
+    int busy_poll_us;                        /* 0 = leave SO_BUSY_POLL alone */
+    int fifo_priority;                       /* 1-99 for SCHED_FIFO; 0 = keep SCHED_OTHER */
+    int cpu_count;                           /* 0 = do not pin */
+    int cpus[LOW_LATENCY_MAX_CPUS];
+} low_latency_config;
+
+static inline void low_latency_init(low_latency_config* ll) {
+    memset(ll, 0, sizeof(*ll));
+    ll->busy_poll_us = LOW_LATENCY_BUSY_POLL_US;
+}
+
+/* "2,3,8-11": cores in the order threads are pinned to them. 0 on success, -1 if malformed. */
+static inline int low_latency_parse_cpus(low_latency_config* ll, const char* list) {
+    int count = 0;
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10), last;
+        if (end == p || first < 0) return -1;
+        last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first) return -1;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            if (count == LOW_LATENCY_MAX_CPUS) return -1;
+            ll->cpus[count++] = (int)cpu;
+        }
+        if (*p == ',') p++;
+        else if (*p != '\0') return -1;
+    }
+    if (count == 0) return -1;
+    ll->cpu_count = count;
+    return 0;
+}
+
+/* SO_BUSY_POLL on one socket; 0 if set (or nothing to set), -1 with errno otherwise */
+static inline int low_latency_socket(int fd, const low_latency_config* ll) {
+    if (!ll->enabled || ll->busy_poll_us <= 0) return 0;
+#ifdef __linux__
+    int us = ll->busy_poll_us, prefer = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) != 0) return -1;
+    /* Keeps the NIC's interrupts deferred while this socket is being polled; older kernels lack it */
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+    return 0;
+#else
+    (void)fd;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* The core the index-th thread is pinned to, or -1 without --cpus */
+static inline int low_latency_cpu(const low_latency_config* ll, int index) {
+    return ll->cpu_count > 0 ? ll->cpus[index % ll->cpu_count] : -1;
+}
+
+/*
+ * Pins the calling thread to low_latency_cpu(index) and, if asked, makes it
+ * SCHED_FIFO. Returns 0, or -1 with errno set by the first setting that failed
+ * (the pin is kept even if the priority could not be raised).
+ */
+static inline int low_latency_thread(const low_latency_config* ll, int index) {
+    if (!ll->enabled) return 0;
+#ifdef __linux__
+    int cpu = low_latency_cpu(ll, index);
+    if (cpu < 0) return 0;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+    if (ll->fifo_priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = ll->fifo_priority;
+        rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (rc != 0) {
+            errno = rc;
+            return -1;
+        }
+    }
+    return 0;
+#else
+    (void)index;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* One iteration of a spin-wait: lets the sibling hyperthread run and saves power */
+static inline void low_latency_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#endif /* LOW_LATENCY_H */
@@ -0,0 +1,289 @@
+/*
+ * net_sim.h - network impairment for include/transport.h: loss, latency,
+ * jitter, duplication and reordering between in-process endpoints.
+ *
+ * transport_sim_wrap() puts a simulated link in front of another transport's
+ * send path. Every queued datagram is copied into a delay queue with the time
+ * it is due; transport_flush and transport_recv release the due ones to the
+ * wrapped transport. Receiving is passed straight through, so wrapping every
+ * endpoint of a transport_loopback_net impairs each direction once:
+ *
+ *   net_sim_config link;
+ *   net_sim_config_init(&link);
+ *   link.loss = 0.02; link.latency_us = 40000; link.jitter_us = 5000;
+ *   transport* t = transport_sim_wrap(transport_loopback_open(net, i), &link, 1200, seed);
+ *   transport_queue(t, dest, &addr, data, len);   // maybe lost, maybe twice, later
+ *   transport_flush(t);                           // sends what is due by now
+ *
+ * Each datagram is delayed by latency_us plus a uniform jitter of up to
+ * jitter_us. Order is kept, like a single network path, except for the
+ * datagrams picked for reordering (probability `reorder`): those are held back
+ * an extra reorder_us and overtaken. A duplicate is an independent second
+ * copy. Datagrams that find the delay queue full (max_pending) are dropped, as
+ * a router queue would drop them.
+ *
+ * Time is CLOCK_MONOTONIC unless a clock is set with transport_sim_set_clock
+ * (e.g. a simulated clock for tests that must not sleep). Randomness is a
+ * per-link xorshift generator, so a seed reproduces a run. A simulated link
+ * belongs to the thread that owns the wrapped transport. Header-only, usable
+ * from C and C++; Linux.
+ */
+#ifndef NET_SIM_H
+#define NET_SIM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "transport.h"
+
+typedef struct net_sim_config {
+    double loss;                         /* 0-1, per datagram */
+    double duplicate;                    /* 0-1, chance of a second copy */
+    double reorder;                      /* 0-1, chance of being held back and overtaken */
+    uint32_t latency_us;                 /* one way */
+    uint32_t jitter_us;                  /* uniform 0..jitter_us on top of the latency */
+    uint32_t reorder_us;                 /* extra delay of a reordered datagram */
+    uint32_t max_pending;                /* datagrams the delay queue holds */
+} net_sim_config;
+
+typedef struct net_sim_stats {
+    uint64_t queued;                     /* datagrams handed to the link */
+    uint64_t lost;
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t overflowed;                 /* delay queue full */
+    uint64_t delivered;                  /* passed on to the wrapped transport */
+    uint32_t pending;
+    uint32_t high_water;                 /* most datagrams ever in the delay queue */
+} net_sim_stats;
+
+typedef uint64_t (*net_sim_clock_fn)(void* context);
+
+/* One delayed datagram; the payload lives in the link's slab at slot * max_datagram */
+typedef struct net_sim_pending {
+    uint64_t due_ns;
+    uint64_t order;                      /* ties: first queued, first out */
+    struct sockaddr_in addr;
+    uint32_t dest;
+    uint32_t length;
+    uint32_t slot;
+} net_sim_pending;
+
+typedef struct transport_sim {
+    transport base;
+    transport* inner;
+    net_sim_config config;
+    net_sim_stats sim;
+    uint64_t rng;
+    uint64_t order;
+    uint64_t last_due_ns;                /* latest in-order due time, keeps the path FIFO */
+    net_sim_clock_fn clock;
+    void* clock_context;
+    uint32_t max_datagram;
+    net_sim_pending* heap;               /* min-heap on (due_ns, order) */
+    uint32_t* free_slots;
+    uint32_t free_count;
+    unsigned char* payloads;             /* max_pending x max_datagram */
+} transport_sim;
+
+static inline void net_sim_config_init(net_sim_config* config) {
+    memset(config, 0, sizeof(*config));
+    config->reorder_us = 20000;
+    config->max_pending = 65536;
+}
+
+static inline uint64_t net_sim_monotonic_ns(void* context) {
+    (void)context;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static inline uint64_t net_sim_next(transport_sim* s) {
+    uint64_t x = s->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    s->rng = x;
+    return x;
+}
+
+/* Uniform in [0, 1) */
+static inline double net_sim_uniform(transport_sim* s) {
+    return (double)(net_sim_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline int net_sim_before(const net_sim_pending* a, const net_sim_pending* b) {
+    return a->due_ns < b->due_ns || (a->due_ns == b->due_ns && a->order < b->order);
+}
+
+static inline void net_sim_push(transport_sim* s, const net_sim_pending* item) {
+    uint32_t i = s->sim.pending++;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!net_sim_before(item, &s->heap[parent])) break;
+        s->heap[i] = s->heap[parent];
+        i = parent;
+    }
+    s->heap[i] = *item;
+    if (s->sim.pending > s->sim.high_water) s->sim.high_water = s->sim.pending;
+}
+
+static inline void net_sim_pop(transport_sim* s) {
+    net_sim_pending last = s->heap[--s->sim.pending];
+    uint32_t i = 0, n = s->sim.pending;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && net_sim_before(&s->heap[child + 1], &s->heap[child])) child++;
+        if (!net_sim_before(&s->heap[child], &last)) break;
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    if (n > 0) s->heap[i] = last;
+}
+
+/* Copies one datagram into the delay queue, due at due_ns */
+static inline void net_sim_hold(transport_sim* s, uint32_t dest, const struct sockaddr_in* addr, const void* data,
+                                uint32_t length, uint64_t due_ns) {
+    if (s->free_count == 0) {
+        s->sim.overflowed++;
+        return;
+    }
+    net_sim_pending item;
+    item.due_ns = due_ns;
+    item.order = s->order++;
+    item.addr = *addr;
+    item.dest = dest;
+    item.length = length;
+    item.slot = s->free_slots[--s->free_count];
+    memcpy(s->payloads + (size_t)item.slot * s->max_datagram, data, length);
+    net_sim_push(s, &item);
+}
+
+/* Hands every due datagram to the wrapped transport and flushes it */
+static inline void net_sim_release(transport_sim* s) {
+    if (s->sim.pending == 0) return;
+    uint64_t now = s->clock(s->clock_context);
+    uint32_t released = 0;
+    while (s->sim.pending > 0 && s->heap[0].due_ns <= now) {
+        const net_sim_pending* item = &s->heap[0];
+        uint32_t slot = item->slot;
+        transport_queue(s->inner, item->dest, &item->addr, s->payloads + (size_t)slot * s->max_datagram, item->length);
+        s->free_slots[s->free_count++] = slot;
+        net_sim_pop(s);
+        released++;
+    }
+    if (released > 0) {
+        /* A udp inner transport still points into the freed slots; nothing can reuse
+         * them before this flush, since only transport_sim_queue takes slots */
+        transport_flush(s->inner);
+        s->sim.delivered += released;
+    }
+}
+
+static inline int transport_sim_recv(transport* t, transport_datagram* out, int max) {
+    transport_sim* s = (transport_sim*)t;
+    net_sim_release(s);
+    int n = transport_recv(s->inner, out, max);
+    t->stats.received += (uint64_t)n;
+    return n;
+}
+
+static inline int transport_sim_queue(transport* t, uint32_t dest, const struct sockaddr_in* addr, const void* data, uint32_t length) {
+    transport_sim* s = (transport_sim*)t;
+    if (length > s->max_datagram) {
+        t->stats.dropped++;
+        return -1;
+    }
+    s->sim.queued++;
+    if (s->config.loss > 0.0 && net_sim_uniform(s) < s->config.loss) {
+        s->sim.lost++;
+        return 0; /* Lost on the way: the sender cannot tell */
+    }
+    uint64_t now = s->clock(s->clock_context);
+    int copies = s->config.duplicate > 0.0 && net_sim_uniform(s) < s->config.duplicate ? 2 : 1;
+    if (copies == 2) s->sim.duplicated++;
+    for (int c = 0; c < copies; ++c) {
+        uint64_t due = now + (uint64_t)s->config.latency_us * 1000;
+        if (s->config.jitter_us > 0) due += net_sim_next(s) % ((uint64_t)s->config.jitter_us * 1000 + 1);
+        if (s->config.reorder > 0.0 && net_sim_uniform(s) < s->config.reorder) {
+            due += (uint64_t)s->config.reorder_us * 1000;
+            s->sim.reordered++;
+        } else {
+            if (due < s->last_due_ns) due = s->last_due_ns; /* Jitter alone never reorders a path */
+            s->last_due_ns = due;
+        }
+        net_sim_hold(s, dest, addr, data, length, due);
+    }
+    return 0;
+}
+
+static inline void transport_sim_flush(transport* t) {
+    transport_sim* s = (transport_sim*)t;
+    net_sim_release(s);
+    t->stats.sent = s->inner->stats.sent;
+    t->stats.dropped = s->inner->stats.dropped + s->sim.lost + s->sim.overflowed;
+    t->stats.syscalls = s->inner->stats.syscalls;
+}
+
+/* Destroys the wrapped transport too; datagrams still in the delay queue are lost */
+static inline void transport_sim_destroy(transport* t) {
+    transport_sim* s = (transport_sim*)t;
+    transport_destroy(s->inner);
+    free(s->heap);
+    free(s->free_slots);
+    free(s->payloads);
+    free(s);
+}
+
+static const transport_ops transport_sim_ops = {
+    "sim", transport_sim_recv, transport_sim_queue, transport_sim_flush, transport_sim_destroy
+};
+
+/* Takes ownership of inner. max_datagram: largest payload the link carries. NULL if
+ * inner is NULL or memory ran out (inner is destroyed then). */
+static inline transport* transport_sim_wrap(transport* inner, const net_sim_config* config, uint32_t max_datagram, uint64_t seed) {
+    if (inner == NULL) return NULL;
+    transport_sim* s = (transport_sim*)calloc(1, sizeof(transport_sim));
+    uint32_t capacity = config->max_pending > 0 ? config->max_pending : 1;
+    if (s != NULL) {
+        s->heap = (net_sim_pending*)malloc(capacity * sizeof(net_sim_pending));
+        s->free_slots = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+        s->payloads = (unsigned char*)malloc((size_t)capacity * max_datagram);
+    }
+    if (s == NULL || !s->heap || !s->free_slots || !s->payloads) {
+        if (s) {
+            free(s->heap);
+            free(s->free_slots);
+            free(s->payloads);
+            free(s);
+        }
+        transport_destroy(inner);
+        return NULL;
+    }
+    s->base.ops = &transport_sim_ops;
+    s->inner = inner;
+    s->config = *config;
+    s->config.max_pending = capacity;
+    s->rng = seed ? seed : 0x9E3779B97F4A7C15ull;
+    s->clock = net_sim_monotonic_ns;
+    s->max_datagram = max_datagram;
+    for (uint32_t i = 0; i < capacity; ++i) s->free_slots[i] = capacity - 1 - i;
+    s->free_count = capacity;
+    return &s->base;
+}
+
+static inline void transport_sim_set_clock(transport* t, net_sim_clock_fn clock, void* context) {
+    transport_sim* s = (transport_sim*)t;
+    s->clock = clock ? clock : net_sim_monotonic_ns;
+    s->clock_context = context;
+}
+
+static inline const net_sim_stats* transport_sim_stats(const transport* t) {
+    return &((const transport_sim*)t)->sim;
+}
+
+#endif /* NET_SIM_H */
@@ -0,0 +1,358 @@
+/*
+ * netlog.h - asynchronous binary logging for the UDP servers.
+ *
+ * The hot path never formats text or touches stdout. Each thread that logs
+ * gets its own single-producer/single-consumer ring of fixed 64-byte binary
+ * records; a background drainer thread pops them, formats them with the
+ * record's format callback and writes them out in large buffered chunks.
+ *
+ *   netlog_set_category(LOG_NET, "net", 1, 1000);   // every record, max 1000/s
+ *   netlog_start(stdout);
+ *   netlog_write(LOG_NET, format_recv, id, ip, port, 0);
+ *   netlog_shutdown();                               // drains what is left
+ *
+ * Per-category sampling ("keep 1 of every N") and rate limits ("at most N per
+ * second") are applied per thread before the record is written, and every
+ * record that is not written is counted: ring full, sampled out, rate limited,
+ * or no ring at all (more than NETLOG_MAX_THREADS threads logging at once).
+ *
+ * A thread claims one of NETLOG_MAX_THREADS ring slots the first time it logs
+ * and gives it back when it exits; the drainer empties a given-back ring before
+ * another thread may claim it, and its memory is reused rather than freed.
+ *
+ * Header-only and usable from both C (meta_server.c) and C++ (Udpserver.cpp);
+ * include it from exactly one translation unit per program. Needs POSIX
+ * threads and the GCC/Clang __atomic builtins.
+ */
+#ifndef NETLOG_H
+#define NETLOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define NETLOG_RING_CAPACITY 4096   /* records per thread, must be a power of two */
+#define NETLOG_MAX_THREADS 64
+#define NETLOG_MAX_CATEGORIES 16
+#define NETLOG_PAYLOAD_BYTES 40
+#define NETLOG_IDLE_SLEEP_NS 1000000 /* drainer naps 1 ms when every ring is empty */
+
+typedef struct netlog_record netlog_record;
+
+/* Turns one record into text on the drainer thread. */
+typedef void (*netlog_format_fn)(FILE* out, const netlog_record* record);
+
+/* Exactly one cache line. */
+struct netlog_record {
+    uint64_t timestamp_ns;              /* CLOCK_MONOTONIC_COARSE at the call site */
+    netlog_format_fn format;
+    uint16_t category;
+    uint16_t length;                    /* bytes used in payload.bytes, if any */
+    uint32_t tag;                       /* free for the caller, e.g. a full message length */
+    union {
+        uint64_t u[NETLOG_PAYLOAD_BYTES / 8];
+        unsigned char bytes[NETLOG_PAYLOAD_BYTES];
+    } payload;
+};
+
+typedef struct netlog_category {
+    const char* name;
+    uint32_t sample_every;              /* 0 or 1 keeps every record */
+    uint32_t max_per_second;            /* 0 means unlimited */
+} netlog_category;
+
+typedef struct netlog_stats {
+    uint64_t written;
+    uint64_t dropped_full;
+    uint64_t sampled_out;
+    uint64_t rate_limited;
+    uint64_t dropped_no_ring;           /* threads beyond NETLOG_MAX_THREADS */
+} netlog_stats;
+
+/* Slot states in netlog_slot_state */
+#define NETLOG_SLOT_FREE 0              /* no owner; its ring, if any, is drained */
+#define NETLOG_SLOT_OWNED 1
+#define NETLOG_SLOT_RELEASED 2          /* owner exited; the drainer frees it once empty */
+
+typedef struct netlog_ring {
+    /* Producer side */
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail_cache;
+    uint64_t written;
+    uint64_t dropped_full;
+    uint64_t sampled_out;
+    uint64_t rate_limited;
+    uint32_t sample_counter[NETLOG_MAX_CATEGORIES];
+    uint32_t window_count[NETLOG_MAX_CATEGORIES];
+    uint64_t window_id[NETLOG_MAX_CATEGORIES];
+
+    /* Consumer side */
+    uint64_t tail __attribute__((aligned(64)));
+
+    netlog_record records[NETLOG_RING_CAPACITY] __attribute__((aligned(64)));
+} netlog_ring;
+
+static netlog_category netlog_categories[NETLOG_MAX_CATEGORIES];
+static netlog_ring* netlog_rings[NETLOG_MAX_THREADS];
+static uint32_t netlog_slot_state[NETLOG_MAX_THREADS];
+static uint64_t netlog_dropped_no_ring;
+static __thread netlog_ring* netlog_thread_ring;
+static __thread int netlog_thread_no_ring;  /* every slot was taken; not retried */
+static pthread_key_t netlog_thread_key;
+static pthread_once_t netlog_thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_t netlog_drainer;
+static FILE* netlog_out;
+static int netlog_running;
+static int netlog_stop_requested;
+
+/* Stores doubles in the integer payload slots and reads them back. */
+static inline uint64_t netlog_f64(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline double netlog_as_f64(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Configure categories before netlog_start(); they are read without locks afterwards. */
+static inline void netlog_set_category(uint16_t category, const char* name, uint32_t sample_every, uint32_t max_per_second) {
+    if (category >= NETLOG_MAX_CATEGORIES) return;
+    netlog_categories[category].name = name;
+    netlog_categories[category].sample_every = sample_every;
+    netlog_categories[category].max_per_second = max_per_second;
+}
+
+/* Thread-exit destructor: hands the slot back, at once if its ring is already empty. */
+static void netlog_release_thread(void* arg) {
+    uint32_t slot = (uint32_t)(uintptr_t)arg - 1;
+    netlog_ring* ring = netlog_rings[slot];
+    netlog_thread_ring = NULL;
+    int empty = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head;
+    __atomic_store_n(&netlog_slot_state[slot], empty ? NETLOG_SLOT_FREE : NETLOG_SLOT_RELEASED, __ATOMIC_RELEASE);
+}
+
+static void netlog_create_thread_key(void) {
+    pthread_key_create(&netlog_thread_key, netlog_release_thread);
+}
+
+/* Claims a free slot for the calling thread, allocating its ring the first time the
+   slot is used; NULL if every slot is taken. Tried once per thread. */
+static inline netlog_ring* netlog_register_thread(void) {
+    pthread_once(&netlog_thread_key_once, netlog_create_thread_key);
+    for (uint32_t slot = 0; slot < NETLOG_MAX_THREADS; ++slot) {
+        uint32_t expected = NETLOG_SLOT_FREE;
+        if (__atomic_load_n(&netlog_slot_state[slot], __ATOMIC_RELAXED) != NETLOG_SLOT_FREE
+            || !__atomic_compare_exchange_n(&netlog_slot_state[slot], &expected, NETLOG_SLOT_OWNED, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        netlog_ring* ring = netlog_rings[slot];
+        if (ring == NULL) {
+            if (posix_memalign((void**)&ring, 64, sizeof(netlog_ring)) != 0) {
+                __atomic_store_n(&netlog_slot_state[slot], NETLOG_SLOT_FREE, __ATOMIC_RELEASE);
+                break;
+            }
+            memset(ring, 0, sizeof(netlog_ring));
+            __atomic_store_n(&netlog_rings[slot], ring, __ATOMIC_RELEASE);
+        } else {
+            /* A previous thread's ring: counters and positions carry on */
+            memset(ring->sample_counter, 0, sizeof(ring->sample_counter));
+            memset(ring->window_count, 0, sizeof(ring->window_count));
+            memset(ring->window_id, 0, sizeof(ring->window_id));
+        }
+        pthread_setspecific(netlog_thread_key, (void*)(uintptr_t)(slot + 1));
+        netlog_thread_ring = ring;
+        return ring;
+    }
+    netlog_thread_no_ring = 1;
+    return NULL;
+}
+
+/* Applies sampling and rate limits, then reserves the next record or returns NULL. */
+static inline netlog_record* netlog_begin(uint16_t category, netlog_format_fn format) {
+    netlog_ring* ring = netlog_thread_ring;
+    if (__builtin_expect(ring == NULL, 0)) {
+        ring = netlog_thread_no_ring ? NULL : netlog_register_thread();
+        if (ring == NULL) {
+            __atomic_fetch_add(&netlog_dropped_no_ring, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+    if (category >= NETLOG_MAX_CATEGORIES) category = 0;
+    const netlog_category* config = &netlog_categories[category];
+
+    if (config->sample_every > 1 && ++ring->sample_counter[category] % config->sample_every != 0) {
+        __atomic_store_n(&ring->sampled_out, ring->sampled_out + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    uint64_t timestamp = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+
+    if (config->max_per_second > 0) {
+        uint64_t window = timestamp >> 30; /* ~1.07 s windows, avoids a division */
+        if (ring->window_id[category] != window) {
+            ring->window_id[category] = window;
+            ring->window_count[category] = 0;
+        }
+        if (++ring->window_count[category] > config->max_per_second) {
+            __atomic_store_n(&ring->rate_limited, ring->rate_limited + 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+
+    if (ring->head - ring->tail_cache >= NETLOG_RING_CAPACITY) {
+        ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (ring->head - ring->tail_cache >= NETLOG_RING_CAPACITY) {
+            __atomic_store_n(&ring->dropped_full, ring->dropped_full + 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+
+    netlog_record* record = &ring->records[ring->head & (NETLOG_RING_CAPACITY - 1)];
+    record->timestamp_ns = timestamp;
+    record->format = format;
+    record->category = category;
+    record->length = 0;
+    record->tag = 0;
+    return record;
+}
+
+/* Publishes the record returned by the last successful netlog_begin() on this thread. */
+static inline void netlog_commit(void) {
+    netlog_ring* ring = netlog_thread_ring;
+    __atomic_store_n(&ring->written, ring->written + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Common case: up to four integer (or netlog_f64) arguments. */
+static inline void netlog_write(uint16_t category, netlog_format_fn format, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3) {
+    netlog_record* record = netlog_begin(category, format);
+    if (record == NULL) return;
+    record->payload.u[0] = a0;
+    record->payload.u[1] = a1;
+    record->payload.u[2] = a2;
+    record->payload.u[3] = a3;
+    netlog_commit();
+}
+
+/* One integer argument plus the first 32 bytes of a buffer; tag keeps the full length. */
+static inline void netlog_write_bytes(uint16_t category, netlog_format_fn format, uint64_t a0, const void* data, size_t length) {
+    netlog_record* record = netlog_begin(category, format);
+    if (record == NULL) return;
+    record->tag = (uint32_t)length;
+    if (length > NETLOG_PAYLOAD_BYTES - 8) length = NETLOG_PAYLOAD_BYTES - 8;
+    record->payload.u[0] = a0;
+    memcpy(record->payload.bytes + 8, data, length);
+    record->length = (uint16_t)length;
+    netlog_commit();
+}
+
+/* Sums the per-thread counters; safe to call from any thread. */
+static inline netlog_stats netlog_get_stats(void) {
+    netlog_stats stats = {0, 0, 0, 0, 0};
+    stats.dropped_no_ring = __atomic_load_n(&netlog_dropped_no_ring, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < NETLOG_MAX_THREADS; ++i) {
+        netlog_ring* ring = __atomic_load_n(&netlog_rings[i], __ATOMIC_ACQUIRE);
+        if (ring == NULL) continue;
+        stats.written += __atomic_load_n(&ring->written, __ATOMIC_RELAXED);
+        stats.dropped_full += __atomic_load_n(&ring->dropped_full, __ATOMIC_RELAXED);
+        stats.sampled_out += __atomic_load_n(&ring->sampled_out, __ATOMIC_RELAXED);
+        stats.rate_limited += __atomic_load_n(&ring->rate_limited, __ATOMIC_RELAXED);
+    }
+    return stats;
+}
+
+/* Formats everything currently queued; returns the number of records written out. */
+static inline uint64_t netlog_drain_once(void) {
+    uint64_t drained = 0;
+
+    /* Hold the stream lock for the whole sweep so other writers cannot split a line */
+    flockfile(netlog_out);
+    for (uint32_t i = 0; i < NETLOG_MAX_THREADS; ++i) {
+        netlog_ring* ring = __atomic_load_n(&netlog_rings[i], __ATOMIC_ACQUIRE);
+        if (ring == NULL) continue;
+        /* Read before head: a released ring's head is final once this is seen */
+        int released = __atomic_load_n(&netlog_slot_state[i], __ATOMIC_ACQUIRE) == NETLOG_SLOT_RELEASED;
+
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+        for (; tail != head; ++tail) {
+            const netlog_record* record = &ring->records[tail & (NETLOG_RING_CAPACITY - 1)];
+            const char* name = netlog_categories[record->category].name;
+            fprintf(netlog_out, "[%llu.%06llu %s] ",
+                    (unsigned long long)(record->timestamp_ns / 1000000000ull),
+                    (unsigned long long)(record->timestamp_ns % 1000000000ull / 1000ull),
+                    name ? name : "log");
+            record->format(netlog_out, record);
+            fputc('\n', netlog_out);
+            drained++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        if (released) __atomic_store_n(&netlog_slot_state[i], NETLOG_SLOT_FREE, __ATOMIC_RELEASE);
+    }
+    funlockfile(netlog_out);
+    return drained;
+}
+
+static void* netlog_drainer_main(void* arg) {
+    (void)arg;
+    uint64_t reported_drops = 0;
+    time_t last_report = 0;
+    for (;;) {
+        int stopping = __atomic_load_n(&netlog_stop_requested, __ATOMIC_ACQUIRE);
+        uint64_t drained = netlog_drain_once();
+
+        /* Drop summaries go out at most once per second */
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        netlog_stats stats = netlog_get_stats();
+        uint64_t drops = stats.dropped_full + stats.rate_limited + stats.dropped_no_ring;
+        if (drops != reported_drops && (now.tv_sec != last_report || stopping)) {
+            last_report = now.tv_sec;
+            fprintf(netlog_out, "[netlog] %llu records dropped so far (%llu ring full, %llu rate limited, %llu no ring)\n",
+                    (unsigned long long)drops, (unsigned long long)stats.dropped_full,
+                    (unsigned long long)stats.rate_limited, (unsigned long long)stats.dropped_no_ring);
+            reported_drops = drops;
+        }
+
+        if (drained > 0) {
+            fflush(netlog_out);
+        } else if (stopping) {
+            break;
+        } else {
+            struct timespec nap = {0, NETLOG_IDLE_SLEEP_NS};
+            nanosleep(&nap, NULL);
+        }
+    }
+    fflush(netlog_out);
+    return NULL;
+}
+
+/* Starts the drainer thread; returns 0 on success. */
+static inline int netlog_start(FILE* out) {
+    if (netlog_running) return 0;
+    netlog_out = out;
+    __atomic_store_n(&netlog_stop_requested, 0, __ATOMIC_RELEASE);
+    if (pthread_create(&netlog_drainer, NULL, netlog_drainer_main, NULL) != 0) return -1;
+    netlog_running = 1;
+    return 0;
+}
+
+/* Drains every ring one last time and stops the drainer thread. */
+static inline void netlog_shutdown(void) {
+    if (!netlog_running) return;
+    __atomic_store_n(&netlog_stop_requested, 1, __ATOMIC_RELEASE);
+    pthread_join(netlog_drainer, NULL);
+    netlog_running = 0;
+}
+
+#endif /* NETLOG_H */
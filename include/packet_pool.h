@@ -0,0 +1,211 @@
+/*
+ * packet_pool.h - reference-counted packet buffers for zero-copy relaying.
+ *
+ * One slab of fixed-size, cache-line-aligned buffers is allocated up front. A
+ * datagram is received straight into a buffer, the buffer is queued to every
+ * recipient by reference (packet_ref per queue), and each queue drops its
+ * reference once the send completed. The last packet_release puts the buffer
+ * back on the free list, so steady-state relaying never calls malloc or free.
+ *
+ *   packet_pool* pool = packet_pool_create(8192, 1200);
+ *   packet_buf* p = packet_pool_alloc(pool);            // refcount 1, or NULL
+ *   p->length = recv(fd, p->data, pool->capacity, 0);
+ *   if (packet_queue_push(&session->sendq, p)) packet_ref(p);
+ *   packet_release(pool, p);                            // drop the receive's reference
+ *
+ * The free list is a lock-free tagged stack and refcounts are atomic, so
+ * buffers may be released on a different thread than they were allocated on.
+ * packet_queue is a bounded FIFO owned by one thread (the session's sender),
+ * with optional latest-wins replacement of position updates.
+ * Header-only, usable from C and C++; needs the GCC/Clang __atomic builtins.
+ */
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACKET_POOL_LINE 64
+#define PACKET_POOL_NONE 0xFFFFFFFFu
+
+typedef struct packet_buf {
+    uint32_t refcount;                   /* atomic */
+    uint32_t length;
+    uint32_t index;                      /* slot in the slab */
+    uint32_t next_free;                  /* free-list link while unused */
+    uint64_t user;                       /* free for the caller, e.g. the sender's session */
+    unsigned char pad[PACKET_POOL_LINE - 24];
+    unsigned char data[];                /* starts on a cache line */
+} packet_buf;
+
+typedef struct packet_pool_stats {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t exhausted;                  /* allocations that found the pool empty */
+    uint32_t in_use;
+    uint32_t high_water;                 /* most buffers ever in use at once */
+} packet_pool_stats;
+
+typedef struct packet_pool {
+    unsigned char* slab;
+    size_t stride;                       /* bytes per buffer, a multiple of PACKET_POOL_LINE */
+    uint32_t count;
+    uint32_t capacity;                   /* payload bytes per buffer */
+    uint64_t free_head;                  /* atomic: ABA tag << 32 | index */
+    packet_pool_stats stats;             /* atomic counters; read with packet_pool_get_stats */
+} packet_pool;
+
+static inline packet_buf* packet_pool_at(const packet_pool* pool, uint32_t index) {
+    return (packet_buf*)(pool->slab + (size_t)index * pool->stride);
+}
+
+static inline void packet_pool_destroy(packet_pool* pool) {
+    if (pool == NULL) return;
+    free(pool->slab);
+    free(pool);
+}
+
+static inline packet_pool* packet_pool_create(uint32_t count, uint32_t capacity) {
+    packet_pool* pool = (packet_pool*)calloc(1, sizeof(packet_pool));
+    if (pool == NULL || count == 0 || count == PACKET_POOL_NONE) {
+        free(pool);
+        return NULL;
+    }
+    size_t stride = (sizeof(packet_buf) + capacity + PACKET_POOL_LINE - 1) & ~(size_t)(PACKET_POOL_LINE - 1);
+    pool->slab = (unsigned char*)aligned_alloc(PACKET_POOL_LINE, stride * count);
+    if (pool->slab == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pool->stride = stride;
+    pool->count = count;
+    pool->capacity = capacity;
+    for (uint32_t i = 0; i < count; ++i) {
+        packet_buf* p = packet_pool_at(pool, i);
+        memset(p, 0, sizeof(packet_buf));
+        p->index = i;
+        p->next_free = i + 1 < count ? i + 1 : PACKET_POOL_NONE;
+    }
+    pool->free_head = 0; /* tag 0, index 0 */
+    return pool;
+}
+
+/* A buffer with refcount 1, or NULL (counted in stats.exhausted) when all are in use */
+static inline packet_buf* packet_pool_alloc(packet_pool* pool) {
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+    packet_buf* p;
+    for (;;) {
+        uint32_t index = (uint32_t)head;
+        if (index == PACKET_POOL_NONE) {
+            __atomic_fetch_add(&pool->stats.exhausted, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        p = packet_pool_at(pool, index);
+        uint32_t next = __atomic_load_n(&p->next_free, __ATOMIC_RELAXED);
+        uint64_t replacement = ((head >> 32) + 1) << 32 | next;
+        if (__atomic_compare_exchange_n(&pool->free_head, &head, replacement, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) break;
+    }
+    __atomic_store_n(&p->refcount, 1, __ATOMIC_RELAXED);
+    p->length = 0;
+    __atomic_fetch_add(&pool->stats.allocs, 1, __ATOMIC_RELAXED);
+    uint32_t in_use = __atomic_add_fetch(&pool->stats.in_use, 1, __ATOMIC_RELAXED);
+    uint32_t high = __atomic_load_n(&pool->stats.high_water, __ATOMIC_RELAXED);
+    while (in_use > high && !__atomic_compare_exchange_n(&pool->stats.high_water, &high, in_use, 1,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return p;
+}
+
+static inline void packet_ref(packet_buf* p) {
+    __atomic_fetch_add(&p->refcount, 1, __ATOMIC_RELAXED);
+}
+
+/* Drops one reference; the last one returns the buffer to the pool */
+static inline void packet_release(packet_pool* pool, packet_buf* p) {
+    if (__atomic_sub_fetch(&p->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+    for (;;) {
+        __atomic_store_n(&p->next_free, (uint32_t)head, __ATOMIC_RELAXED);
+        uint64_t replacement = ((head >> 32) + 1) << 32 | p->index;
+        if (__atomic_compare_exchange_n(&pool->free_head, &head, replacement, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) break;
+    }
+    __atomic_fetch_add(&pool->stats.frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&pool->stats.in_use, 1, __ATOMIC_RELAXED);
+}
+
+static inline packet_pool_stats packet_pool_get_stats(const packet_pool* pool) {
+    packet_pool_stats s;
+    s.allocs = __atomic_load_n(&pool->stats.allocs, __ATOMIC_RELAXED);
+    s.frees = __atomic_load_n(&pool->stats.frees, __ATOMIC_RELAXED);
+    s.exhausted = __atomic_load_n(&pool->stats.exhausted, __ATOMIC_RELAXED);
+    s.in_use = __atomic_load_n(&pool->stats.in_use, __ATOMIC_RELAXED);
+    s.high_water = __atomic_load_n(&pool->stats.high_water, __ATOMIC_RELAXED);
+    return s;
+}
+
+/* --- per-session send queue --- */
+
+#define PACKET_QUEUE_CAPACITY 64         /* power of two */
+
+/* A queue is bounded: when a recipient's link cannot keep up, new packets are
+ * dropped instead of buffered. Packets pushed with a non-zero key (e.g. "move
+ * update from sender 12") are latest-wins: a newer packet replaces a queued one
+ * with the same key in place, so a laggy recipient gets the freshest state at
+ * the old packet's position instead of a backlog of stale updates. */
+typedef struct packet_queue {
+    packet_buf* items[PACKET_QUEUE_CAPACITY];
+    uint32_t keys[PACKET_QUEUE_CAPACITY];/* coalescing key per item, 0 = none */
+    uint32_t head;
+    uint32_t tail;
+    uint64_t drops;                      /* pushes refused because the queue was full */
+    uint64_t coalesced;                  /* queued packets replaced by a newer one */
+} packet_queue;
+
+static inline uint32_t packet_queue_size(const packet_queue* q) {
+    return q->tail - q->head;
+}
+
+/* 1 if queued (the caller then owns one more reference to hand over), 0 if full */
+static inline int packet_queue_push(packet_queue* q, packet_buf* p) {
+    if (q->tail - q->head == PACKET_QUEUE_CAPACITY) {
+        q->drops++;
+        return 0;
+    }
+    q->keys[q->tail & (PACKET_QUEUE_CAPACITY - 1)] = 0;
+    q->items[q->tail++ & (PACKET_QUEUE_CAPACITY - 1)] = p;
+    return 1;
+}
+
+/* Like packet_queue_push, but replaces the queued packet with the same non-zero
+ * key (releasing the queue's reference to it) before trying to append. The queue
+ * must not be in the middle of a send: nothing queued may be held by a fan-out. */
+static inline int packet_queue_push_latest(packet_queue* q, packet_pool* pool, packet_buf* p, uint32_t key) {
+    if (key != 0) {
+        for (uint32_t i = q->head; i != q->tail; ++i) {
+            uint32_t slot = i & (PACKET_QUEUE_CAPACITY - 1);
+            if (q->keys[slot] != key) continue;
+            packet_release(pool, q->items[slot]);
+            q->items[slot] = p;
+            q->coalesced++;
+            return 1;
+        }
+    }
+    if (!packet_queue_push(q, p)) return 0;
+    q->keys[(q->tail - 1) & (PACKET_QUEUE_CAPACITY - 1)] = key;
+    return 1;
+}
+
+/* i-th queued packet from the front, or NULL */
+static inline packet_buf* packet_queue_peek(const packet_queue* q, uint32_t i) {
+    return i < q->tail - q->head ? q->items[(q->head + i) & (PACKET_QUEUE_CAPACITY - 1)] : NULL;
+}
+
+/* Removes the first `count` packets and drops the queue's reference to each */
+static inline void packet_queue_release(packet_queue* q, packet_pool* pool, uint32_t count) {
+    for (uint32_t i = 0; i < count && q->head != q->tail; ++i) {
+        packet_release(pool, q->items[q->head++ & (PACKET_QUEUE_CAPACITY - 1)]);
+    }
+}
+
+#endif /* PACKET_POOL_H */
@@ -0,0 +1,259 @@
+/*
+ * rate_limit.h - per-source token buckets and overload shedding for the UDP servers.
+ *
+ * Every datagram is checked before it is parsed, logged or answered:
+ *
+ *   1. The server-wide bucket (global_rate, global_burst) is the overload
+ *      detector. The emptier it is, the more priority classes are shed, lowest
+ *      first: RATE_LIMIT_LOW below 3/4 full, NORMAL below 1/2, HIGH below 1/4,
+ *      CRITICAL only when it is empty. This is decided before the source is
+ *      even looked up, and shed datagrams spend no tokens.
+ *   2. The source's own bucket (rate tokens per second, up to burst) must hold a
+ *      token, so one flooding endpoint only ever spends its own budget.
+ *
+ *   rate_limit* rl = rate_limit_create(65536, 120, 240, 200000, 50000);
+ *   uint64_t now = ...;                                   // ms, once per receive batch
+ *   if (!rate_limit_check(rl, key, RATE_LIMIT_NORMAL, now)) continue;  // dropped
+ *   rate_limit_age(rl, now, 1000, 4096);                  // now and then, e.g. per tick
+ *
+ * Sources live in a fixed open-addressing table of 16-byte entries (four per
+ * cache line, linear probing, backward-shift deletion). The key is the caller's
+ * choice below 2^63, e.g. ip << 16 | port per endpoint or just the ip. A bucket
+ * that has refilled completely is indistinguishable from a new one, so
+ * rate_limit_age() drops the entries that did and have been silent for a while,
+ * incrementally, and the table only holds recently active sources. Sources that
+ * find the table full, or no free slot within RATE_LIMIT_MAX_PROBE of their home,
+ * share one extra bucket (with the per-source rate and burst) until entries age
+ * out: a flood of spoofed addresses cannot evict real players' buckets, it only
+ * throttles itself and the global budget. Entries only ever move towards their
+ * home slot, so a source that got a slot is always found within the probe limit,
+ * however clustered the flood leaves the table.
+ *
+ * Tokens are fixed point (1/1000 token) and time is integer milliseconds, so a
+ * check is a multiply-shift hash, a short probe and a few integer operations. A
+ * limiter belongs to one thread. Header-only, usable from C and C++.
+ */
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE_LIMIT_PRIORITIES 4
+#define RATE_LIMIT_SCALE 1000u               /* token fixed point: 1/1000 token */
+#define RATE_LIMIT_USED (1ull << 63)         /* set in every stored key; 0 = empty slot */
+#define RATE_LIMIT_MAX_PROBE 16              /* slots looked at per check: four cache lines */
+
+typedef enum rate_limit_priority {
+    RATE_LIMIT_CRITICAL = 0,                 /* shed only once the global budget is gone */
+    RATE_LIMIT_HIGH = 1,
+    RATE_LIMIT_NORMAL = 2,
+    RATE_LIMIT_LOW = 3                       /* shed first */
+} rate_limit_priority;
+
+typedef struct rate_limit_entry {
+    uint64_t key;                            /* source key | RATE_LIMIT_USED */
+    uint32_t tokens;                         /* in 1/RATE_LIMIT_SCALE tokens */
+    uint32_t last_ms;                        /* refill time, wraps every 49 days */
+} rate_limit_entry;
+
+typedef struct rate_limit_stats {
+    uint64_t passed;
+    uint64_t limited;                        /* the source's own bucket was empty */
+    uint64_t shed[RATE_LIMIT_PRIORITIES];    /* dropped by overload, per priority */
+    uint64_t untracked;                      /* checked against the shared bucket, no slot free */
+    uint64_t aged;                           /* entries dropped by rate_limit_age() */
+    uint64_t overloads;                      /* times the global budget fell below 3/4 */
+    uint32_t sources;                        /* entries in the table */
+    uint32_t overloaded;                     /* currently shedding RATE_LIMIT_LOW */
+} rate_limit_stats;
+
+typedef struct rate_limit {
+    rate_limit_entry* slots;
+    uint32_t mask;                           /* slot count - 1 */
+    uint32_t shift;                          /* 64 - log2(slot count) */
+    uint32_t max_sources;                    /* 3/4 of the slots, keeps probes short */
+    uint32_t age_cursor;
+    uint32_t rate;                           /* per source: tokens per second = fixed point per ms */
+    uint32_t burst;                          /* fixed point */
+    uint32_t global_rate;
+    uint32_t global_burst;
+    uint32_t global_tokens;
+    uint32_t global_last_ms;
+    uint32_t shed_below[RATE_LIMIT_PRIORITIES];  /* global tokens under which a class is shed */
+    rate_limit_entry shared;                 /* bucket of the sources that did not fit */
+    rate_limit_stats stats;
+} rate_limit;
+
+static inline void rate_limit_destroy(rate_limit* rl) {
+    if (rl == NULL) return;
+    free(rl->slots);
+    free(rl);
+}
+
+/*
+ * max_sources: sources tracked at once. rate / burst: per source, in datagrams per
+ * second and datagrams. global_rate / global_burst: the whole server; a global_rate
+ * of 0 turns overload shedding off. Burst and rate are clamped to 4 million.
+ */
+static inline rate_limit* rate_limit_create(uint32_t max_sources, uint32_t rate, uint32_t burst,
+                                            uint32_t global_rate, uint32_t global_burst) {
+    rate_limit* rl = (rate_limit*)calloc(1, sizeof(rate_limit));
+    if (rl == NULL) return NULL;
+    const uint32_t limit = 4000000;
+    rate = rate < 1 ? 1 : rate > limit ? limit : rate;
+    burst = burst < 1 ? 1 : burst > limit ? limit : burst;
+    global_rate = global_rate > limit ? limit : global_rate;
+    global_burst = global_burst < 1 ? 1 : global_burst > limit ? limit : global_burst;
+
+    uint32_t slots = 16, bits = 4;
+    while (slots < max_sources + max_sources / 3 && bits < 31) {
+        slots <<= 1;
+        bits++;
+    }
+    rl->slots = (rate_limit_entry*)calloc(slots, sizeof(rate_limit_entry));
+    if (rl->slots == NULL) {
+        rate_limit_destroy(rl);
+        return NULL;
+    }
+    rl->mask = slots - 1;
+    rl->shift = 64 - bits;
+    rl->max_sources = slots / 4 * 3;
+    rl->rate = rate;
+    rl->burst = burst * RATE_LIMIT_SCALE;
+    rl->global_rate = global_rate;
+    rl->global_burst = global_burst * RATE_LIMIT_SCALE;
+    rl->global_tokens = rl->global_burst;
+    for (int p = 0; p < RATE_LIMIT_PRIORITIES; ++p) {
+        uint32_t below = (uint32_t)((uint64_t)rl->global_burst * (uint32_t)p / RATE_LIMIT_PRIORITIES);
+        rl->shed_below[p] = below > RATE_LIMIT_SCALE ? below : RATE_LIMIT_SCALE; /* Never spend the last fraction */
+    }
+    rl->shared.tokens = rl->burst;
+    return rl;
+}
+
+static inline uint32_t rate_limit_slot(const rate_limit* rl, uint64_t key) {
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> rl->shift);
+}
+
+/* Adds the tokens earned since last_ms, capped at burst, and takes one if there is one */
+static inline int rate_limit_take(uint32_t* tokens, uint32_t* last_ms, uint32_t now, uint32_t rate, uint32_t burst) {
+    uint32_t elapsed = now - *last_ms;
+    if (elapsed > 0) {
+        uint64_t refilled = (uint64_t)*tokens + (uint64_t)elapsed * rate;
+        *tokens = refilled > burst ? burst : (uint32_t)refilled;
+        *last_ms = now;
+    }
+    if (*tokens < RATE_LIMIT_SCALE) return 0;
+    *tokens -= RATE_LIMIT_SCALE;
+    return 1;
+}
+
+/* Refills the global budget; 1 if datagrams of this priority are being shed */
+static inline int rate_limit_shed(rate_limit* rl, rate_limit_priority priority, uint32_t now) {
+    if (rl->global_rate == 0) return 0;
+    uint32_t elapsed = now - rl->global_last_ms;
+    if (elapsed > 0) {
+        uint64_t refilled = (uint64_t)rl->global_tokens + (uint64_t)elapsed * rl->global_rate;
+        rl->global_tokens = refilled > rl->global_burst ? rl->global_burst : (uint32_t)refilled;
+        rl->global_last_ms = now;
+    }
+    uint32_t overloaded = rl->global_tokens < rl->shed_below[RATE_LIMIT_LOW];
+    if (overloaded && !rl->stats.overloaded) rl->stats.overloads++;
+    rl->stats.overloaded = overloaded;
+    if (rl->global_tokens >= rl->shed_below[priority]) return 0;
+    rl->stats.shed[priority]++;
+    return 1;
+}
+
+/*
+ * 1 if the datagram from key may be processed, 0 to drop it unread. now_ms is any
+ * millisecond clock; reading it once per receive batch is enough. Shedding comes
+ * first, so under overload the low classes are dropped without a table lookup and
+ * never take table space from the sources still being served.
+ */
+static inline int rate_limit_check(rate_limit* rl, uint64_t key, rate_limit_priority priority, uint64_t now_ms) {
+    uint32_t now = (uint32_t)now_ms;
+    if (rate_limit_shed(rl, priority, now)) return 0;
+
+    uint64_t stored = key | RATE_LIMIT_USED;
+    uint32_t slot = rate_limit_slot(rl, stored);
+    rate_limit_entry* e = &rl->shared;
+    for (uint32_t probe = 0; probe < RATE_LIMIT_MAX_PROBE; ++probe) {
+        rate_limit_entry* candidate = &rl->slots[slot];
+        if (candidate->key == stored) {
+            e = candidate;
+            break;
+        }
+        if (candidate->key == 0) {
+            if (rl->stats.sources < rl->max_sources) {
+                candidate->key = stored;
+                candidate->tokens = rl->burst;
+                candidate->last_ms = now;
+                rl->stats.sources++;
+                e = candidate;
+            }
+            break;
+        }
+        slot = (slot + 1) & rl->mask;
+    }
+    if (e == &rl->shared) rl->stats.untracked++;
+    if (!rate_limit_take(&e->tokens, &e->last_ms, now, rl->rate, rl->burst)) {
+        rl->stats.limited++;
+        return 0;
+    }
+    if (rl->global_rate != 0) rl->global_tokens -= RATE_LIMIT_SCALE; /* At least shed_below[0] left */
+    rl->stats.passed++;
+    return 1;
+}
+
+/* Backward-shift deletion keeps probe chains intact without tombstones */
+static inline void rate_limit_erase(rate_limit* rl, uint32_t slot) {
+    uint32_t next = (slot + 1) & rl->mask;
+    while (rl->slots[next].key != 0) {
+        uint32_t home = rate_limit_slot(rl, rl->slots[next].key);
+        /* Move the entry back unless its home lies cyclically in (slot, next] */
+        if (((next - home) & rl->mask) >= ((next - slot) & rl->mask)) {
+            rl->slots[slot] = rl->slots[next];
+            slot = next;
+        }
+        next = (next + 1) & rl->mask;
+    }
+    rl->slots[slot].key = 0;
+    rl->stats.sources--;
+}
+
+/*
+ * Looks at up to budget slots, resuming where the last call stopped, and drops the
+ * sources that have been silent for idle_ms and whose bucket has refilled
+ * completely. Returns the number dropped. An idle_ms above the sources' usual send
+ * interval keeps steady senders that stay under their rate from being dropped and
+ * re-inserted over and over.
+ */
+static inline uint32_t rate_limit_age(rate_limit* rl, uint64_t now_ms, uint32_t idle_ms, uint32_t budget) {
+    uint32_t now = (uint32_t)now_ms, dropped = 0;
+    uint32_t slot = rl->age_cursor;
+    for (uint32_t n = 0; n < budget && n <= rl->mask; ++n) {
+        rate_limit_entry* e = &rl->slots[slot];
+        /* A completely refilled bucket behaves like a new one */
+        uint32_t idle = now - e->last_ms;
+        if (e->key != 0 && idle >= idle_ms && (uint64_t)e->tokens + (uint64_t)idle * rl->rate >= rl->burst) {
+            rate_limit_erase(rl, slot);
+            dropped++;
+            if (rl->slots[slot].key != 0) continue; /* An entry moved in: look at it again */
+        }
+        slot = (slot + 1) & rl->mask;
+    }
+    rl->age_cursor = slot;
+    rl->stats.aged += dropped;
+    return dropped;
+}
+
+static inline uint64_t rate_limit_dropped(const rate_limit* rl) {
+    uint64_t dropped = rl->stats.limited;
+    for (int p = 0; p < RATE_LIMIT_PRIORITIES; ++p) dropped += rl->stats.shed[p];
+    return dropped;
+}
+
+#endif /* RATE_LIMIT_H */
@@ -0,0 +1,390 @@
+/*
+ * room_router.h - rooms (matches) owned by worker threads, for the relays.
+ *
+ * Every room belongs to exactly one worker of a fixed pool. Everything that
+ * touches a room - its members, their interest grid entries, the fan-out of
+ * its datagrams - runs on the owner, so none of it needs a lock. The receive
+ * thread only posts messages to the owner's inbox:
+ *
+ *   room_router* r = room_router_create(4, 1024, 4096);
+ *   room_router_open(r, room);                               // first join of a match
+ *   room_router_post(r, room, ROOM_MSG_JOIN, session, NULL);
+ *   room_router_post(r, room, ROOM_MSG_PACKET, session, packet);
+ *
+ *   // worker w
+ *   room_msg m;
+ *   while (room_router_next(r, w, &m)) handle(&m);           // then flush, then
+ *   room_router_wait(r, w, 10);                              // sleep until posted to
+ *
+ * Owners report what a room cost them (room_router_account, e.g. recipients
+ * per datagram). room_router_rebalance(), called now and then from one thread,
+ * moves rooms from the busiest workers to the idlest while the gap is large
+ * enough. A move is a message too:
+ *
+ *   ROOM_MSG_MIGRATE  arrives at the old owner, which detaches its room state
+ *                     and calls room_router_handoff(r, w, room, state)
+ *   ROOM_MSG_ADOPT    arrives at the new owner with that state in m.data,
+ *                     before any datagram posted after the handoff
+ *
+ * Messages still queued at the old owner are forwarded by room_router_next,
+ * so a worker only ever sees messages for rooms it owns. Packets may be
+ * reordered across a move; nothing is lost unless an inbox is full.
+ *
+ * Inboxes are bounded multi-producer rings. Packets are refused (the caller
+ * keeps ownership of m.data) when fewer than a quarter of the slots are free;
+ * the rest is reserved for joins, leaves and moves, which wait for a slot
+ * instead of failing. Packets forwarded into a full inbox are passed to the
+ * callback set with room_router_set_drop.
+ *
+ * Header-only, usable from C and C++; Linux (futex) and the GCC/Clang __atomic
+ * builtins. C programs must define _GNU_SOURCE before their first system include.
+ */
+#ifndef ROOM_ROUTER_H
+#define ROOM_ROUTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define ROOM_ROUTER_NONE 0xFFFFFFFFu
+#define ROOM_ROUTER_LINE 64
+#define ROOM_ROUTER_MIN_GAP 0.2          /* rebalance when busiest - idlest > 20% of the mean */
+#define ROOM_ROUTER_MAX_MOVES 16         /* rooms moved per room_router_rebalance */
+
+typedef enum room_msg_kind {
+    ROOM_MSG_PACKET = 0,
+    ROOM_MSG_JOIN = 1,
+    ROOM_MSG_LEAVE = 2,
+    ROOM_MSG_MIGRATE = 3,                /* arg: the worker to hand the room to */
+    ROOM_MSG_ADOPT = 4                   /* data: the room state from the old owner */
+} room_msg_kind;
+
+typedef struct room_msg {
+    uint32_t kind;
+    uint32_t room;
+    uint32_t session;
+    uint32_t arg;
+    void* data;
+} room_msg;
+
+typedef void (*room_drop_fn)(void* user, const room_msg* m);
+
+typedef struct room_inbox_cell {
+    uint64_t seq;
+    room_msg msg;
+} room_inbox_cell;
+
+typedef struct room_router_worker {
+    /* Producers */
+    uint64_t tail;                       /* atomic */
+    uint32_t sleeping;                   /* atomic: the owner is in room_router_wait */
+    uint32_t wake;                       /* atomic futex word */
+    unsigned char pad0[ROOM_ROUTER_LINE - 16];
+    /* Owner */
+    uint64_t head;
+    uint64_t handled;                    /* messages returned by room_router_next */
+    uint64_t load;                       /* atomic: sum of room_router_account */
+    uint32_t rooms;                      /* atomic: rooms owned */
+    uint32_t reserved;
+    room_inbox_cell* cells;
+    unsigned char pad1[ROOM_ROUTER_LINE - 40];
+} room_router_worker;
+
+typedef struct room_router_stats {
+    uint64_t posted;
+    uint64_t refused;                    /* packets refused by room_router_post: inbox nearly full */
+    uint64_t forwarded;                  /* messages that reached an old owner after a move */
+    uint64_t dropped;                    /* forwarded packets that found the new inbox full */
+    uint64_t migrations;
+} room_router_stats;
+
+typedef struct room_router {
+    uint32_t worker_count;
+    uint32_t max_rooms;
+    uint32_t inbox_mask;
+    uint32_t reserve;                    /* slots only control messages may use */
+    room_router_worker* workers;
+    uint32_t* owner;                     /* atomic, per room; ROOM_ROUTER_NONE until opened */
+    uint32_t* migrating;                 /* atomic, per room: a move is in flight */
+    uint64_t* room_load;                 /* atomic, per room */
+    uint64_t* room_seen;                 /* rebalancer: room_load at the last rebalance */
+    uint64_t* room_delta;                /* rebalancer scratch: load since then, per room ... */
+    uint64_t* worker_delta;              /* ... and per worker, with the planned moves applied */
+    room_drop_fn drop;
+    void* drop_user;
+    room_router_stats stats;             /* atomic counters */
+} room_router;
+
+static inline void room_router_destroy(room_router* r) {
+    if (r == NULL) return;
+    if (r->workers) {
+        for (uint32_t w = 0; w < r->worker_count; ++w) free(r->workers[w].cells);
+    }
+    free(r->workers);
+    free(r->owner);
+    free(r->migrating);
+    free(r->room_load);
+    free(r->room_seen);
+    free(r->room_delta);
+    free(r->worker_delta);
+    free(r);
+}
+
+/* inbox_capacity is rounded up to a power of two (at least 16) */
+static inline room_router* room_router_create(uint32_t worker_count, uint32_t max_rooms, uint32_t inbox_capacity) {
+    if (worker_count == 0 || max_rooms == 0) return NULL;
+    uint32_t capacity = 16;
+    while (capacity < inbox_capacity && capacity < 0x40000000u) capacity <<= 1;
+    room_router* r = (room_router*)calloc(1, sizeof(room_router));
+    if (r == NULL) return NULL;
+    r->worker_count = worker_count;
+    r->max_rooms = max_rooms;
+    r->inbox_mask = capacity - 1;
+    r->reserve = capacity / 4;
+    r->workers = (room_router_worker*)aligned_alloc(ROOM_ROUTER_LINE, worker_count * sizeof(room_router_worker));
+    r->owner = (uint32_t*)malloc(max_rooms * sizeof(uint32_t));
+    r->migrating = (uint32_t*)calloc(max_rooms, sizeof(uint32_t));
+    r->room_load = (uint64_t*)calloc(max_rooms, sizeof(uint64_t));
+    r->room_seen = (uint64_t*)calloc(max_rooms, sizeof(uint64_t));
+    r->room_delta = (uint64_t*)calloc(max_rooms, sizeof(uint64_t));
+    r->worker_delta = (uint64_t*)calloc(worker_count, sizeof(uint64_t));
+    int ok = r->workers && r->owner && r->migrating && r->room_load && r->room_seen && r->room_delta && r->worker_delta;
+    if (r->workers) {
+        memset(r->workers, 0, worker_count * sizeof(room_router_worker));
+        for (uint32_t w = 0; w < worker_count && ok; ++w) {
+            room_router_worker* worker = &r->workers[w];
+            worker->cells = (room_inbox_cell*)calloc(capacity, sizeof(room_inbox_cell));
+            if (worker->cells == NULL) ok = 0;
+            for (uint32_t i = 0; ok && i < capacity; ++i) worker->cells[i].seq = i;
+        }
+    }
+    if (!ok) {
+        room_router_destroy(r);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < max_rooms; ++i) r->owner[i] = ROOM_ROUTER_NONE;
+    return r;
+}
+
+static inline void room_router_set_drop(room_router* r, room_drop_fn drop, void* user) {
+    r->drop = drop;
+    r->drop_user = user;
+}
+
+static inline uint32_t room_router_owner(const room_router* r, uint32_t room) {
+    return room < r->max_rooms ? __atomic_load_n(&r->owner[room], __ATOMIC_ACQUIRE) : ROOM_ROUTER_NONE;
+}
+
+static inline void room_router_wake(room_router_worker* worker) {
+    /* Orders the message store before the sleeping check; pairs with room_router_wait */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&worker->wake, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &worker->wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/* Appends to worker's inbox unless fewer than `keep_free` slots would remain. 1 if queued. */
+static inline int room_inbox_push(room_router* r, uint32_t w, const room_msg* m, uint32_t keep_free) {
+    room_router_worker* worker = &r->workers[w];
+    uint64_t pos = __atomic_load_n(&worker->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        if (keep_free) {
+            uint64_t head = __atomic_load_n(&worker->head, __ATOMIC_RELAXED);
+            if (pos - head + keep_free > r->inbox_mask) return 0;
+        }
+        room_inbox_cell* cell = &worker->cells[pos & r->inbox_mask];
+        uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&worker->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->msg = *m;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                room_router_wake(worker);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0; /* full */
+        } else {
+            pos = __atomic_load_n(&worker->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Control messages may not be lost: wait for the owner to make room */
+static inline void room_inbox_push_wait(room_router* r, uint32_t w, const room_msg* m) {
+    while (!room_inbox_push(r, w, m, 0)) sched_yield();
+}
+
+/* Gives a room to the worker owning the fewest rooms. Returns its owner; a room
+ * that is already open keeps its owner. Rooms are never closed: an empty room
+ * accounts no load, and reusing its id for the next match costs nothing. */
+static inline uint32_t room_router_open(room_router* r, uint32_t room) {
+    if (room >= r->max_rooms) return ROOM_ROUTER_NONE;
+    uint32_t best = 0;
+    for (uint32_t w = 1; w < r->worker_count; ++w) {
+        if (__atomic_load_n(&r->workers[w].rooms, __ATOMIC_RELAXED) < __atomic_load_n(&r->workers[best].rooms, __ATOMIC_RELAXED)) best = w;
+    }
+    uint32_t expected = ROOM_ROUTER_NONE;
+    if (!__atomic_compare_exchange_n(&r->owner[room], &expected, best, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return expected;
+    __atomic_fetch_add(&r->workers[best].rooms, 1, __ATOMIC_RELAXED);
+    return best;
+}
+
+/* Posts to the room's owner. Packets are refused (-1; the caller still owns
+ * data) when the room was never opened or the inbox is nearly full; joins and
+ * leaves wait for a slot. */
+static inline int room_router_post(room_router* r, uint32_t room, room_msg_kind kind, uint32_t session, void* data) {
+    uint32_t owner = room_router_owner(r, room);
+    room_msg m = {(uint32_t)kind, room, session, 0, data};
+    if (owner == ROOM_ROUTER_NONE) {
+        __atomic_fetch_add(&r->stats.refused, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    if (kind == ROOM_MSG_PACKET) {
+        if (!room_inbox_push(r, owner, &m, r->reserve)) {
+            __atomic_fetch_add(&r->stats.refused, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    } else {
+        room_inbox_push_wait(r, owner, &m);
+    }
+    __atomic_fetch_add(&r->stats.posted, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Owner side: what handling a message of this room cost (e.g. recipients) */
+static inline void room_router_account(room_router* r, uint32_t worker, uint32_t room, uint32_t cost) {
+    __atomic_fetch_add(&r->room_load[room], cost, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&r->workers[worker].load, cost, __ATOMIC_RELAXED);
+}
+
+/* Old owner, on ROOM_MSG_MIGRATE: hands the detached room state to m.arg */
+static inline void room_router_handoff(room_router* r, uint32_t worker, const room_msg* migrate, void* state) {
+    uint32_t to = migrate->arg;
+    room_msg adopt = {ROOM_MSG_ADOPT, migrate->room, ROOM_ROUTER_NONE, worker, state};
+    /* ADOPT is queued before the owner changes, so it precedes every later post */
+    room_inbox_push_wait(r, to, &adopt);
+    __atomic_store_n(&r->owner[migrate->room], to, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&r->workers[worker].rooms, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&r->workers[to].rooms, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&r->stats.migrations, 1, __ATOMIC_RELAXED);
+}
+
+/* Owner side: the next message for a room this worker owns. 0 when the inbox is empty. */
+static inline int room_router_next(room_router* r, uint32_t w, room_msg* out) {
+    room_router_worker* worker = &r->workers[w];
+    for (;;) {
+        room_inbox_cell* cell = &worker->cells[worker->head & r->inbox_mask];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != worker->head + 1) return 0;
+        *out = cell->msg;
+        __atomic_store_n(&cell->seq, worker->head + r->inbox_mask + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&worker->head, worker->head + 1, __ATOMIC_RELAXED);
+
+        if (out->kind == ROOM_MSG_ADOPT) {
+            __atomic_store_n(&r->migrating[out->room], 0, __ATOMIC_RELEASE);
+        } else {
+            uint32_t owner = room_router_owner(r, out->room);
+            if (owner != w) {
+                /* Posted before the room moved away: follow it */
+                __atomic_fetch_add(&r->stats.forwarded, 1, __ATOMIC_RELAXED);
+                if (out->kind != ROOM_MSG_PACKET) {
+                    room_inbox_push_wait(r, owner, out);
+                } else if (!room_inbox_push(r, owner, out, r->reserve / 2)) {
+                    __atomic_fetch_add(&r->stats.dropped, 1, __ATOMIC_RELAXED);
+                    if (r->drop) r->drop(r->drop_user, out);
+                }
+                continue;
+            }
+        }
+        worker->handled++;
+        return 1;
+    }
+}
+
+/* Owner side: sleeps until something is posted or timeout_ms passed */
+static inline void room_router_wait(room_router* r, uint32_t w, int timeout_ms) {
+    room_router_worker* worker = &r->workers[w];
+    uint32_t wake = __atomic_load_n(&worker->wake, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+    room_inbox_cell* cell = &worker->cells[worker->head & r->inbox_mask];
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != worker->head + 1) {
+        struct timespec ts = {timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L};
+        syscall(SYS_futex, &worker->wake, FUTEX_WAIT_PRIVATE, wake, &ts, NULL, 0);
+    }
+    __atomic_store_n(&worker->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+/* Evens out the load accounted since the last call: repeatedly moves the room
+ * that best splits the gap between the busiest and the idlest worker, up to
+ * ROOM_ROUTER_MAX_MOVES rooms. Call from one thread, e.g. once a second.
+ * Returns the number of moves started. */
+static inline uint32_t room_router_rebalance(room_router* r) {
+    memset(r->worker_delta, 0, r->worker_count * sizeof(uint64_t));
+    uint64_t total = 0;
+    for (uint32_t room = 0; room < r->max_rooms; ++room) {
+        uint64_t load = __atomic_load_n(&r->room_load[room], __ATOMIC_RELAXED);
+        uint32_t owner = room_router_owner(r, room);
+        r->room_delta[room] = load - r->room_seen[room];
+        r->room_seen[room] = load;
+        if (owner == ROOM_ROUTER_NONE) continue;
+        r->worker_delta[owner] += r->room_delta[room];
+        total += r->room_delta[room];
+    }
+    double mean = (double)total / r->worker_count;
+
+    uint32_t moves = 0;
+    while (moves < ROOM_ROUTER_MAX_MOVES) {
+        uint32_t busiest = 0, idlest = 0;
+        for (uint32_t w = 1; w < r->worker_count; ++w) {
+            if (r->worker_delta[w] > r->worker_delta[busiest]) busiest = w;
+            if (r->worker_delta[w] < r->worker_delta[idlest]) idlest = w;
+        }
+        uint64_t gap = r->worker_delta[busiest] - r->worker_delta[idlest];
+        if (busiest == idlest || gap == 0 || (double)gap <= ROOM_ROUTER_MIN_GAP * mean) break;
+
+        /* The room whose load is closest to half the gap evens the two workers best */
+        uint32_t pick = ROOM_ROUTER_NONE;
+        uint64_t best_error = UINT64_MAX;
+        for (uint32_t room = 0; room < r->max_rooms; ++room) {
+            uint64_t delta = r->room_delta[room];
+            if (delta == 0 || delta >= gap) continue; /* Moving it would not narrow the gap */
+            if (room_router_owner(r, room) != busiest || __atomic_load_n(&r->migrating[room], __ATOMIC_ACQUIRE)) continue;
+            uint64_t error = delta * 2 > gap ? delta * 2 - gap : gap - delta * 2;
+            if (error < best_error) {
+                best_error = error;
+                pick = room;
+            }
+        }
+        if (pick == ROOM_ROUTER_NONE) break;
+
+        __atomic_store_n(&r->migrating[pick], 1, __ATOMIC_RELEASE);
+        room_msg m = {ROOM_MSG_MIGRATE, pick, ROOM_ROUTER_NONE, idlest, NULL};
+        if (!room_inbox_push(r, busiest, &m, 0)) {
+            __atomic_store_n(&r->migrating[pick], 0, __ATOMIC_RELEASE);
+            break;
+        }
+        r->worker_delta[busiest] -= r->room_delta[pick];
+        r->worker_delta[idlest] += r->room_delta[pick];
+        moves++;
+    }
+    return moves;
+}
+
+static inline room_router_stats room_router_get_stats(const room_router* r) {
+    room_router_stats s;
+    s.posted = __atomic_load_n(&r->stats.posted, __ATOMIC_RELAXED);
+    s.refused = __atomic_load_n(&r->stats.refused, __ATOMIC_RELAXED);
+    s.forwarded = __atomic_load_n(&r->stats.forwarded, __ATOMIC_RELAXED);
+    s.dropped = __atomic_load_n(&r->stats.dropped, __ATOMIC_RELAXED);
+    s.migrations = __atomic_load_n(&r->stats.migrations, __ATOMIC_RELAXED);
+    return s;
+}
+
+#endif /* ROOM_ROUTER_H */
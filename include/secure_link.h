@@ -0,0 +1,346 @@
+/*
+ * secure_link.h - stateless connect tokens and per-connection AEAD for the UDP servers.
+ *
+ * A server that creates a session for every source address it hears from can
+ * be filled up by spoofed packets. Here a client has to prove it receives
+ * packets at its address before the server keeps anything for it:
+ *
+ *   client                                  server
+ *   REQUEST   client public key   ------>   nothing stored; replies with
+ *             (padded)                      a token: expiry + random salt +
+ *                                           HMAC(endpoint, expiry, salt,
+ *                                           client key) under a key only
+ *                                           the server knows
+ *             <------   CHALLENGE           server public key + token
+ *   RESPONSE  client public key + token -->  token checked (MAC, expiry,
+ *                                           same endpoint): only now is a
+ *                                           session created, with keys from
+ *                                           an X25519 key exchange hashed
+ *                                           with the salt
+ *             <------   DATA                sealed from here on, both ways
+ *
+ * All three handshake packets are SECURE_LINK_HANDSHAKE_BYTES long, so a
+ * challenge sent to a spoofed address is never larger than the request that
+ * caused it (no amplification). A spoofed REQUEST costs one HMAC and no
+ * memory; only a RESPONSE with a valid token costs a key exchange, and
+ * getting one takes a real round trip from the claimed address.
+ *
+ *   secure_link_keys keys;
+ *   secure_link_keys_generate(&keys);                        // once, at startup
+ *   if (secure_link_type(in, len) == SECURE_LINK_REQUEST)
+ *       n = secure_link_challenge(&keys, endpoint, in, len, now_ms, out);  // 0 if malformed
+ *   if (secure_link_type(in, len) == SECURE_LINK_RESPONSE
+ *       && secure_link_accept(&keys, endpoint, in, len, now_ms, &session) == 0) ... // create the session
+ *   n = secure_link_seal(&session, plain, plain_len, out);   // plain_len + SECURE_LINK_DATA_OVERHEAD
+ *   n = secure_link_open(&session, in, len, plain);          // -1: forged, replayed or malformed
+ *
+ * secure_link_open may decrypt in place (plain = in + SECURE_LINK_DATA_HEADER_BYTES),
+ * so a received datagram needs no second buffer.
+ *
+ * DATA is ChaCha20-Poly1305 (IETF) with one key per direction and a 64-bit
+ * packet counter as the nonce; the receiver keeps a 64-packet replay window,
+ * so reordering is tolerated but every packet is accepted at most once. The
+ * client side (secure_link_client_*) is used by udp_loadgen.cpp. Without a
+ * pinned server key the client trusts the key in the first challenge.
+ *
+ * The counter starts at 0 in every session, so a session must never get keys
+ * an earlier one used. The key exchange alone would repeat them: the server
+ * keypair is static, so a client that handshakes again with the same keypair
+ * (after its session was evicted, or from a new address) would get the same
+ * keys. Each challenge therefore carries a fresh random salt that goes into
+ * the keys, and the client makes a new keypair for every handshake. The same
+ * RESPONSE can still be accepted twice until its token expires; the server
+ * tells a retransmission from a new handshake by the salt
+ * (secure_link_same_handshake) and must not evict a session before its token
+ * has expired, so an idle timeout has to exceed SECURE_LINK_TOKEN_LIFETIME_MS.
+ *
+ * Needs libsodium; its users only include it when built with -DWITH_SODIUM
+ * (the Makefile's WITH_SODIUM=1, the default). A session is 120 bytes and
+ * belongs to one thread; the keys are shared read-only. Header-only, usable
+ * from C and C++.
+ */
+#ifndef SECURE_LINK_H
+#define SECURE_LINK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sodium.h>
+
+#define SECURE_LINK_REQUEST 0xC1
+#define SECURE_LINK_CHALLENGE 0xC2
+#define SECURE_LINK_RESPONSE 0xC3
+#define SECURE_LINK_DATA 0xC4
+#define SECURE_LINK_VERSION 2
+
+#define SECURE_LINK_KEY_BYTES 32             /* crypto_kx public keys and session keys */
+#define SECURE_LINK_MAC_BYTES 32             /* crypto_auth (HMAC-SHA-512-256) */
+#define SECURE_LINK_SALT_BYTES 16            /* per challenge; the crypto_generichash key */
+#define SECURE_LINK_HANDSHAKE_BYTES 96       /* type, version, key, expiry, salt, MAC, padding */
+#define SECURE_LINK_DATA_HEADER_BYTES 9      /* type, u64 counter */
+#define SECURE_LINK_DATA_OVERHEAD (SECURE_LINK_DATA_HEADER_BYTES + 16)
+#ifndef SECURE_LINK_TOKEN_LIFETIME_MS
+#define SECURE_LINK_TOKEN_LIFETIME_MS 5000
+#endif
+
+/* Handshake layout: u8 type, u8 version, key[32], u64 expiry_ms, salt[16], mac[32], zero padding */
+#define SECURE_LINK_KEY_OFFSET 2
+#define SECURE_LINK_EXPIRY_OFFSET (SECURE_LINK_KEY_OFFSET + SECURE_LINK_KEY_BYTES)
+#define SECURE_LINK_SALT_OFFSET (SECURE_LINK_EXPIRY_OFFSET + 8)
+#define SECURE_LINK_MAC_OFFSET (SECURE_LINK_SALT_OFFSET + SECURE_LINK_SALT_BYTES)
+
+typedef struct secure_link_keys {
+    unsigned char token_key[crypto_auth_KEYBYTES];
+    unsigned char public_key[SECURE_LINK_KEY_BYTES];
+    unsigned char secret_key[SECURE_LINK_KEY_BYTES];
+} secure_link_keys;
+
+typedef struct secure_link_session {
+    unsigned char rx_key[SECURE_LINK_KEY_BYTES];
+    unsigned char tx_key[SECURE_LINK_KEY_BYTES];
+    unsigned char salt[SECURE_LINK_SALT_BYTES]; /* of the challenge the keys came from */
+    uint64_t tx_counter;                     /* nonce of the next packet sealed */
+    uint64_t rx_next;                        /* newest counter opened + 1; 0 = none yet */
+    uint64_t rx_bits;                        /* bit i: counter rx_next - 2 - i was opened too */
+    uint64_t opened;
+    uint64_t rejected;                       /* forged, replayed or malformed DATA */
+} secure_link_session;
+
+typedef struct secure_link_client {
+    unsigned char public_key[SECURE_LINK_KEY_BYTES];
+    unsigned char secret_key[SECURE_LINK_KEY_BYTES];
+    unsigned char server_key[SECURE_LINK_KEY_BYTES];
+    int pinned;                              /* server_key given up front */
+    int fresh;                               /* keypair not used by a response yet */
+    int responded;                           /* session holds keys */
+    secure_link_session session;
+} secure_link_client;
+
+static inline void secure_link_put_u64(unsigned char* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static inline uint64_t secure_link_get_u64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+/* Packet type, or 0 if the datagram cannot be one of ours (used before any crypto) */
+static inline int secure_link_type(const unsigned char* data, uint32_t len) {
+    if (len == 0) return 0;
+    switch (data[0]) {
+    case SECURE_LINK_REQUEST:
+    case SECURE_LINK_CHALLENGE:
+    case SECURE_LINK_RESPONSE:
+        return len == SECURE_LINK_HANDSHAKE_BYTES && data[1] == SECURE_LINK_VERSION ? data[0] : 0;
+    case SECURE_LINK_DATA:
+        return len >= SECURE_LINK_DATA_OVERHEAD ? data[0] : 0;
+    default:
+        return 0;
+    }
+}
+
+/* 0, or -1 if libsodium cannot be initialized */
+static inline int secure_link_keys_generate(secure_link_keys* keys) {
+    if (sodium_init() < 0) return -1;
+    randombytes_buf(keys->token_key, sizeof(keys->token_key));
+    return crypto_kx_keypair(keys->public_key, keys->secret_key);
+}
+
+/* HMAC over endpoint, expiry, salt and client key: binds a token to one address and keypair */
+static inline void secure_link_token_mac(const secure_link_keys* keys, uint64_t endpoint, const unsigned char* packet,
+                                         unsigned char* mac) {
+    unsigned char input[8 + 8 + SECURE_LINK_SALT_BYTES + SECURE_LINK_KEY_BYTES];
+    secure_link_put_u64(input, endpoint);
+    memcpy(input + 8, packet + SECURE_LINK_EXPIRY_OFFSET, 8 + SECURE_LINK_SALT_BYTES);
+    memcpy(input + 16 + SECURE_LINK_SALT_BYTES, packet + SECURE_LINK_KEY_OFFSET, SECURE_LINK_KEY_BYTES);
+    crypto_auth(mac, input, sizeof(input), keys->token_key);
+}
+
+/* Turns the key exchange output into the session keys: each one hashed with the
+ * handshake's salt, so no two handshakes share keys even with the same keypairs */
+static inline void secure_link_derive(secure_link_session* session, const unsigned char* salt) {
+    unsigned char shared[SECURE_LINK_KEY_BYTES];
+    memcpy(session->salt, salt, SECURE_LINK_SALT_BYTES);
+    memcpy(shared, session->rx_key, SECURE_LINK_KEY_BYTES);
+    crypto_generichash(session->rx_key, SECURE_LINK_KEY_BYTES, shared, SECURE_LINK_KEY_BYTES, salt, SECURE_LINK_SALT_BYTES);
+    memcpy(shared, session->tx_key, SECURE_LINK_KEY_BYTES);
+    crypto_generichash(session->tx_key, SECURE_LINK_KEY_BYTES, shared, SECURE_LINK_KEY_BYTES, salt, SECURE_LINK_SALT_BYTES);
+    sodium_memzero(shared, sizeof(shared));
+}
+
+/*
+ * Writes the CHALLENGE (SECURE_LINK_HANDSHAKE_BYTES) answering a REQUEST from
+ * endpoint (any 64-bit encoding of the source address, the same one
+ * secure_link_accept gets). Returns its length, or 0 if request is malformed.
+ */
+static inline uint32_t secure_link_challenge(const secure_link_keys* keys, uint64_t endpoint, const unsigned char* request,
+                                             uint32_t len, uint64_t now_ms, unsigned char* out) {
+    if (secure_link_type(request, len) != SECURE_LINK_REQUEST) return 0;
+    unsigned char token[SECURE_LINK_HANDSHAKE_BYTES];
+    memcpy(token, request, SECURE_LINK_HANDSHAKE_BYTES);
+    secure_link_put_u64(token + SECURE_LINK_EXPIRY_OFFSET, now_ms + SECURE_LINK_TOKEN_LIFETIME_MS);
+    randombytes_buf(token + SECURE_LINK_SALT_OFFSET, SECURE_LINK_SALT_BYTES);
+
+    memset(out, 0, SECURE_LINK_HANDSHAKE_BYTES);
+    out[0] = SECURE_LINK_CHALLENGE;
+    out[1] = SECURE_LINK_VERSION;
+    memcpy(out + SECURE_LINK_KEY_OFFSET, keys->public_key, SECURE_LINK_KEY_BYTES);
+    memcpy(out + SECURE_LINK_EXPIRY_OFFSET, token + SECURE_LINK_EXPIRY_OFFSET, 8 + SECURE_LINK_SALT_BYTES);
+    secure_link_token_mac(keys, endpoint, token, out + SECURE_LINK_MAC_OFFSET);
+    return SECURE_LINK_HANDSHAKE_BYTES;
+}
+
+static inline void secure_link_session_init(secure_link_session* session) {
+    session->tx_counter = 0;
+    session->rx_next = 0;
+    session->rx_bits = 0;
+    session->opened = 0;
+    session->rejected = 0;
+}
+
+/*
+ * Checks a RESPONSE from endpoint and derives the session keys. 0 on success,
+ * -1 if the token is forged, expired, for another address or another key.
+ */
+static inline int secure_link_accept(const secure_link_keys* keys, uint64_t endpoint, const unsigned char* response,
+                                     uint32_t len, uint64_t now_ms, secure_link_session* session) {
+    if (secure_link_type(response, len) != SECURE_LINK_RESPONSE) return -1;
+    if (secure_link_get_u64(response + SECURE_LINK_EXPIRY_OFFSET) < now_ms) return -1;
+    if (secure_link_get_u64(response + SECURE_LINK_EXPIRY_OFFSET) > now_ms + SECURE_LINK_TOKEN_LIFETIME_MS) return -1;
+    unsigned char mac[SECURE_LINK_MAC_BYTES];
+    secure_link_token_mac(keys, endpoint, response, mac);
+    if (sodium_memcmp(mac, response + SECURE_LINK_MAC_OFFSET, SECURE_LINK_MAC_BYTES) != 0) return -1;
+    if (crypto_kx_server_session_keys(session->rx_key, session->tx_key, keys->public_key, keys->secret_key,
+                                      response + SECURE_LINK_KEY_OFFSET) != 0) return -1;
+    secure_link_derive(session, response + SECURE_LINK_SALT_OFFSET);
+    secure_link_session_init(session);
+    return 0;
+}
+
+/* Same salt: a retransmitted RESPONSE of an established session, not a new handshake */
+static inline int secure_link_same_handshake(const secure_link_session* a, const secure_link_session* b) {
+    return sodium_memcmp(a->salt, b->salt, SECURE_LINK_SALT_BYTES) == 0;
+}
+
+static inline void secure_link_nonce(unsigned char* nonce, uint64_t counter) {
+    memset(nonce, 0, crypto_aead_chacha20poly1305_ietf_NPUBBYTES);
+    secure_link_put_u64(nonce + 4, counter);
+}
+
+/* Seals len bytes into a DATA datagram at out; returns len + SECURE_LINK_DATA_OVERHEAD */
+static inline uint32_t secure_link_seal(secure_link_session* session, const unsigned char* plain, uint32_t len,
+                                        unsigned char* out) {
+    unsigned char nonce[crypto_aead_chacha20poly1305_ietf_NPUBBYTES];
+    uint64_t counter = session->tx_counter++;
+    out[0] = SECURE_LINK_DATA;
+    secure_link_put_u64(out + 1, counter);
+    secure_link_nonce(nonce, counter);
+    unsigned long long sealed = 0;
+    crypto_aead_chacha20poly1305_ietf_encrypt(out + SECURE_LINK_DATA_HEADER_BYTES, &sealed, plain, len,
+                                              out, SECURE_LINK_DATA_HEADER_BYTES, NULL, nonce, session->tx_key);
+    return SECURE_LINK_DATA_HEADER_BYTES + (uint32_t)sealed;
+}
+
+/*
+ * Opens a DATA datagram into plain (len - SECURE_LINK_DATA_OVERHEAD bytes).
+ * Returns the plaintext length, or -1 if it is forged, malformed or a replay.
+ */
+static inline int secure_link_open(secure_link_session* session, const unsigned char* in, uint32_t len, unsigned char* plain) {
+    if (secure_link_type(in, len) != SECURE_LINK_DATA) {
+        session->rejected++;
+        return -1;
+    }
+    uint64_t counter = secure_link_get_u64(in + 1);
+    if (counter + 1 <= session->rx_next) {
+        uint64_t back = session->rx_next - 2 - counter; /* 0 = the packet before the newest */
+        if (counter + 1 == session->rx_next || back >= 64 || (session->rx_bits >> back) & 1) {
+            session->rejected++;
+            return -1;
+        }
+    }
+    unsigned char nonce[crypto_aead_chacha20poly1305_ietf_NPUBBYTES];
+    secure_link_nonce(nonce, counter);
+    unsigned long long opened = 0;
+    if (crypto_aead_chacha20poly1305_ietf_decrypt(plain, &opened, NULL, in + SECURE_LINK_DATA_HEADER_BYTES,
+                                                  len - SECURE_LINK_DATA_HEADER_BYTES, in, SECURE_LINK_DATA_HEADER_BYTES,
+                                                  nonce, session->rx_key) != 0) {
+        session->rejected++;
+        return -1;
+    }
+    /* Only authentic packets move the window */
+    if (counter + 1 > session->rx_next) {
+        uint64_t shift = counter + 1 - session->rx_next;
+        if (session->rx_next == 0) session->rx_bits = 0;
+        else if (shift > 64) session->rx_bits = 0;
+        else session->rx_bits = shift == 64 ? 1ull << 63 : (session->rx_bits << shift) | (1ull << (shift - 1));
+        session->rx_next = counter + 1;
+    } else {
+        session->rx_bits |= 1ull << (session->rx_next - 2 - counter);
+    }
+    session->opened++;
+    return (int)opened;
+}
+
+/* --- client side --- */
+
+/* server_key: the server's public key if known (pinned), else NULL to trust the first challenge */
+static inline int secure_link_client_init(secure_link_client* client, const unsigned char* server_key) {
+    if (sodium_init() < 0) return -1;
+    client->pinned = server_key != NULL;
+    if (server_key) memcpy(client->server_key, server_key, SECURE_LINK_KEY_BYTES);
+    client->fresh = 0;
+    client->responded = 0;
+    secure_link_session_init(&client->session);
+    return 0;
+}
+
+/*
+ * Writes the REQUEST; returns SECURE_LINK_HANDSHAKE_BYTES. The first request of
+ * a handshake makes a new keypair; retransmissions reuse it until a challenge
+ * has been answered, so a challenge to an earlier copy still matches.
+ */
+static inline uint32_t secure_link_client_request(secure_link_client* client, unsigned char* out) {
+    if (!client->fresh) {
+        crypto_kx_keypair(client->public_key, client->secret_key);
+        client->fresh = 1;
+    }
+    memset(out, 0, SECURE_LINK_HANDSHAKE_BYTES);
+    out[0] = SECURE_LINK_REQUEST;
+    out[1] = SECURE_LINK_VERSION;
+    memcpy(out + SECURE_LINK_KEY_OFFSET, client->public_key, SECURE_LINK_KEY_BYTES);
+    return SECURE_LINK_HANDSHAKE_BYTES;
+}
+
+/*
+ * Turns a CHALLENGE into the RESPONSE at out and derives the session keys.
+ * Returns SECURE_LINK_HANDSHAKE_BYTES, or 0 if it is malformed or from
+ * another server than the pinned one. A duplicate of the challenge already
+ * answered gets the same response and leaves the session (and its counter) as it is.
+ */
+static inline uint32_t secure_link_client_respond(secure_link_client* client, const unsigned char* challenge, uint32_t len,
+                                                  unsigned char* out) {
+    if (secure_link_type(challenge, len) != SECURE_LINK_CHALLENGE) return 0;
+    const unsigned char* server_key = challenge + SECURE_LINK_KEY_OFFSET;
+    const unsigned char* salt = challenge + SECURE_LINK_SALT_OFFSET;
+    if (client->pinned && sodium_memcmp(server_key, client->server_key, SECURE_LINK_KEY_BYTES) != 0) return 0;
+    int duplicate = client->responded && sodium_memcmp(salt, client->session.salt, SECURE_LINK_SALT_BYTES) == 0;
+    if (!duplicate) {
+        secure_link_session session;
+        if (crypto_kx_client_session_keys(session.rx_key, session.tx_key, client->public_key, client->secret_key,
+                                          server_key) != 0) return 0;
+        secure_link_derive(&session, salt);
+        secure_link_session_init(&session);
+        client->session = session;
+        memcpy(client->server_key, server_key, SECURE_LINK_KEY_BYTES);
+        client->fresh = 0;
+        client->responded = 1;
+    }
+
+    memcpy(out, challenge, SECURE_LINK_HANDSHAKE_BYTES);
+    out[0] = SECURE_LINK_RESPONSE;
+    memcpy(out + SECURE_LINK_KEY_OFFSET, client->public_key, SECURE_LINK_KEY_BYTES);
+    return SECURE_LINK_HANDSHAKE_BYTES;
+}
+
+#endif /* SECURE_LINK_H */
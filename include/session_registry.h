@@ -0,0 +1,203 @@
+/*
+ * session_registry.h - lock-free reads of the relay's session list.
+ *
+ * The relay walks its sessions on every datagram while sessions join and leave
+ * on other threads. The registry is copy-on-write with epoch-based reclamation:
+ *
+ *   - Readers pin the current epoch, iterate an immutable snapshot with plain
+ *     loads, and unpin. No lock, no reference count, no shared cache line is
+ *     written besides the reader's own epoch slot.
+ *   - Writers (serialized by a mutex) copy the snapshot, change the copy,
+ *     publish it and retire the old one with the epoch it was replaced in.
+ *   - A retired snapshot is freed once every pinned reader entered a later
+ *     epoch. A removed session's release callback runs at that point too, so a
+ *     reader can never see a freed Session.
+ *
+ *   int reader = session_registry_reader(reg);          // once per thread
+ *   const session_snapshot* snap = session_registry_enter(reg, reader);
+ *   for (uint32_t i = 0; i < snap->slots; ++i) if (snap->items[i]) ...;
+ *   session_registry_exit(reg, reader);
+ *
+ *   session_registry_set(reg, slot, session, NULL);     // join
+ *   session_registry_set(reg, slot, NULL, destroy_fn);  // leave, destroy later
+ *
+ * Snapshots are indexed by session slot (NULL where free), so a reader can both
+ * iterate and look sessions up by index. Writes cost O(slots in use). Header-only,
+ * usable from C and C++; needs POSIX threads and the GCC/Clang __atomic builtins.
+ */
+#ifndef SESSION_REGISTRY_H
+#define SESSION_REGISTRY_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SESSION_REGISTRY_MAX_READERS 64
+
+typedef void (*session_release_fn)(void* item);
+
+typedef struct session_snapshot {
+    uint32_t slots;                      /* items[0 .. slots) may be non-NULL */
+    uint32_t count;                      /* non-NULL items */
+    uint64_t retire_epoch;
+    struct session_snapshot* next_retired;
+    void* released;                      /* item removed when this snapshot was replaced */
+    session_release_fn release;
+    void* items[];
+} session_snapshot;
+
+typedef struct session_registry_reader_slot {
+    uint64_t epoch;                      /* 0 while not reading */
+    uint32_t claimed;
+    unsigned char pad[64 - 12];
+} session_registry_reader_slot;
+
+typedef struct session_registry_stats {
+    uint64_t published;
+    uint64_t freed;
+    uint64_t pending;                    /* retired snapshots still waiting for readers */
+} session_registry_stats;
+
+typedef struct session_registry {
+    session_snapshot* current;           /* atomic */
+    uint64_t epoch;                      /* atomic, starts at 1 */
+    uint32_t max_slots;
+    pthread_mutex_t write_lock;
+    session_snapshot* retired;           /* oldest last; writer-owned */
+    session_registry_stats stats;        /* writer-owned */
+    session_registry_reader_slot readers[SESSION_REGISTRY_MAX_READERS];
+} session_registry;
+
+static inline session_snapshot* session_snapshot_alloc(uint32_t max_slots) {
+    session_snapshot* s = (session_snapshot*)calloc(1, sizeof(session_snapshot) + max_slots * sizeof(void*));
+    return s;
+}
+
+static inline session_registry* session_registry_create(uint32_t max_slots) {
+    session_registry* reg = (session_registry*)aligned_alloc(64, (sizeof(session_registry) + 63) & ~(size_t)63);
+    if (reg == NULL) return NULL;
+    memset(reg, 0, sizeof(*reg));
+    reg->current = session_snapshot_alloc(max_slots);
+    if (reg->current == NULL || pthread_mutex_init(&reg->write_lock, NULL) != 0) {
+        free(reg->current);
+        free(reg);
+        return NULL;
+    }
+    reg->epoch = 1;
+    reg->max_slots = max_slots;
+    return reg;
+}
+
+/* Claims a reader slot for the calling thread; -1 when all are taken */
+static inline int session_registry_reader(session_registry* reg) {
+    for (int i = 0; i < SESSION_REGISTRY_MAX_READERS; ++i) {
+        uint32_t expected = 0;
+        if (__atomic_compare_exchange_n(&reg->readers[i].claimed, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return i;
+    }
+    return -1;
+}
+
+static inline void session_registry_release_reader(session_registry* reg, int reader) {
+    __atomic_store_n(&reg->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&reg->readers[reader].claimed, 0, __ATOMIC_RELEASE);
+}
+
+/* Pins the epoch and returns the snapshot to iterate until session_registry_exit */
+static inline const session_snapshot* session_registry_enter(session_registry* reg, int reader) {
+    /* The pin must be visible before the snapshot is loaded (store-load order) */
+    __atomic_store_n(&reg->readers[reader].epoch, __atomic_load_n(&reg->epoch, __ATOMIC_RELAXED), __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&reg->current, __ATOMIC_SEQ_CST);
+}
+
+static inline void session_registry_exit(session_registry* reg, int reader) {
+    __atomic_store_n(&reg->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+static inline void session_snapshot_free(session_snapshot* s) {
+    if (s->release && s->released) s->release(s->released);
+    free(s);
+}
+
+/* Frees every retired snapshot no pinned reader can still hold; writer side */
+static inline void session_registry_reclaim_locked(session_registry* reg) {
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < SESSION_REGISTRY_MAX_READERS; ++i) {
+        uint64_t e = __atomic_load_n(&reg->readers[i].epoch, __ATOMIC_SEQ_CST);
+        if (e != 0 && e < oldest) oldest = e;
+    }
+    /* A reader pinned at epoch e may hold any snapshot retired at epoch >= e */
+    session_snapshot** link = &reg->retired;
+    while (*link) {
+        session_snapshot* s = *link;
+        if (s->retire_epoch < oldest) {
+            *link = s->next_retired;
+            session_snapshot_free(s);
+            reg->stats.freed++;
+            reg->stats.pending--;
+        } else {
+            link = &s->next_retired;
+        }
+    }
+}
+
+static inline void session_registry_reclaim(session_registry* reg) {
+    pthread_mutex_lock(&reg->write_lock);
+    session_registry_reclaim_locked(reg);
+    pthread_mutex_unlock(&reg->write_lock);
+}
+
+/* Puts item into slot (NULL removes). The item it replaces is passed to release
+ * once no reader can see it any more. Returns -1 if slot is out of range or the
+ * copy cannot be allocated (the registry is then unchanged). */
+static inline int session_registry_set(session_registry* reg, uint32_t slot, void* item, session_release_fn release) {
+    if (slot >= reg->max_slots) return -1;
+    pthread_mutex_lock(&reg->write_lock);
+    session_snapshot* old = reg->current;
+    session_snapshot* next = session_snapshot_alloc(reg->max_slots);
+    if (next == NULL) {
+        pthread_mutex_unlock(&reg->write_lock);
+        return -1;
+    }
+    uint32_t slots = old->slots > slot + 1 ? old->slots : slot + 1;
+    memcpy(next->items, old->items, old->slots * sizeof(void*));
+    void* previous = next->items[slot];
+    next->items[slot] = item;
+    while (slots > 0 && next->items[slots - 1] == NULL) slots--;
+    next->slots = slots;
+    next->count = old->count - (previous != NULL) + (item != NULL);
+
+    __atomic_store_n(&reg->current, next, __ATOMIC_SEQ_CST);
+    old->retire_epoch = __atomic_fetch_add(&reg->epoch, 1, __ATOMIC_SEQ_CST);
+    old->released = previous;
+    old->release = release;
+    old->next_retired = reg->retired;
+    reg->retired = old;
+    reg->stats.published++;
+    reg->stats.pending++;
+    session_registry_reclaim_locked(reg);
+    pthread_mutex_unlock(&reg->write_lock);
+    return 0;
+}
+
+static inline session_registry_stats session_registry_get_stats(session_registry* reg) {
+    pthread_mutex_lock(&reg->write_lock);
+    session_registry_stats s = reg->stats;
+    pthread_mutex_unlock(&reg->write_lock);
+    return s;
+}
+
+/* No reader may be inside enter/exit any more. Items still registered are not released. */
+static inline void session_registry_destroy(session_registry* reg) {
+    if (reg == NULL) return;
+    while (reg->retired) {
+        session_snapshot* s = reg->retired;
+        reg->retired = s->next_retired;
+        session_snapshot_free(s);
+    }
+    free(reg->current);
+    pthread_mutex_destroy(&reg->write_lock);
+    free(reg);
+}
+
+#endif /* SESSION_REGISTRY_H */
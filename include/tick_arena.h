@@ -0,0 +1,90 @@
+/*
+ * tick_arena.h - bump allocator for memory that only lives until the end of a tick.
+ *
+ * Serialization buffers, scratch lists and formatted messages are carved out of
+ * one preallocated block by bumping an offset, and the whole tick's worth is
+ * dropped at once by resetting it. Nothing is freed individually, nothing
+ * fragments, and the global allocator is never called after creation:
+ *
+ *   tick_arena* arena = tick_arena_create(256 * 1024);
+ *   for (;;) {                                        // every tick
+ *       tick_arena_reset(arena);
+ *       char* json = (char*)tick_arena_alloc(arena, 256, 1);  // NULL when full
+ *       ...
+ *   }
+ *
+ * Work outside the tick (e.g. answering a command) can borrow the arena with
+ * tick_arena_mark / tick_arena_rewind, which release only what was taken
+ * since the mark. An allocation that does not fit returns NULL and is counted
+ * in stats.overflows; the caller falls back or drops the work, and the peak
+ * tells how large the arena should have been. Not thread-safe: an arena
+ * belongs to one thread or to the caller's lock. Header-only, usable from C
+ * and C++.
+ */
+#ifndef TICK_ARENA_H
+#define TICK_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct tick_arena_stats {
+    size_t capacity;
+    size_t peak;                         /* most bytes in use between two resets */
+    uint64_t allocs;
+    uint64_t overflows;                  /* allocations that did not fit */
+    uint64_t resets;
+} tick_arena_stats;
+
+typedef struct tick_arena {
+    unsigned char* base;
+    size_t used;
+    tick_arena_stats stats;
+} tick_arena;
+
+static inline tick_arena* tick_arena_create(size_t capacity) {
+    tick_arena* arena = (tick_arena*)calloc(1, sizeof(tick_arena));
+    if (arena == NULL) return NULL;
+    arena->base = (unsigned char*)malloc(capacity);
+    if (arena->base == NULL) {
+        free(arena);
+        return NULL;
+    }
+    arena->stats.capacity = capacity;
+    return arena;
+}
+
+static inline void tick_arena_destroy(tick_arena* arena) {
+    if (arena == NULL) return;
+    free(arena->base);
+    free(arena);
+}
+
+/* align must be a power of two; NULL if the arena is full */
+static inline void* tick_arena_alloc(tick_arena* arena, size_t size, size_t align) {
+    size_t start = (arena->used + align - 1) & ~(align - 1);
+    if (start > arena->stats.capacity || size > arena->stats.capacity - start) {
+        arena->stats.overflows++;
+        return NULL;
+    }
+    arena->used = start + size;
+    if (arena->used > arena->stats.peak) arena->stats.peak = arena->used;
+    arena->stats.allocs++;
+    return arena->base + start;
+}
+
+static inline void tick_arena_reset(tick_arena* arena) {
+    arena->used = 0;
+    arena->stats.resets++;
+}
+
+static inline size_t tick_arena_mark(const tick_arena* arena) {
+    return arena->used;
+}
+
+/* Releases everything allocated since mark */
+static inline void tick_arena_rewind(tick_arena* arena, size_t mark) {
+    if (mark < arena->used) arena->used = mark;
+}
+
+#endif /* TICK_ARENA_H */
@@ -0,0 +1,324 @@
+/*
+ * tlsf_heap.h - capped two-level segregated fit (TLSF) heaps, one per connection.
+ *
+ * A tlsf_heap manages one fixed region: malloc and free are O(1) (two bitmap
+ * scans, no searching of lists), adjacent free blocks are merged immediately,
+ * and the heap can never grow past its region, so a connection that tries to
+ * hold more than its budget gets NULL instead of taking memory from everyone
+ * else. Per-connection heaps also keep one connection's churn from fragmenting
+ * the memory of the others, and since each heap is touched by one thread at a
+ * time there is no allocator lock to contend on.
+ *
+ * tlsf_heap_set carves one allocation into equally sized heaps and hands them
+ * out to connections:
+ *
+ *   tlsf_heap_set* set = tlsf_heap_set_create(10000, 64 * 1024); // 10k heaps of 64 KB
+ *   tlsf_heap* heap = tlsf_heap_set_acquire(set);                 // on connect, or NULL
+ *   void* p = tlsf_heap_malloc(heap, 200);                        // NULL past the cap
+ *   tlsf_heap_free(heap, p);
+ *   tlsf_heap_set_release(set, heap);                             // on disconnect
+ *
+ * Free blocks are kept in TLSF_FL_COUNT x TLSF_SL_COUNT size classes: the first
+ * level is the power of two, the second splits it into 16 linear steps, so a
+ * request is served from a block at most 1/16 larger than needed. Every block
+ * has a 16-byte header and payloads are 16-byte aligned. A heap's bookkeeping
+ * (about 2.5 KB) lives at the start of its own region.
+ *
+ * Not thread-safe: a heap, and a set's acquire/release, belong to one thread
+ * or to the caller's lock. Header-only, usable from C and C++.
+ */
+#ifndef TLSF_HEAP_H
+#define TLSF_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TLSF_ALIGN_LOG2 4
+#define TLSF_ALIGN ((size_t)1 << TLSF_ALIGN_LOG2)
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + TLSF_ALIGN_LOG2)   /* blocks below 256 bytes share the first level */
+#ifndef TLSF_MAX_LOG2
+#define TLSF_MAX_LOG2 24                                 /* largest heap: 16 MB */
+#endif
+#define TLSF_FL_COUNT (TLSF_MAX_LOG2 - TLSF_FL_SHIFT + 2)
+#define TLSF_FREE 1u                                      /* in tlsf_block.size */
+#define TLSF_PREV_FREE 2u
+#define TLSF_MIN_BLOCK (2 * sizeof(void*))                /* room for the free-list links */
+
+typedef struct tlsf_block {
+    struct tlsf_block* prev_phys;        /* the block before it in memory */
+    size_t size;                         /* payload bytes | TLSF_FREE | TLSF_PREV_FREE */
+    struct tlsf_block* next_free;        /* payload starts here; links only while free */
+    struct tlsf_block* prev_free;
+} tlsf_block;
+
+#define TLSF_HEADER offsetof(tlsf_block, next_free)
+
+typedef struct tlsf_heap_stats {
+    size_t capacity;                     /* payload bytes when empty */
+    size_t used;                         /* payload bytes allocated, headers included */
+    size_t peak;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures;                   /* NULL returned: cap reached or too fragmented */
+} tlsf_heap_stats;
+
+typedef struct tlsf_heap {
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[TLSF_FL_COUNT];
+    tlsf_block* free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+    tlsf_heap_stats stats;
+} tlsf_heap;
+
+static inline int tlsf_fls(size_t v) {
+    return (int)(sizeof(unsigned long long) * 8 - 1) - __builtin_clzll((unsigned long long)v);
+}
+
+static inline size_t tlsf_block_size(const tlsf_block* b) {
+    return b->size & ~(size_t)(TLSF_FREE | TLSF_PREV_FREE);
+}
+
+static inline tlsf_block* tlsf_block_next(const tlsf_block* b) {
+    return (tlsf_block*)((unsigned char*)b + TLSF_HEADER + tlsf_block_size(b));
+}
+
+static inline void tlsf_mapping(size_t size, int* fl, int* sl) {
+    if (size < ((size_t)1 << TLSF_FL_SHIFT)) {
+        *fl = 0;
+        *sl = (int)(size >> TLSF_ALIGN_LOG2);
+    } else {
+        int f = tlsf_fls(size);
+        *sl = (int)(size >> (f - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+        *fl = f - TLSF_FL_SHIFT + 1;
+    }
+}
+
+static inline void tlsf_insert(tlsf_heap* h, tlsf_block* b) {
+    int fl, sl;
+    tlsf_mapping(tlsf_block_size(b), &fl, &sl);
+    tlsf_block* head = h->free_lists[fl][sl];
+    b->next_free = head;
+    b->prev_free = NULL;
+    if (head) head->prev_free = b;
+    h->free_lists[fl][sl] = b;
+    h->fl_bitmap |= 1u << fl;
+    h->sl_bitmap[fl] |= 1u << sl;
+}
+
+static inline void tlsf_remove(tlsf_heap* h, tlsf_block* b) {
+    int fl, sl;
+    tlsf_mapping(tlsf_block_size(b), &fl, &sl);
+    if (b->prev_free) b->prev_free->next_free = b->next_free;
+    else h->free_lists[fl][sl] = b->next_free;
+    if (b->next_free) b->next_free->prev_free = b->prev_free;
+    if (h->free_lists[fl][sl] == NULL) {
+        h->sl_bitmap[fl] &= ~(1u << sl);
+        if (h->sl_bitmap[fl] == 0) h->fl_bitmap &= ~(1u << fl);
+    }
+}
+
+/*
+ * Turns region (bytes long, any alignment) into an empty heap whose bookkeeping
+ * sits at its start. NULL if the region is too small or larger than
+ * 2^TLSF_MAX_LOG2.
+ */
+static inline tlsf_heap* tlsf_heap_init(void* region, size_t bytes) {
+    uintptr_t start = ((uintptr_t)region + TLSF_ALIGN - 1) & ~(uintptr_t)(TLSF_ALIGN - 1);
+    uintptr_t end = ((uintptr_t)region + bytes) & ~(uintptr_t)(TLSF_ALIGN - 1);
+    size_t control = (sizeof(tlsf_heap) + TLSF_ALIGN - 1) & ~(TLSF_ALIGN - 1);
+    if (end < start || end - start < control + 2 * TLSF_HEADER + TLSF_MIN_BLOCK) return NULL;
+    size_t payload = end - start - control - 2 * TLSF_HEADER; /* One header for the block, one for the end sentinel */
+    if (payload >= ((size_t)1 << TLSF_MAX_LOG2)) return NULL;
+
+    tlsf_heap* h = (tlsf_heap*)start;
+    memset(h, 0, sizeof(*h));
+    tlsf_block* b = (tlsf_block*)(start + control);
+    b->prev_phys = NULL;
+    b->size = payload | TLSF_FREE;
+    tlsf_block* sentinel = tlsf_block_next(b);
+    sentinel->prev_phys = b;
+    sentinel->size = 0 | TLSF_PREV_FREE; /* Used, so nothing ever merges past the end */
+    tlsf_insert(h, b);
+    h->stats.capacity = payload;
+    return h;
+}
+
+/* NULL if size is 0 or no free block is large enough */
+static inline void* tlsf_heap_malloc(tlsf_heap* h, size_t size) {
+    if (size == 0 || size > h->stats.capacity) {
+        h->stats.failures += size != 0;
+        return NULL;
+    }
+    size_t need = (size + TLSF_ALIGN - 1) & ~(TLSF_ALIGN - 1);
+    if (need < TLSF_MIN_BLOCK) need = TLSF_MIN_BLOCK;
+
+    /* Round up to the next class boundary, so any block in the class found is large enough */
+    size_t rounded = need;
+    if (rounded >= ((size_t)1 << TLSF_FL_SHIFT)) rounded += ((size_t)1 << (tlsf_fls(rounded) - TLSF_SL_LOG2)) - 1;
+    int fl, sl;
+    tlsf_mapping(rounded, &fl, &sl);
+    tlsf_block* b = NULL;
+    if (fl < TLSF_FL_COUNT) {
+        uint32_t sl_map = h->sl_bitmap[fl] & (~0u << sl);
+        if (sl_map == 0) {
+            uint32_t fl_map = fl + 1 < 32 ? h->fl_bitmap & (~0u << (fl + 1)) : 0;
+            if (fl_map != 0) {
+                fl = __builtin_ctz(fl_map);
+                sl_map = h->sl_bitmap[fl];
+            }
+        }
+        if (sl_map != 0) b = h->free_lists[fl][__builtin_ctz(sl_map)];
+    }
+    if (b == NULL) {
+        h->stats.failures++;
+        return NULL;
+    }
+    tlsf_remove(h, b);
+
+    size_t size_bits = b->size & TLSF_PREV_FREE;
+    size_t have = tlsf_block_size(b);
+    if (have >= need + TLSF_HEADER + TLSF_MIN_BLOCK) {
+        /* Split: the tail goes back on a free list */
+        b->size = need | size_bits;
+        tlsf_block* rest = tlsf_block_next(b);
+        rest->prev_phys = b;
+        rest->size = (have - need - TLSF_HEADER) | TLSF_FREE;
+        tlsf_block_next(rest)->prev_phys = rest;
+        tlsf_insert(h, rest);
+    } else {
+        b->size = have | size_bits;
+        tlsf_block_next(b)->size &= ~(size_t)TLSF_PREV_FREE;
+    }
+    h->stats.used += tlsf_block_size(b) + TLSF_HEADER;
+    if (h->stats.used > h->stats.peak) h->stats.peak = h->stats.used;
+    h->stats.allocs++;
+    return &b->next_free;
+}
+
+static inline void tlsf_heap_free(tlsf_heap* h, void* p) {
+    if (p == NULL) return;
+    tlsf_block* b = (tlsf_block*)((unsigned char*)p - TLSF_HEADER);
+    h->stats.used -= tlsf_block_size(b) + TLSF_HEADER;
+    h->stats.frees++;
+
+    size_t size = tlsf_block_size(b);
+    size_t size_bits = b->size & TLSF_PREV_FREE;
+    tlsf_block* next = tlsf_block_next(b);
+    if (size_bits & TLSF_PREV_FREE) {
+        tlsf_block* prev = b->prev_phys;
+        tlsf_remove(h, prev);
+        size += TLSF_HEADER + tlsf_block_size(prev);
+        size_bits = prev->size & TLSF_PREV_FREE; /* Never set: two free blocks are never adjacent */
+        b = prev;
+    }
+    if (next->size & TLSF_FREE) {
+        tlsf_remove(h, next);
+        size += TLSF_HEADER + tlsf_block_size(next);
+    }
+    b->size = size | size_bits | TLSF_FREE;
+    next = tlsf_block_next(b);
+    next->prev_phys = b;
+    next->size |= TLSF_PREV_FREE;
+    tlsf_insert(h, b);
+}
+
+/* Bytes a live allocation can actually hold (at least what was asked for) */
+static inline size_t tlsf_heap_usable(const void* p) {
+    return tlsf_block_size((const tlsf_block*)((const unsigned char*)p - TLSF_HEADER));
+}
+
+/* --- Sets of equally sized heaps, one per connection --- */
+
+typedef struct tlsf_heap_set_stats {
+    uint32_t heaps;
+    uint32_t in_use;                     /* acquired and not released */
+    uint32_t high_water;
+    uint64_t exhausted;                  /* acquires that found every heap taken */
+    size_t used;                         /* summed over the heaps in use */
+    size_t peak;                         /* largest peak of any heap in use */
+    uint64_t failures;                   /* summed over the heaps in use */
+} tlsf_heap_set_stats;
+
+typedef struct tlsf_heap_set {
+    unsigned char* region;
+    size_t heap_bytes;                   /* stride between heaps, bookkeeping included */
+    uint32_t count;
+    uint32_t free_count;
+    uint32_t* free_slots;
+    tlsf_heap** heaps;                   /* NULL while free */
+    tlsf_heap_set_stats stats;
+} tlsf_heap_set;
+
+static inline void tlsf_heap_set_destroy(tlsf_heap_set* set) {
+    if (set == NULL) return;
+    free(set->region);
+    free(set->free_slots);
+    free(set->heaps);
+    free(set);
+}
+
+/* count heaps of heap_bytes each (bookkeeping included); NULL if out of memory */
+static inline tlsf_heap_set* tlsf_heap_set_create(uint32_t count, size_t heap_bytes) {
+    heap_bytes = (heap_bytes + TLSF_ALIGN - 1) & ~(TLSF_ALIGN - 1);
+    tlsf_heap_set* set = (tlsf_heap_set*)calloc(1, sizeof(tlsf_heap_set));
+    if (set == NULL) return NULL;
+    /* malloc'd, not calloc'd: pages are only touched once a heap is first used */
+    set->region = (unsigned char*)malloc((size_t)count * heap_bytes + TLSF_ALIGN);
+    set->free_slots = (uint32_t*)malloc(count * sizeof(uint32_t));
+    set->heaps = (tlsf_heap**)calloc(count, sizeof(tlsf_heap*));
+    if (set->region == NULL || set->free_slots == NULL || set->heaps == NULL || count == 0
+        || tlsf_heap_init(set->region, heap_bytes) == NULL) {
+        tlsf_heap_set_destroy(set);
+        return NULL;
+    }
+    set->heap_bytes = heap_bytes;
+    set->count = count;
+    for (uint32_t i = 0; i < count; ++i) set->free_slots[i] = count - 1 - i;
+    set->free_count = count;
+    set->stats.heaps = count;
+    return set;
+}
+
+/* An empty heap, or NULL if every heap is in use */
+static inline tlsf_heap* tlsf_heap_set_acquire(tlsf_heap_set* set) {
+    if (set->free_count == 0) {
+        set->stats.exhausted++;
+        return NULL;
+    }
+    uint32_t slot = set->free_slots[--set->free_count];
+    uintptr_t base = ((uintptr_t)set->region + TLSF_ALIGN - 1) & ~(uintptr_t)(TLSF_ALIGN - 1);
+    tlsf_heap* h = tlsf_heap_init((void*)(base + (size_t)slot * set->heap_bytes), set->heap_bytes);
+    set->heaps[slot] = h;
+    if (++set->stats.in_use > set->stats.high_water) set->stats.high_water = set->stats.in_use;
+    return h;
+}
+
+/* Returns a heap to the set; whatever is still allocated in it is gone */
+static inline void tlsf_heap_set_release(tlsf_heap_set* set, tlsf_heap* h) {
+    uintptr_t base = ((uintptr_t)set->region + TLSF_ALIGN - 1) & ~(uintptr_t)(TLSF_ALIGN - 1);
+    uint32_t slot = (uint32_t)(((uintptr_t)h - base) / set->heap_bytes);
+    set->heaps[slot] = NULL;
+    set->free_slots[set->free_count++] = slot;
+    set->stats.in_use--;
+}
+
+/* Usage summed over the heaps in use; walks every slot, so call it for reports, not per packet */
+static inline tlsf_heap_set_stats tlsf_heap_set_get_stats(const tlsf_heap_set* set) {
+    tlsf_heap_set_stats s = set->stats;
+    s.used = 0;
+    s.peak = 0;
+    s.failures = 0;
+    for (uint32_t i = 0; i < set->count; ++i) {
+        const tlsf_heap* h = set->heaps[i];
+        if (h == NULL) continue;
+        s.used += h->stats.used;
+        if (h->stats.peak > s.peak) s.peak = h->stats.peak;
+        s.failures += h->stats.failures;
+    }
+    return s;
+}
+
+#endif /* TLSF_HEAP_H */
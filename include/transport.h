@@ -0,0 +1,365 @@
+/*
+ * transport.h - datagram transport interface for the relays, with a real UDP
+ * backend and an in-process loopback backend.
+ *
+ * The relay logic only needs three operations, so it can run unchanged over the
+ * kernel or over memory (benchmarks, CI without a QUIC/WebTransport stack):
+ *
+ *   int n = transport_recv(t, in, 64);          // non-blocking, 0 when idle
+ *   transport_queue(t, dest, &addr, data, len); // for every recipient
+ *   transport_flush(t);                         // once per receive batch
+ *
+ * Backends:
+ *
+ *   transport_udp_create(fd, mode, ...)  recvmmsg for receiving, udp_fanout.h
+ *                                        (sendto / sendmmsg / GSO) for sending.
+ *   transport_loopback_open(net, i)      endpoint i of a transport_loopback_net:
+ *                                        one lock-free multi-producer ring per
+ *                                        endpoint. Sending copies the payload
+ *                                        into the receiver's ring; receiving
+ *                                        reads it in place, with no syscall.
+ *
+ * Loopback endpoints are addressed like sockets: endpoint i is 127.0.0.1, port
+ * TRANSPORT_LOOPBACK_PORT + i (see transport_loopback_addr), so Session::addr
+ * works for both. A loopback datagram to a full ring or an unknown endpoint is
+ * dropped and counted, as the kernel drops on a full socket buffer.
+ *
+ * Received datagrams stay valid until the next transport_recv on the same
+ * transport; queued payloads must stay valid until the next flush. A transport
+ * belongs to one thread; any number of loopback endpoints may send to one.
+ * Header-only, usable from C and C++; Linux. C programs must define
+ * _GNU_SOURCE before their first system include.
+ */
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "udp_fanout.h"
+
+#define TRANSPORT_LOOPBACK_PORT 20000    /* endpoint i listens on this + i */
+#define TRANSPORT_LINE 64
+
+typedef struct transport_datagram {
+    struct sockaddr_in addr;             /* source when received */
+    const unsigned char* data;
+    uint32_t length;
+} transport_datagram;
+
+typedef struct transport_stats {
+    uint64_t received;
+    uint64_t sent;                       /* datagrams handed to the kernel / peer */
+    uint64_t dropped;                    /* refused: full buffer, unknown peer, would-block */
+    uint64_t syscalls;
+} transport_stats;
+
+typedef struct transport transport;
+
+typedef struct transport_ops {
+    const char* name;
+    int (*recv)(transport* t, transport_datagram* out, int max);
+    int (*queue)(transport* t, uint32_t dest, const struct sockaddr_in* addr, const void* data, uint32_t length);
+    void (*flush)(transport* t);
+    void (*destroy)(transport* t);
+} transport_ops;
+
+struct transport {
+    const transport_ops* ops;
+    transport_stats stats;
+};
+
+static inline int transport_recv(transport* t, transport_datagram* out, int max) {
+    return t->ops->recv(t, out, max);
+}
+
+/* dest is a small per-recipient id (e.g. the session index), as for udp_fanout */
+static inline int transport_queue(transport* t, uint32_t dest, const struct sockaddr_in* addr, const void* data, uint32_t length) {
+    return t->ops->queue(t, dest, addr, data, length);
+}
+
+static inline void transport_flush(transport* t) {
+    t->ops->flush(t);
+}
+
+static inline void transport_destroy(transport* t) {
+    if (t) t->ops->destroy(t);
+}
+
+static inline const char* transport_name(const transport* t) {
+    return t->ops->name;
+}
+
+/* --- UDP --- */
+
+typedef struct transport_udp {
+    transport base;
+    int fd;
+    udp_fanout* fanout;
+    uint32_t batch;
+    uint32_t max_datagram;
+    unsigned char* buffers;              /* batch x max_datagram */
+    struct sockaddr_in* from;
+    struct iovec* iovs;
+    struct mmsghdr* msgs;
+    uint64_t queued;                     /* datagrams queued into the fan-out, ever */
+    uint64_t refused;                    /* not queued: destination id out of range */
+    uint64_t recv_calls;
+} transport_udp;
+
+static inline void transport_udp_destroy(transport* t) {
+    transport_udp* u = (transport_udp*)t;
+    udp_fanout_destroy(u->fanout);
+    free(u->buffers);
+    free(u->from);
+    free(u->iovs);
+    free(u->msgs);
+    free(u);
+}
+
+static inline int transport_udp_recv(transport* t, transport_datagram* out, int max) {
+    transport_udp* u = (transport_udp*)t;
+    uint32_t count = (uint32_t)max < u->batch ? (uint32_t)max : u->batch;
+    for (uint32_t i = 0; i < count; ++i) {
+        u->iovs[i].iov_base = u->buffers + (size_t)i * u->max_datagram;
+        u->iovs[i].iov_len = u->max_datagram;
+        memset(&u->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+        u->msgs[i].msg_hdr.msg_name = &u->from[i];
+        u->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        u->msgs[i].msg_hdr.msg_iov = &u->iovs[i];
+        u->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = recvmmsg(u->fd, u->msgs, count, MSG_DONTWAIT, NULL);
+    u->recv_calls++;
+    t->stats.syscalls = u->recv_calls + u->fanout->stats.send_calls;
+    if (n <= 0) return 0;
+    for (int i = 0; i < n; ++i) {
+        out[i].addr = u->from[i];
+        out[i].data = (const unsigned char*)u->iovs[i].iov_base;
+        out[i].length = u->msgs[i].msg_len;
+    }
+    t->stats.received += (uint64_t)n;
+    return n;
+}
+
+static inline int transport_udp_queue(transport* t, uint32_t dest, const struct sockaddr_in* addr, const void* data, uint32_t length) {
+    transport_udp* u = (transport_udp*)t;
+    if (udp_fanout_queue(u->fanout, dest, addr, data, length) != 0) {
+        u->refused++;
+        t->stats.dropped++;
+        return -1;
+    }
+    u->queued++;
+    return 0;
+}
+
+static inline void transport_udp_flush(transport* t) {
+    transport_udp* u = (transport_udp*)t;
+    udp_fanout_flush(u->fanout);
+    /* Everything queued is now either on the wire or dropped (refused, or left
+     * behind by a would-block: a full socket buffer loses datagrams either way) */
+    const udp_fanout_stats* s = &u->fanout->stats;
+    t->stats.sent = s->datagrams;
+    t->stats.dropped = u->refused + u->queued - s->datagrams;
+    t->stats.syscalls = u->recv_calls + s->send_calls;
+}
+
+static const transport_ops transport_udp_ops = {
+    "udp", transport_udp_recv, transport_udp_queue, transport_udp_flush, transport_udp_destroy
+};
+
+/* Wraps a bound, non-blocking-capable UDP socket (not closed on destroy).
+ * max_dests and max_queued size the fan-out as in udp_fanout_create. */
+static inline transport* transport_udp_create(int fd, udp_fanout_mode mode, uint32_t max_dests, uint32_t max_queued,
+                                              uint32_t batch, uint32_t max_datagram) {
+    transport_udp* u = (transport_udp*)calloc(1, sizeof(transport_udp));
+    if (u == NULL) return NULL;
+    u->base.ops = &transport_udp_ops;
+    u->fd = fd;
+    u->batch = batch;
+    u->max_datagram = max_datagram;
+    u->fanout = udp_fanout_create(mode, fd, max_dests, max_queued);
+    u->buffers = (unsigned char*)malloc((size_t)batch * max_datagram);
+    u->from = (struct sockaddr_in*)calloc(batch, sizeof(struct sockaddr_in));
+    u->iovs = (struct iovec*)calloc(batch, sizeof(struct iovec));
+    u->msgs = (struct mmsghdr*)calloc(batch, sizeof(struct mmsghdr));
+    if (!u->fanout || !u->buffers || !u->from || !u->iovs || !u->msgs) {
+        int saved = errno;
+        transport_udp_destroy(&u->base);
+        errno = saved;
+        return NULL;
+    }
+    return &u->base;
+}
+
+/* --- in-process loopback --- */
+
+typedef struct transport_loopback_slot {
+    uint64_t seq;
+    uint32_t length;
+    uint32_t from;                       /* sending endpoint */
+    unsigned char data[];
+} transport_loopback_slot;
+
+typedef struct transport_loopback_ring {
+    uint64_t tail;                       /* atomic, producers */
+    unsigned char pad0[TRANSPORT_LINE - 8];
+    uint64_t head;                       /* consumer */
+    uint32_t held;                       /* slots handed out by the last recv */
+    unsigned char pad1[TRANSPORT_LINE - 12];
+} transport_loopback_ring;
+
+typedef struct transport_loopback_net {
+    uint32_t endpoints;
+    uint32_t slot_mask;
+    uint32_t max_datagram;
+    size_t slot_stride;
+    transport_loopback_ring* rings;
+    unsigned char* slots;                /* endpoints x slots x slot_stride */
+} transport_loopback_net;
+
+typedef struct transport_loopback {
+    transport base;
+    transport_loopback_net* net;
+    uint32_t index;
+} transport_loopback;
+
+static inline struct sockaddr_in transport_loopback_addr(uint32_t index) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)(TRANSPORT_LOOPBACK_PORT + index));
+    return addr;
+}
+
+static inline transport_loopback_slot* transport_loopback_slot_at(const transport_loopback_net* net, uint32_t endpoint, uint64_t pos) {
+    size_t slot = (size_t)endpoint * (net->slot_mask + 1) + (size_t)(pos & net->slot_mask);
+    return (transport_loopback_slot*)(net->slots + slot * net->slot_stride);
+}
+
+static inline void transport_loopback_net_destroy(transport_loopback_net* net) {
+    if (net == NULL) return;
+    free(net->rings);
+    free(net->slots);
+    free(net);
+}
+
+/* ring_slots (rounded up to a power of two) datagrams of up to max_datagram
+ * bytes can wait at each endpoint */
+static inline transport_loopback_net* transport_loopback_net_create(uint32_t endpoints, uint32_t ring_slots, uint32_t max_datagram) {
+    if (endpoints == 0 || endpoints > 65535 - TRANSPORT_LOOPBACK_PORT) return NULL;
+    uint32_t slots = 2;
+    while (slots < ring_slots && slots < 0x40000000u) slots <<= 1;
+    transport_loopback_net* net = (transport_loopback_net*)calloc(1, sizeof(transport_loopback_net));
+    if (net == NULL) return NULL;
+    net->endpoints = endpoints;
+    net->slot_mask = slots - 1;
+    net->max_datagram = max_datagram;
+    net->slot_stride = (sizeof(transport_loopback_slot) + max_datagram + 7) & ~(size_t)7;
+    net->rings = (transport_loopback_ring*)aligned_alloc(TRANSPORT_LINE, endpoints * sizeof(transport_loopback_ring));
+    net->slots = (unsigned char*)malloc((size_t)endpoints * slots * net->slot_stride);
+    if (net->rings == NULL || net->slots == NULL) {
+        transport_loopback_net_destroy(net);
+        return NULL;
+    }
+    memset(net->rings, 0, endpoints * sizeof(transport_loopback_ring));
+    for (uint32_t e = 0; e < endpoints; ++e) {
+        for (uint64_t i = 0; i < slots; ++i) transport_loopback_slot_at(net, e, i)->seq = i;
+    }
+    return net;
+}
+
+/* Returns the slots handed out by the previous recv to the producers */
+static inline void transport_loopback_release_held(transport_loopback_net* net, uint32_t endpoint) {
+    transport_loopback_ring* ring = &net->rings[endpoint];
+    for (uint32_t i = 0; i < ring->held; ++i) {
+        transport_loopback_slot* slot = transport_loopback_slot_at(net, endpoint, ring->head);
+        __atomic_store_n(&slot->seq, ring->head + net->slot_mask + 1, __ATOMIC_RELEASE);
+        ring->head++;
+    }
+    ring->held = 0;
+}
+
+static inline int transport_loopback_recv(transport* t, transport_datagram* out, int max) {
+    transport_loopback* l = (transport_loopback*)t;
+    transport_loopback_net* net = l->net;
+    transport_loopback_ring* ring = &net->rings[l->index];
+    transport_loopback_release_held(net, l->index);
+    int n = 0;
+    for (uint64_t pos = ring->head; n < max; ++pos) {
+        transport_loopback_slot* slot = transport_loopback_slot_at(net, l->index, pos);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) break;
+        out[n].addr = transport_loopback_addr(slot->from);
+        out[n].data = slot->data;
+        out[n].length = slot->length;
+        n++;
+    }
+    ring->held = (uint32_t)n;
+    t->stats.received += (uint64_t)n;
+    return n;
+}
+
+static inline int transport_loopback_queue(transport* t, uint32_t dest, const struct sockaddr_in* addr, const void* data, uint32_t length) {
+    (void)dest;
+    transport_loopback* l = (transport_loopback*)t;
+    transport_loopback_net* net = l->net;
+    uint32_t to = (uint32_t)ntohs(addr->sin_port) - TRANSPORT_LOOPBACK_PORT;
+    if (to >= net->endpoints || length > net->max_datagram) {
+        t->stats.dropped++;
+        return -1;
+    }
+    transport_loopback_ring* ring = &net->rings[to];
+    uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        transport_loopback_slot* slot = transport_loopback_slot_at(net, to, pos);
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->length = length;
+                slot->from = l->index;
+                memcpy(slot->data, data, length);
+                __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                t->stats.sent++;
+                return 0;
+            }
+        } else if (diff < 0) {
+            t->stats.dropped++; /* The receiver's ring is full */
+            return -1;
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static inline void transport_loopback_flush(transport* t) {
+    (void)t; /* Queued datagrams were delivered right away */
+}
+
+static inline void transport_loopback_destroy(transport* t) {
+    free(t);
+}
+
+static const transport_ops transport_loopback_ops = {
+    "loopback", transport_loopback_recv, transport_loopback_queue, transport_loopback_flush, transport_loopback_destroy
+};
+
+/* Endpoint `index` of net; open each endpoint once */
+static inline transport* transport_loopback_open(transport_loopback_net* net, uint32_t index) {
+    if (index >= net->endpoints) return NULL;
+    transport_loopback* l = (transport_loopback*)calloc(1, sizeof(transport_loopback));
+    if (l == NULL) return NULL;
+    l->base.ops = &transport_loopback_ops;
+    l->net = net;
+    l->index = index;
+    return &l->base;
+}
+
+#endif /* TRANSPORT_H */
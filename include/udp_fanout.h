@@ -0,0 +1,368 @@
+/*
+ * udp_fanout.h - batched datagram fan-out for the relays.
+ *
+ * A relay that forwards every inbound datagram to every other player makes one
+ * send syscall per recipient. udp_fanout collects the outbound datagrams of one
+ * receive batch instead and hands them to the kernel on udp_fanout_flush():
+ *
+ *   UDP_FANOUT_SENDTO  one sendto() per datagram (the old behaviour, portable)
+ *   UDP_FANOUT_MMSG    one sendmmsg() for up to UDP_FANOUT_MAX_MSGS datagrams
+ *   UDP_FANOUT_GSO     sendmmsg(), and all datagrams for the same recipient are
+ *                      merged into one UDP_SEGMENT (generic segmentation offload)
+ *                      message: the kernel builds the packets from one buffer.
+ *
+ * GSO needs equal-sized segments to one destination, so it pays off when a
+ * recipient gets several datagrams per flush (a 64-player lobby where most
+ * packets are same-sized move updates). sendmmsg is what amortizes across
+ * recipients.
+ *
+ *   udp_fanout* f = udp_fanout_create(UDP_FANOUT_GSO, fd, 64, 8192);
+ *   udp_fanout_queue(f, session, &addr, data, length);  // for each recipient
+ *   udp_fanout_flush(f);                                // once per receive batch
+ *
+ * Payloads are not copied: they must stay valid until the next flush. Each
+ * destination id (e.g. a session index below max_dests) must always come with
+ * the same address between flushes.
+ *
+ * When the socket would block, the flush stops there and everything not yet
+ * handed over is left unsent. udp_fanout_done(f, dest) then says how many of
+ * the datagrams queued for dest in the last flush were consumed (sent, or
+ * refused by the kernel), always a prefix in queue order, so a caller with its
+ * own send queues (packet_pool.h) can keep the rest for the next flush. Those
+ * counts are only exact if the caller flushed explicitly, i.e. never queued
+ * more than udp_fanout_room() since the last flush.
+ *
+ * Header-only, usable from C and C++; C programs must define _GNU_SOURCE
+ * before their first system include.
+ */
+#ifndef UDP_FANOUT_H
+#define UDP_FANOUT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#ifdef __linux__
+#include <netinet/udp.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#endif
+
+#define UDP_FANOUT_NONE 0xFFFFFFFFu
+#define UDP_FANOUT_MAX_MSGS 1024         /* UIO_MAXIOV: messages per sendmmsg */
+#define UDP_FANOUT_MAX_SEGMENTS 64       /* UDP_MAX_SEGMENTS on older kernels */
+#define UDP_FANOUT_MAX_GSO_BYTES 65000   /* Payload per GSO message, below the IP limit */
+
+typedef enum udp_fanout_mode {
+    UDP_FANOUT_SENDTO = 0,
+    UDP_FANOUT_MMSG = 1,
+    UDP_FANOUT_GSO = 2
+} udp_fanout_mode;
+
+typedef struct udp_fanout_stats {
+    uint64_t send_calls;                 /* syscalls made */
+    uint64_t messages;                   /* msghdrs handed to the kernel */
+    uint64_t datagrams;                  /* datagrams on the wire */
+    uint64_t bytes;                      /* payload bytes on the wire */
+    uint64_t errors;                     /* datagrams the kernel refused */
+    uint64_t would_block;                /* flushes cut short by a full socket buffer */
+} udp_fanout_stats;
+
+typedef struct udp_fanout_entry {
+    const unsigned char* data;
+    uint32_t length;
+    uint32_t next;                       /* next entry for the same destination */
+} udp_fanout_entry;
+
+typedef struct udp_fanout {
+    udp_fanout_mode mode;
+    int fd;
+    uint32_t max_dests;
+    uint32_t max_datagrams;
+    udp_fanout_stats stats;
+
+    udp_fanout_entry* entries;
+    uint32_t entry_count;
+
+    struct sockaddr_in* dest_addrs;
+    uint32_t* dest_head;
+    uint32_t* dest_tail;
+    uint32_t* touched;                   /* destinations with queued entries */
+    uint32_t touched_count;
+    uint32_t* dest_done;                 /* datagrams consumed per destination ... */
+    uint32_t* dest_flush;                /* ... valid when equal to flush_id */
+    uint32_t flush_id;
+    int blocked;
+
+#ifdef __linux__
+    struct mmsghdr* msgs;
+    struct iovec* iovs;
+    unsigned char* controls;             /* one UDP_SEGMENT cmsg per message */
+    uint32_t* msg_dests;                 /* destination of each message */
+#endif
+} udp_fanout;
+
+static inline const char* udp_fanout_mode_name(udp_fanout_mode mode) {
+    switch (mode) {
+    case UDP_FANOUT_SENDTO: return "sendto";
+    case UDP_FANOUT_MMSG: return "sendmmsg";
+    case UDP_FANOUT_GSO: return "gso";
+    }
+    return "?";
+}
+
+static inline int udp_fanout_parse_mode(const char* name) {
+    if (strcmp(name, "sendto") == 0) return UDP_FANOUT_SENDTO;
+    if (strcmp(name, "mmsg") == 0 || strcmp(name, "sendmmsg") == 0) return UDP_FANOUT_MMSG;
+    if (strcmp(name, "gso") == 0) return UDP_FANOUT_GSO;
+    return -1;
+}
+
+/* 1 if the kernel accepts UDP_SEGMENT on this socket (Linux 4.18+) */
+static inline int udp_fanout_gso_supported(int fd) {
+#ifdef __linux__
+    int segment = 0;
+    socklen_t len = sizeof(segment);
+    return getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, &len) == 0;
+#else
+    (void)fd;
+    return 0;
+#endif
+}
+
+#define UDP_FANOUT_CONTROL_BYTES CMSG_SPACE(sizeof(uint16_t))
+
+static inline void udp_fanout_destroy(udp_fanout* f) {
+    if (f == NULL) return;
+    free(f->entries);
+    free(f->dest_addrs);
+    free(f->dest_head);
+    free(f->dest_tail);
+    free(f->touched);
+    free(f->dest_done);
+    free(f->dest_flush);
+#ifdef __linux__
+    free(f->msgs);
+    free(f->iovs);
+    free(f->controls);
+    free(f->msg_dests);
+#endif
+    free(f);
+}
+
+/* NULL on allocation failure, or with errno = EOPNOTSUPP when the mode is not
+ * available here (the caller picks another one). */
+static inline udp_fanout* udp_fanout_create(udp_fanout_mode mode, int fd, uint32_t max_dests, uint32_t max_datagrams) {
+#ifndef __linux__
+    if (mode != UDP_FANOUT_SENDTO) {
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
+#endif
+    if (mode == UDP_FANOUT_GSO && !udp_fanout_gso_supported(fd)) {
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
+    udp_fanout* f = (udp_fanout*)calloc(1, sizeof(udp_fanout));
+    if (f == NULL) return NULL;
+    f->mode = mode;
+    f->fd = fd;
+    f->max_dests = max_dests;
+    f->max_datagrams = max_datagrams;
+    f->entries = (udp_fanout_entry*)calloc(max_datagrams, sizeof(udp_fanout_entry));
+    f->dest_addrs = (struct sockaddr_in*)calloc(max_dests, sizeof(struct sockaddr_in));
+    f->dest_head = (uint32_t*)malloc(max_dests * sizeof(uint32_t));
+    f->dest_tail = (uint32_t*)malloc(max_dests * sizeof(uint32_t));
+    f->touched = (uint32_t*)calloc(max_dests, sizeof(uint32_t));
+    f->dest_done = (uint32_t*)calloc(max_dests, sizeof(uint32_t));
+    f->dest_flush = (uint32_t*)calloc(max_dests, sizeof(uint32_t));
+    int ok = f->entries && f->dest_addrs && f->dest_head && f->dest_tail && f->touched && f->dest_done && f->dest_flush;
+#ifdef __linux__
+    f->msgs = (struct mmsghdr*)calloc(UDP_FANOUT_MAX_MSGS, sizeof(struct mmsghdr));
+    f->iovs = (struct iovec*)calloc(max_datagrams, sizeof(struct iovec));
+    f->controls = (unsigned char*)calloc(UDP_FANOUT_MAX_MSGS, UDP_FANOUT_CONTROL_BYTES);
+    f->msg_dests = (uint32_t*)calloc(UDP_FANOUT_MAX_MSGS, sizeof(uint32_t));
+    ok = ok && f->msgs && f->iovs && f->controls && f->msg_dests;
+#endif
+    if (!ok) {
+        udp_fanout_destroy(f);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < max_dests; ++i) f->dest_head[i] = UDP_FANOUT_NONE;
+    return f;
+}
+
+/* Datagrams queued for dest that the last flush consumed (see the header comment) */
+static inline uint32_t udp_fanout_done(const udp_fanout* f, uint32_t dest) {
+    return dest < f->max_dests && f->dest_flush[dest] == f->flush_id ? f->dest_done[dest] : 0;
+}
+
+/* Datagrams that can still be queued without an automatic flush */
+static inline uint32_t udp_fanout_room(const udp_fanout* f) {
+    return f->max_datagrams - f->entry_count;
+}
+
+static inline int udp_fanout_is_would_block(int error) {
+    return error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS;
+}
+
+#ifdef __linux__
+/* Sends msgs[0..count) with as few sendmmsg calls as the kernel allows */
+static inline void udp_fanout_submit(udp_fanout* f, uint32_t count) {
+    uint32_t done = 0;
+    while (done < count) {
+        int n = sendmmsg(f->fd, f->msgs + done, count - done, MSG_DONTWAIT);
+        f->stats.send_calls++;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (udp_fanout_is_would_block(errno)) {
+                f->stats.would_block++;
+                f->blocked = 1;
+                return;
+            }
+            /* Skip the message the kernel refused and carry on with the rest */
+            f->stats.errors += f->msgs[done].msg_hdr.msg_iovlen;
+            f->dest_done[f->msg_dests[done]] += (uint32_t)f->msgs[done].msg_hdr.msg_iovlen;
+            done++;
+            continue;
+        }
+        for (int i = 0; i < n; ++i) {
+            const struct msghdr* h = &f->msgs[done + (uint32_t)i].msg_hdr;
+            f->stats.messages++;
+            f->stats.datagrams += h->msg_iovlen;
+            f->stats.bytes += f->msgs[done + (uint32_t)i].msg_len;
+            f->dest_done[f->msg_dests[done + (uint32_t)i]] += (uint32_t)h->msg_iovlen;
+        }
+        done += (uint32_t)n;
+    }
+}
+#endif
+
+static inline void udp_fanout_reset(udp_fanout* f) {
+    for (uint32_t t = 0; t < f->touched_count; ++t) f->dest_head[f->touched[t]] = UDP_FANOUT_NONE;
+    f->touched_count = 0;
+    f->entry_count = 0;
+}
+
+/* Sends everything queued since the last flush. */
+static inline void udp_fanout_flush(udp_fanout* f) {
+    f->flush_id++;
+    if (f->touched_count == 0) return;
+    for (uint32_t t = 0; t < f->touched_count; ++t) {
+        f->dest_done[f->touched[t]] = 0;
+        f->dest_flush[f->touched[t]] = f->flush_id;
+    }
+    f->blocked = 0;
+#ifdef __linux__
+    if (f->mode != UDP_FANOUT_SENDTO) {
+        uint32_t msg_count = 0, iov_count = 0;
+        for (uint32_t t = 0; t < f->touched_count && !f->blocked; ++t) {
+            uint32_t dest = f->touched[t];
+            uint32_t e = f->dest_head[dest];
+            while (e != UDP_FANOUT_NONE) {
+                if (msg_count == UDP_FANOUT_MAX_MSGS) {
+                    udp_fanout_submit(f, msg_count);
+                    msg_count = 0;
+                    iov_count = 0;
+                    if (f->blocked) break;
+                }
+                /* One message: a single datagram, or with GSO a run of equal-sized
+                 * datagrams, the last of which may be shorter */
+                uint32_t segment = f->entries[e].length;
+                uint32_t first_iov = iov_count, total = 0, segments = 0;
+                while (e != UDP_FANOUT_NONE) {
+                    const udp_fanout_entry* entry = &f->entries[e];
+                    if (segments > 0 && (f->mode != UDP_FANOUT_GSO || entry->length > segment
+                        || segments == UDP_FANOUT_MAX_SEGMENTS || total + entry->length > UDP_FANOUT_MAX_GSO_BYTES)) break;
+                    f->iovs[iov_count].iov_base = (void*)entry->data;
+                    f->iovs[iov_count].iov_len = entry->length;
+                    iov_count++;
+                    total += entry->length;
+                    segments++;
+                    e = entry->next;
+                    if (entry->length < segment) break; /* A short segment must be the last */
+                }
+
+                struct msghdr* h = &f->msgs[msg_count].msg_hdr;
+                memset(h, 0, sizeof(*h));
+                h->msg_name = &f->dest_addrs[dest];
+                h->msg_namelen = sizeof(struct sockaddr_in);
+                h->msg_iov = &f->iovs[first_iov];
+                h->msg_iovlen = segments;
+                if (segments > 1) {
+                    unsigned char* control = f->controls + (size_t)msg_count * UDP_FANOUT_CONTROL_BYTES;
+                    memset(control, 0, UDP_FANOUT_CONTROL_BYTES);
+                    h->msg_control = control;
+                    h->msg_controllen = UDP_FANOUT_CONTROL_BYTES;
+                    struct cmsghdr* cm = CMSG_FIRSTHDR(h);
+                    cm->cmsg_level = SOL_UDP;
+                    cm->cmsg_type = UDP_SEGMENT;
+                    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                    uint16_t gso_size = (uint16_t)segment;
+                    memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+                }
+                f->msg_dests[msg_count] = dest;
+                msg_count++;
+            }
+        }
+        if (!f->blocked) udp_fanout_submit(f, msg_count);
+        udp_fanout_reset(f);
+        return;
+    }
+#endif
+    for (uint32_t t = 0; t < f->touched_count && !f->blocked; ++t) {
+        uint32_t dest = f->touched[t];
+        for (uint32_t e = f->dest_head[dest]; e != UDP_FANOUT_NONE; e = f->entries[e].next) {
+            const udp_fanout_entry* entry = &f->entries[e];
+            int n = (int)sendto(f->fd, (const char*)entry->data, entry->length, MSG_DONTWAIT,
+                                (const struct sockaddr*)&f->dest_addrs[dest], sizeof(struct sockaddr_in));
+            f->stats.send_calls++;
+            if (n < 0 && udp_fanout_is_would_block(errno)) {
+                f->stats.would_block++;
+                f->blocked = 1;
+                break;
+            }
+            f->dest_done[dest]++;
+            if (n < 0) {
+                f->stats.errors++;
+                continue;
+            }
+            f->stats.messages++;
+            f->stats.datagrams++;
+            f->stats.bytes += (uint64_t)n;
+        }
+    }
+    udp_fanout_reset(f);
+}
+
+/* Queues one datagram for `dest` (an id below max_dests); flushes first when full.
+ * Returns -1 if dest is out of range. */
+static inline int udp_fanout_queue(udp_fanout* f, uint32_t dest, const struct sockaddr_in* addr,
+                                   const void* data, uint32_t length) {
+    if (dest >= f->max_dests) return -1;
+    if (f->entry_count == f->max_datagrams) udp_fanout_flush(f);
+    uint32_t e = f->entry_count++;
+    f->entries[e].data = (const unsigned char*)data;
+    f->entries[e].length = length;
+    f->entries[e].next = UDP_FANOUT_NONE;
+    if (f->dest_head[dest] == UDP_FANOUT_NONE) {
+        f->dest_head[dest] = e;
+        f->dest_addrs[dest] = *addr;
+        f->touched[f->touched_count++] = dest;
+    } else {
+        f->entries[f->dest_tail[dest]].next = e;
+    }
+    f->dest_tail[dest] = e;
+    return 0;
+}
+
+#endif /* UDP_FANOUT_H */
@@ -0,0 +1,885 @@
+/*
+ * udp_io.h - pluggable datagram I/O backends for the UDP servers.
+ *
+ * Both the Udpserver worker (UDPClient/ServerWorker.hpp) and meta_server.c
+ * receive and send through this one interface and pick the backend at startup:
+ *
+ *   UDP_IO_BLOCKING  recvfrom / sendto, one datagram per syscall (portable)
+ *   UDP_IO_MMSG      recvmmsg / sendmmsg, up to `batch` datagrams per syscall
+ *   UDP_IO_URING     io_uring: one multishot RECVMSG drawing from a provided
+ *                    buffer ring registered with the kernel, SENDMSG SQEs for
+ *                    replies. Completions that are already in the CQ are
+ *                    picked up without any syscall.
+ *   UDP_IO_CUSTOM    the caller's receive and send functions, with the same
+ *                    buffers and stats (udp_io_create_custom), e.g. an
+ *                    in-process transport (include/udp_io_transport.h).
+ *
+ *   udp_io* io = udp_io_create(UDP_IO_MMSG, fd, 64, 12, 1024);
+ *   int n = udp_io_recv(io, packets, 64);     // blocks until >= 1 datagram
+ *   ...                                       // packets[i].data is valid
+ *   udp_io_send(io, replies, count);          // replies may point into packets
+ *   n = udp_io_recv(io, packets, 64);         // previous packets are recycled
+ *
+ * udp_io_enable_timestamps() (Linux, before the first receive) turns on
+ * SO_TIMESTAMPNS: every received packet then carries the time the kernel
+ * queued it (rx_ns, CLOCK_REALTIME), so callers can tell how long datagrams
+ * waited in the socket buffer. It costs one control message per datagram.
+ *
+ * udp_io_recv_timeout() gives up after a deadline instead, so one thread can
+ * both receive and run a fixed-rate tick. Callers with their own epoll loop wait
+ * on udp_io_event_fd() and drain with a timeout of 0; spinning callers use
+ * udp_io_try_recv().
+ *
+ * Received packets stay valid until the next udp_io_recv() on the same io,
+ * and sends may reference them until then. The io_uring backend talks to the
+ * kernel through raw syscalls (no liburing), needs Linux 6.0+ and falls back
+ * to nothing on its own: udp_io_create() returns NULL and the caller decides.
+ *
+ * Header-only and usable from both C and C++; include it from exactly one
+ * translation unit per program. C programs must define _GNU_SOURCE before
+ * their first system include (recvmmsg/sendmmsg); C++ compilers already do.
+ */
+#ifndef UDP_IO_H
+#define UDP_IO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <time.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#endif
+
+typedef enum udp_io_kind {
+    UDP_IO_BLOCKING = 0,
+    UDP_IO_MMSG = 1,
+    UDP_IO_URING = 2,
+    UDP_IO_CUSTOM = 3
+} udp_io_kind;
+
+typedef struct udp_packet {
+    struct sockaddr_in addr;
+    unsigned char* data;
+    uint32_t length;
+    uint32_t truncated;                 /* datagram was longer than buffer_size */
+    uint64_t rx_ns;                     /* received: kernel arrival, CLOCK_REALTIME ns; 0 without timestamps */
+} udp_packet;
+
+typedef struct udp_io_stats {
+    uint64_t recv_calls;                /* syscalls made to receive */
+    uint64_t send_calls;                /* syscalls made to send */
+    uint64_t packets_in;
+    uint64_t packets_out;
+    uint64_t send_errors;
+    uint64_t recv_errors;
+} udp_io_stats;
+
+struct udp_io;
+
+/* UDP_IO_CUSTOM: recv fills up to max packets (data pointing into io->buffers, which
+ * may be written to) within timeout_ms as udp_io_recv_timeout does; send returns how
+ * many packets it took. destroy (may be NULL) frees the context. Calls are counted
+ * in io->stats by the caller of the hooks. */
+typedef struct udp_io_custom {
+    int (*recv)(struct udp_io* io, udp_packet* packets, int max, int timeout_ms);
+    int (*send)(struct udp_io* io, const udp_packet* packets, int count);
+    void (*destroy)(struct udp_io* io);
+    void* context;
+} udp_io_custom;
+
+#ifdef __linux__
+#define UDP_URING_RECV_TAG 1ull
+#define UDP_URING_SEND_TAG 2ull
+#define UDP_URING_BUFFER_GROUP 0
+#define UDP_URING_BUFFER_COUNT 4096     /* provided receive buffers, power of two */
+#define UDP_IO_CONTROL_BYTES 64         /* per datagram: room for one SCM_TIMESTAMPNS */
+
+typedef struct udp_uring {
+    int ring_fd;
+    int socket_fd;
+    unsigned sq_entries;
+    unsigned cq_entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_local_tail;
+    unsigned sq_unsubmitted;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring_ptr;
+    size_t sq_ring_len;
+    void* cq_ring_ptr;
+    size_t cq_ring_len;
+    size_t sqes_len;
+
+    /* Provided buffer ring: the kernel picks a free buffer for every datagram */
+    struct io_uring_buf* buf_ring;
+    size_t buf_ring_len;
+    uint16_t buf_local_tail;
+    unsigned char* buffers;
+    unsigned buf_size;
+    uint16_t* held;                     /* buffer ids handed out by the last recv */
+    int held_count;
+
+    struct msghdr recv_template;
+    int recv_armed;
+
+    /* Receive completions reaped while waiting for something else */
+    struct io_uring_cqe* stash;
+    unsigned stash_head;
+    unsigned stash_count;
+
+    unsigned pending_sends;
+    struct msghdr* send_msgs;
+    struct iovec* send_iovs;
+} udp_uring;
+#endif
+
+typedef struct udp_io {
+    udp_io_kind kind;
+    const char* name;
+    int fd;
+    int batch;                          /* max datagrams per receive */
+    int buffer_size;                    /* max payload per datagram */
+    int tx_slots;                       /* max datagrams per send syscall / SQE batch */
+    int timestamps;                     /* udp_io_enable_timestamps() succeeded */
+    udp_io_stats stats;
+
+    unsigned char* buffers;             /* batch x buffer_size receive buffers */
+    udp_io_custom custom;               /* UDP_IO_CUSTOM only */
+#ifdef __linux__
+    struct mmsghdr* rx_msgs;
+    struct iovec* rx_iovs;
+    struct sockaddr_in* rx_addrs;
+    unsigned char* rx_control;          /* batch x UDP_IO_CONTROL_BYTES, with timestamps only */
+    struct mmsghdr* tx_msgs;
+    struct iovec* tx_iovs;
+    udp_uring* uring;
+#endif
+} udp_io;
+
+static inline const char* udp_io_kind_name(udp_io_kind kind) {
+    switch (kind) {
+        case UDP_IO_MMSG: return "mmsg";
+        case UDP_IO_URING: return "io_uring";
+        case UDP_IO_CUSTOM: return "custom";
+        default: return "blocking";
+    }
+}
+
+/* Parses "blocking", "mmsg" or "uring"/"io_uring"; returns -1 if unknown. */
+static inline int udp_io_parse_kind(const char* name) {
+    if (strcmp(name, "blocking") == 0) return UDP_IO_BLOCKING;
+    if (strcmp(name, "mmsg") == 0) return UDP_IO_MMSG;
+    if (strcmp(name, "uring") == 0 || strcmp(name, "io_uring") == 0) return UDP_IO_URING;
+    return -1;
+}
+
+/* ---- io_uring plumbing (raw syscalls) ---- */
+#ifdef __linux__
+static inline int udp_uring_enter(udp_uring* r, unsigned min_complete) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int rc;
+    do {
+        rc = (int)syscall(__NR_io_uring_enter, r->ring_fd, r->sq_unsubmitted, min_complete, flags, NULL, 0);
+    } while (rc < 0 && errno == EINTR);
+    if (rc >= 0) r->sq_unsubmitted -= (unsigned)rc < r->sq_unsubmitted ? (unsigned)rc : r->sq_unsubmitted;
+    return rc;
+}
+
+/* Submits and waits for one completion for at most timeout_ms; a timeout is not an error */
+static inline int udp_uring_wait(udp_uring* r, int64_t timeout_ms) {
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    int rc;
+    do {
+        rc = (int)syscall(__NR_io_uring_enter, r->ring_fd, r->sq_unsubmitted, 1,
+                          IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0) return errno == ETIME ? 0 : -1;
+    r->sq_unsubmitted -= (unsigned)rc < r->sq_unsubmitted ? (unsigned)rc : r->sq_unsubmitted;
+    return rc;
+}
+
+static inline struct io_uring_sqe* udp_uring_get_sqe(udp_uring* r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_local_tail - head >= r->sq_entries) return NULL;
+    unsigned index = r->sq_local_tail & *r->sq_mask;
+    struct io_uring_sqe* sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[index] = index;
+    r->sq_local_tail++;
+    r->sq_unsubmitted++;
+    return sqe;
+}
+
+static inline void udp_uring_publish(udp_uring* r) {
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static inline void udp_uring_give_buffer(udp_uring* r, uint16_t bid) {
+    struct io_uring_buf* buf = &r->buf_ring[r->buf_local_tail & (UDP_URING_BUFFER_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(r->buffers + (size_t)bid * r->buf_size);
+    buf->len = r->buf_size;
+    buf->bid = bid;
+    r->buf_local_tail++;
+}
+
+static inline void udp_uring_publish_buffers(udp_uring* r) {
+    /* The ring tail shares storage with the resv field of the first entry */
+    __atomic_store_n(&r->buf_ring[0].resv, r->buf_local_tail, __ATOMIC_RELEASE);
+}
+
+/* Drains the CQ: send completions are counted, receive completions are stashed. */
+static inline void udp_uring_reap(udp_io* io, udp_uring* r) {
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+        if (cqe->user_data == UDP_URING_SEND_TAG) {
+            r->pending_sends--;
+            if (cqe->res < 0) io->stats.send_errors++;
+            else io->stats.packets_out++;
+            continue;
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) r->recv_armed = 0;
+        if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            r->stash[(r->stash_head + r->stash_count) & (UDP_URING_BUFFER_COUNT - 1)] = *cqe;
+            r->stash_count++;
+        } else if (cqe->res != -ENOBUFS) {
+            io->stats.recv_errors++;
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static inline void udp_uring_arm_recv(udp_uring* r) {
+    struct io_uring_sqe* sqe = udp_uring_get_sqe(r);
+    if (sqe == NULL) return;            /* SQ full; retried on the next recv */
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = r->socket_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&r->recv_template;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = UDP_URING_BUFFER_GROUP;
+    sqe->user_data = UDP_URING_RECV_TAG;
+    r->recv_armed = 1;
+}
+
+static inline void udp_uring_destroy(udp_uring* r) {
+    if (r == NULL) return;
+    if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+    if (r->cq_ring_ptr && r->cq_ring_ptr != MAP_FAILED && r->cq_ring_ptr != r->sq_ring_ptr) munmap(r->cq_ring_ptr, r->cq_ring_len);
+    if (r->sq_ring_ptr && r->sq_ring_ptr != MAP_FAILED) munmap(r->sq_ring_ptr, r->sq_ring_len);
+    if (r->buf_ring && (void*)r->buf_ring != MAP_FAILED) munmap(r->buf_ring, r->buf_ring_len);
+    if (r->ring_fd >= 0) close(r->ring_fd);
+    free(r->buffers);
+    free(r->held);
+    free(r->stash);
+    free(r->send_msgs);
+    free(r->send_iovs);
+    free(r);
+}
+
+static inline udp_uring* udp_uring_create(int fd, int buffer_size, int tx_slots) {
+    udp_uring* r = (udp_uring*)calloc(1, sizeof(udp_uring));
+    if (r == NULL) return NULL;
+    r->ring_fd = -1;
+    r->socket_fd = fd;
+
+    /* 1. Ring setup: room for every send SQE of one batch plus the receive */
+    unsigned entries = 64;
+    while (entries < (unsigned)tx_slots + 8) entries <<= 1;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    r->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (r->ring_fd < 0) {
+        params.flags = 0;
+        r->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (r->ring_fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) goto fail;
+
+    r->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_ring_len > r->sq_ring_len) r->sq_ring_len = r->cq_ring_len;
+    r->cq_ring_len = r->sq_ring_len;
+    r->sq_ring_ptr = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring_ptr == MAP_FAILED) goto fail;
+    r->cq_ring_ptr = r->sq_ring_ptr;
+    r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail;
+
+    {
+        unsigned char* sq = (unsigned char*)r->sq_ring_ptr;
+        r->sq_head = (unsigned*)(sq + params.sq_off.head);
+        r->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        r->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+        r->sq_array = (unsigned*)(sq + params.sq_off.array);
+        r->cq_head = (unsigned*)(sq + params.cq_off.head);
+        r->cq_tail = (unsigned*)(sq + params.cq_off.tail);
+        r->cq_mask = (unsigned*)(sq + params.cq_off.ring_mask);
+        r->cqes = (struct io_uring_cqe*)(sq + params.cq_off.cqes);
+        r->sq_entries = params.sq_entries;
+        r->cq_entries = params.cq_entries;
+        r->sq_local_tail = *r->sq_tail;
+    }
+
+    /* 2. Provided buffer ring: header + sockaddr + control + payload per buffer, cache-line
+     *    rounded; the control room is only filled once timestamps are enabled */
+    r->buf_size = (unsigned)((sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + UDP_IO_CONTROL_BYTES
+                              + (size_t)buffer_size + 63) & ~(size_t)63);
+    r->buffers = (unsigned char*)aligned_alloc(64, (size_t)r->buf_size * UDP_URING_BUFFER_COUNT);
+    r->held = (uint16_t*)calloc(UDP_URING_BUFFER_COUNT, sizeof(uint16_t));
+    r->stash = (struct io_uring_cqe*)calloc(UDP_URING_BUFFER_COUNT, sizeof(struct io_uring_cqe));
+    r->send_msgs = (struct msghdr*)calloc((size_t)tx_slots, sizeof(struct msghdr));
+    r->send_iovs = (struct iovec*)calloc((size_t)tx_slots, sizeof(struct iovec));
+    if (!r->buffers || !r->held || !r->stash || !r->send_msgs || !r->send_iovs) goto fail;
+
+    r->buf_ring_len = UDP_URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    r->buf_ring = (struct io_uring_buf*)mmap(NULL, r->buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((void*)r->buf_ring == MAP_FAILED) goto fail;
+    {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)(uintptr_t)r->buf_ring;
+        reg.ring_entries = UDP_URING_BUFFER_COUNT;
+        reg.bgid = UDP_URING_BUFFER_GROUP;
+        if (syscall(__NR_io_uring_register, r->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) goto fail;
+    }
+    for (unsigned i = 0; i < UDP_URING_BUFFER_COUNT; ++i) udp_uring_give_buffer(r, (uint16_t)i);
+    udp_uring_publish_buffers(r);
+
+    /* 3. Multishot RECVMSG template: the kernel writes the source address into each buffer */
+    r->recv_template.msg_namelen = sizeof(struct sockaddr_in);
+    r->recv_armed = 0;
+    return r;
+
+fail:
+    udp_uring_destroy(r);
+    return NULL;
+}
+#endif
+
+#ifdef __linux__
+/* Kernel arrival time from a control message area, 0 if there is none */
+static inline uint64_t udp_io_parse_timestamp(const unsigned char* control, size_t length) {
+    size_t offset = 0;
+    while (offset + sizeof(struct cmsghdr) <= length) {
+        struct cmsghdr cmsg;
+        memcpy(&cmsg, control + offset, sizeof(cmsg));
+        if (cmsg.cmsg_len < sizeof(struct cmsghdr) || offset + cmsg.cmsg_len > length) break;
+        if (cmsg.cmsg_level == SOL_SOCKET && cmsg.cmsg_type == SCM_TIMESTAMPNS
+            && cmsg.cmsg_len >= CMSG_LEN(sizeof(struct timespec))) {
+            struct timespec ts;
+            memcpy(&ts, control + offset + CMSG_LEN(0), sizeof(ts));
+            return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+        }
+        offset += CMSG_ALIGN(cmsg.cmsg_len);
+    }
+    return 0;
+}
+#endif
+
+/* CLOCK_REALTIME in ns, the clock rx_ns is on */
+static inline uint64_t udp_io_realtime_ns(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static inline int64_t udp_io_clock_ms(void) {
+#ifdef _WIN32
+    return (int64_t)GetTickCount64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+/* ---- public API ---- */
+
+static inline void udp_io_destroy(udp_io* io) {
+    if (io == NULL) return;
+    if (io->custom.destroy) io->custom.destroy(io);
+    free(io->buffers);
+#ifdef __linux__
+    free(io->rx_msgs);
+    free(io->rx_iovs);
+    free(io->rx_addrs);
+    free(io->rx_control);
+    free(io->tx_msgs);
+    free(io->tx_iovs);
+    udp_uring_destroy(io->uring);
+#endif
+    free(io);
+}
+
+/* Receives up to `batch` datagrams of up to `buffer_size` bytes and sends up to
+ * `tx_slots` datagrams per syscall. Returns NULL if the backend is unavailable. */
+static inline udp_io* udp_io_create(udp_io_kind kind, int fd, int batch, int buffer_size, int tx_slots) {
+    if (batch < 1) batch = 1;
+    if (tx_slots < 1) tx_slots = 1;
+    udp_io* io = (udp_io*)calloc(1, sizeof(udp_io));
+    if (io == NULL) return NULL;
+    io->kind = kind;
+    io->name = udp_io_kind_name(kind);
+    io->fd = fd;
+    io->batch = kind == UDP_IO_BLOCKING ? 1 : batch;
+    io->buffer_size = buffer_size;
+    io->tx_slots = tx_slots;
+
+#ifdef __linux__
+    if (kind == UDP_IO_URING) {
+        io->uring = udp_uring_create(fd, buffer_size, tx_slots);
+        if (io->uring == NULL) goto fail;
+        return io;
+    }
+#else
+    if (kind != UDP_IO_BLOCKING) goto fail;
+#endif
+
+    io->buffers = (unsigned char*)malloc((size_t)io->batch * (size_t)buffer_size);
+    if (io->buffers == NULL) goto fail;
+
+#ifdef __linux__
+    if (kind == UDP_IO_MMSG) {
+        io->rx_msgs = (struct mmsghdr*)calloc((size_t)batch, sizeof(struct mmsghdr));
+        io->rx_iovs = (struct iovec*)calloc((size_t)batch, sizeof(struct iovec));
+        io->rx_addrs = (struct sockaddr_in*)calloc((size_t)batch, sizeof(struct sockaddr_in));
+        io->tx_msgs = (struct mmsghdr*)calloc((size_t)tx_slots, sizeof(struct mmsghdr));
+        io->tx_iovs = (struct iovec*)calloc((size_t)tx_slots, sizeof(struct iovec));
+        if (!io->rx_msgs || !io->rx_iovs || !io->rx_addrs || !io->tx_msgs || !io->tx_iovs) goto fail;
+        for (int i = 0; i < batch; ++i) {
+            io->rx_iovs[i].iov_base = io->buffers + (size_t)i * (size_t)buffer_size;
+            io->rx_iovs[i].iov_len = (size_t)buffer_size;
+        }
+    }
+#endif
+    return io;
+
+fail:
+    udp_io_destroy(io);
+    return NULL;
+}
+
+/* A UDP_IO_CUSTOM io named `name` with batch x buffer_size receive buffers; the hooks
+ * move the datagrams. Returns NULL (custom->destroy not called) if memory ran out. */
+static inline udp_io* udp_io_create_custom(const char* name, const udp_io_custom* custom, int batch, int buffer_size, int tx_slots) {
+    if (batch < 1) batch = 1;
+    if (tx_slots < 1) tx_slots = 1;
+    udp_io* io = (udp_io*)calloc(1, sizeof(udp_io));
+    if (io == NULL) return NULL;
+    io->kind = UDP_IO_CUSTOM;
+    io->name = name;
+    io->fd = -1;
+    io->batch = batch;
+    io->buffer_size = buffer_size;
+    io->tx_slots = tx_slots;
+    io->buffers = (unsigned char*)malloc((size_t)batch * (size_t)buffer_size);
+    if (io->buffers == NULL) {
+        free(io);
+        return NULL;
+    }
+    io->custom = *custom;
+    return io;
+}
+
+/* UDP_IO_CUSTOM receive, counted like a syscall */
+static inline int udp_io_recv_custom(udp_io* io, udp_packet* packets, int max, int timeout_ms) {
+    int n = io->custom.recv(io, packets, max, timeout_ms);
+    io->stats.recv_calls++;
+    if (n > 0) io->stats.packets_in += (uint64_t)n;
+    else if (n < 0) io->stats.recv_errors++;
+    return n;
+}
+
+/* Stamps every received datagram with its kernel arrival time (packet.rx_ns). Call
+ * before the first receive. Returns 0, or -1 with errno set (ENOTSUP off Linux,
+ * EBUSY once an io_uring receive is armed). */
+static inline int udp_io_enable_timestamps(udp_io* io) {
+    if (io->kind == UDP_IO_CUSTOM) {
+        errno = ENOTSUP;
+        return -1;
+    }
+#ifdef __linux__
+    if (io->timestamps) return 0;
+    if (io->kind == UDP_IO_URING && io->uring->recv_armed) {
+        errno = EBUSY;
+        return -1;
+    }
+    int enable = 1;
+    if (setsockopt(io->fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) != 0) return -1;
+    if (io->kind == UDP_IO_URING) {
+        io->uring->recv_template.msg_controllen = UDP_IO_CONTROL_BYTES;
+    } else {
+        io->rx_control = (unsigned char*)calloc((size_t)io->batch, UDP_IO_CONTROL_BYTES);
+        if (io->rx_control == NULL) return -1;
+    }
+    io->timestamps = 1;
+    return 0;
+#else
+    (void)io;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* Waits until every send handed to the backend has completed, so the buffers they
+ * point at may be reused. Only io_uring sends asynchronously; the others return at once. */
+static inline int udp_io_wait_sends(udp_io* io) {
+#ifdef __linux__
+    if (io->kind == UDP_IO_URING) {
+        udp_uring* r = io->uring;
+        while (r->pending_sends > 0) {
+            if (udp_uring_enter(r, 1) < 0) return -1;
+            io->stats.send_calls++;
+            udp_uring_reap(io, r);
+        }
+    }
+#endif
+    (void)io;
+    return 0;
+}
+
+#ifdef __linux__
+static inline int udp_io_recv_uring(udp_io* io, udp_packet* packets, int max, int timeout_ms) {
+    udp_uring* r = io->uring;
+    int64_t deadline = timeout_ms >= 0 ? udp_io_clock_ms() + timeout_ms : 0;
+
+    /* 1. Recycle last call's buffers, once no SENDMSG can still be reading them */
+    if (udp_io_wait_sends(io) < 0) return -1;
+    if (r->held_count > 0) {
+        for (int i = 0; i < r->held_count; ++i) udp_uring_give_buffer(r, r->held[i]);
+        udp_uring_publish_buffers(r);
+        r->held_count = 0;
+    }
+
+    /* 2. Take whatever already completed; only enter the kernel when nothing has */
+    udp_uring_reap(io, r);
+    while (r->stash_count == 0) {
+        if (!r->recv_armed) {
+            udp_uring_arm_recv(r);
+            udp_uring_publish(r);
+        }
+        int rc;
+        if (timeout_ms < 0) {
+            rc = udp_uring_enter(r, 1);
+        } else {
+            int64_t left = deadline - udp_io_clock_ms();
+            rc = udp_uring_wait(r, left > 0 ? left : 0);
+        }
+        if (rc < 0) return -1;
+        io->stats.recv_calls++;
+        udp_uring_reap(io, r);
+        if (timeout_ms >= 0 && r->stash_count == 0 && udp_io_clock_ms() >= deadline) return 0;
+    }
+
+    /* 3. Hand out datagrams straight from the provided buffers */
+    int n = 0;
+    while (n < max && r->stash_count > 0) {
+        const struct io_uring_cqe* cqe = &r->stash[r->stash_head];
+        r->stash_head = (r->stash_head + 1) & (UDP_URING_BUFFER_COUNT - 1);
+        r->stash_count--;
+
+        uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        unsigned char* buf = r->buffers + (size_t)bid * r->buf_size;
+        const struct io_uring_recvmsg_out* out = (const struct io_uring_recvmsg_out*)buf;
+        unsigned char* name = buf + sizeof(*out);
+        unsigned char* control = name + r->recv_template.msg_namelen;
+        unsigned char* payload = control + r->recv_template.msg_controllen;
+        uint32_t room = (uint32_t)(buf + cqe->res - payload);
+
+        memcpy(&packets[n].addr, name, sizeof(struct sockaddr_in));
+        packets[n].data = payload;
+        packets[n].length = out->payloadlen < room ? out->payloadlen : room;
+        packets[n].truncated = (out->flags & MSG_TRUNC) != 0;
+        packets[n].rx_ns = io->timestamps ? udp_io_parse_timestamp(control, out->controllen) : 0;
+        r->held[r->held_count++] = bid;
+        n++;
+    }
+    io->stats.packets_in += (uint64_t)n;
+    return n;
+}
+
+static inline int udp_io_send_uring(udp_io* io, const udp_packet* packets, int count) {
+    udp_uring* r = io->uring;
+    int done = 0;
+    while (done < count) {
+        /* The msghdr slots are reused, so the previous chunk must have completed */
+        if (udp_io_wait_sends(io) < 0) return done;
+        int chunk = count - done < io->tx_slots ? count - done : io->tx_slots;
+        int queued = 0;
+        for (; queued < chunk; ++queued) {
+            struct io_uring_sqe* sqe = udp_uring_get_sqe(r);
+            if (sqe == NULL) break;
+            const udp_packet* p = &packets[done + queued];
+            struct msghdr* msg = &r->send_msgs[queued];
+            memset(msg, 0, sizeof(*msg));
+            r->send_iovs[queued].iov_base = p->data;
+            r->send_iovs[queued].iov_len = p->length;
+            msg->msg_name = (void*)&p->addr;
+            msg->msg_namelen = sizeof(struct sockaddr_in);
+            msg->msg_iov = &r->send_iovs[queued];
+            msg->msg_iovlen = 1;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = io->fd;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+            sqe->user_data = UDP_URING_SEND_TAG;
+        }
+        udp_uring_publish(r);
+        if (udp_uring_enter(r, 0) < 0) return done;
+        io->stats.send_calls++;
+        r->pending_sends += (unsigned)queued;
+        done += queued;
+    }
+    return done;
+}
+#endif
+
+/* recvfrom / recvmmsg path; with MSG_DONTWAIT an empty queue returns 0 */
+static inline int udp_io_recv_socket(udp_io* io, udp_packet* packets, int max, int flags) {
+#ifdef __linux__
+    if (io->kind == UDP_IO_MMSG) {
+        for (int i = 0; i < max; ++i) {
+            struct msghdr* hdr = &io->rx_msgs[i].msg_hdr;
+            memset(hdr, 0, sizeof(*hdr));
+            hdr->msg_name = &io->rx_addrs[i];
+            hdr->msg_namelen = sizeof(struct sockaddr_in);
+            hdr->msg_iov = &io->rx_iovs[i];
+            hdr->msg_iovlen = 1;
+            if (io->rx_control) {
+                hdr->msg_control = io->rx_control + (size_t)i * UDP_IO_CONTROL_BYTES;
+                hdr->msg_controllen = UDP_IO_CONTROL_BYTES;
+            }
+        }
+        int n = recvmmsg(io->fd, io->rx_msgs, (unsigned)max, MSG_WAITFORONE | flags, NULL);
+        io->stats.recv_calls++;
+        if (n < 0) {
+            if ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+            io->stats.recv_errors++;
+            return -1;
+        }
+        for (int i = 0; i < n; ++i) {
+            packets[i].addr = io->rx_addrs[i];
+            packets[i].data = (unsigned char*)io->rx_iovs[i].iov_base;
+            packets[i].length = io->rx_msgs[i].msg_len;
+            packets[i].truncated = (io->rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+            packets[i].rx_ns = io->rx_control ? udp_io_parse_timestamp((const unsigned char*)io->rx_msgs[i].msg_hdr.msg_control,
+                                                                        io->rx_msgs[i].msg_hdr.msg_controllen) : 0;
+        }
+        io->stats.packets_in += (uint64_t)n;
+        return n;
+    }
+#endif
+    (void)max;
+    int n;
+    uint32_t truncated = 0;
+    packets[0].rx_ns = 0;
+#ifdef __linux__
+    if (io->rx_control) {
+        /* recvmsg instead of recvfrom, for the timestamp */
+        struct iovec iov;
+        struct msghdr hdr;
+        iov.iov_base = io->buffers;
+        iov.iov_len = (size_t)io->buffer_size;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = &packets[0].addr;
+        hdr.msg_namelen = sizeof(struct sockaddr_in);
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = io->rx_control;
+        hdr.msg_controllen = UDP_IO_CONTROL_BYTES;
+        n = (int)recvmsg(io->fd, &hdr, flags);
+        if (n >= 0) {
+            packets[0].rx_ns = udp_io_parse_timestamp(io->rx_control, hdr.msg_controllen);
+            truncated = (hdr.msg_flags & MSG_TRUNC) != 0;
+        }
+    } else
+#endif
+    {
+        socklen_t addr_len = sizeof(struct sockaddr_in);
+#ifdef __linux__
+        flags |= MSG_TRUNC; /* Returns the datagram's real length, so a longer one is seen as such */
+#endif
+        n = (int)recvfrom(io->fd, (char*)io->buffers, (size_t)io->buffer_size, flags, (struct sockaddr*)&packets[0].addr, &addr_len);
+#ifdef _WIN32
+        if (n < 0 && WSAGetLastError() == WSAEMSGSIZE) n = io->buffer_size + 1; /* Filled, the rest discarded */
+#endif
+        if (n > io->buffer_size) {
+            n = io->buffer_size;
+            truncated = 1;
+        }
+    }
+    io->stats.recv_calls++;
+    if (n < 0) {
+#ifdef MSG_DONTWAIT
+        if ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+#endif
+        io->stats.recv_errors++;
+        return -1;
+    }
+    packets[0].data = io->buffers;
+    packets[0].length = (uint32_t)n;
+    packets[0].truncated = truncated;
+    io->stats.packets_in++;
+    return 1;
+}
+
+/* 1 when the socket is readable, 0 on timeout (or signal), -1 on error */
+static inline int udp_io_poll(int fd, int timeout_ms) {
+#ifdef _WIN32
+    WSAPOLLFD pfd;
+    pfd.fd = (SOCKET)fd;
+    pfd.events = POLLRDNORM;
+    pfd.revents = 0;
+    int rc = WSAPoll(&pfd, 1, timeout_ms);
+#else
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int rc = poll(&pfd, 1, timeout_ms);
+    if (rc < 0 && errno == EINTR) return 0;
+#endif
+    return rc > 0 ? 1 : rc;
+}
+
+/* Waits at most timeout_ms (-1 = forever) for datagrams; returns the count, 0 on
+ * timeout, or -1 with errno set. */
+static inline int udp_io_recv_timeout(udp_io* io, udp_packet* packets, int max, int timeout_ms) {
+    if (max > io->batch) max = io->batch;
+    if (io->kind == UDP_IO_CUSTOM) return udp_io_recv_custom(io, packets, max, timeout_ms);
+#ifdef __linux__
+    if (io->kind == UDP_IO_URING) return udp_io_recv_uring(io, packets, max, timeout_ms);
+#endif
+    if (timeout_ms < 0) return udp_io_recv_socket(io, packets, max, 0);
+#ifdef MSG_DONTWAIT
+    /* Under load datagrams are already queued: one syscall and no poll */
+    int n = udp_io_recv_socket(io, packets, max, MSG_DONTWAIT);
+    if (n != 0) return n;
+#endif
+    int ready = udp_io_poll(io->fd, timeout_ms);
+    if (ready <= 0) return ready;
+#ifdef MSG_DONTWAIT
+    return udp_io_recv_socket(io, packets, max, MSG_DONTWAIT);
+#else
+    return udp_io_recv_socket(io, packets, max, 0);
+#endif
+}
+
+/* One non-blocking attempt: the datagrams already queued (up to max) or 0, with a
+ * single syscall at most. For spin-polling loops (include/low_latency.h), where
+ * udp_io_recv_timeout(io, .., 0) would add a poll() to every empty round. */
+static inline int udp_io_try_recv(udp_io* io, udp_packet* packets, int max) {
+    if (max > io->batch) max = io->batch;
+    if (io->kind == UDP_IO_CUSTOM) return udp_io_recv_custom(io, packets, max, 0);
+#ifdef __linux__
+    if (io->kind == UDP_IO_URING) return udp_io_recv_uring(io, packets, max, 0);
+#endif
+#ifdef MSG_DONTWAIT
+    return udp_io_recv_socket(io, packets, max, MSG_DONTWAIT);
+#else
+    return udp_io_recv_timeout(io, packets, max, 0);
+#endif
+}
+
+/* The descriptor to watch with epoll or poll when the caller owns the event loop: it
+ * becomes readable when udp_io_recv_timeout(io, .., 0) has work (for io_uring, when
+ * completions are queued). The io_uring receive is armed by the first receive call,
+ * so make one before the first wait. -1 for UDP_IO_CUSTOM, which has nothing to wait on. */
+static inline int udp_io_event_fd(const udp_io* io) {
+#ifdef __linux__
+    if (io->kind == UDP_IO_URING) return io->uring->ring_fd;
+#endif
+    return io->fd;
+}
+
+/* Blocks until at least one datagram arrives; returns the count or -1 with errno set. */
+static inline int udp_io_recv(udp_io* io, udp_packet* packets, int max) {
+    return udp_io_recv_timeout(io, packets, max, -1);
+}
+
+/* Sends every packet (in tx_slots sized syscalls); returns how many were handed to the kernel. */
+static inline int udp_io_send(udp_io* io, const udp_packet* packets, int count) {
+    if (io->kind == UDP_IO_CUSTOM) {
+        int sent = io->custom.send(io, packets, count);
+        io->stats.send_calls++;
+        io->stats.packets_out += (uint64_t)(sent > 0 ? sent : 0);
+        io->stats.send_errors += (uint64_t)(count - (sent > 0 ? sent : 0));
+        return sent;
+    }
+#ifdef __linux__
+    if (io->kind == UDP_IO_URING) return udp_io_send_uring(io, packets, count);
+    if (io->kind == UDP_IO_MMSG) {
+        int sent = 0;
+        while (sent < count) {
+            int chunk = count - sent < io->tx_slots ? count - sent : io->tx_slots;
+            for (int i = 0; i < chunk; ++i) {
+                const udp_packet* p = &packets[sent + i];
+                struct msghdr* hdr = &io->tx_msgs[i].msg_hdr;
+                memset(hdr, 0, sizeof(*hdr));
+                io->tx_iovs[i].iov_base = p->data;
+                io->tx_iovs[i].iov_len = p->length;
+                hdr->msg_name = (void*)&p->addr;
+                hdr->msg_namelen = sizeof(struct sockaddr_in);
+                hdr->msg_iov = &io->tx_iovs[i];
+                hdr->msg_iovlen = 1;
+            }
+            int n = sendmmsg(io->fd, io->tx_msgs, (unsigned)chunk, 0);
+            io->stats.send_calls++;
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                io->stats.send_errors += (uint64_t)(count - sent);
+                break;
+            }
+            io->stats.packets_out += (uint64_t)n;
+            sent += n;
+        }
+        return sent;
+    }
+#endif
+    int sent = 0;
+    for (int i = 0; i < count; ++i) {
+        const udp_packet* p = &packets[i];
+        io->stats.send_calls++;
+        if (sendto(io->fd, (const char*)p->data, p->length, 0, (const struct sockaddr*)&p->addr, sizeof(struct sockaddr_in)) < 0) {
+            io->stats.send_errors++;
+        } else {
+            io->stats.packets_out++;
+            sent++;
+        }
+    }
+    return sent;
+}
+
+#endif /* UDP_IO_H */
@@ -0,0 +1,105 @@
+/*
+ * udp_io_transport.h - a udp_io (include/udp_io.h) over a transport.h endpoint.
+ *
+ * Code written against udp_io, such as the Udpserver worker
+ * (UDPClient/ServerWorker.hpp), runs unchanged over the in-process transports:
+ * a transport_loopback endpoint, or one wrapped in a transport_sim link
+ * (include/net_sim.h) for loss, latency, duplication and reordering.
+ *
+ *   transport* link = transport_sim_wrap(transport_loopback_open(net, 0), &sim, 1500, seed);
+ *   udp_io* io = udp_io_transport_create(link, 64, 512, 1024);
+ *   int n = udp_io_recv_timeout(io, packets, 64, 5); // polls the link until then
+ *   udp_io_send(io, replies, count);                 // queued, one flush per tx_slots
+ *   udp_io_destroy(io);                              // the link stays the caller's
+ *
+ * Received datagrams are copied into the io's buffers, so they may be changed
+ * in place as with the socket backends (the worker opens --secure datagrams
+ * there), and one longer than buffer_size is cut short and flagged truncated.
+ * A transport never blocks, so waiting is polling with UDP_IO_TRANSPORT_NAP_US
+ * naps; there are no kernel timestamps (rx_ns is 0). Sent datagrams are
+ * queued with their index in the send batch as the destination id, so a
+ * transport_udp link needs max_dests >= tx_slots. The io belongs to the
+ * link's thread. Header-only, usable from C and C++; Linux.
+ */
+#ifndef UDP_IO_TRANSPORT_H
+#define UDP_IO_TRANSPORT_H
+
+#include <time.h>
+
+#include "udp_io.h"
+#include "transport.h"
+
+#define UDP_IO_TRANSPORT_NAP_US 100     /* between polls while a receive waits */
+
+typedef struct udp_io_transport {
+    transport* link;
+    transport_datagram* in;             /* batch */
+} udp_io_transport;
+
+static inline int udp_io_transport_recv(udp_io* io, udp_packet* packets, int max, int timeout_ms) {
+    udp_io_transport* t = (udp_io_transport*)io->custom.context;
+    int64_t deadline = timeout_ms > 0 ? udp_io_clock_ms() + timeout_ms : 0;
+    for (;;) {
+        int n = transport_recv(t->link, t->in, max);
+        if (n > 0) {
+            for (int i = 0; i < n; ++i) {
+                uint32_t length = t->in[i].length;
+                packets[i].truncated = length > (uint32_t)io->buffer_size;
+                if (packets[i].truncated) length = (uint32_t)io->buffer_size;
+                packets[i].addr = t->in[i].addr;
+                packets[i].data = io->buffers + (size_t)i * (size_t)io->buffer_size;
+                packets[i].length = length;
+                packets[i].rx_ns = 0;
+                memcpy(packets[i].data, t->in[i].data, length);
+            }
+            return n;
+        }
+        if (timeout_ms == 0 || (timeout_ms > 0 && udp_io_clock_ms() >= deadline)) return 0;
+        struct timespec nap = {0, UDP_IO_TRANSPORT_NAP_US * 1000};
+        nanosleep(&nap, NULL);
+    }
+}
+
+static inline int udp_io_transport_send(udp_io* io, const udp_packet* packets, int count) {
+    udp_io_transport* t = (udp_io_transport*)io->custom.context;
+    int sent = 0;
+    for (int first = 0; first < count; first += io->tx_slots) {
+        int chunk = count - first < io->tx_slots ? count - first : io->tx_slots;
+        for (int i = 0; i < chunk; ++i) {
+            const udp_packet* p = &packets[first + i];
+            if (transport_queue(t->link, (uint32_t)i, &p->addr, p->data, p->length) == 0) sent++;
+        }
+        transport_flush(t->link);
+    }
+    return sent;
+}
+
+static inline void udp_io_transport_destroy(udp_io* io) {
+    udp_io_transport* t = (udp_io_transport*)io->custom.context;
+    free(t->in);
+    free(t);
+}
+
+/* Receives up to batch datagrams of up to buffer_size bytes per call from link and
+ * queues up to tx_slots per flush. The link is not destroyed with the io. NULL if
+ * memory ran out. */
+static inline udp_io* udp_io_transport_create(transport* link, int batch, int buffer_size, int tx_slots) {
+    if (batch < 1) batch = 1;
+    udp_io_transport* t = (udp_io_transport*)calloc(1, sizeof(udp_io_transport));
+    if (t == NULL) return NULL;
+    t->link = link;
+    t->in = (transport_datagram*)calloc((size_t)batch, sizeof(transport_datagram));
+    if (t->in == NULL) {
+        free(t);
+        return NULL;
+    }
+    udp_io_custom custom = {udp_io_transport_recv, udp_io_transport_send, udp_io_transport_destroy, t};
+    udp_io* io = udp_io_create_custom(transport_name(link), &custom, batch, buffer_size, tx_slots);
+    if (io == NULL) {
+        free(t->in);
+        free(t);
+    }
+    return io;
+}
+
+#endif /* UDP_IO_TRANSPORT_H */
@@ -1,19 +1,621 @@
+#define _GNU_SOURCE // recvmmsg / sendmmsg for include/udp_io.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+
+#include "include/netlog.h" // Async binary logging; keeps printf off the receive loop
+#include "include/udp_io.h" // Blocking / recvmmsg / io_uring datagram backends
+#include "include/rate_limit.h" // Per-source token buckets, checked before any parsing
 // "meta_server on ubuntu"
 #define BUFFER_SIZE 1024
 #define PORT 8090
+#define BATCH_SIZE 64 // Datagrams per receive call for the mmsg and io_uring backends
+
+// --- PROTOCOL ---
+// The master server for the server browser. Game servers announce themselves with
+// heartbeats, clients page through the filtered list. Every message starts with a
+// type byte; multi-byte fields are little-endian except ip/port, which are in
+// network order as in sockaddr_in.
+//
+//   heartbeat  game server -> master, every few seconds. Registers on first sight;
+//              the server is (source ip, game_port) and is dropped after
+//              SERVER_TIMEOUT_MS without one.
+//   query      client -> master: one page of the servers matching (mode, filter)
+//   list       master -> client: reply to a query, with the page count and the list
+//              generation; a client that sees the generation change restarts at page 0
+//   ping       echoed back unchanged, for latency measurements (udp_loadgen --mode echo)
+#define MSG_HEARTBEAT 1
+#define MSG_QUERY 2
+#define MSG_LIST 3
+#define MSG_PING 4
+
+#define SERVER_PASSWORD 0x01 // heartbeat flags
+
+#define FILTER_NOT_FULL 0x01 // query filter bits
+#define FILTER_NOT_EMPTY 0x02
+#define FILTER_NO_PASSWORD 0x04
+#define FILTER_MASK 0x07
+
+#define MAX_NAME 32
+
+#pragma pack(push, 1)
+typedef struct heartbeat_msg {
+	uint8_t type;
+	uint8_t mode;           // Game mode, 1-255
+	uint8_t flags;
+	uint8_t name_len;       // Name bytes follow the header
+	uint16_t game_port;
+	uint16_t players;
+	uint16_t max_players;
+} heartbeat_msg;
+
+typedef struct query_msg {
+	uint8_t type;
+	uint8_t mode;           // 0 = any
+	uint8_t filter;
+	uint8_t reserved;
+	uint16_t page;
+} query_msg;
+
+typedef struct list_header {
+	uint8_t type;
+	uint8_t mode;
+	uint8_t filter;
+	uint8_t reserved;
+	uint16_t page;
+	uint16_t page_count;
+	uint32_t generation;
+	uint16_t count;         // list_entry records follow, each followed by its name
+} list_header;
+
+typedef struct list_entry {
+	uint32_t ip;
+	uint16_t port;
+	uint16_t players;
+	uint16_t max_players;
+	uint8_t mode;
+	uint8_t flags;
+	uint8_t name_len;
+} list_entry;
+#pragma pack(pop)
+
+// --- REGISTRY ---
+// Servers live in a fixed array and are found by (ip, port) through an open-addressing
+// hash. Expiry uses a hashed timer wheel: each server sits in the slot of the tick it
+// expires on, a heartbeat moves it to a later slot, and every tick only looks at its
+// own slot, so expiry never scans the registry.
+#define MAX_SERVERS 65536
+#define HASH_BITS 17                          // 2 x MAX_SERVERS slots
+#define HASH_SLOTS (1u << HASH_BITS)
+#define NONE 0xFFFFFFFFu
+#define TICK_MS 100
+#define SERVER_TIMEOUT_MS 30000
+#define WHEEL_SLOTS 512                       // TICK_MS x WHEEL_SLOTS must exceed SERVER_TIMEOUT_MS
+#define TIMEOUT_TICKS (SERVER_TIMEOUT_MS / TICK_MS)
+#define STATS_TICKS 100                       // Stats line every 10 s
+
+typedef struct game_server {
+	uint32_t ip;
+	uint16_t port;
+	uint16_t players;
+	uint16_t max_players;
+	uint8_t mode;
+	uint8_t flags;
+	uint8_t name_len;
+	uint8_t active;
+	char name[MAX_NAME];
+	uint32_t expire_tick;
+	uint32_t wheel_next, wheel_prev;
+} game_server;
+
+static game_server servers[MAX_SERVERS];
+static uint32_t free_list[MAX_SERVERS];
+static uint32_t free_count;
+static uint32_t server_hash[HASH_SLOTS];      // Server index or NONE
+static uint32_t wheel[WHEEL_SLOTS];           // Head of each slot's list
+static uint32_t server_count;
+static uint32_t high_water;                   // Indices at or above this were never used
+static uint32_t tick;
+
+// The list generation advances on the first tick after a change, so under a steady
+// stream of heartbeats pages are rebuilt at most 1000 / TICK_MS times a second
+static uint32_t generation = 1;
+static int registry_dirty;
+
+// --- PAGE CACHE ---
+// Serialized list pages per (mode, filter), built on the first query after the
+// generation changes. A query is answered with a pointer into the cached bytes.
+#define PAGE_BYTES 1200
+#define CACHE_SLOTS 32
+
+typedef struct page_cache {
+	uint16_t key;                             // mode << 8 | filter
+	uint8_t used;
+	uint32_t generation;
+	uint32_t batch;                           // Last receive batch that queued replies from it
+	uint64_t last_used;
+	uint32_t page_count;
+	uint32_t page_capacity;
+	uint16_t* lengths;
+	unsigned char* pages;                     // page_capacity x PAGE_BYTES
+} page_cache;
+
+static page_cache cache[CACHE_SLOTS];
+static uint32_t batch_id;
+static uint64_t query_clock;
+
+typedef struct server_stats {
+	uint64_t heartbeats;
+	uint64_t queries;
+	uint64_t pings;
+	uint64_t rebuilds;
+	uint64_t dropped;                         // Malformed or unknown datagrams
+	uint64_t registry_full;
+} server_stats;
+
+static server_stats stats;
+
+// --- FLOOD PROTECTION ---
+// Every datagram is checked against its source endpoint's token bucket before it is
+// parsed, logged or answered. Once the server-wide budget runs low the type byte
+// decides what is shed first: unknown datagrams and pings, then queries, then
+// heartbeats, which keep the registry itself from expiring.
+#define SOURCE_RATE 200                       // Datagrams per second per endpoint; enough to page through fast
+#define SOURCE_BURST 400
+#define GLOBAL_RATE 400000                    // Datagrams per second the server answers before shedding
+#define GLOBAL_BURST (GLOBAL_RATE / 4)
+#define LIMITER_SOURCES 65536
+#define LIMITER_IDLE_MS 5000
+#define LIMITER_AGE_BUDGET 4096               // Limiter slots looked at per tick
 
-int main() {
+static rate_limit* limiter;
+
+// Log categories
+#define LOG_MESSAGES 0
+#define LOG_ERRORS 1
+#define LOG_REGISTRY 2
+#define LOG_STATS 3
+#define LOG_MESSAGE_RATE 1000 // Message lines per second
+
+// Drainer-side formatters: the receive loop only stores the endpoint and the first bytes
+static void format_message(FILE* out, const netlog_record* record)
+{
+	struct in_addr ip;
+	char client_ip[INET_ADDRSTRLEN];
+	ip.s_addr = (uint32_t)(record->payload.u[0] >> 16);
+	inet_ntop(AF_INET, &ip, client_ip, INET_ADDRSTRLEN);
+	fprintf(out, "Dropped message from client %s:%u: %.*s%s (%u bytes)", client_ip,
+		(unsigned)(record->payload.u[0] & 0xFFFF), (int)record->length,
+		(const char*)record->payload.bytes + 8, record->tag > record->length ? "..." : "", record->tag);
+}
+
+static void format_send_failed(FILE* out, const netlog_record* record)
+{
+	fprintf(out, "send failed: %llu of %llu replies not sent", (unsigned long long)record->payload.u[0],
+		(unsigned long long)record->payload.u[1]);
+}
+
+static void format_server_event(FILE* out, const netlog_record* record)
+{
+	struct in_addr ip;
+	char server_ip[INET_ADDRSTRLEN];
+	ip.s_addr = (uint32_t)record->payload.u[0];
+	inet_ntop(AF_INET, &ip, server_ip, INET_ADDRSTRLEN);
+	fprintf(out, "%s %s:%u (%llu servers)", record->payload.u[3] ? "Expired" : "Registered", server_ip,
+		(unsigned)ntohs((uint16_t)record->payload.u[1]), (unsigned long long)record->payload.u[2]);
+}
+
+static void format_rate_limit(FILE* out, const netlog_record* record)
+{
+	fprintf(out, "rate limit | last %d s: %llu limited, %llu shed (%llu heartbeats), %llu sources%s",
+		STATS_TICKS * TICK_MS / 1000, (unsigned long long)record->payload.u[0], (unsigned long long)record->payload.u[1],
+		(unsigned long long)record->payload.u[2], (unsigned long long)(record->payload.u[3] >> 1),
+		(record->payload.u[3] & 1) ? ", overloaded" : "");
+}
+
+static void format_registry_full(FILE* out, const netlog_record* record)
+{
+	fprintf(out, "registry full: %llu heartbeats from new servers ignored", (unsigned long long)record->payload.u[0]);
+}
+
+static void format_stats(FILE* out, const netlog_record* record)
+{
+	fprintf(out, "%llu servers, generation %llu | last %d s: %llu queries, %llu heartbeats, %llu page rebuilds",
+		(unsigned long long)(record->payload.u[0] >> 32), (unsigned long long)(record->payload.u[0] & 0xFFFFFFFFu),
+		STATS_TICKS * TICK_MS / 1000, (unsigned long long)record->payload.u[1], (unsigned long long)record->payload.u[2],
+		(unsigned long long)record->payload.u[3]);
+}
+
+static uint32_t hash_slot(uint32_t ip, uint16_t port)
+{
+	uint64_t key = ((uint64_t)ip << 16) | port;
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - HASH_BITS));
+}
+
+// Slot holding the server, or the empty slot where it would go
+static uint32_t registry_lookup(uint32_t ip, uint16_t port)
+{
+	uint32_t slot = hash_slot(ip, port);
+	while (server_hash[slot] != NONE)
+	{
+		const game_server* s = &servers[server_hash[slot]];
+		if (s->ip == ip && s->port == port) return slot;
+		slot = (slot + 1) & (HASH_SLOTS - 1);
+	}
+	return slot;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones
+static void hash_erase(uint32_t slot)
+{
+	uint32_t next = (slot + 1) & (HASH_SLOTS - 1);
+	while (server_hash[next] != NONE)
+	{
+		const game_server* s = &servers[server_hash[next]];
+		uint32_t home = hash_slot(s->ip, s->port);
+		// Move the entry back unless its home lies cyclically in (slot, next]
+		if (((next - home) & (HASH_SLOTS - 1)) >= ((next - slot) & (HASH_SLOTS - 1)))
+		{
+			server_hash[slot] = server_hash[next];
+			slot = next;
+		}
+		next = (next + 1) & (HASH_SLOTS - 1);
+	}
+	server_hash[slot] = NONE;
+}
+
+static void wheel_unlink(uint32_t index)
+{
+	game_server* s = &servers[index];
+	if (s->wheel_prev != NONE) servers[s->wheel_prev].wheel_next = s->wheel_next;
+	else wheel[s->expire_tick & (WHEEL_SLOTS - 1)] = s->wheel_next;
+	if (s->wheel_next != NONE) servers[s->wheel_next].wheel_prev = s->wheel_prev;
+}
+
+static void wheel_link(uint32_t index)
+{
+	game_server* s = &servers[index];
+	uint32_t* head = &wheel[s->expire_tick & (WHEEL_SLOTS - 1)];
+	s->wheel_prev = NONE;
+	s->wheel_next = *head;
+	if (*head != NONE) servers[*head].wheel_prev = index;
+	*head = index;
+}
+
+static void registry_init(void)
+{
+	memset(server_hash, 0xFF, sizeof(server_hash));
+	memset(wheel, 0xFF, sizeof(wheel));
+	for (uint32_t i = 0; i < MAX_SERVERS; ++i) free_list[i] = MAX_SERVERS - 1 - i; // Lowest index first
+	free_count = MAX_SERVERS;
+}
+
+static void registry_remove(uint32_t slot)
+{
+	uint32_t index = server_hash[slot];
+	game_server* s = &servers[index];
+	wheel_unlink(index);
+	hash_erase(slot);
+	s->active = 0;
+	free_list[free_count++] = index;
+	server_count--;
+	registry_dirty = 1;
+}
+
+static void handle_heartbeat(const udp_packet* in)
+{
+	heartbeat_msg msg;
+	if (in->length < sizeof(msg))
+	{
+		stats.dropped++;
+		return;
+	}
+	memcpy(&msg, in->data, sizeof(msg));
+	if (msg.mode == 0 || msg.name_len > MAX_NAME || in->length < sizeof(msg) + msg.name_len)
+	{
+		stats.dropped++;
+		return;
+	}
+	stats.heartbeats++;
+
+	uint32_t ip = in->addr.sin_addr.s_addr;
+	uint16_t port = htons(msg.game_port);
+	uint32_t slot = registry_lookup(ip, port);
+	uint32_t index = server_hash[slot];
+	game_server* s;
+	if (index == NONE)
+	{
+		if (free_count == 0)
+		{
+			if (stats.registry_full++ % 1000 == 0) netlog_write(LOG_ERRORS, format_registry_full, stats.registry_full, 0, 0, 0);
+			return;
+		}
+		index = free_list[--free_count];
+		if (index >= high_water) high_water = index + 1;
+		server_hash[slot] = index;
+		s = &servers[index];
+		memset(s, 0, sizeof(*s));
+		s->ip = ip;
+		s->port = port;
+		s->active = 1;
+		server_count++;
+		registry_dirty = 1;
+		netlog_write(LOG_REGISTRY, format_server_event, ip, port, server_count, 0);
+	}
+	else
+	{
+		s = &servers[index];
+		wheel_unlink(index);
+	}
+
+	const char* name = (const char*)in->data + sizeof(msg);
+	if (s->players != msg.players || s->max_players != msg.max_players || s->mode != msg.mode
+		|| s->flags != msg.flags || s->name_len != msg.name_len || memcmp(s->name, name, msg.name_len) != 0)
+	{
+		s->players = msg.players;
+		s->max_players = msg.max_players;
+		s->mode = msg.mode;
+		s->flags = msg.flags;
+		s->name_len = msg.name_len;
+		memcpy(s->name, name, msg.name_len);
+		registry_dirty = 1;
+	}
+	s->expire_tick = tick + TIMEOUT_TICKS;
+	wheel_link(index);
+}
+
+// Expires the servers due on this tick and publishes a new generation if anything changed
+static void registry_tick(void)
+{
+	tick++;
+	uint32_t index = wheel[tick & (WHEEL_SLOTS - 1)];
+	while (index != NONE)
+	{
+		game_server* s = &servers[index];
+		uint32_t next = s->wheel_next;
+		if (s->expire_tick == tick)
+		{
+			uint32_t ip = s->ip;
+			uint16_t port = s->port;
+			registry_remove(registry_lookup(ip, port));
+			netlog_write(LOG_REGISTRY, format_server_event, ip, port, server_count, 1);
+		}
+		index = next;
+	}
+	if (registry_dirty)
+	{
+		generation++;
+		registry_dirty = 0;
+	}
+}
+
+static int matches(const game_server* s, uint8_t mode, uint8_t filter)
+{
+	if (mode != 0 && s->mode != mode) return 0;
+	if ((filter & FILTER_NOT_FULL) && s->players >= s->max_players) return 0;
+	if ((filter & FILTER_NOT_EMPTY) && s->players == 0) return 0;
+	if ((filter & FILTER_NO_PASSWORD) && (s->flags & SERVER_PASSWORD)) return 0;
+	return 1;
+}
+
+static unsigned char* cache_page(page_cache* c, uint32_t page)
+{
+	if (page >= c->page_capacity)
+	{
+		uint32_t capacity = c->page_capacity ? c->page_capacity * 2 : 4;
+		unsigned char* pages = (unsigned char*)realloc(c->pages, (size_t)capacity * PAGE_BYTES);
+		uint16_t* lengths = (uint16_t*)realloc(c->lengths, capacity * sizeof(uint16_t));
+		if (pages) c->pages = pages;
+		if (lengths) c->lengths = lengths;
+		if (pages == NULL || lengths == NULL) return NULL;
+		c->page_capacity = capacity;
+	}
+	return c->pages + (size_t)page * PAGE_BYTES;
+}
+
+// Serializes every matching server into PAGE_BYTES pages; returns 0 on allocation failure
+static int cache_build(page_cache* c, uint8_t mode, uint8_t filter)
+{
+	list_header header;
+	memset(&header, 0, sizeof(header));
+	header.type = MSG_LIST;
+	header.mode = mode;
+	header.filter = filter;
+	header.generation = generation;
+
+	uint32_t page = 0;
+	unsigned char* out = cache_page(c, 0);
+	if (out == NULL) return 0;
+	size_t used = sizeof(header);
+	for (uint32_t i = 0; i < high_water; ++i)
+	{
+		const game_server* s = &servers[i];
+		if (!s->active || !matches(s, mode, filter)) continue;
+		size_t size = sizeof(list_entry) + s->name_len;
+		if (used + size > PAGE_BYTES)
+		{
+			memcpy(out, &header, sizeof(header));
+			c->lengths[page] = (uint16_t)used;
+			out = cache_page(c, ++page);
+			if (out == NULL) return 0;
+			header.page = (uint16_t)page;
+			header.count = 0;
+			used = sizeof(header);
+		}
+		list_entry entry;
+		entry.ip = s->ip;
+		entry.port = s->port;
+		entry.players = s->players;
+		entry.max_players = s->max_players;
+		entry.mode = s->mode;
+		entry.flags = s->flags;
+		entry.name_len = s->name_len;
+		memcpy(out + used, &entry, sizeof(entry));
+		memcpy(out + used + sizeof(entry), s->name, s->name_len);
+		used += size;
+		header.count++;
+	}
+	memcpy(out, &header, sizeof(header));
+	c->lengths[page] = (uint16_t)used;
+	c->page_count = page + 1;
+
+	// The page count is only known now
+	for (uint32_t p = 0; p < c->page_count; ++p)
+	{
+		uint16_t count = (uint16_t)c->page_count;
+		memcpy(c->pages + (size_t)p * PAGE_BYTES + offsetof(list_header, page_count), &count, sizeof(count));
+	}
+	c->generation = generation;
+	stats.rebuilds++;
+	return 1;
+}
+
+// Replies waiting to be sent; they point into packets or into the page cache
+static udp_packet replies[BATCH_SIZE];
+static int reply_count;
+
+static void flush_replies(udp_io* io)
+{
+	if (reply_count == 0) return;
+	int sent = udp_io_send(io, replies, reply_count);
+	if (sent < reply_count)
+	{
+		netlog_write(LOG_ERRORS, format_send_failed, (uint64_t)(reply_count - sent), (uint64_t)reply_count, 0, 0);
+	}
+	reply_count = 0;
+}
+
+// Cached pages for (mode, filter), rebuilt if the generation moved on
+static page_cache* cache_lookup(udp_io* io, uint8_t mode, uint8_t filter)
+{
+	uint16_t key = (uint16_t)(mode << 8 | filter);
+	page_cache* victim = &cache[0];
+	page_cache* c = NULL;
+	for (int i = 0; i < CACHE_SLOTS; ++i)
+	{
+		if (cache[i].used && cache[i].key == key)
+		{
+			c = &cache[i];
+			break;
+		}
+		if (!cache[i].used || (victim->used && cache[i].last_used < victim->last_used)) victim = &cache[i];
+	}
+	if (c == NULL)
+	{
+		c = victim;
+		c->used = 1;
+		c->key = key;
+		c->generation = 0;
+	}
+	c->last_used = ++query_clock;
+	if (c->generation == generation) return c;
+
+	// Replies queued in this batch may point at the pages about to be overwritten
+	if (c->batch == batch_id)
+	{
+		flush_replies(io);
+		udp_io_wait_sends(io);
+	}
+	if (!cache_build(c, mode, filter))
+	{
+		c->used = 0;
+		return NULL;
+	}
+	return c;
+}
+
+static void handle_query(udp_io* io, const udp_packet* in)
+{
+	query_msg msg;
+	if (in->length < sizeof(msg))
+	{
+		stats.dropped++;
+		return;
+	}
+	memcpy(&msg, in->data, sizeof(msg));
+	stats.queries++;
+	page_cache* c = cache_lookup(io, msg.mode, msg.filter & FILTER_MASK);
+	if (c == NULL) return;
+
+	// A page past the end (the list shrank) gets the last one; its header says so
+	uint32_t page = msg.page < c->page_count ? msg.page : c->page_count - 1;
+	udp_packet* out = &replies[reply_count++];
+	out->addr = in->addr;
+	out->data = c->pages + (size_t)page * PAGE_BYTES;
+	out->length = c->lengths[page];
+	out->truncated = 0;
+	c->batch = batch_id;
+}
+
+static uint64_t monotonic_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+// Only the type byte is looked at: it picks what an overloaded server sheds first
+static int admit_packet(const udp_packet* in, uint64_t now)
+{
+	uint8_t type = in->length > 0 ? in->data[0] : 0;
+	rate_limit_priority priority = type == MSG_HEARTBEAT ? RATE_LIMIT_HIGH
+		: type == MSG_QUERY ? RATE_LIMIT_NORMAL : RATE_LIMIT_LOW;
+	uint64_t endpoint = ((uint64_t)in->addr.sin_addr.s_addr << 16) | ntohs(in->addr.sin_port);
+	return rate_limit_check(limiter, endpoint, priority, now);
+}
+
+static void handle_packet(udp_io* io, const udp_packet* in)
+{
+	uint8_t type = in->length > 0 ? in->data[0] : 0;
+	if (in->truncated) type = 0;
+	switch (type)
+	{
+	case MSG_HEARTBEAT:
+		handle_heartbeat(in);
+		break;
+	case MSG_QUERY:
+		handle_query(io, in);
+		break;
+	case MSG_PING:
+		stats.pings++;
+		replies[reply_count++] = *in; // Same size as the request, so nothing to amplify
+		break;
+	default:
+		stats.dropped++;
+		netlog_write_bytes(LOG_MESSAGES, format_message,
+			((uint64_t)in->addr.sin_addr.s_addr << 16) | ntohs(in->addr.sin_port), in->data, in->length);
+		break;
+	}
+}
+
+// Usage: meta_server [--io blocking|mmsg|uring]
+int main(int argc, char* argv[]) {
 
 	int sockfd;
-	struct sockaddr_in server_addr, client_addr;
-	socklen_t client_len = sizeof(client_addr);
-	char buffer[BUFFER_SIZE];
+	struct sockaddr_in server_addr;
+	udp_io_kind io_kind = UDP_IO_BLOCKING;
+	udp_io* io;
+	udp_packet packets[BATCH_SIZE];
+
+	if (argc == 3 && strcmp(argv[1], "--io") == 0 && udp_io_parse_kind(argv[2]) >= 0)
+	{
+		io_kind = (udp_io_kind)udp_io_parse_kind(argv[2]);
+	}
+	else if (argc != 1)
+	{
+		fprintf(stderr, "Usage: %s [--io blocking|mmsg|uring]\n", argv[0]);
+		exit(1);
+	}
 
 	// Create UDP socket
 	sockfd = socket(AF_INET, SOCK_DGRAM, 0 );
@@ -22,32 +624,145 @@ int main() {
 		perror("socket creation failed");
 		exit(1);
 	}
+	int buffer_bytes = 8 << 20; // Rides out query bursts while pages are rebuilt
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &buffer_bytes, sizeof(buffer_bytes));
+	setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &buffer_bytes, sizeof(buffer_bytes));
 
-	printf("Server listening on port %d...\n", PORT);
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = INADDR_ANY;
+	server_addr.sin_port = htons(PORT);
+	if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+	{
+		perror("bind failed");
+		exit(1);
+	}
 
-	while(1) {
-	// Receive message from client
-	int bytes_received = recvfrom(sockfd, buffer, BUFFER_SIZE, 0 ,(struct sockaddr * )&client_Addr, &client_len);
-	if(bytes_received < 0)
+	netlog_set_category(LOG_MESSAGES, "message", 1, LOG_MESSAGE_RATE);
+	netlog_set_category(LOG_ERRORS, "error", 1, 100);
+	netlog_set_category(LOG_REGISTRY, "registry", 1, LOG_MESSAGE_RATE);
+	netlog_set_category(LOG_STATS, "stats", 1, 0);
+	if (netlog_start(stdout) != 0)
+	{
+		fprintf(stderr, "failed to start log drainer\n");
+		exit(1);
+	}
+
+	io = udp_io_create(io_kind, sockfd, BATCH_SIZE, BUFFER_SIZE, BATCH_SIZE);
+	if (io == NULL && io_kind == UDP_IO_URING)
+	{
+		fprintf(stderr, "io_uring unavailable (%s), falling back to mmsg\n", strerror(errno));
+		io = udp_io_create(UDP_IO_MMSG, sockfd, BATCH_SIZE, BUFFER_SIZE, BATCH_SIZE);
+	}
+	if (io == NULL)
+	{
+		fprintf(stderr, "failed to create the I/O backend\n");
+		exit(1);
+	}
+	registry_init();
+	limiter = rate_limit_create(LIMITER_SOURCES, SOURCE_RATE, SOURCE_BURST, GLOBAL_RATE, GLOBAL_BURST);
+	if (limiter == NULL)
+	{
+		fprintf(stderr, "failed to allocate the rate limiter\n");
+		exit(1);
+	}
+
+	// One epoll set: datagrams (or io_uring completions) and the registry tick
+	int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	int epoll_fd = epoll_create1(0);
+	struct itimerspec interval;
+	memset(&interval, 0, sizeof(interval));
+	interval.it_interval.tv_nsec = TICK_MS * 1000000L;
+	interval.it_value = interval.it_interval;
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = timer_fd;
+	if (timer_fd < 0 || epoll_fd < 0 || timerfd_settime(timer_fd, 0, &interval, NULL) < 0
+		|| epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0)
 	{
-	perror("recvfrom failed");
-	continue;
+		perror("epoll/timerfd setup failed");
+		exit(1);
+	}
+	ev.data.fd = udp_io_event_fd(io);
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0)
+	{
+		perror("epoll_ctl failed");
+		exit(1);
 	}
 
-	buffer[bytes_received] = '\0';
-	printf("Receieved message from client: %s\n" ,buffer);
+	printf("Server listening on port %d (%s I/O, epoll)...\n", PORT, io->name);
+	fflush(stdout);
 
-	//Send response back to client
-	int bytes_sent = sendto(sockfd, buffer, bytes_received, 0, (struct sockaddr * ) &client_addr , &client_len);
+	server_stats reported;
+	rate_limit_stats limiter_reported;
+	memset(&reported, 0, sizeof(reported));
+	memset(&limiter_reported, 0, sizeof(limiter_reported));
+	int drain = 1; // Also arms the io_uring receive before the first wait
+	while(1) {
+	// Drain everything queued, one batch at a time, then sleep in epoll
+	while (drain)
+	{
+		int received = udp_io_recv_timeout(io, packets, BATCH_SIZE, 0);
+		if (received < 0)
+		{
+			perror("receive failed");
+			break;
+		}
+		if (received == 0) break;
+		batch_id++;
+		uint64_t now = monotonic_ms();
+		for (int i = 0; i < received; ++i)
+		{
+			if (admit_packet(&packets[i], now)) handle_packet(io, &packets[i]);
+		}
+		flush_replies(io);
+	}
+	drain = 0;
 
-	if(bytes_sent < 0)
+	struct epoll_event events[2];
+	int ready = epoll_wait(epoll_fd, events, 2, -1);
+	for (int e = 0; e < ready; ++e)
 	{
-	perror("recvfrom failed");
+		if (events[e].data.fd != timer_fd)
+		{
+			drain = 1;
+			continue;
+		}
+		uint64_t expirations = 0;
+		if (read(timer_fd, &expirations, sizeof(expirations)) != (ssize_t)sizeof(expirations)) continue;
+		while (expirations-- > 0)
+		{
+			registry_tick();
+			rate_limit_age(limiter, monotonic_ms(), LIMITER_IDLE_MS, LIMITER_AGE_BUDGET);
+			if (tick % STATS_TICKS == 0)
+			{
+				const rate_limit_stats* r = &limiter->stats;
+				uint64_t shed = 0;
+				for (int p = 0; p < RATE_LIMIT_PRIORITIES; ++p) shed += r->shed[p] - limiter_reported.shed[p];
+				if (shed > 0 || r->limited > limiter_reported.limited)
+				{
+					netlog_write(LOG_STATS, format_rate_limit, r->limited - limiter_reported.limited, shed,
+						r->shed[RATE_LIMIT_HIGH] - limiter_reported.shed[RATE_LIMIT_HIGH],
+						((uint64_t)r->sources << 1) | r->overloaded);
+				}
+				limiter_reported = *r;
+				netlog_write(LOG_STATS, format_stats, ((uint64_t)server_count << 32) | generation,
+					stats.queries - reported.queries, stats.heartbeats - reported.heartbeats,
+					stats.rebuilds - reported.rebuilds);
+				reported = stats;
+			}
+		}
 	}
 
 
 	}
-	
+
+	close(epoll_fd);
+	close(timer_fd);
+	udp_io_destroy(io);
+	rate_limit_destroy(limiter);
+	netlog_shutdown();
 	return 0;
 
 
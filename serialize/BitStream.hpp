@@ -0,0 +1,177 @@
+// BitStream.hpp - bit-level packing and quantization for network state
+//
+// BitWriter packs fields LSB-first into a byte buffer with no padding between
+// them, so an 18-bit position costs exactly 18 bits on the wire. BitReader
+// unpacks them in the same order. Neither allocates or throws: running off the
+// end of the buffer sets overflowed() and the caller drops the packet.
+//
+// Field encodings:
+//   writeBits       raw unsigned value, 1-32 bits
+//   writeVarint     7 bits per group plus a continuation bit (small values are cheap);
+//                   narrower groups (e.g. 4 bits) suit fields that are mostly tiny
+//   writeQuantized  bounded-range fixed point; see Quantization
+//   writeAngle      radians wrapped to one turn and split into 2^bits steps
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+
+// Maps [min, max] onto the integers 0 .. 2^bits - 1. Values outside the range are
+// clamped; the worst-case round-trip error is resolution() / 2.
+struct Quantization {
+    float min;
+    float max;
+    int bits;
+
+    float resolution() const { return (max - min) / float((uint64_t(1) << bits) - 1); }
+};
+
+const float BITSTREAM_TWO_PI = 6.28318530717958647692f;
+
+inline uint32_t bitMask(int bits) {
+    return bits >= 32 ? 0xFFFFFFFFu : (uint32_t(1) << bits) - 1;
+}
+
+// Signed values as unsigned so small negatives stay small: 0, -1, 1, -2 -> 0, 1, 2, 3
+inline uint32_t zigzagEncode(int32_t value) {
+    return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+
+inline int32_t zigzagDecode(uint32_t value) {
+    return int32_t(value >> 1) ^ -int32_t(value & 1);
+}
+
+inline uint32_t quantize(float value, const Quantization& q) {
+    double maxIndex = double(bitMask(q.bits));
+    double t = (double(value) - q.min) / (double(q.max) - q.min);
+    if (!(t > 0.0)) return 0;
+    if (t >= 1.0) return uint32_t(maxIndex);
+    return uint32_t(t * maxIndex + 0.5);
+}
+
+inline float dequantize(uint32_t index, const Quantization& q) {
+    return float(double(q.min) + double(index) * (double(q.max) - q.min) / double(bitMask(q.bits)));
+}
+
+class BitWriter {
+public:
+    BitWriter(void* buffer, size_t capacityBytes)
+        : data(static_cast<uint8_t*>(buffer)), capacityBits(uint64_t(capacityBytes) * 8) {}
+
+    void writeBits(uint32_t value, int bits) {
+        if (bitsWritten + uint64_t(bits) > capacityBits) {
+            overflow = true;
+            return;
+        }
+        scratch |= uint64_t(value & bitMask(bits)) << scratchBits;
+        scratchBits += bits;
+        bitsWritten += uint64_t(bits);
+        while (scratchBits >= 8) {
+            data[bytePos++] = uint8_t(scratch);
+            scratch >>= 8;
+            scratchBits -= 8;
+        }
+    }
+
+    void writeBool(bool value) { writeBits(value ? 1 : 0, 1); }
+
+    // groupBits - 1 value bits per group, 2 to 8
+    void writeVarint(uint32_t value, int groupBits = 8) {
+        const int valueBits = groupBits - 1;
+        do {
+            uint32_t group = value & bitMask(valueBits);
+            value >>= valueBits;
+            writeBits(group | (value != 0 ? 1u << valueBits : 0), groupBits);
+        } while (value != 0);
+    }
+
+    void writeQuantized(float value, const Quantization& q) { writeBits(quantize(value, q), q.bits); }
+
+    void writeAngle(float radians, int bits) {
+        float turns = radians / BITSTREAM_TWO_PI;
+        turns -= std::floor(turns);
+        writeBits(uint32_t(double(turns) * double(uint64_t(1) << bits) + 0.5) & bitMask(bits), bits);
+    }
+
+    // Pads the last partial byte with zeros; call once before sending
+    void flush() {
+        if (scratchBits > 0) {
+            data[bytePos++] = uint8_t(scratch);
+            bitsWritten += uint64_t(8 - scratchBits);
+            scratch = 0;
+            scratchBits = 0;
+        }
+    }
+
+    size_t bytesWritten() const { return size_t((bitsWritten + 7) / 8); }
+    uint64_t bitsUsed() const { return bitsWritten; }
+    uint64_t bitsRemaining() const { return capacityBits - bitsWritten; }
+    bool overflowed() const { return overflow; }
+
+private:
+    uint8_t* data;
+    uint64_t capacityBits;
+    uint64_t bitsWritten = 0;
+    uint64_t scratch = 0;
+    int scratchBits = 0;
+    size_t bytePos = 0;
+    bool overflow = false;
+};
+
+class BitReader {
+public:
+    BitReader(const void* buffer, size_t sizeBytes)
+        : data(static_cast<const uint8_t*>(buffer)), sizeBits(uint64_t(sizeBytes) * 8) {}
+
+    uint32_t readBits(int bits) {
+        if (bitsRead + uint64_t(bits) > sizeBits) {
+            overflow = true;
+            return 0;
+        }
+        while (scratchBits < bits) {
+            scratch |= uint64_t(data[bytePos++]) << scratchBits;
+            scratchBits += 8;
+        }
+        uint32_t value = uint32_t(scratch) & bitMask(bits);
+        scratch >>= bits;
+        scratchBits -= bits;
+        bitsRead += uint64_t(bits);
+        return value;
+    }
+
+    bool readBool() { return readBits(1) != 0; }
+
+    uint32_t readVarint(int groupBits = 8) {
+        const int valueBits = groupBits - 1;
+        uint32_t value = 0;
+        for (int shift = 0; shift < 32; shift += valueBits) {
+            uint32_t group = readBits(groupBits);
+            value |= (group & bitMask(valueBits)) << shift;
+            if (!(group >> valueBits)) return value;
+        }
+        overflow = true; // More groups than a 32-bit value needs cannot come from writeVarint
+        return 0;
+    }
+
+    float readQuantized(const Quantization& q) { return dequantize(readBits(q.bits), q); }
+
+    // Returns radians in [-pi, pi)
+    float readAngle(int bits) {
+        double turns = double(readBits(bits)) / double(uint64_t(1) << bits);
+        if (turns >= 0.5) turns -= 1.0;
+        return float(turns * BITSTREAM_TWO_PI);
+    }
+
+    uint64_t bitsConsumed() const { return bitsRead; }
+    bool overflowed() const { return overflow; }
+
+private:
+    const uint8_t* data;
+    uint64_t sizeBits;
+    uint64_t bitsRead = 0;
+    uint64_t scratch = 0;
+    int scratchBits = 0;
+    size_t bytePos = 0;
+    bool overflow = false;
+};
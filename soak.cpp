@@ -0,0 +1,610 @@
+// soak.cpp - long-running soak test of the replication server over a simulated network
+//
+// One process: the Udpserver worker on one thread and --clients virtual clients on
+// --threads threads. The worker is Udpserver's own (UDPClient/ServerWorker.hpp): the
+// same runWorker, receive/tick loop, SessionTable, rate limiter, AOI, ack_channel relay
+// and secure_link handshake, with a udp_io (include/udp_io_transport.h) in place of its
+// socket. Every endpoint is a transport_loopback_net endpoint wrapped in a transport_sim
+// link (include/net_sim.h), so each direction sees the configured loss, latency,
+// jitter, duplication and reordering without any sockets.
+//
+// Clients send positions at --rate Hz, as udp_loadgen's snapshot mode does (x carries
+// a sequence number), and time each position until the first snapshot showing it.
+// With --churn N, N clients a minute go silent until the server evicts them and then
+// come back as new sessions, so join/evict paths run all the time too. The worker
+// options work as in Udpserver: --aoi-radius; --reliable, where clients put an
+// ack_channel header on every datagram and send a command every COMMAND_INTERVAL_MS
+// for the worker to relay to their match; and --secure (built with -DWITH_SODIUM),
+// where clients connect with the secure_link handshake, again after every churn pause,
+// and seal everything. The worker's netlog records are never drained: its ring fills
+// once and the rest are counted as dropped, so the report is all that is printed.
+//
+// Every --report seconds one line: datagrams per second both ways, what the links
+// lost/duplicated/reordered, sessions, resident memory and its growth since the end
+// of the warm-up (the first report), and the interval's update-to-snapshot latency.
+// The run fails (exit code 1) if no snapshot arrived, if --reliable delivered no
+// command, or if memory grew by more than --max-rss-growth MB after the warm-up:
+// steady state must not allocate.
+//
+// Build: make bin/soak (WITH_SODIUM=0 without --secure), or
+//        g++ -std=c++17 -O2 -pthread -I. -Iinclude -DWITH_SODIUM soak.cpp -o soak -lsodium
+// Usage: soak [--clients N] [--threads N] [--rate HZ] [--tick-rate HZ] [--match-size N]
+//             [--seconds S] [--report S] [--loss P] [--latency-ms MS] [--jitter-ms MS]
+//             [--duplicate P] [--reorder P] [--churn N] [--max-rss-growth MB] [--seed N]
+//             [--aoi-radius R] [--reliable] [--secure]
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "include/net_sim.h"
+#include "include/udp_io_transport.h"
+#include "UDPClient/ServerWorker.hpp"
+
+const uint32_t SEQUENCE_WINDOW = 4096;          // Sequences carried in x
+
+const uint32_t RING_SLOTS = 512;                // Datagrams waiting per endpoint
+const uint32_t LINK_MAX_DATAGRAM = MAX_SNAPSHOT_BYTES + 64; // A sealed snapshot is 25 bytes longer
+const int RECV_BATCH = 64;
+const int64_t IDLE_TIMEOUT_MS = 3000;           // With --secure it must outlast a connect token
+const uint64_t IDLE_SLEEP_US = 200;             // Client loops sleep this long when nothing is due
+const uint64_t COMMAND_INTERVAL_MS = 1000;      // --reliable: one command per client per second
+
+struct SoakConfig {
+    int clients = 256;
+    int threads = 2;
+    double rate = 30.0;
+    int tickRate = 30;
+    uint32_t matchSize = 16;
+    int seconds = 60;
+    int reportSeconds = 10;
+    double churnPerMinute = 0.0;
+    double maxRssGrowthMb = 0.0;                // 0 = report only
+    uint64_t seed = 1;
+    float aoiRadius = 0.0f;
+    bool reliable = false;
+    bool secure = false;
+    int64_t idleTimeoutMs = IDLE_TIMEOUT_MS;
+    net_sim_config link;
+
+    SoakConfig() {
+        net_sim_config_init(&link);
+        link.latency_us = 20000;
+        link.jitter_us = 5000;
+        link.loss = 0.01;
+        link.duplicate = 0.001;
+        link.reorder = 0.001;
+        link.max_pending = 4096;                // Per link; a client link holds a few dozen
+    }
+};
+
+uint64_t monotonicNs() {
+    return net_sim_monotonic_ns(nullptr);
+}
+
+// Resident set size from /proc/self/statm
+double residentMb() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == nullptr) return 0.0;
+    unsigned long long pages = 0, resident = 0;
+    int fields = fscanf(f, "%llu %llu", &pages, &resident);
+    fclose(f);
+    return fields == 2 ? double(resident) * double(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0) : 0.0;
+}
+
+void addLinkStats(const transport* t, net_sim_stats& sum) {
+    const net_sim_stats* s = transport_sim_stats(t);
+    sum.queued += s->queued;
+    sum.lost += s->lost;
+    sum.duplicated += s->duplicated;
+    sum.reordered += s->reordered;
+    sum.overflowed += s->overflowed;
+    sum.delivered += s->delivered;
+    sum.pending += s->pending;
+}
+
+// --- SERVER ---
+
+// The worker's counters, copied out after every tick (Worker::onTick) on its thread
+struct ServerReport {
+    const transport* link = nullptr;
+    std::mutex mutex;
+    WorkerStats stats;
+    udp_io_stats io{};
+    uint64_t limited = 0;
+    uint32_t sessions = 0;
+    net_sim_stats linkStats{};
+};
+
+void copyServerReport(Worker& worker, void* context) {
+    ServerReport& report = *static_cast<ServerReport*>(context);
+    std::lock_guard<std::mutex> lock(report.mutex);
+    report.stats = worker.stats;
+    report.io = worker.io->stats;
+    report.limited = worker.limiter ? worker.limiter->stats.limited : 0;
+    report.sessions = worker.sessions.size();
+    report.linkStats = net_sim_stats();
+    addLinkStats(report.link, report.linkStats);
+}
+
+// --- CLIENTS ---
+
+struct Client {
+    transport* link = nullptr;
+    int32_t id = 0;
+    uint64_t nextSendNs = 0;
+    uint64_t silentUntilNs = 0;                 // Churn: quiet until then, then a new session
+    uint32_t sequence = 0;
+    int64_t lastSeen = -1;
+    std::vector<uint64_t> sentAt = std::vector<uint64_t>(SEQUENCE_WINDOW, 0);
+    ack_channel channel;                        // --reliable
+    uint64_t nextCommandMs = 0;
+    uint32_t commands = 0;
+#ifdef WITH_SODIUM
+    secure_link_client secure;                  // --secure
+    bool responding = false;                    // Got a challenge; response holds the answer
+    bool connected = false;                     // The server sealed something to us
+    unsigned char response[SECURE_LINK_HANDSHAKE_BYTES];
+#endif
+};
+
+struct ClientThread {
+    std::vector<Client> clients;
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> received{0};
+    std::atomic<uint64_t> churned{0};
+    std::atomic<uint64_t> commandsSent{0};      // --reliable
+    std::atomic<uint64_t> commandsReceived{0};
+    std::atomic<uint64_t> connects{0};          // --secure: handshakes completed
+    std::atomic<uint64_t> rejected{0};          // --secure: sealed datagrams that did not open (duplicates too)
+    std::mutex latencyMutex;
+    LatencyHistogram interval;                  // Since the last report
+    LatencyHistogram total;
+    net_sim_stats linkStats{};
+};
+
+// Finds the client's own entry and times the newest position the snapshot shows
+void handleSnapshot(ClientThread& thread, Client& client, const unsigned char* data, uint32_t length, uint64_t now) {
+    SnapshotHeader header;
+    if (length < sizeof(header)) return;
+    memcpy(&header, data, sizeof(header));
+    BitReader reader(data + sizeof(header), length - sizeof(header));
+    PlayerPosition pos;
+    for (uint32_t i = 0; i < header.playerCount; ++i) {
+        if (!decodePosition(reader, pos)) return;
+        if (pos.id != client.id) continue;
+        uint32_t slot = uint32_t(std::lround(pos.x - POSITION_QUANT.min)) % SEQUENCE_WINDOW;
+        uint32_t back = (client.sequence - 1 - slot) % SEQUENCE_WINDOW;
+        int64_t sequence = int64_t(client.sequence) - 1 - int64_t(back);
+        if (sequence > client.lastSeen) {
+            client.lastSeen = sequence;
+            std::lock_guard<std::mutex> lock(thread.latencyMutex);
+            thread.interval.record(now - client.sentAt[slot]);
+            thread.total.record(now - client.sentAt[slot]);
+        }
+        return;
+    }
+}
+
+// One position (with --reliable behind the ack_channel header, with --secure sealed),
+// or, while a --secure client is not connected yet, its REQUEST or RESPONSE instead.
+// False if nothing went out.
+bool sendPosition(const SoakConfig& config, ClientThread& thread, Client& c, const sockaddr_in& serverAddr, uint64_t now) {
+#ifdef WITH_SODIUM
+    if (config.secure && !c.connected) {
+        unsigned char request[SECURE_LINK_HANDSHAKE_BYTES];
+        if (!c.responding) secure_link_client_request(&c.secure, request);
+        transport_queue(c.link, 0, &serverAddr, c.responding ? c.response : request, SECURE_LINK_HANDSHAKE_BYTES);
+        return false;
+    }
+#endif
+    uint32_t slot = c.sequence % SEQUENCE_WINDOW;
+    PlayerPosition pos = {c.id, float(slot) + POSITION_QUANT.min, float(c.id % 1024)};
+    unsigned char datagram[RELIABLE_RECV_BUFFER_SIZE];
+    uint32_t length = 0;
+    if (config.reliable) {
+        uint64_t nowMs = now / 1000000;
+        if (nowMs >= c.nextCommandMs) {
+            char command[32];
+            int commandLength = snprintf(command, sizeof(command), "order %u", c.commands);
+            if (ack_channel_send(&c.channel, command, uint32_t(commandLength), nowMs) == 0) {
+                c.commands++;
+                thread.commandsSent.fetch_add(1, std::memory_order_relaxed);
+            }
+            c.nextCommandMs = nowMs + COMMAND_INTERVAL_MS;
+        }
+        length = uint32_t(ack_channel_write(&c.channel, datagram, sizeof(datagram) - sizeof(pos), nowMs));
+    }
+    memcpy(datagram + length, &pos, sizeof(pos));
+    length += sizeof(pos);
+    const unsigned char* data = datagram;
+#ifdef WITH_SODIUM
+    unsigned char sealed[sizeof(datagram) + SECURE_LINK_DATA_OVERHEAD];
+    if (config.secure) {
+        length = secure_link_seal(&c.secure.session, datagram, length, sealed);
+        data = sealed;
+    }
+#endif
+    c.sentAt[slot] = now;
+    c.sequence++;
+    transport_queue(c.link, 0, &serverAddr, data, length);
+    return true;
+}
+
+// Answers a challenge or opens a sealed datagram, strips the ack_channel header and
+// hands the snapshot, if any, to handleSnapshot
+void handleDatagram(const SoakConfig& config, ClientThread& thread, Client& c, const sockaddr_in& serverAddr,
+                    const transport_datagram& in, uint64_t now) {
+    unsigned char buffer[LINK_MAX_DATAGRAM];
+    const unsigned char* data = in.data;
+    uint32_t length = in.length;
+#ifdef WITH_SODIUM
+    if (config.secure) {
+        int type = secure_link_type(in.data, in.length);
+        if (type == SECURE_LINK_CHALLENGE && !c.responding) { // Later ones answer our retransmitted requests
+            if (secure_link_client_respond(&c.secure, in.data, in.length, c.response) == 0) return;
+            c.responding = true;
+            transport_queue(c.link, 0, &serverAddr, c.response, SECURE_LINK_HANDSHAKE_BYTES);
+            return;
+        }
+        if (type != SECURE_LINK_DATA || !c.responding || in.length > sizeof(buffer)) return;
+        memcpy(buffer, in.data, in.length); // Opened in place; the ring slot is read-only
+        int opened = secure_link_open(&c.secure.session, buffer, in.length, buffer + SECURE_LINK_DATA_HEADER_BYTES);
+        if (opened < 0) {
+            thread.rejected.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (!c.connected) {
+            c.connected = true;
+            c.nextSendNs = now;
+            thread.connects.fetch_add(1, std::memory_order_relaxed);
+        }
+        data = buffer + SECURE_LINK_DATA_HEADER_BYTES;
+        length = uint32_t(opened);
+        if (length == 0) return; // The server's "you are in"
+    }
+#else
+    (void)serverAddr;
+    (void)buffer;
+#endif
+    if (config.reliable) {
+        int offset = ack_channel_read(&c.channel, data, length, now / 1000000);
+        if (offset < 0) return;
+        const unsigned char* command;
+        uint32_t commandLength;
+        while (ack_channel_receive(&c.channel, &command, &commandLength)) {
+            thread.commandsReceived.fetch_add(1, std::memory_order_relaxed);
+        }
+        data += offset;
+        length -= uint32_t(offset);
+    }
+    handleSnapshot(thread, c, data, length, now); // Bare --reliable headers are too short for one
+}
+
+void runClients(ClientThread& thread, const SoakConfig& config, const sockaddr_in& serverAddr,
+                const std::atomic<bool>& stop, uint64_t seed) {
+    const uint64_t intervalNs = uint64_t(1e9 / config.rate);
+    // Chance per send that a client starts a churn pause
+    double churnChance = config.churnPerMinute / 60.0 / config.rate / double(config.clients);
+    uint64_t rng = seed | 1;
+    transport_datagram in[RECV_BATCH];
+    while (!stop.load(std::memory_order_relaxed)) {
+        uint64_t now = monotonicNs();
+        uint64_t sent = 0, received = 0;
+        for (Client& c : thread.clients) {
+            if (c.silentUntilNs != 0 && now >= c.silentUntilNs) {
+                // Back: the server sees a new session, the client a new history, channel and handshake
+                c.silentUntilNs = 0;
+                c.lastSeen = int64_t(c.sequence) - 1;
+                c.nextSendNs = now;
+                ack_channel_reset(&c.channel);
+#ifdef WITH_SODIUM
+                c.responding = false;
+                c.connected = false;
+#endif
+            }
+            while (c.silentUntilNs == 0 && c.nextSendNs <= now) {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+                if (churnChance > 0.0 && double(rng >> 11) * (1.0 / 9007199254740992.0) < churnChance) {
+                    c.silentUntilNs = now + uint64_t(config.idleTimeoutMs + 1000) * 1000000ull;
+                    thread.churned.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+                if (sendPosition(config, thread, c, serverAddr, now)) sent++;
+                c.nextSendNs += intervalNs;
+            }
+            transport_flush(c.link);
+            int n;
+            while ((n = transport_recv(c.link, in, RECV_BATCH)) > 0) {
+                uint64_t at = monotonicNs();
+                for (int i = 0; i < n; ++i) handleDatagram(config, thread, c, serverAddr, in[i], at);
+                received += uint64_t(n);
+            }
+            transport_flush(c.link); // Handshake replies
+        }
+        thread.sent.fetch_add(sent, std::memory_order_relaxed);
+        thread.received.fetch_add(received, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(thread.latencyMutex);
+            thread.linkStats = net_sim_stats();
+            for (const Client& c : thread.clients) addLinkStats(c.link, thread.linkStats);
+        }
+        usleep(IDLE_SLEEP_US);
+    }
+}
+
+// --- REPORTING ---
+
+struct Totals {
+    uint64_t clientSent = 0, clientReceived = 0, churned = 0;
+    uint64_t commandsSent = 0, commandsReceived = 0, connects = 0, rejected = 0;
+    net_sim_stats links{};
+    WorkerStats server;
+    udp_io_stats serverIo{};
+    uint64_t limited = 0;
+    uint32_t sessions = 0;
+};
+
+void addLinks(net_sim_stats& sum, const net_sim_stats& s) {
+    sum.queued += s.queued;
+    sum.lost += s.lost;
+    sum.duplicated += s.duplicated;
+    sum.reordered += s.reordered;
+    sum.overflowed += s.overflowed;
+    sum.pending += s.pending;
+}
+
+Totals collect(std::vector<ClientThread>& threads, ServerReport& server, LatencyHistogram* interval) {
+    Totals t;
+    for (ClientThread& thread : threads) {
+        t.clientSent += thread.sent.load(std::memory_order_relaxed);
+        t.clientReceived += thread.received.load(std::memory_order_relaxed);
+        t.churned += thread.churned.load(std::memory_order_relaxed);
+        t.commandsSent += thread.commandsSent.load(std::memory_order_relaxed);
+        t.commandsReceived += thread.commandsReceived.load(std::memory_order_relaxed);
+        t.connects += thread.connects.load(std::memory_order_relaxed);
+        t.rejected += thread.rejected.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(thread.latencyMutex);
+        if (interval) {
+            interval->merge(thread.interval);
+            thread.interval.reset();
+        }
+        addLinks(t.links, thread.linkStats);
+    }
+    std::lock_guard<std::mutex> lock(server.mutex);
+    addLinks(t.links, server.linkStats);
+    t.server = server.stats;
+    t.serverIo = server.io;
+    t.limited = server.limited;
+    t.sessions = server.sessions;
+    return t;
+}
+
+int main(int argc, char* argv[]) {
+    SoakConfig config;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) config.clients = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) config.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) config.rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) config.tickRate = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--match-size") == 0 && i + 1 < argc) config.matchSize = uint32_t(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) config.seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) config.reportSeconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc) config.link.loss = atof(argv[++i]);
+        else if (strcmp(argv[i], "--latency-ms") == 0 && i + 1 < argc) config.link.latency_us = uint32_t(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "--jitter-ms") == 0 && i + 1 < argc) config.link.jitter_us = uint32_t(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "--duplicate") == 0 && i + 1 < argc) config.link.duplicate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) config.link.reorder = atof(argv[++i]);
+        else if (strcmp(argv[i], "--churn") == 0 && i + 1 < argc) config.churnPerMinute = atof(argv[++i]);
+        else if (strcmp(argv[i], "--max-rss-growth") == 0 && i + 1 < argc) config.maxRssGrowthMb = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) config.seed = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--aoi-radius") == 0 && i + 1 < argc) config.aoiRadius = float(atof(argv[++i]));
+        else if (strcmp(argv[i], "--reliable") == 0) config.reliable = true;
+        else if (strcmp(argv[i], "--secure") == 0) config.secure = true;
+        else {
+            fprintf(stderr, "Usage: %s [--clients N] [--threads N] [--rate HZ] [--tick-rate HZ] [--match-size N]\n"
+                            "          [--seconds S] [--report S] [--loss P] [--latency-ms MS] [--jitter-ms MS]\n"
+                            "          [--duplicate P] [--reorder P] [--churn N] [--max-rss-growth MB] [--seed N]\n"
+                            "          [--aoi-radius R] [--reliable] [--secure]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (config.clients < 2 || config.threads < 1 || config.rate <= 0.0 || config.tickRate < 1 || config.tickRate > MAX_TICK_RATE
+        || config.matchSize < 2 || config.matchSize > MAX_MATCH_SIZE || config.seconds < 1 || config.reportSeconds < 1
+        || config.aoiRadius < 0.0f) {
+        fprintf(stderr, "Need at least 2 clients and a match size of 2; threads, rates and times must be positive.\n");
+        return 1;
+    }
+    if (config.threads > config.clients) config.threads = config.clients;
+
+    // The worker, configured as Udpserver's options would
+    ServerConfig server;
+    server.batchSize = RECV_BATCH;
+    server.maxSessions = uint32_t(config.clients);
+    server.matchSize = config.matchSize;
+    server.tickRate = config.tickRate;
+    server.aoiRadius = config.aoiRadius;
+    server.rateLimit = uint32_t(config.rate * 4);
+    server.rateBurst = uint32_t(config.rate * 8);
+    server.reliable = config.reliable;
+    server.statsIntervalSeconds = 0; // The soak's own report replaces the STATS lines
+#ifdef WITH_SODIUM
+    secure_link_keys secureKeys;
+    if (config.secure) {
+        if (secure_link_keys_generate(&secureKeys) != 0) {
+            fprintf(stderr, "Failed to initialize libsodium.\n");
+            return 1;
+        }
+        server.secureKeys = &secureKeys;
+        config.idleTimeoutMs = SECURE_LINK_TOKEN_LIFETIME_MS + 1000; // As Udpserver requires
+    }
+#else
+    if (config.secure) {
+        fprintf(stderr, "--secure needs a build with libsodium (make WITH_SODIUM=1).\n");
+        return 1;
+    }
+#endif
+    server.idleTimeoutMs = config.idleTimeoutMs;
+
+    // Endpoint 0 is the server, endpoint 1 + i client i
+    transport_loopback_net* net = transport_loopback_net_create(uint32_t(config.clients) + 1, RING_SLOTS, LINK_MAX_DATAGRAM);
+    if (net == nullptr) {
+        fprintf(stderr, "Failed to allocate the loopback network.\n");
+        return 1;
+    }
+    ServerReport report;
+    transport* serverLink = transport_sim_wrap(transport_loopback_open(net, 0), &config.link, LINK_MAX_DATAGRAM, config.seed);
+    Worker worker;
+    if (serverLink != nullptr) {
+        worker.io = udp_io_transport_create(serverLink, server.batchSize, workerRecvBufferSize(server), MAX_SEND_SLOTS);
+    }
+    if (worker.io == nullptr) {
+        fprintf(stderr, "Failed to set up the server.\n");
+        return 1;
+    }
+    report.link = serverLink;
+    worker.onTick = copyServerReport;
+    worker.onTickContext = &report;
+
+    std::vector<ClientThread> threads(config.threads);
+    const uint64_t intervalNs = uint64_t(1e9 / config.rate);
+    uint64_t start = monotonicNs();
+    for (int i = 0; i < config.clients; ++i) {
+        Client c;
+        c.id = i;
+        c.link = transport_sim_wrap(transport_loopback_open(net, uint32_t(i) + 1), &config.link, LINK_MAX_DATAGRAM,
+                                    config.seed * 1000003ull + uint64_t(i) + 1);
+        if (c.link == nullptr) {
+            fprintf(stderr, "Failed to set up client %d.\n", i);
+            return 1;
+        }
+        ack_channel_reset(&c.channel);
+#ifdef WITH_SODIUM
+        if (config.secure && secure_link_client_init(&c.secure, secureKeys.public_key) != 0) {
+            fprintf(stderr, "Failed to set up client %d.\n", i);
+            return 1;
+        }
+#endif
+        c.nextSendNs = start + intervalNs * uint64_t(i) / uint64_t(config.clients); // Spread the sends out
+        threads[size_t(i) * size_t(config.threads) / size_t(config.clients)].clients.push_back(std::move(c));
+    }
+
+    printf("soak: %d clients x %.1f Hz on %d threads, %d Hz ticks, matches of %u, %d s\n", config.clients, config.rate,
+           config.threads, config.tickRate, config.matchSize, config.seconds);
+    printf("server: Udpserver worker over %s links", worker.io->name);
+    if (config.aoiRadius > 0.0f) printf(", area of interest %.0f units", config.aoiRadius);
+    if (config.reliable) printf(", reliable commands");
+    if (config.secure) printf(", secure");
+    printf(", %lld ms idle timeout\n", (long long)config.idleTimeoutMs);
+    printf("links: %.2f%% loss, %.1f ms + %.1f ms jitter, %.2f%% duplicated, %.2f%% reordered, churn %.1f clients/min\n\n",
+           config.link.loss * 100.0, config.link.latency_us / 1000.0, config.link.jitter_us / 1000.0,
+           config.link.duplicate * 100.0, config.link.reorder * 100.0, config.churnPerMinute);
+    printf("%8s %10s %10s %7s %7s %7s %9s %9s %9s  %s\n", "time", "in pps", "out pps", "lost", "dup", "reord",
+           "sessions", "rss MB", "growth", "update to snapshot");
+    fflush(stdout);
+
+    std::atomic<bool> stop{false};
+    worker.stop = &stop;
+    sockaddr_in serverAddr = transport_loopback_addr(0);
+    std::thread serverThread(runWorker, std::ref(worker), std::cref(server));
+    std::vector<std::thread> clientThreads;
+    for (int t = 0; t < config.threads; ++t) {
+        clientThreads.emplace_back(runClients, std::ref(threads[t]), std::cref(config), std::cref(serverAddr),
+                                   std::cref(stop), config.seed * 7919ull + uint64_t(t));
+    }
+
+    double baselineRss = 0.0, peakGrowth = 0.0;
+    uint64_t lastIn = 0, lastOut = 0;
+    net_sim_stats lastLinks{};
+    for (int elapsed = config.reportSeconds; ; elapsed += config.reportSeconds) {
+        int wait = elapsed <= config.seconds ? config.reportSeconds : config.seconds % config.reportSeconds;
+        std::this_thread::sleep_for(std::chrono::seconds(wait));
+        if (elapsed > config.seconds) elapsed = config.seconds;
+
+        LatencyHistogram interval;
+        Totals t = collect(threads, report, &interval);
+        uint64_t in = t.serverIo.packets_in;
+        uint64_t out = t.clientReceived;
+        double rss = residentMb();
+        if (baselineRss == 0.0) baselineRss = rss; // The first interval is the warm-up
+        double growth = rss - baselineRss;
+        if (growth > peakGrowth) peakGrowth = growth;
+        double seconds = wait > 0 ? double(wait) : 1.0;
+        printf("%7ds %10.0f %10.0f %7llu %7llu %7llu %9u %9.1f %+9.1f  %s\n", elapsed, double(in - lastIn) / seconds,
+               double(out - lastOut) / seconds, (unsigned long long)(t.links.lost - lastLinks.lost),
+               (unsigned long long)(t.links.duplicated - lastLinks.duplicated),
+               (unsigned long long)(t.links.reordered - lastLinks.reordered), t.sessions, rss, growth,
+               interval.summary().c_str());
+        fflush(stdout);
+        lastIn = in;
+        lastOut = out;
+        lastLinks = t.links;
+        if (elapsed >= config.seconds) break;
+    }
+
+    stop = true;
+    serverThread.join();
+    for (auto& thread : clientThreads) thread.join();
+
+    Totals t = collect(threads, report, nullptr);
+    LatencyHistogram total;
+    for (ClientThread& thread : threads) total.merge(thread.total);
+    printf("\nclients sent %llu, server received %llu (%llu rate limited, %llu bad), %llu snapshots sent, %llu received\n",
+           (unsigned long long)t.clientSent, (unsigned long long)t.serverIo.packets_in, (unsigned long long)t.limited,
+           (unsigned long long)t.server.badPackets, (unsigned long long)t.server.snapshotsSent,
+           (unsigned long long)t.clientReceived);
+    printf("links: %llu datagrams, %llu lost, %llu duplicated, %llu reordered, %llu dropped at a full delay queue\n",
+           (unsigned long long)t.links.queued, (unsigned long long)t.links.lost, (unsigned long long)t.links.duplicated,
+           (unsigned long long)t.links.reordered, (unsigned long long)t.links.overflowed);
+    printf("sessions: %llu joins, %llu evictions, %llu churn pauses, %llu table full; %llu ticks, %llu late\n",
+           (unsigned long long)t.server.sessionsJoined, (unsigned long long)t.server.sessionsEvicted,
+           (unsigned long long)t.churned, (unsigned long long)t.server.tableFull, (unsigned long long)t.server.ticks,
+           (unsigned long long)t.server.lateTicks);
+    if (config.reliable) {
+        printf("commands: %llu sent, %llu received by the server, %llu relayed, %llu refused, %llu delivered; %llu bare headers\n",
+               (unsigned long long)t.commandsSent, (unsigned long long)t.server.commandsReceived,
+               (unsigned long long)t.server.commandsRelayed, (unsigned long long)t.server.commandsRefused,
+               (unsigned long long)t.commandsReceived, (unsigned long long)t.server.bareHeaders);
+    }
+    if (config.secure) {
+        printf("secure: %llu challenges, %llu accepted, %llu bad tokens, %llu unknown senders, %llu rejected by the server; "
+               "%llu client connects, %llu rejected by clients\n",
+               (unsigned long long)t.server.challengesSent, (unsigned long long)t.server.connectsAccepted,
+               (unsigned long long)t.server.badTokens, (unsigned long long)t.server.unknownData,
+               (unsigned long long)t.server.rejectedData, (unsigned long long)t.connects, (unsigned long long)t.rejected);
+    }
+    printf("update to snapshot: %s\n", total.summary().c_str());
+    printf("memory: %.1f MB after warm-up, peak growth %+.1f MB\n", baselineRss, peakGrowth);
+
+    for (ClientThread& thread : threads) {
+        for (Client& c : thread.clients) transport_destroy(c.link);
+    }
+    udp_io_destroy(worker.io);
+    transport_destroy(serverLink);
+    transport_loopback_net_destroy(net);
+
+    if (total.count() == 0) {
+        printf("FAIL: no snapshot reached a client\n");
+        return 1;
+    }
+    if (config.reliable && t.commandsReceived == 0) {
+        printf("FAIL: no command was relayed to a client\n");
+        return 1;
+    }
+    if (config.maxRssGrowthMb > 0.0 && peakGrowth > config.maxRssGrowthMb) {
+        printf("FAIL: memory grew by %.1f MB after the warm-up (limit %.1f MB)\n", peakGrowth, config.maxRssGrowthMb);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}